@@ -0,0 +1,106 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+	  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Author: Wu jiaxu (wujiaxu@sogou-inc.com;void00@foxmail.com)
+*/
+
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include <workflow/URIParser.h>
+#include <anyclient/WFRequestTarget.h>
+
+using namespace std;
+
+static const char *targets[] = {
+	"/",
+	"/index.html",
+	"/api/v1/user/1412/orders?page=2&size=20",
+	"/static/js/app.5f1d2c.min.js",
+	"/search?query=anyclient+workflow&from=bench&lang=zh-CN#top",
+};
+
+static const int TARGET_NUM = sizeof targets / sizeof targets[0];
+
+// only the URIParser way needs the Host header
+static const std::string host = "www.sogou.com:8080";
+
+// what WFWebProcessor::process did before: absolute url + ParsedURI + path copy
+static size_t __parse_by_uri(const char *target)
+{
+	std::string request_uri = "http://";
+
+	request_uri += host;
+	request_uri += target;
+
+	ParsedURI uri;
+
+	if (URIParser::parse(request_uri, uri) < 0)
+		return 0;
+
+	std::string path;
+
+	if (uri.path && uri.path[0])
+		path = uri.path;
+	else
+		path = "/";
+
+	return path.size();
+}
+
+static size_t __parse_by_target(const char *target)
+{
+	WFRequestTarget t;
+
+	if (WFRequestTargetParser::parse(target, t) < 0)
+		return 0;
+
+	return t.path_len;
+}
+
+template<class FUNC>
+static void __run(const char *name, int times, FUNC func)
+{
+	size_t sink = 0;
+	auto start = chrono::steady_clock::now();
+
+	for (int i = 0; i < times; i++)
+		sink += func(targets[i % TARGET_NUM]);
+
+	auto end = chrono::steady_clock::now();
+	double ns = chrono::duration<double, std::nano>(end - start).count();
+
+	cout << name << ": " << ns / times << " ns/op (sink " << sink << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int times = 1000000;
+
+	if (argc > 1)
+		times = atoi(argv[1]);
+
+	if (times <= 0)
+	{
+		cerr << "USAGE: " << argv[0] << " [times]" << endl;
+		return 1;
+	}
+
+	__run("URIParser", times, __parse_by_uri);
+	__run("WFRequestTargetParser", times, __parse_by_target);
+	return 0;
+}
+
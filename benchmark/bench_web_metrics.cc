@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+	  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Author: Wu jiaxu (wujiaxu@sogou-inc.com;void00@foxmail.com)
+*/
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <workflow/WFTaskFactory.h>
+#include <anyclient/WFWebMetrics.h>
+
+using namespace std;
+
+// cost of WFWebMetrics::record() on the hot path, per thread
+static void __run(WFWebMetrics *metrics, int times, double *ns)
+{
+	WFHttpTask *task = WFTaskFactory::create_http_task("http://127.0.0.1/", 0, 0, nullptr);
+
+	task->get_resp()->set_status_code("200");
+	task->get_resp()->append_output_body("hello");
+
+	auto start = chrono::steady_clock::now();
+
+	for (int i = 0; i < times; i++)
+		metrics->record(i % 16, task, i % 100000);
+
+	auto end = chrono::steady_clock::now();
+
+	*ns = chrono::duration<double, std::nano>(end - start).count() / times;
+	task->dismiss();
+}
+
+int main(int argc, char *argv[])
+{
+	int times = 10000000;
+	int threads = 4;
+
+	if (argc > 1)
+		times = atoi(argv[1]);
+
+	if (argc > 2)
+		threads = atoi(argv[2]);
+
+	if (times <= 0 || threads <= 0)
+	{
+		cerr << "USAGE: " << argv[0] << " [times] [threads]" << endl;
+		return 1;
+	}
+
+	WFWebMetrics metrics;
+	std::vector<std::thread> workers;
+	std::vector<double> ns(threads);
+	std::string text;
+
+	for (int i = 0; i < 16; i++)
+		metrics.add_route(i, "GET", "/route/" + std::to_string(i));
+
+	for (int i = 0; i < threads; i++)
+		workers.emplace_back(__run, &metrics, times, &ns[i]);
+
+	for (int i = 0; i < threads; i++)
+	{
+		workers[i].join();
+		cout << "thread " << i << ": " << ns[i] << " ns/record" << endl;
+	}
+
+	metrics.dump(text);
+	cout << "dump: " << text.size() << " bytes" << endl;
+	return 0;
+}
+
@@ -0,0 +1,273 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFCLIENTBATCH_H_
+#define _WFCLIENTBATCH_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <workflow/Workflow.h>
+#include <workflow/WFTask.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFClientLimiter.h"
+
+/**
+ * @file   WFClientBatch.h
+ * @brief  Run many client requests in one ParallelWork
+ */
+
+enum
+{
+	BATCH_COLLECT_ALL	=	0,	// wait for every request
+	BATCH_FAIL_FAST		=	1,	// finish on the first failure
+	BATCH_FIRST_N		=	2,	// finish on first_n successes
+};
+
+struct WFBatchParams
+{
+	int mode;
+	int concurrency;	// requests in flight, 0 for no limit
+	int first_n;		// BATCH_FIRST_N only
+};
+
+static constexpr struct WFBatchParams BATCH_PARAMS_DEFAULT =
+{
+	.mode			=	BATCH_COLLECT_ALL,
+	.concurrency	=	0,
+	.first_n		=	1,
+};
+
+// Every series of the parallel takes the next request when its task is
+// done, so no more than concurrency requests are in flight. Results are
+// in the order of requests. A batch finished early by FAIL_FAST or
+// FIRST_N starts no more requests, those already sent still run but their
+// results are dropped. Requests not run have task_state WFT_STATE_UNDEFINED.
+//
+// With a limiter every request waits for its own admission in its series.
+// A rejected request fails with WFT_STATE_SYS_ERROR and EAGAIN, and the
+// series goes on with the next one.
+template<class TASK, class RESULT>
+class WFClientBatch
+{
+public:
+	using callback_t = std::function<void (std::vector<RESULT>&)>;
+	using create_t = std::function<TASK *(size_t index,
+										  std::function<void (TASK *)>&& callback)>;
+	// fill res from task, or mark a request not run if task is NULL.
+	// return true on success
+	using result_t = bool (*)(TASK *task, RESULT& res);
+	// limiter upstream of a request
+	using upstream_t = std::function<WFClientLimiterUpstream *(size_t index)>;
+
+	static void start(size_t n, create_t create, result_t result,
+					  const struct WFBatchParams *params, callback_t callback,
+					  std::shared_ptr<WFClientLimiter> limiter = nullptr,
+					  upstream_t upstream = nullptr)
+	{
+		auto *batch = new WFClientBatch(n, std::move(create), result, params,
+										std::move(callback));
+		size_t width = n;
+
+		batch->limiter_ = std::move(limiter);
+		batch->upstream_ = std::move(upstream);
+
+		if (params->concurrency > 0 && (size_t)params->concurrency < n)
+			width = params->concurrency;
+
+		auto *parallel = Workflow::create_parallel_work([batch](const ParallelWork *) {
+			batch->mutex_.lock();
+			bool deliver = !batch->finished_;
+			batch->finished_ = true;
+			batch->mutex_.unlock();
+
+			if (deliver)
+				batch->deliver();
+
+			delete batch;
+		});
+
+		for (size_t i = 0; i < width; i++)
+		{
+			SeriesWork *series;
+
+			series = Workflow::create_series_work(WFTaskFactory::create_empty_task(),
+												  nullptr);
+			parallel->add_series(series);
+			batch->push_next(series);
+		}
+
+		parallel->start();
+	}
+
+private:
+	WFClientBatch(size_t n, create_t&& create, result_t result,
+				  const struct WFBatchParams *params, callback_t&& callback):
+		results_(n),
+		ran_(n, false),
+		create_(std::move(create)),
+		result_(result),
+		callback_(std::move(callback)),
+		params_(*params),
+		next_(0),
+		successes_(0),
+		finished_(false)
+	{
+		if (params_.first_n <= 0)
+			params_.first_n = 1;
+	}
+
+	bool take(size_t& index)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (finished_ || next_ == results_.size())
+			return false;
+
+		index = next_++;
+		return true;
+	}
+
+	TASK *create(size_t index, WFClientLimiterUpstream *up, long long admitted_at)
+	{
+		return create_(index, [this, index, up, admitted_at](TASK *task) {
+			if (up)
+			{
+				limiter_->release(up, admitted_at,
+								  task->get_state() == WFT_STATE_SUCCESS);
+			}
+
+			this->finish(index, task);
+		});
+	}
+
+	// A gate holds the series until its request is admitted. Rejections
+	// are always at once, in acquire(), so they are handled in the loop.
+	void push_next(SeriesWork *series)
+	{
+		size_t index;
+
+		while (this->take(index))
+		{
+			if (!limiter_)
+				return series->push_back(this->create(index, NULL, -1));
+
+			WFClientLimiterUpstream *up = upstream_(index);
+			WFCounterTask *gate = WFTaskFactory::create_counter_task(1, nullptr);
+			bool rejected = false;
+
+			series->push_back(gate);
+			// rejected is only touched before acquire() returns
+			limiter_->acquire(up, [this, index, up, gate, &rejected](long long admitted_at) {
+				if (admitted_at < 0)
+					rejected = true;
+				else
+					series_of(gate)->push_back(this->create(index, up, admitted_at));
+
+				gate->count();
+			});
+
+			if (!rejected || !this->reject(index))
+				return;
+		}
+	}
+
+	// return false if the batch is finished by it
+	bool reject(size_t index)
+	{
+		bool deliver = false;
+
+		mutex_.lock();
+		if (!finished_)
+		{
+			RESULT& res = results_[index];
+
+			result_(NULL, res);
+			res.task_state = WFT_STATE_SYS_ERROR;
+			res.task_error = EAGAIN;
+			ran_[index] = true;
+			deliver = (params_.mode == BATCH_FAIL_FAST);
+			finished_ = deliver;
+		}
+
+		mutex_.unlock();
+		if (deliver)
+			this->deliver();
+
+		return !deliver;
+	}
+
+	void finish(size_t index, TASK *task)
+	{
+		bool deliver = false;
+
+		mutex_.lock();
+		if (!finished_)
+		{
+			// filled in place, results may point into themselves
+			if (result_(task, results_[index]))
+				successes_++;
+			else if (params_.mode == BATCH_FAIL_FAST)
+				deliver = true;
+
+			ran_[index] = true;
+			if (params_.mode == BATCH_FIRST_N && successes_ >= (size_t)params_.first_n)
+				deliver = true;
+
+			finished_ = deliver;
+		}
+
+		mutex_.unlock();
+		if (deliver)
+			return this->deliver();
+
+		this->push_next(series_of(task));
+	}
+
+	// no result is written after finished_ is set
+	void deliver()
+	{
+		for (size_t i = 0; i < results_.size(); i++)
+		{
+			if (!ran_[i])
+				result_(NULL, results_[i]);
+		}
+
+		callback_(results_);
+	}
+
+private:
+	std::vector<RESULT> results_;
+	std::vector<bool> ran_;
+	create_t create_;
+	result_t result_;
+	callback_t callback_;
+	struct WFBatchParams params_;
+	size_t next_;
+	size_t successes_;
+	bool finished_;
+	std::shared_ptr<WFClientLimiter> limiter_;
+	upstream_t upstream_;
+	std::mutex mutex_;
+};
+
+#endif
+
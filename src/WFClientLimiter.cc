@@ -0,0 +1,228 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <math.h>
+#include <time.h>
+#include <deque>
+#include <vector>
+#include "WFClientLimiter.h"
+
+// weights of a new sample in short-term and long-term rtt
+#define LIMITER_SHORT_ALPHA		0.1
+#define LIMITER_LONG_ALPHA		0.01
+// weight of a new limit
+#define LIMITER_SMOOTHING		0.2
+
+static long long __monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+class WFClientLimiterUpstream
+{
+public:
+	std::mutex mutex;
+	std::deque<WFClientLimiter::start_t> queue;
+	double limit;
+	double short_rtt;
+	double long_rtt;
+	int in_flight;
+	unsigned long long admitted;
+	unsigned long long queued;
+	unsigned long long rejected;
+};
+
+WFClientLimiterUpstream *WFClientLimiter::upstream(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFClientLimiterUpstream *& up = upstreams_[name];
+
+	if (!up)
+	{
+		up = new WFClientLimiterUpstream;
+		up->limit = params_.initial_limit;
+		up->short_rtt = 0;
+		up->long_rtt = 0;
+		up->in_flight = 0;
+		up->admitted = 0;
+		up->queued = 0;
+		up->rejected = 0;
+	}
+
+	return up;
+}
+
+void WFClientLimiter::acquire(WFClientLimiterUpstream *up, start_t start)
+{
+	up->mutex.lock();
+	if (up->in_flight < (int)up->limit && up->queue.empty())
+	{
+		up->in_flight++;
+		up->admitted++;
+		up->mutex.unlock();
+		return start(__monotonic_us());
+	}
+
+	if (up->queue.size() >= (size_t)params_.max_queue)
+	{
+		up->rejected++;
+		up->mutex.unlock();
+		return start(-1);
+	}
+
+	up->queue.push_back(std::move(start));
+	up->queued++;
+	up->mutex.unlock();
+}
+
+// with up->mutex locked
+void WFClientLimiter::update(WFClientLimiterUpstream *up, long long rtt,
+							 bool success)
+{
+	double limit = up->limit;
+
+	if (!success)
+		limit = limit * 0.9;
+	else
+	{
+		if (up->long_rtt == 0)
+		{
+			up->short_rtt = rtt;
+			up->long_rtt = rtt;
+		}
+
+		up->short_rtt += (rtt - up->short_rtt) * LIMITER_SHORT_ALPHA;
+		up->long_rtt += (rtt - up->long_rtt) * LIMITER_LONG_ALPHA;
+
+		// recover fast once the queueing is gone
+		if (up->long_rtt > up->short_rtt * 2)
+			up->long_rtt = up->short_rtt * 2;
+
+		double gradient = up->long_rtt * params_.tolerance / 100 /
+						  (up->short_rtt > 1 ? up->short_rtt : 1);
+
+		if (gradient > 1)
+			gradient = 1;
+		else if (gradient < 0.5)
+			gradient = 0.5;
+
+		// do not grow a limit that is not used
+		if (gradient == 1 && up->in_flight < up->limit / 2)
+			return;
+
+		double target = up->limit * gradient + sqrt(up->limit);
+
+		limit = up->limit * (1 - LIMITER_SMOOTHING) + target * LIMITER_SMOOTHING;
+	}
+
+	if (limit < params_.min_limit)
+		limit = params_.min_limit;
+	else if (limit > params_.max_limit)
+		limit = params_.max_limit;
+
+	up->limit = limit;
+}
+
+void WFClientLimiter::release(WFClientLimiterUpstream *up, long long admitted_at,
+							  bool success)
+{
+	long long now = __monotonic_us();
+	std::vector<start_t> ready;
+
+	up->mutex.lock();
+	up->in_flight--;
+	update(up, now - admitted_at, success);
+	while (!up->queue.empty() && up->in_flight < (int)up->limit)
+	{
+		ready.push_back(std::move(up->queue.front()));
+		up->queue.pop_front();
+		up->in_flight++;
+		up->admitted++;
+	}
+
+	up->mutex.unlock();
+	for (start_t& start : ready)
+		start(now);
+}
+
+static void __fill_stats(WFClientLimiterUpstream *up,
+						 struct WFClientLimiterStats *stats)
+{
+	std::lock_guard<std::mutex> lock(up->mutex);
+
+	stats->limit = (int)up->limit;
+	stats->in_flight = up->in_flight;
+	stats->queue_size = (int)up->queue.size();
+	stats->rtt = (long long)up->long_rtt;
+	stats->admitted = up->admitted;
+	stats->queued = up->queued;
+	stats->rejected = up->rejected;
+}
+
+int WFClientLimiter::get_stats(const std::string& name,
+							   struct WFClientLimiterStats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = upstreams_.find(name);
+
+	if (it == upstreams_.end())
+		return -1;
+
+	__fill_stats(it->second, stats);
+	return 0;
+}
+
+void WFClientLimiter::get_stats(std::map<std::string, struct WFClientLimiterStats>& stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	for (const auto& kv : upstreams_)
+		__fill_stats(kv.second, &stats[kv.first]);
+}
+
+std::string WFClientLimiter::upstream_of(const std::string& url)
+{
+	size_t pos = url.find("://");
+	size_t end;
+	size_t at;
+
+	pos = pos == std::string::npos ? 0 : pos + 3;
+	end = url.find_first_of("/?#", pos);
+	if (end == std::string::npos)
+		end = url.size();
+
+	at = url.rfind('@', end);
+	if (at != std::string::npos && at >= pos)
+		return url.substr(0, pos) + url.substr(at + 1, end - at - 1);
+
+	return url.substr(0, end);
+}
+
+WFClientLimiter::WFClientLimiter(const struct WFClientLimiterParams *params):
+	params_(*params)
+{}
+
+WFClientLimiter::~WFClientLimiter()
+{
+	for (const auto& kv : upstreams_)
+		delete kv.second;
+}
+
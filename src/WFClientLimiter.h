@@ -0,0 +1,113 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFCLIENTLIMITER_H_
+#define _WFCLIENTLIMITER_H_
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+/**
+ * @file   WFClientLimiter.h
+ * @brief  Adaptive concurrency limit per upstream for the clients
+ */
+
+struct WFClientLimiterParams
+{
+	int initial_limit;
+	int min_limit;
+	int max_limit;
+	int max_queue;		// requests waiting for a slot, 0 to reject at once
+	int tolerance;		// percent of long-term rtt that is not queueing
+};
+
+static constexpr struct WFClientLimiterParams CLIENT_LIMITER_PARAMS_DEFAULT =
+{
+	.initial_limit	=	20,
+	.min_limit		=	1,
+	.max_limit		=	1000,
+	.max_queue		=	100,
+	.tolerance		=	150,
+};
+
+struct WFClientLimiterStats
+{
+	int limit;
+	int in_flight;
+	int queue_size;
+	long long rtt;		// us, long-term
+	unsigned long long admitted;
+	unsigned long long queued;
+	unsigned long long rejected;
+};
+
+class WFClientLimiterUpstream;
+
+// The limit of an upstream follows the gradient of its rtt: while short-term
+// rtt stays within tolerance of long-term rtt the limit grows by about its
+// square root, when short-term rtt rises the limit shrinks in proportion,
+// and a failed task cuts it by 1/10. Requests above the limit wait in a
+// bounded queue, requests beyond the queue are rejected at once.
+//
+// One limiter may be shared by WFHttpClient, WFRedisClient and
+// WFMySQLClient. Always owned by a shared_ptr.
+//
+// auto limiter = std::make_shared<WFClientLimiter>(&CLIENT_LIMITER_PARAMS_DEFAULT);
+// http_client.set_limiter(limiter);
+// redis_client.set_limiter(limiter);
+class WFClientLimiter
+{
+public:
+	// admitted_at is -1 if rejected, otherwise pass it to release()
+	using start_t = std::function<void (long long admitted_at)>;
+
+	// upstreams are never removed, the pointer stays valid
+	WFClientLimiterUpstream *upstream(const std::string& name);
+
+	// start runs at once or when a slot is released, in that thread
+	void acquire(WFClientLimiterUpstream *upstream, start_t start);
+	void release(WFClientLimiterUpstream *upstream, long long admitted_at,
+				 bool success);
+
+	int get_stats(const std::string& name, struct WFClientLimiterStats *stats);
+	void get_stats(std::map<std::string, struct WFClientLimiterStats>& stats);
+
+	// "scheme://host:port" of a url, userinfo and path removed
+	static std::string upstream_of(const std::string& url);
+
+public:
+	WFClientLimiter(const struct WFClientLimiterParams *params);
+	~WFClientLimiter();
+
+	WFClientLimiter(const WFClientLimiter&) = delete;
+	WFClientLimiter& operator= (const WFClientLimiter&) = delete;
+
+private:
+	void update(WFClientLimiterUpstream *upstream, long long rtt, bool success);
+
+private:
+	struct WFClientLimiterParams params_;
+	std::map<std::string, WFClientLimiterUpstream *> upstreams_;
+	std::mutex mutex_;
+};
+
+#endif
+
@@ -0,0 +1,661 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <workflow/HttpUtil.h>
+#include <workflow/StringUtil.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFHttpClient.h"
+#include "WFHttpCache.h"
+
+using namespace protocol;
+
+#define HTTP_CACHE_SHARDS		16
+
+static long long __monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// append() is protected, borrow it to parse a stored response
+class __HttpResponseParser : public HttpResponse
+{
+public:
+	static int append_response(HttpResponse *resp, const void *buf, size_t *size)
+	{
+		int (HttpMessage::*fn)(const void *, size_t *) = &__HttpResponseParser::append;
+
+		return (resp->*fn)(buf, size);
+	}
+};
+
+class WFHttpCacheEntry
+{
+public:
+	std::string key;
+	// status line, headers and body, parsed again for every answer
+	std::string raw;
+	std::string etag;
+	std::string last_modified;
+	// request headers named by Vary, names in lower case
+	std::vector<std::pair<std::string, std::string>> vary;
+	long long lifetime;		// ms
+	long long swr;			// ms, stale-while-revalidate
+	bool must_revalidate;
+	long long fresh_until;	// monotonic ms
+	long long stale_until;
+	size_t bytes;
+};
+
+using WFHttpCacheEntryPtr = std::shared_ptr<const WFHttpCacheEntry>;
+
+class __WFHttpFreshness
+{
+public:
+	long long lifetime;		// ms, -1 if the response does not tell
+	long long swr;
+	bool no_store;
+	bool no_cache;
+	bool must_revalidate;
+};
+
+static time_t __parse_http_date(const std::string& str)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof tm);
+	if (!strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S", &tm))
+		return -1;
+
+	return timegm(&tm);
+}
+
+static long long __directive_value(const char *p, const char *end)
+{
+	while (p < end && (*p == '=' || *p == ' ' || *p == '"'))
+		p++;
+
+	return p < end ? atoll(p) : 0;
+}
+
+static void __parse_cache_control(const std::string& value, __WFHttpFreshness *f)
+{
+	const char *p = value.c_str();
+	const char *end = p + value.size();
+
+	while (p < end)
+	{
+		const char *comma = (const char *)memchr(p, ',', end - p);
+
+		if (!comma)
+			comma = end;
+
+		while (p < comma && *p == ' ')
+			p++;
+
+		size_t len = comma - p;
+
+		if (len >= 8 && strncasecmp(p, "no-store", 8) == 0)
+			f->no_store = true;
+		else if (len >= 8 && strncasecmp(p, "no-cache", 8) == 0)
+			f->no_cache = true;
+		else if (len >= 15 && strncasecmp(p, "must-revalidate", 15) == 0)
+			f->must_revalidate = true;
+		else if (len > 7 && strncasecmp(p, "max-age", 7) == 0)
+			f->lifetime = __directive_value(p + 7, comma) * 1000;
+		else if (len > 22 && strncasecmp(p, "stale-while-revalidate", 22) == 0)
+			f->swr = __directive_value(p + 22, comma) * 1000;
+
+		p = comma + 1;
+	}
+}
+
+static void __parse_freshness(const HttpResponse *resp, __WFHttpFreshness *f)
+{
+	HttpHeaderCursor cursor(resp);
+	std::string name;
+	std::string value;
+	time_t expires = 0;
+	time_t date = 0;
+	long long age = 0;
+	bool has_expires = false;
+
+	f->lifetime = -1;
+	f->swr = 0;
+	f->no_store = false;
+	f->no_cache = false;
+	f->must_revalidate = false;
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "Cache-Control") == 0)
+			__parse_cache_control(value, f);
+		else if (strcasecmp(name.c_str(), "Expires") == 0)
+		{
+			expires = __parse_http_date(value);
+			has_expires = true;
+		}
+		else if (strcasecmp(name.c_str(), "Date") == 0)
+			date = __parse_http_date(value);
+		else if (strcasecmp(name.c_str(), "Age") == 0)
+			age = atoll(value.c_str());
+	}
+
+	// max-age beats Expires, an invalid Expires means expired
+	if (f->lifetime < 0 && has_expires)
+	{
+		if (date <= 0)
+			date = time(NULL);
+
+		f->lifetime = expires > date ? (expires - date) * 1000LL : 0;
+	}
+
+	if (f->no_cache)
+		f->lifetime = 0;
+
+	if (f->lifetime > 0)
+	{
+		f->lifetime -= age * 1000;
+		if (f->lifetime < 0)
+			f->lifetime = 0;
+	}
+}
+
+static void __fill_result(const WFHttpCacheEntryPtr& entry, WFHttpResult& res)
+{
+	size_t size = entry->raw.size();
+
+	res.seqid = -1;
+	res.task_state = WFT_STATE_SUCCESS;
+	res.task_error = 0;
+	res.status_code = -1;
+	if (__HttpResponseParser::append_response(&res.resp, entry->raw.c_str(), &size) > 0)
+		res.status_code = atoi(res.resp.get_status_code());
+	else
+		res.task_state = WFT_STATE_TASK_ERROR;
+}
+
+class WFHttpCacheImpl : public std::enable_shared_from_this<WFHttpCacheImpl>
+{
+public:
+	void request(const std::string& url,
+				 const std::map<std::string, std::string>& headers,
+				 WFHttpCache::send_t&& send, http_callback_t&& callback,
+				 WFHttpCache::result_t&& on_result);
+
+	WFHttpCacheImpl(const struct WFHttpCacheParams *params):
+		hits(0),
+		stale_hits(0),
+		revalidated(0),
+		misses(0),
+		evictions(0)
+	{
+		max_bytes_ = params->max_bytes / HTTP_CACHE_SHARDS;
+		max_entry_ = params->max_entry;
+	}
+
+private:
+	using LRUList = std::list<WFHttpCacheEntryPtr>;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		LRUList lru;//front is the most recently used
+		std::unordered_map<std::string, LRUList::iterator> map;
+		std::unordered_set<std::string> revalidating;
+		size_t bytes;
+
+		Shard(): bytes(0) { }
+	};
+
+	Shard& shard_of(const std::string& key)
+	{
+		return shards_[std::hash<std::string>()(key) % HTTP_CACHE_SHARDS];
+	}
+
+	WFHttpCacheEntryPtr find(const std::string& key,
+							 const std::map<std::string, std::string>& headers);
+	void insert(const WFHttpCacheEntryPtr& entry);
+	void erase(Shard& shard, std::unordered_map<std::string, LRUList::iterator>::iterator it);
+
+	WFHttpCacheEntryPtr capture(const std::string& key,
+								const std::map<std::string, std::string>& headers,
+								WFHttpTask *task) const;
+	WFHttpCacheEntryPtr refresh(const WFHttpCacheEntryPtr& entry, WFHttpTask *task) const;
+	void store(const std::string& key,
+			   const std::map<std::string, std::string>& headers,
+			   WFHttpTask *task);
+
+	void answer(const WFHttpCacheEntryPtr& entry, WFHttpCache::result_t on_result);
+	void revalidate(const std::string& key,
+					const std::map<std::string, std::string>& headers,
+					const WFHttpCacheEntryPtr& entry,
+					const WFHttpCache::send_t& send);
+	void revalidated_by(const std::string& key,
+						const std::map<std::string, std::string>& headers,
+						const WFHttpCacheEntryPtr& entry,
+						WFHttpTask *task, WFHttpCacheEntryPtr *fresh);
+
+	static bool has_validator(const WFHttpCacheEntryPtr& entry)
+	{
+		return !entry->etag.empty() || !entry->last_modified.empty();
+	}
+
+	static void add_validator(std::map<std::string, std::string>& headers,
+							  const WFHttpCacheEntryPtr& entry);
+
+public:
+	std::atomic<unsigned long long> hits;
+	std::atomic<unsigned long long> stale_hits;
+	std::atomic<unsigned long long> revalidated;
+	std::atomic<unsigned long long> misses;
+	std::atomic<unsigned long long> evictions;
+
+private:
+	Shard shards_[HTTP_CACHE_SHARDS];
+	size_t max_bytes_;//per shard
+	size_t max_entry_;
+
+	friend class WFHttpCache;
+};
+
+static const char *__header_of(const std::map<std::string, std::string>& headers,
+							   const std::string& name)
+{
+	for (const auto& kv : headers)
+	{
+		if (strcasecmp(kv.first.c_str(), name.c_str()) == 0)
+			return kv.second.c_str();
+	}
+
+	return NULL;
+}
+
+WFHttpCacheEntryPtr WFHttpCacheImpl::find(const std::string& key,
+										  const std::map<std::string, std::string>& headers)
+{
+	Shard& shard = shard_of(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it = shard.map.find(key);
+
+	if (it == shard.map.end())
+		return WFHttpCacheEntryPtr();
+
+	const WFHttpCacheEntryPtr& entry = *it->second;
+
+	for (const auto& kv : entry->vary)
+	{
+		const char *value = __header_of(headers, kv.first);
+
+		if (kv.second != (value ? value : ""))
+			return WFHttpCacheEntryPtr();
+	}
+
+	shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+	return entry;
+}
+
+void WFHttpCacheImpl::erase(Shard& shard,
+							std::unordered_map<std::string, LRUList::iterator>::iterator it)
+{
+	shard.bytes -= (*it->second)->bytes;
+	shard.lru.erase(it->second);
+	shard.map.erase(it);
+}
+
+void WFHttpCacheImpl::insert(const WFHttpCacheEntryPtr& entry)
+{
+	Shard& shard = shard_of(entry->key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it = shard.map.find(entry->key);
+
+	if (it != shard.map.end())
+		erase(shard, it);
+
+	if (entry->bytes > max_bytes_)
+		return;
+
+	shard.lru.push_front(entry);
+	shard.map[entry->key] = shard.lru.begin();
+	shard.bytes += entry->bytes;
+	while (shard.bytes > max_bytes_)
+	{
+		erase(shard, shard.map.find(shard.lru.back()->key));
+		evictions++;
+	}
+}
+
+WFHttpCacheEntryPtr WFHttpCacheImpl::capture(const std::string& key,
+											 const std::map<std::string, std::string>& headers,
+											 WFHttpTask *task) const
+{
+	auto *resp = task->get_resp();
+	__WFHttpFreshness f;
+	const void *body;
+	size_t size;
+
+	if (task->get_state() != WFT_STATE_SUCCESS ||
+		strcmp(resp->get_status_code(), "200") != 0)
+	{
+		return WFHttpCacheEntryPtr();
+	}
+
+	__parse_freshness(resp, &f);
+	if (f.no_store)
+		return WFHttpCacheEntryPtr();
+
+	if (!resp->get_parsed_body(&body, &size))
+		size = 0;
+
+	if (size > max_entry_)
+		return WFHttpCacheEntryPtr();
+
+	auto *entry = new WFHttpCacheEntry;
+	WFHttpCacheEntryPtr ret(entry);
+	HttpHeaderCursor cursor(resp);
+	std::string name;
+	std::string value;
+
+	const char *reason = resp->get_reason_phrase();
+
+	entry->raw = std::string("HTTP/1.1 200 ") + (reason ? reason : "OK") + "\r\n";
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "Set-Cookie") == 0)
+			return WFHttpCacheEntryPtr();
+
+		if (strcasecmp(name.c_str(), "ETag") == 0)
+			entry->etag = value;
+		else if (strcasecmp(name.c_str(), "Last-Modified") == 0)
+			entry->last_modified = value;
+		else if (strcasecmp(name.c_str(), "Vary") == 0)
+		{
+			for (std::string& v : StringUtil::split(value, ','))
+			{
+				v = StringUtil::strip(v);
+				if (v == "*")
+					return WFHttpCacheEntryPtr();
+
+				if (v.empty())
+					continue;
+
+				const char *req_value = __header_of(headers, v);
+
+				for (char& c : v)
+					c = tolower(c);
+
+				entry->vary.emplace_back(std::move(v), req_value ? req_value : "");
+			}
+		}
+
+		// the body is stored decoded with its length
+		if (strcasecmp(name.c_str(), "Content-Length") == 0 ||
+			strcasecmp(name.c_str(), "Transfer-Encoding") == 0 ||
+			strcasecmp(name.c_str(), "Connection") == 0 ||
+			strcasecmp(name.c_str(), "Keep-Alive") == 0)
+		{
+			continue;
+		}
+
+		entry->raw += name + ": " + value + "\r\n";
+	}
+
+	// never fresh and nothing to revalidate with
+	if (f.lifetime <= 0 && entry->etag.empty() && entry->last_modified.empty())
+		return WFHttpCacheEntryPtr();
+
+	entry->raw += "Content-Length: " + std::to_string(size) + "\r\n\r\n";
+	entry->raw.append((const char *)body, size);
+	entry->key = key;
+	entry->lifetime = f.lifetime < 0 ? 0 : f.lifetime;
+	entry->swr = f.swr;
+	entry->must_revalidate = f.must_revalidate;
+	entry->fresh_until = __monotonic_ms() + entry->lifetime;
+	entry->stale_until = f.must_revalidate ? 0 : entry->fresh_until + entry->swr;
+	entry->bytes = sizeof (WFHttpCacheEntry) + key.size() + entry->raw.size() +
+				   entry->etag.size() + entry->last_modified.size();
+	for (const auto& kv : entry->vary)
+		entry->bytes += kv.first.size() + kv.second.size();
+
+	return ret;
+}
+
+// a 304 updates freshness, the stored response stays
+WFHttpCacheEntryPtr WFHttpCacheImpl::refresh(const WFHttpCacheEntryPtr& entry,
+											 WFHttpTask *task) const
+{
+	auto *e = new WFHttpCacheEntry(*entry);
+	WFHttpCacheEntryPtr ret(e);
+	__WFHttpFreshness f;
+
+	__parse_freshness(task->get_resp(), &f);
+	if (f.lifetime >= 0)
+	{
+		e->lifetime = f.lifetime;
+		e->swr = f.swr;
+		e->must_revalidate = f.must_revalidate;
+	}
+
+	e->fresh_until = __monotonic_ms() + e->lifetime;
+	e->stale_until = e->must_revalidate ? 0 : e->fresh_until + e->swr;
+	return ret;
+}
+
+void WFHttpCacheImpl::store(const std::string& key,
+							const std::map<std::string, std::string>& headers,
+							WFHttpTask *task)
+{
+	WFHttpCacheEntryPtr entry = capture(key, headers, task);
+
+	if (entry)
+		insert(entry);
+}
+
+void WFHttpCacheImpl::add_validator(std::map<std::string, std::string>& headers,
+									const WFHttpCacheEntryPtr& entry)
+{
+	if (!entry->etag.empty())
+		headers["If-None-Match"] = entry->etag;
+
+	if (!entry->last_modified.empty())
+		headers["If-Modified-Since"] = entry->last_modified;
+}
+
+void WFHttpCacheImpl::answer(const WFHttpCacheEntryPtr& entry,
+							 WFHttpCache::result_t on_result)
+{
+	auto&& fn = [entry, on_result]() {
+		WFHttpResult res;
+
+		__fill_result(entry, res);
+		on_result(res);
+	};
+
+	WFTaskFactory::create_go_task("WFHttpCache", std::move(fn))->start();
+}
+
+// a 304 refreshes entry, other responses replace it.
+// *fresh is the entry to answer with, NULL if task is the answer
+void WFHttpCacheImpl::revalidated_by(const std::string& key,
+									 const std::map<std::string, std::string>& headers,
+									 const WFHttpCacheEntryPtr& entry,
+									 WFHttpTask *task, WFHttpCacheEntryPtr *fresh)
+{
+	if (task->get_state() == WFT_STATE_SUCCESS &&
+		strcmp(task->get_resp()->get_status_code(), "304") == 0)
+	{
+		*fresh = refresh(entry, task);
+		insert(*fresh);
+		revalidated++;
+		return;
+	}
+
+	fresh->reset();
+	store(key, headers, task);
+}
+
+void WFHttpCacheImpl::revalidate(const std::string& key,
+								 const std::map<std::string, std::string>& headers,
+								 const WFHttpCacheEntryPtr& entry,
+								 const WFHttpCache::send_t& send)
+{
+	Shard& shard = shard_of(key);
+	auto self = shared_from_this();
+
+	shard.mutex.lock();
+	bool first = shard.revalidating.insert(key).second;
+	shard.mutex.unlock();
+
+	// one revalidation of a key at a time
+	if (!first)
+		return;
+
+	auto done = [self, key]() {
+		Shard& shard = self->shard_of(key);
+
+		shard.mutex.lock();
+		shard.revalidating.erase(key);
+		shard.mutex.unlock();
+	};
+
+	std::map<std::string, std::string> h(headers);
+
+	add_validator(h, entry);
+	send(h, [self, key, headers, entry, done](WFHttpTask *task) {
+			WFHttpCacheEntryPtr fresh;
+
+			self->revalidated_by(key, headers, entry, task, &fresh);
+			done();
+		},
+		[done](WFHttpResult&) { done(); });
+}
+
+void WFHttpCacheImpl::request(const std::string& url,
+							  const std::map<std::string, std::string>& headers,
+							  WFHttpCache::send_t&& send, http_callback_t&& callback,
+							  WFHttpCache::result_t&& on_result)
+{
+	WFHttpCacheEntryPtr entry = find(url, headers);
+	long long now = __monotonic_ms();
+	auto self = shared_from_this();
+
+	if (entry && now < entry->fresh_until)
+	{
+		hits++;
+		return answer(entry, std::move(on_result));
+	}
+
+	if (entry && now < entry->stale_until)
+	{
+		stale_hits++;
+		answer(entry, on_result);
+		return revalidate(url, headers, entry, send);
+	}
+
+	misses++;
+	if (entry && has_validator(entry))
+	{
+		std::map<std::string, std::string> h(headers);
+
+		add_validator(h, entry);
+		return send(h, [self, url, headers, entry, callback, on_result](WFHttpTask *task) {
+				WFHttpCacheEntryPtr fresh;
+
+				self->revalidated_by(url, headers, entry, task, &fresh);
+				if (!fresh)
+					return callback(task);
+
+				WFHttpResult res;
+
+				__fill_result(fresh, res);
+				res.seqid = task->get_task_seq();
+				on_result(res);
+			},
+			WFHttpCache::result_t(on_result));
+	}
+
+	send(headers, [self, url, headers, callback](WFHttpTask *task) {
+			self->store(url, headers, task);
+			callback(task);
+		},
+		std::move(on_result));
+}
+
+bool WFHttpCache::cacheable(const std::string& method,
+							const std::map<std::string, std::string>& headers,
+							size_t body_size)
+{
+	static const char *bypass[] = {
+		"Authorization", "Cache-Control", "Pragma", "Range",
+		"If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since"
+	};
+
+	if (strcasecmp(method.c_str(), "GET") != 0 || body_size != 0)
+		return false;
+
+	for (const char *name : bypass)
+	{
+		if (__header_of(headers, name))
+			return false;
+	}
+
+	return true;
+}
+
+void WFHttpCache::request(const std::string& url,
+						  const std::map<std::string, std::string>& headers,
+						  send_t send, http_callback_t callback, result_t on_result)
+{
+	impl_->request(url, headers, std::move(send), std::move(callback),
+				   std::move(on_result));
+}
+
+void WFHttpCache::get_stats(struct WFHttpCacheStats *stats) const
+{
+	stats->hits = impl_->hits;
+	stats->stale_hits = impl_->stale_hits;
+	stats->revalidated = impl_->revalidated;
+	stats->misses = impl_->misses;
+	stats->evictions = impl_->evictions;
+	stats->entries = 0;
+	stats->bytes = 0;
+	for (auto& shard : impl_->shards_)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		stats->entries += shard.map.size();
+		stats->bytes += shard.bytes;
+	}
+}
+
+WFHttpCache::WFHttpCache(const struct WFHttpCacheParams *params):
+	impl_(std::make_shared<WFHttpCacheImpl>(params))
+{}
+
@@ -0,0 +1,106 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFHTTPCACHE_H_
+#define _WFHTTPCACHE_H_
+
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFHttpCache.h
+ * @brief  Client side HTTP response cache of WFHttpClient
+ */
+
+struct WFHttpCacheParams
+{
+	size_t max_bytes;		// memory cap of all cached responses
+	size_t max_entry;		// larger responses are not stored
+};
+
+static constexpr struct WFHttpCacheParams HTTP_CACHE_PARAMS_DEFAULT =
+{
+	.max_bytes		=	64 * 1024 * 1024,
+	.max_entry		=	1024 * 1024,
+};
+
+struct WFHttpCacheStats
+{
+	unsigned long long hits;		// fresh
+	unsigned long long stale_hits;	// served while revalidating
+	unsigned long long revalidated;	// answered 304
+	unsigned long long misses;
+	unsigned long long evictions;
+	size_t entries;
+	size_t bytes;
+};
+
+struct WFHttpResult;
+class WFHttpCacheImpl;
+
+// auto cache = std::make_shared<WFHttpCache>(&HTTP_CACHE_PARAMS_DEFAULT);
+// client.set_cache(cache);
+//
+// A private cache for GET requests without Authorization, Cache-Control,
+// Pragma, Range or conditional headers, keyed by url and the request
+// headers named by Vary. Only 200 responses are stored.
+//
+// Freshness comes from Cache-Control max-age or Expires, minus Age.
+// "no-store" is never stored, "no-cache" and responses with only a
+// validator are stored but revalidated on every use. A stale entry is
+// revalidated with If-None-Match/If-Modified-Since, and a 304 is answered
+// with the stored response. Within stale-while-revalidate the stale entry
+// is answered at once and revalidated in background, unless the response
+// says must-revalidate.
+//
+// Answers from the cache have seqid -1 and run in a go task.
+class WFHttpCache
+{
+public:
+	using result_t = std::function<void (WFHttpResult&)>;
+	// headers are those of the request plus the validators,
+	// on_result is called instead of callback if there is no task
+	using send_t = std::function<void (const std::map<std::string, std::string>& headers,
+									   http_callback_t&& callback,
+									   result_t&& on_result)>;
+
+	// callback gets the task of a network response,
+	// on_result gets an answer made from the cache
+	void request(const std::string& url,
+				 const std::map<std::string, std::string>& headers,
+				 send_t send, http_callback_t callback, result_t on_result);
+
+	static bool cacheable(const std::string& method,
+						  const std::map<std::string, std::string>& headers,
+						  size_t body_size);
+
+	void get_stats(struct WFHttpCacheStats *stats) const;
+
+public:
+	WFHttpCache(const struct WFHttpCacheParams *params);
+
+private:
+	std::shared_ptr<WFHttpCacheImpl> impl_;
+};
+
+#endif
+
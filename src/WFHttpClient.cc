@@ -17,8 +17,13 @@
            Li Yingxin (liyingxin@sogou-inc.com)
 */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <strings.h>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFGlobal.h>
+#include <workflow/HttpUtil.h>
+#include <workflow/URIParser.h>
 #include "WFHttpClient.h"
 
 static inline int __set_result(WFHttpTask *task, WFHttpResult& res)
@@ -36,14 +41,12 @@ static inline int __set_result(WFHttpTask *task, WFHttpResult& res)
 	return res.status_code;
 }
 
-static void __async_callback(WFHttpClient::ON_SUCCESS on_success,
-							 WFHttpClient::ON_ERROR on_error,
-							 WFHttpClient::ON_COMPLETE on_complete,
-							 WFHttpTask *task)
+static void __async_result(const WFHttpClient::ON_SUCCESS& on_success,
+						   const WFHttpClient::ON_ERROR& on_error,
+						   const WFHttpClient::ON_COMPLETE& on_complete,
+						   WFHttpResult& res)
 {
-	WFHttpResult res;
-
-	if (__set_result(task, res) != -1)
+	if (res.status_code != -1)
 	{
 		if (on_success)
 			on_success(res.resp);
@@ -62,6 +65,17 @@ static void __async_callback(WFHttpClient::ON_SUCCESS on_success,
 		on_complete(res);
 }
 
+static void __async_callback(const WFHttpClient::ON_SUCCESS& on_success,
+							 const WFHttpClient::ON_ERROR& on_error,
+							 const WFHttpClient::ON_COMPLETE& on_complete,
+							 WFHttpTask *task)
+{
+	WFHttpResult res;
+
+	__set_result(task, res);
+	__async_result(on_success, on_error, on_complete, res);
+}
+
 static void __future_callback(WFHttpTask *task)
 {
 	auto *pr = static_cast<WFPromise<WFHttpResult> *>(task->user_data);
@@ -72,25 +86,129 @@ static void __future_callback(WFHttpTask *task)
 	delete pr;
 }
 
-WFHttpResult WFHttpClient::sync_request(const std::string& method,
-										const std::string& url,
-										const std::map<std::string, std::string>& headers,
-										const std::string& body)
+WFHttpBody& WFHttpBody::append(std::string&& str)
 {
-	return this->async_request(method, url, headers, body).get();
+	auto *p = new std::string(std::move(str));
+
+	pieces_.push_back({p->c_str(), p->size()});
+	owners_.emplace_back(p, [](const void *p) {
+		delete static_cast<const std::string *>(p);
+	});
+	size_ += p->size();
+	return *this;
 }
 
-WFFuture<WFHttpResult> WFHttpClient::async_request(const std::string& method,
-												   const std::string& url,
-												   const std::map<std::string, std::string>& headers,
-												   const std::string& body)
+WFHttpBody& WFHttpBody::append(std::shared_ptr<const std::string> buf)
 {
-	auto *pr = new WFPromise<WFHttpResult>();
-	auto fr = pr->get_future();
-	auto *http_task = WFTaskFactory::create_http_task(url,
-													  redirect_max_,
-													  retry_max_,
-													  __future_callback);
+	pieces_.push_back({buf->c_str(), buf->size()});
+	size_ += buf->size();
+	owners_.emplace_back(std::move(buf));
+	return *this;
+}
+
+WFHttpBody& WFHttpBody::append(const void *buf, size_t size,
+							   std::function<void ()> deleter)
+{
+	pieces_.push_back({buf, size});
+	size_ += size;
+	if (deleter)
+	{
+		// called when the last copy of this body is gone
+		owners_.emplace_back(buf, [deleter](const void *) { deleter(); });
+	}
+
+	return *this;
+}
+
+WFHttpBody& WFHttpBody::append_copy(const void *buf, size_t size)
+{
+	if (size == 0)
+		return *this;
+
+	return append(std::string((const char *)buf, size));
+}
+
+WFHttpBody& WFHttpBody::append(const WFHttpBody& body)
+{
+	pieces_.insert(pieces_.end(), body.pieces_.begin(), body.pieces_.end());
+	owners_.insert(owners_.end(), body.owners_.begin(), body.owners_.end());
+	size_ += body.size_;
+	return *this;
+}
+
+void WFHttpBody::attach(protocol::HttpRequest *req) const
+{
+	for (const Piece& piece : pieces_)
+		req->append_output_body_nocopy(piece.buf, piece.size);
+}
+
+// the body lives as long as the callback of task
+static void __body_callback(const http_callback_t& callback,
+							const WFHttpBody& body,
+							WFHttpTask *task)
+{
+	callback(task);
+}
+
+static bool __has_header(const std::map<std::string, std::string>& headers,
+						 const char *name)
+{
+	for (const auto& kv : headers)
+	{
+		if (strcasecmp(kv.first.c_str(), name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+// decoded before anyone sees the response
+static void __decode_callback(const std::shared_ptr<WFHttpCompress>& compress,
+							  const http_callback_t& callback,
+							  WFHttpTask *task)
+{
+	if (task->get_state() == WFT_STATE_SUCCESS)
+		compress->decode(task->get_resp());
+
+	callback(task);
+}
+
+using http_options_t = std::shared_ptr<const WFHttpClientOptions>;
+
+static WFHttpTask *__create_http_task(const WFHttpClientOptions *opts,
+									  const std::string& method,
+									  const std::string& url,
+									  const std::map<std::string, std::string>& headers,
+									  WFHttpBody&& body,
+									  http_callback_t&& callback)
+{
+	const std::shared_ptr<WFHttpCompress>& compress = opts->compress;
+	const char *encoding = NULL;
+	WFHttpTask *http_task;
+
+	if (compress)
+	{
+		if (!__has_header(headers, "Content-Encoding"))
+			encoding = compress->encode_body(body);
+
+		callback = std::bind(__decode_callback, compress, std::move(callback),
+							 std::placeholders::_1);
+	}
+
+	if (body.empty())
+	{
+		http_task = WFTaskFactory::create_http_task(url, opts->redirect_max,
+													opts->retry_max,
+													std::move(callback));
+	}
+	else
+	{
+		http_task = WFTaskFactory::create_http_task(url, opts->redirect_max,
+													opts->retry_max,
+			std::bind(__body_callback, std::move(callback), body,
+					  std::placeholders::_1));
+	}
+
 	auto *req = http_task->get_req();
 
 	req->set_method(method);
@@ -98,80 +216,524 @@ WFFuture<WFHttpResult> WFHttpClient::async_request(const std::string& method,
 	for (const auto& kv : headers)
 		req->add_header_pair(kv.first, kv.second);
 
-	req->append_output_body(body);
+	if (compress && !__has_header(headers, "Accept-Encoding"))
+		req->add_header_pair("Accept-Encoding", WFHttpCompress::accept_encoding());
 
-	http_task->set_send_timeout(send_timeout_);
-	http_task->set_receive_timeout(recv_timeout_);
-	http_task->user_data = pr;
-	http_task->start();
+	if (encoding)
+		req->add_header_pair("Content-Encoding", encoding);
 
+	body.attach(req);
+	http_task->set_send_timeout(opts->send_timeout);
+	http_task->set_receive_timeout(opts->recv_timeout);
+	return http_task;
+}
+
+static void __upstream_callback(const std::shared_ptr<WFHttpUpstream>& upstream,
+								WFHttpUpstreamEndpoint *ep,
+								long long start_us,
+								const http_callback_t& callback,
+								WFHttpTask *task)
+{
+	const char *code = task->get_resp()->get_status_code();
+	bool success = task->get_state() == WFT_STATE_SUCCESS;
+
+	// the endpoint is broken or overloaded
+	if (success && code && code[0] == '5')
+		success = false;
+
+	upstream->release(ep, start_us, success);
+	callback(task);
+}
+
+// a url under upstream->base() goes to an endpoint chosen for this task
+static WFHttpTask *__create_task(const WFHttpClientOptions *opts,
+								 const std::string& method,
+								 const std::string& url,
+								 const std::map<std::string, std::string>& headers,
+								 WFHttpBody&& body,
+								 http_callback_t&& callback)
+{
+	const std::shared_ptr<WFHttpUpstream>& upstream = opts->upstream;
+	WFHttpUpstreamEndpoint *ep;
+	size_t len;
+
+	if (!upstream || url.compare(0, upstream->base().size(), upstream->base()) != 0 ||
+		!(ep = upstream->select()))
+	{
+		return __create_http_task(opts, method, url, headers, std::move(body),
+								  std::move(callback));
+	}
+
+	len = upstream->base().size();
+	return __create_http_task(opts, method, upstream->url_of(ep) + url.substr(len),
+							  headers, std::move(body),
+							  std::bind(__upstream_callback, upstream, ep,
+										WFHttpUpstream::now_us(),
+										std::move(callback), std::placeholders::_1));
+}
+
+// a path is under the base of upstream, a full url is sent as it is
+static std::string __upstream_url(const std::shared_ptr<WFHttpUpstream>& upstream,
+								  const std::string& url)
+{
+	if (!upstream || url.find("://") != std::string::npos)
+		return url;
+
+	if (url.empty() || url[0] != '/')
+		return upstream->base() + "/" + url;
+
+	return upstream->base() + url;
+}
+
+static void __send_request(const http_options_t& opts,
+						   const std::string& method,
+						   const std::string& url,
+						   const std::map<std::string, std::string>& headers,
+						   WFHttpBody&& body,
+						   void *user_data,
+						   http_callback_t&& callback)
+{
+	WFHttpTask *http_task;
+
+	if (!opts->hedge || !WFHttpHedge::idempotent(method))
+	{
+		http_task = __create_task(opts.get(), method, url, headers, std::move(body),
+								  std::move(callback));
+		http_task->user_data = user_data;
+		http_task->start();
+		return;
+	}
+
+	// the hedge is an identical task made by the same function
+	auto create = [opts, method, url, headers, body, user_data]
+				  (http_callback_t&& callback) {
+		auto *http_task = __create_task(opts.get(), method, url, headers,
+										WFHttpBody(body), std::move(callback));
+
+		http_task->user_data = user_data;
+		return http_task;
+	};
+
+	opts->hedge->request(url, std::move(create), std::move(callback));
+}
+
+static void __limiter_callback(const std::shared_ptr<WFClientLimiter>& limiter,
+							   WFClientLimiterUpstream *up,
+							   long long admitted_at,
+							   const http_callback_t& callback,
+							   WFHttpTask *task)
+{
+	const char *code = task->get_resp()->get_status_code();
+	bool success = task->get_state() == WFT_STATE_SUCCESS;
+
+	// the upstream is shedding load
+	if (success && code && (strcmp(code, "503") == 0 || strcmp(code, "429") == 0))
+		success = false;
+
+	limiter->release(up, admitted_at, success);
+	callback(task);
+}
+
+static void __start_request(const http_options_t& opts,
+							const std::string& method,
+							const std::string& url,
+							const std::map<std::string, std::string>& headers,
+							WFHttpBody&& body,
+							void *user_data,
+							http_callback_t&& callback,
+							std::function<void (WFHttpResult&)>&& reject)
+{
+	const std::shared_ptr<WFClientLimiter>& limiter = opts->limiter;
+
+	if (!limiter)
+	{
+		return __send_request(opts, method, url, headers, std::move(body),
+							  user_data, std::move(callback));
+	}
+
+	auto *up = limiter->upstream(WFClientLimiter::upstream_of(url));
+
+	// may be sent later from another thread, everything is copied
+	limiter->acquire(up, [opts, up, method, url, headers, body, user_data,
+						  callback, reject](long long admitted_at) {
+		if (admitted_at < 0)
+		{
+			WFHttpResult res;
+
+			res.seqid = -1;
+			res.task_state = WFT_STATE_SYS_ERROR;
+			res.task_error = EAGAIN;
+			res.status_code = -1;
+			return reject(res);
+		}
+
+		__send_request(opts, method, url, headers, WFHttpBody(body), user_data,
+					   std::bind(__limiter_callback, opts->limiter, up, admitted_at,
+								 callback, std::placeholders::_1));
+	});
+}
+
+static void __cache_request(const http_options_t& opts,
+							const std::string& method,
+							const std::string& url,
+							const std::map<std::string, std::string>& headers,
+							WFHttpBody&& body,
+							void *user_data,
+							http_callback_t&& callback,
+							std::function<void (WFHttpResult&)>&& on_result)
+{
+	const std::shared_ptr<WFHttpCache>& cache = opts->cache;
+
+	if (!cache || !WFHttpCache::cacheable(method, headers, body.size()))
+	{
+		return __start_request(opts, method, url, headers, std::move(body),
+							   user_data, std::move(callback), std::move(on_result));
+	}
+
+	// a cacheable request has no body
+	auto send = [opts, method, url, user_data]
+				(const std::map<std::string, std::string>& headers,
+				 http_callback_t&& callback,
+				 WFHttpCache::result_t&& on_result) {
+		__start_request(opts, method, url, headers, WFHttpBody(), user_data,
+						std::move(callback), std::move(on_result));
+	};
+
+	cache->request(url, headers, std::move(send), std::move(callback),
+				   std::move(on_result));
+}
+
+using WFHttpFlight = WFSingleFlight<WFHttpResult>;
+
+// HttpResponse can not be copied, a copy is parsed from its bytes.
+// append() is protected
+class __HttpResponseCopier : public protocol::HttpResponse
+{
+public:
+	static void copy(const protocol::HttpResponse& from, protocol::HttpResponse& to)
+	{
+		int (HttpMessage::*fn)(const void *, size_t *) = &__HttpResponseCopier::append;
+		protocol::HttpHeaderCursor cursor(&from);
+		const char *reason = from.get_reason_phrase();
+		std::string name;
+		std::string value;
+		std::string raw;
+		const void *body;
+		size_t size;
+
+		raw = std::string(from.get_http_version()) + " " + from.get_status_code() +
+			  " " + (reason ? reason : "") + "\r\n";
+		while (cursor.next(name, value))
+		{
+			// the body is copied decoded with its length
+			if (strcasecmp(name.c_str(), "Content-Length") != 0 &&
+				strcasecmp(name.c_str(), "Transfer-Encoding") != 0)
+			{
+				raw += name + ": " + value + "\r\n";
+			}
+		}
+
+		if (!from.get_parsed_body(&body, &size))
+			size = 0;
+
+		raw += "Content-Length: " + std::to_string(size) + "\r\n\r\n";
+		raw.append((const char *)body, size);
+		size = raw.size();
+		(to.*fn)(raw.c_str(), &size);
+	}
+};
+
+static void __copy_result(const WFHttpResult& from, WFHttpResult& to)
+{
+	to.seqid = from.seqid;
+	to.task_state = from.task_state;
+	to.task_error = from.task_error;
+	to.status_code = from.status_code;
+	if (from.task_state == WFT_STATE_SUCCESS)
+		__HttpResponseCopier::copy(from.resp, to.resp);
+}
+
+// partial and conditional GETs may get different responses
+static bool __flight_shareable(const std::map<std::string, std::string>& headers)
+{
+	static const char *bypass[] = {
+		"Range", "If-Range", "If-None-Match", "If-Modified-Since",
+		"If-Match", "If-Unmodified-Since"
+	};
+
+	for (const char *name : bypass)
+	{
+		if (__has_header(headers, name))
+			return false;
+	}
+
+	return true;
+}
+
+static std::string __flight_key(const std::string& url,
+								const std::map<std::string, std::string>& headers,
+								const std::vector<std::string>& key_headers)
+{
+	std::string key = url;
+
+	for (const auto& kv : headers)
+	{
+		bool count = strcasecmp(kv.first.c_str(), "Authorization") == 0 ||
+					 strcasecmp(kv.first.c_str(), "Cookie") == 0 ||
+					 strcasecmp(kv.first.c_str(), "Accept-Encoding") == 0;
+
+		for (size_t i = 0; !count && i < key_headers.size(); i++)
+			count = strcasecmp(kv.first.c_str(), key_headers[i].c_str()) == 0;
+
+		// headers is sorted, so is the key
+		if (count)
+			key += "\n" + kv.first + ": " + kv.second;
+	}
+
+	return key;
+}
+
+static void __flight_request(const http_options_t& opts,
+							 const std::string& method,
+							 const std::string& url,
+							 const std::map<std::string, std::string>& headers,
+							 WFHttpBody&& body,
+							 void *user_data,
+							 http_callback_t&& callback,
+							 std::function<void (WFHttpResult&)>&& on_result)
+{
+	const std::shared_ptr<WFHttpFlight>& flight = opts->flight;
+
+	if (!flight || strcasecmp(method.c_str(), "GET") != 0 || !body.empty() ||
+		!__flight_shareable(headers))
+	{
+		return __cache_request(opts, method, url, headers, std::move(body),
+							   user_data, std::move(callback), std::move(on_result));
+	}
+
+	// start is called at once, before request() returns
+	auto start = [&](WFHttpFlight::callback_t done) {
+		auto&& cb = [done](WFHttpTask *task) {
+			WFHttpResult res;
+
+			__set_result(task, res);
+			done(res);
+		};
+
+		__cache_request(opts, method, url, headers, WFHttpBody(), NULL,
+						std::move(cb), std::move(done));
+	};
+
+	flight->request(__flight_key(url, headers, opts->flight_headers), start,
+					std::move(on_result));
+}
+
+WFHttpResult WFHttpClient::sync_request(const std::string& method,
+										const std::string& url,
+										const std::map<std::string, std::string>& headers,
+										WFHttpBody body)
+{
+	return this->async_request(method, url, headers, std::move(body)).get();
+}
+
+WFFuture<WFHttpResult> WFHttpClient::async_request(const std::string& method,
+												   const std::string& url,
+												   const std::map<std::string, std::string>& headers,
+												   WFHttpBody body)
+{
+	auto *pr = new WFPromise<WFHttpResult>();
+	auto fr = pr->get_future();
+	http_options_t opts = options();
+
+	__flight_request(opts, method, __upstream_url(opts->upstream, url), headers,
+					 std::move(body), pr, __future_callback,
+					 [pr](WFHttpResult& res) {
+						 pr->set_value(std::move(res));
+						 delete pr;
+					 });
 	return fr;
 }
 
 void WFHttpClient::request(const std::string& method,
 						   const std::string& url,
 						   const std::map<std::string, std::string>& headers,
-						   const std::string& body,
+						   WFHttpBody body,
 						   WFHttpClient::ON_COMPLETE on_complete)
 {
-	request(method, url, headers, body, NULL, NULL, on_complete);
+	request(method, url, headers, std::move(body), NULL, NULL, std::move(on_complete));
 }
 
 void WFHttpClient::request(const std::string& method,
 						   const std::string& url,
 						   const std::map<std::string, std::string>& headers,
-						   const std::string& body,
+						   WFHttpBody body,
 						   WFHttpClient::ON_SUCCESS on_success,
 						   WFHttpClient::ON_ERROR on_error,
 						   WFHttpClient::ON_COMPLETE on_complete)
 {
+	std::function<void (WFHttpResult&)> on_result;
+	http_options_t opts = options();
+
+	if (opts->limiter || opts->cache || opts->flight)
+	{
+		on_result = std::bind(__async_result, on_success, on_error, on_complete,
+							  std::placeholders::_1);
+	}
+
 	auto&& cb = std::bind(__async_callback,
 						  std::move(on_success),
 						  std::move(on_error),
 						  std::move(on_complete),
 						  std::placeholders::_1);
 
-	auto *http_task = WFTaskFactory::create_http_task(url,
-													  redirect_max_,
-													  retry_max_,
-													  std::move(cb));
-	auto *req = http_task->get_req();
+	__flight_request(opts, method, __upstream_url(opts->upstream, url), headers,
+					 std::move(body), NULL, std::move(cb), std::move(on_result));
+}
 
-	req->set_method(method);
+static bool __batch_result(WFHttpTask *task, WFHttpResult& res)
+{
+	if (task)
+		return __set_result(task, res) != -1;
 
-	for (const auto& kv : headers)
-		req->add_header_pair(kv.first, kv.second);
+	res.seqid = -1;
+	res.task_state = WFT_STATE_UNDEFINED;
+	res.task_error = 0;
+	res.status_code = -1;
+	return false;
+}
 
-	req->append_output_body(body);
+std::vector<WFHttpResult> WFHttpClient::sync_parallel_request(std::vector<WFHttpRequest> requests,
+															  const struct WFBatchParams *params)
+{
+	return this->async_parallel_request(std::move(requests), params).get();
+}
 
-	http_task->set_send_timeout(send_timeout_);
-	http_task->set_receive_timeout(recv_timeout_);
-	http_task->start();
+WFFuture<std::vector<WFHttpResult>>
+WFHttpClient::async_parallel_request(std::vector<WFHttpRequest> requests,
+									 const struct WFBatchParams *params)
+{
+	auto pr = std::make_shared<WFPromise<std::vector<WFHttpResult>>>();
+	auto fr = pr->get_future();
+
+	parallel_request(std::move(requests), [pr](std::vector<WFHttpResult>& results) {
+		pr->set_value(std::move(results));
+	}, params);
+
+	return fr;
+}
+
+void WFHttpClient::parallel_request(std::vector<WFHttpRequest> requests,
+									WFHttpClient::ON_BATCH on_complete,
+									const struct WFBatchParams *params)
+{
+	auto reqs = std::make_shared<const std::vector<WFHttpRequest>>(std::move(requests));
+	size_t n = reqs->size();
+	http_options_t opts = options();
+
+	auto create = [reqs, opts](size_t i, http_callback_t&& callback) {
+		const WFHttpRequest& req = (*reqs)[i];
+
+		return __create_task(opts.get(), req.method,
+							 __upstream_url(opts->upstream, req.url), req.headers,
+							 WFHttpBody(req.body), std::move(callback));
+	};
+
+	auto limiter_upstream = [reqs, opts](size_t i) {
+		std::string url = __upstream_url(opts->upstream, (*reqs)[i].url);
+
+		return opts->limiter->upstream(WFClientLimiter::upstream_of(url));
+	};
+
+	WFClientBatch<WFHttpTask, WFHttpResult>::start(n, std::move(create),
+												   __batch_result, params,
+												   std::move(on_complete), opts->limiter,
+												   std::move(limiter_upstream));
+}
+
+WFHttpDownloadResult WFHttpClient::sync_download(const std::string& url,
+												 const std::map<std::string, std::string>& headers,
+												 const std::string& path,
+												 const struct WFHttpDownloadParams *params)
+{
+	return this->async_download(url, headers, path, params).get();
+}
+
+WFFuture<WFHttpDownloadResult>
+WFHttpClient::async_download(const std::string& url,
+							 const std::map<std::string, std::string>& headers,
+							 const std::string& path,
+							 const struct WFHttpDownloadParams *params)
+{
+	auto pr = std::make_shared<WFPromise<WFHttpDownloadResult>>();
+	auto fr = pr->get_future();
+
+	download(url, headers, path, nullptr, [pr](WFHttpDownloadResult& result) {
+		pr->set_value(std::move(result));
+	}, params);
+
+	return fr;
+}
+
+void WFHttpClient::download(const std::string& url,
+							const std::map<std::string, std::string>& headers,
+							const std::string& path,
+							WFHttpDownload::progress_t on_progress,
+							WFHttpClient::ON_DOWNLOAD on_complete,
+							const struct WFHttpDownloadParams *params)
+{
+	auto opts = std::make_shared<WFHttpClientOptions>(*options());
+	std::string full_url = __upstream_url(opts->upstream, url);
+
+	// the ranges are of the bytes on the wire, so no Accept-Encoding
+	opts->compress.reset();
+	auto create = [opts, full_url, headers]
+				  (const std::string& range, http_callback_t&& callback) {
+		auto *http_task = __create_task(opts.get(), "GET", full_url, headers,
+										WFHttpBody(), std::move(callback));
+
+		http_task->get_req()->add_header_pair("Range", range);
+		return http_task;
+	};
+
+	WFHttpDownload::start(path, std::move(create), params,
+						  std::move(on_progress), std::move(on_complete));
 }
 
 WFHttpChain WFHttpClient::request(const std::string& method, const std::string& url)
 {
-	return WFHttpChain(method, url,
-					   retry_max_, redirect_max_, send_timeout_, recv_timeout_);
+	http_options_t opts = options();
+
+	return WFHttpChain(method, __upstream_url(opts->upstream, url), opts);
 }
 
-WFHttpChain::WFHttpChain(const std::string& method,
-						 const std::string& url,
-						 int retry_max,
-						 int redirect_max,
-						 int send_timeout,
-						 int recv_timeout):
+void WFHttpClient::set_single_flight(std::vector<std::string> key_headers)
+{
+	auto flight = std::make_shared<WFHttpFlight>(__copy_result);
+
+	update([&flight, &key_headers](WFHttpClientOptions *opts) {
+		opts->flight = flight;
+		opts->flight_headers = key_headers;
+	});
+}
+
+WFHttpChain::WFHttpChain(const std::string& method, const std::string& url,
+						 std::shared_ptr<const WFHttpClientOptions> opts):
 	method_(method),
 	url_(url),
 	on_complete_(NULL),
 	on_success_(NULL),
 	on_error_(NULL),
-	retry_max_(retry_max),
-	redirect_max_(redirect_max),
-	send_timeout_(send_timeout),
-	recv_timeout_(recv_timeout)
+	opts_(std::move(opts))
 {}
 
+WFHttpClientOptions *WFHttpChain::options()
+{
+	auto opts = std::make_shared<WFHttpClientOptions>(*opts_);
+
+	opts_ = opts;
+	return opts.get();
+}
+
 WFHttpTask *WFHttpChain::create_task()
 {
 	auto&& cb = std::bind(__async_callback,
@@ -180,28 +742,33 @@ WFHttpTask *WFHttpChain::create_task()
 						  on_complete_,
 						  std::placeholders::_1);
 
-	auto *http_task = WFTaskFactory::create_http_task(url_,
-													  redirect_max_,
-													  retry_max_,
-													  std::move(cb));
-
-	auto *req = http_task->get_req();
+	// copies of body_ share the pieces, chain can create many tasks
+	return __create_task(opts_.get(), method_, url_, headers_, WFHttpBody(body_),
+						 std::move(cb));
+}
 
-	req->set_method(method_);
+void WFHttpChain::send()
+{
+	std::function<void (WFHttpResult&)> on_result;
 
-	for (const auto& kv : headers_)
-		req->add_header_pair(kv.first, kv.second);
+	// create_task() has everything else
+	if (!opts_->hedge && !opts_->limiter && !opts_->cache && !opts_->flight)
+		return create_task()->start();
 
-	req->append_output_body(body_);
+	if (opts_->limiter || opts_->cache || opts_->flight)
+	{
+		on_result = std::bind(__async_result, on_success_, on_error_, on_complete_,
+							  std::placeholders::_1);
+	}
 
-	http_task->set_send_timeout(send_timeout_);
-	http_task->set_receive_timeout(recv_timeout_);
-	return http_task;
-}
+	auto&& cb = std::bind(__async_callback,
+						  on_success_,
+						  on_error_,
+						  on_complete_,
+						  std::placeholders::_1);
 
-void WFHttpChain::send()
-{
-	create_task()->start();
+	__flight_request(opts_, method_, url_, headers_, WFHttpBody(body_), NULL,
+					 std::move(cb), std::move(on_result));
 }
 
 WFHttpChain& WFHttpChain::set_header(const std::string& key, const std::string& value)
@@ -212,7 +779,7 @@ WFHttpChain& WFHttpChain::set_header(const std::string& key, const std::string&
 
 WFHttpChain& WFHttpChain::set_header(const std::map<std::string, std::string>& headers)
 {
-	for (const auto& kv : headers_)
+	for (const auto& kv : headers)
 		headers_[kv.first] = kv.second;
 
 	return *this;
@@ -220,7 +787,38 @@ WFHttpChain& WFHttpChain::set_header(const std::map<std::string, std::string>& h
 
 WFHttpChain& WFHttpChain::append_body(const std::string& str)
 {
-	body_ += str;
+	body_.append_copy(str.c_str(), str.size());
+	return *this;
+}
+
+WFHttpChain& WFHttpChain::append_body(std::string&& str)
+{
+	body_.append(std::move(str));
+	return *this;
+}
+
+WFHttpChain& WFHttpChain::append_body(const char *str)
+{
+	body_.append_copy(str, strlen(str));
+	return *this;
+}
+
+WFHttpChain& WFHttpChain::append_body(std::shared_ptr<const std::string> buf)
+{
+	body_.append(std::move(buf));
+	return *this;
+}
+
+WFHttpChain& WFHttpChain::append_body(const void *buf, size_t size,
+									  std::function<void ()> deleter)
+{
+	body_.append(buf, size, std::move(deleter));
+	return *this;
+}
+
+WFHttpChain& WFHttpChain::append_body(const WFHttpBody& body)
+{
+	body_.append(body);
 	return *this;
 }
 
@@ -229,6 +827,11 @@ WFHttpChain& WFHttpChain::operator() (const std::string& str)
 	return append_body(str);
 }
 
+WFHttpChain& WFHttpChain::operator() (std::string&& str)
+{
+	return append_body(std::move(str));
+}
+
 WFHttpChain& WFHttpChain::complete(WFHttpClient::ON_COMPLETE on_complete)
 {
 	on_complete_ = std::move(on_complete);
@@ -249,25 +852,265 @@ WFHttpChain& WFHttpChain::error(WFHttpClient::ON_ERROR on_error)
 
 WFHttpChain& WFHttpChain::retry_max(int n)
 {
-	retry_max_ = n;
+	options()->retry_max = n;
 	return *this;
 }
 
 WFHttpChain& WFHttpChain::redirect_max(int n)
 {
-	redirect_max_ = n;
+	options()->redirect_max = n;
 	return *this;
 }
 
 WFHttpChain& WFHttpChain::send_timeout(int timeout)
 {
-	send_timeout_ = timeout;
+	options()->send_timeout = timeout;
 	return *this;
 }
 
 WFHttpChain& WFHttpChain::recv_timeout(int timeout)
 {
-	recv_timeout_ = timeout;
+	options()->recv_timeout = timeout;
 	return *this;
 }
 
+class WFHttpTemplateData
+{
+public:
+	std::string method;
+	ParsedURI uri;
+	std::string path;
+	std::string query;
+	// all names and values in one buffer, headers point into it
+	std::string header_buf;
+	std::vector<struct HttpMessageHeader> headers;
+	WFHttpBody body;
+	WFHttpClient::ON_COMPLETE on_complete;
+	WFHttpClient::ON_SUCCESS on_success;
+	WFHttpClient::ON_ERROR on_error;
+	int retry_max;
+	int redirect_max;
+	int send_timeout;
+	int recv_timeout;
+	std::shared_ptr<WFHttpCompress> compress;
+	bool content_encoding;//headers have Content-Encoding
+};
+
+WFHttpTemplate WFHttpChain::prepare() const
+{
+	auto *data = new WFHttpTemplateData;
+	size_t size = 0;
+
+	data->method = method_;
+	// a bad url is reported by every task when it starts
+	URIParser::parse(url_, data->uri);
+	if (data->uri.state == URI_STATE_SUCCESS)
+	{
+		data->path = data->uri.path && *data->uri.path ? data->uri.path : "/";
+		if (data->uri.query)
+			data->query = data->uri.query;
+	}
+
+	for (const auto& kv : headers_)
+		size += kv.first.size() + kv.second.size();
+
+	data->header_buf.reserve(size);
+	for (const auto& kv : headers_)
+	{
+		data->header_buf.append(kv.first);
+		data->header_buf.append(kv.second);
+	}
+
+	const char *p = data->header_buf.c_str();
+
+	for (const auto& kv : headers_)
+	{
+		data->headers.push_back({p, kv.first.size(),
+								 p + kv.first.size(), kv.second.size()});
+		p += kv.first.size() + kv.second.size();
+	}
+
+	// added once with the prepared headers
+	if (opts_->compress && !__has_header(headers_, "Accept-Encoding"))
+	{
+		const char *value = WFHttpCompress::accept_encoding();
+
+		data->headers.push_back({"Accept-Encoding", strlen("Accept-Encoding"),
+								 value, strlen(value)});
+	}
+
+	data->compress = opts_->compress;
+	data->content_encoding = __has_header(headers_, "Content-Encoding");
+	data->body = body_;
+	data->on_complete = on_complete_;
+	data->on_success = on_success_;
+	data->on_error = on_error_;
+	data->retry_max = opts_->retry_max;
+	data->redirect_max = opts_->redirect_max;
+	data->send_timeout = opts_->send_timeout;
+	data->recv_timeout = opts_->recv_timeout;
+	return WFHttpTemplate(std::shared_ptr<const WFHttpTemplateData>(data));
+}
+
+static void __template_callback(const std::shared_ptr<const WFHttpTemplateData>& data,
+								const WFHttpBody& body,
+								WFHttpTask *task)
+{
+	if (data->compress && task->get_state() == WFT_STATE_SUCCESS)
+		data->compress->decode(task->get_resp());
+
+	__async_callback(data->on_success, data->on_error, data->on_complete, task);
+}
+
+// borrows the fields of the prepared uri, the task keeps the only copy
+class __WFHttpURIView : public ParsedURI
+{
+public:
+	__WFHttpURIView(const ParsedURI& base, const char *path, const char *query)
+	{
+		this->scheme = base.scheme;
+		this->userinfo = base.userinfo;
+		this->host = base.host;
+		this->port = base.port;
+		this->path = const_cast<char *>(path);
+		this->query = const_cast<char *>(query);
+		this->fragment = base.fragment;
+		this->state = base.state;
+		this->error = base.error;
+	}
+
+	~__WFHttpURIView()
+	{
+		this->scheme = NULL;
+		this->userinfo = NULL;
+		this->host = NULL;
+		this->port = NULL;
+		this->path = NULL;
+		this->query = NULL;
+		this->fragment = NULL;
+	}
+};
+
+// base path and suffix are joined with exactly one '/',
+// returns the query of the new uri, may be NULL
+static const char *__set_suffix(const WFHttpTemplateData *data,
+								const std::string& suffix,
+								std::string& path, std::string& query)
+{
+	size_t pos = suffix.find('?');
+	const char *p = suffix.c_str();
+	size_t len = pos == std::string::npos ? suffix.size() : pos;
+
+	path.reserve(data->path.size() + len + 1);
+	path = data->path;
+	if (len > 0 && *p == '/' && path.back() == '/')
+	{
+		p++;
+		len--;
+	}
+	else if (len > 0 && *p != '/' && path.back() != '/')
+		path.push_back('/');
+
+	path.append(p, len);
+	if (pos != std::string::npos)
+	{
+		query.assign(suffix, pos + 1, std::string::npos);
+		return query.c_str();
+	}
+
+	return data->query.empty() ? NULL : data->query.c_str();
+}
+
+// body is NULL for the prepared one, which is shared and never copied
+static WFHttpTask *__template_task(const std::shared_ptr<const WFHttpTemplateData>& ptr,
+								   const std::string& path_suffix,
+								   WFHttpBody *body,
+								   WFHttpTemplate::HeaderPairs headers)
+{
+	const WFHttpTemplateData *data = ptr.get();
+	const char *encoding = NULL;
+	WFHttpBody encoded;
+	WFHttpTask *http_task;
+
+	if (data->compress && !data->content_encoding)
+	{
+		if (!body)
+		{
+			encoded.append(data->body);
+			body = &encoded;
+		}
+
+		encoding = data->compress->encode_body(*body);
+	}
+
+	if (path_suffix.empty() || data->uri.state != URI_STATE_SUCCESS)
+	{
+		http_task = WFTaskFactory::create_http_task(data->uri,
+													data->redirect_max,
+													data->retry_max,
+													nullptr);
+	}
+	else
+	{
+		std::string path;
+		std::string query;
+		const char *q = __set_suffix(data, path_suffix, path, query);
+		__WFHttpURIView uri(data->uri, path.c_str(), q);
+
+		http_task = WFTaskFactory::create_http_task(uri,
+													data->redirect_max,
+													data->retry_max,
+													nullptr);
+	}
+
+	auto *req = http_task->get_req();
+
+	req->set_method(data->method);
+	for (const struct HttpMessageHeader& header : data->headers)
+		req->add_header(&header);
+
+	for (const auto& kv : headers)
+		req->add_header_pair(kv.first, kv.second);
+
+	if (encoding)
+		req->add_header_pair("Content-Encoding", encoding);
+
+	// the pieces are owned by buffers, not by the body, so moving is safe
+	if (body)
+	{
+		body->attach(req);
+		http_task->set_callback(std::bind(__template_callback, ptr,
+										  std::move(*body),
+										  std::placeholders::_1));
+	}
+	else
+	{
+		data->body.attach(req);
+		http_task->set_callback(std::bind(__template_callback, ptr,
+										  WFHttpBody(),
+										  std::placeholders::_1));
+	}
+
+	http_task->set_send_timeout(data->send_timeout);
+	http_task->set_receive_timeout(data->recv_timeout);
+	return http_task;
+}
+
+WFHttpTask *WFHttpTemplate::create_task() const
+{
+	return __template_task(data_, std::string(), NULL, {});
+}
+
+WFHttpTask *WFHttpTemplate::create_task(const std::string& path_suffix,
+										WFHttpBody body) const
+{
+	return __template_task(data_, path_suffix, &body, {});
+}
+
+WFHttpTask *WFHttpTemplate::create_task(const std::string& path_suffix,
+										WFHttpBody body,
+										HeaderPairs headers) const
+{
+	return __template_task(data_, path_suffix, &body, headers);
+}
+
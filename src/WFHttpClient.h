@@ -20,12 +20,26 @@
 #ifndef _WFHTTPCLIENT_H_
 #define _WFHTTPCLIENT_H_
 
+#include <string.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <functional>
+#include <initializer_list>
+#include <utility>
 #include <workflow/HttpMessage.h>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFFuture.h>
+#include "WFClientBatch.h"
+#include "WFHttpHedge.h"
+#include "WFClientLimiter.h"
+#include "WFHttpCache.h"
+#include "WFSingleFlight.h"
+#include "WFHttpCompress.h"
+#include "WFHttpDownload.h"
+#include "WFHttpUpstream.h"
 
 /**
  * @file   WFHttpClient.h
@@ -41,7 +55,86 @@ struct WFHttpResult
 	int status_code;//-1, 200, 206, 404, 500
 };
 
+// A request body made of pieces, each piece is sent as it is by
+// append_output_body_nocopy(), nothing is flattened or copied.
+// Pieces are kept alive until the task is destroyed.
+// Copies of WFHttpBody share the same pieces.
+class WFHttpBody
+{
+public:
+	// take the ownership
+	WFHttpBody& append(std::string&& str);
+	// reference counted buffer, may be shared by many requests
+	WFHttpBody& append(std::shared_ptr<const std::string> buf);
+	// caller owned memory, deleter is called after the task is done, may be NULL
+	WFHttpBody& append(const void *buf, size_t size, std::function<void ()> deleter);
+	// copy once
+	WFHttpBody& append_copy(const void *buf, size_t size);
+	// share the pieces of another body
+	WFHttpBody& append(const WFHttpBody& body);
+
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	// add pieces to req without copy, keep this body until the task is done
+	void attach(protocol::HttpRequest *req) const;
+
+public:
+	WFHttpBody(): size_(0) { }
+	WFHttpBody(std::string&& str): size_(0) { append(std::move(str)); }
+	WFHttpBody(const std::string& str): size_(0) { append_copy(str.c_str(), str.size()); }
+	WFHttpBody(const char *str): size_(0) { append_copy(str, strlen(str)); }
+
+private:
+	struct Piece
+	{
+		const void *buf;
+		size_t size;
+	};
+
+	std::vector<Piece> pieces_;
+	std::vector<std::shared_ptr<const void>> owners_;
+	size_t size_;
+
+	friend class WFHttpCompress;
+};
+
+// one request of a batch
+struct WFHttpRequest
+{
+	std::string method;
+	std::string url;
+	std::map<std::string, std::string> headers;
+	WFHttpBody body;
+};
+
+// Everything a request is sent with besides itself. A client shares one
+// copy with its chains and requests in flight, setters publish a new copy
+// atomically, so they may run while requests are made.
+struct WFHttpClientOptions
+{
+	int retry_max;
+	int redirect_max;
+	int send_timeout;
+	int recv_timeout;
+	std::shared_ptr<WFHttpHedge> hedge;
+	std::shared_ptr<WFClientLimiter> limiter;
+	std::shared_ptr<WFHttpCache> cache;
+	std::shared_ptr<WFSingleFlight<WFHttpResult>> flight;
+	std::vector<std::string> flight_headers;
+	std::shared_ptr<WFHttpCompress> compress;
+	std::shared_ptr<WFHttpUpstream> upstream;
+
+	WFHttpClientOptions():
+		retry_max(0),
+		redirect_max(0),
+		send_timeout(-1),
+		recv_timeout(-1)
+	{}
+};
+
 class WFHttpChain;//for method chaining
+class WFHttpTemplateData;
 
 class WFHttpClient
 {
@@ -51,40 +144,140 @@ public:
 	using ON_ERROR = std::function<void (int state, int error, const std::string& errmsg)>;
 
 	WFHttpClient():
-		retry_max_(0),
-		redirect_max_(0),
-		send_timeout_(-1),
-		recv_timeout_(-1)
+		opts_(std::make_shared<WFHttpClientOptions>())
 	{}
 
-	void default_retry_max(int n) { retry_max_ = n; }
-	void default_redirect_max(int n) { redirect_max_ = n; }
-	void default_send_timeout(int timeout) { send_timeout_ = timeout; }
-	void default_recv_timeout(int timeout) { recv_timeout_ = timeout; }
+	void default_retry_max(int n)
+	{
+		update([n](WFHttpClientOptions *opts) { opts->retry_max = n; });
+	}
+
+	void default_redirect_max(int n)
+	{
+		update([n](WFHttpClientOptions *opts) { opts->redirect_max = n; });
+	}
+
+	void default_send_timeout(int timeout)
+	{
+		update([timeout](WFHttpClientOptions *opts) { opts->send_timeout = timeout; });
+	}
+
+	void default_recv_timeout(int timeout)
+	{
+		update([timeout](WFHttpClientOptions *opts) { opts->recv_timeout = timeout; });
+	}
+
+	// hedge requests of idempotent methods, see WFHttpHedge.h.
+	// Tasks from create_task() are never hedged.
+	void set_hedge(const struct WFHttpHedgeParams *params)
+	{
+		auto hedge = std::make_shared<WFHttpHedge>(params);
+
+		update([&hedge](WFHttpClientOptions *opts) { opts->hedge = hedge; });
+	}
+
+	// return -1 if set_hedge() is not called
+	int get_hedge_stats(struct WFHttpHedgeStats *stats) const
+	{
+		auto opts = options();
+
+		if (!opts->hedge)
+			return -1;
+
+		opts->hedge->get_stats(stats);
+		return 0;
+	}
+
+	// limit concurrency per host:port, see WFClientLimiter.h. A rejected
+	// request fails with WFT_STATE_SYS_ERROR and EAGAIN. Every request of
+	// a batch is admitted on its own.
+	// Tasks from create_task() are never limited.
+	void set_limiter(std::shared_ptr<WFClientLimiter> limiter)
+	{
+		update([&limiter](WFHttpClientOptions *opts) { opts->limiter = limiter; });
+	}
+
+	// answer GET requests from a response cache, see WFHttpCache.h.
+	// A cache may be shared by many clients.
+	// Tasks from create_task() never use the cache.
+	void set_cache(std::shared_ptr<WFHttpCache> cache)
+	{
+		update([&cache](WFHttpClientOptions *opts) { opts->cache = cache; });
+	}
+
+	// send Accept-Encoding, decode responses and compress large request
+	// bodies, see WFHttpCompress.h. Also applies to create_task().
+	void set_compress(const struct WFHttpCompressParams *params)
+	{
+		auto compress = std::make_shared<WFHttpCompress>(params);
+
+		update([&compress](WFHttpClientOptions *opts) { opts->compress = compress; });
+	}
+
+	// identical GET requests in flight share one request and its result,
+	// see WFSingleFlight.h. GETs are identical if url and the values of
+	// key_headers are, Authorization, Cookie and Accept-Encoding always
+	// count. GETs with Range or conditional headers never share.
+	// Tasks from create_task() never share.
+	void set_single_flight(std::vector<std::string> key_headers);
 
+	// return -1 if set_single_flight() is not called
+	int get_single_flight_stats(struct WFSingleFlightStats *stats) const
+	{
+		auto opts = options();
+
+		if (!opts->flight)
+			return -1;
+
+		opts->flight->get_stats(stats);
+		return 0;
+	}
+
+	// bind to the endpoints of a service, see WFHttpUpstream.h. A url
+	// without "://" is a path under the endpoint chosen for every task,
+	// full urls are sent as they are. Templates are not balanced,
+	// prepare() them from a full url.
+	void set_upstream(std::shared_ptr<WFHttpUpstream> upstream)
+	{
+		update([&upstream](WFHttpClientOptions *opts) { opts->upstream = upstream; });
+	}
+
+	// return -1 if set_upstream() is not called
+	int get_upstream_stats(std::vector<struct WFHttpEndpointStats>& stats) const
+	{
+		auto opts = options();
+
+		if (!opts->upstream)
+			return -1;
+
+		opts->upstream->get_stats(stats);
+		return 0;
+	}
+
+	// body: std::string (copied once), std::move(std::string) or WFHttpBody
 	//sync
 	WFHttpResult sync_request(const std::string& method,
 							  const std::string& url,
 							  const std::map<std::string, std::string>& headers,
-							  const std::string& body);
+							  WFHttpBody body);
 
 	//async future
 	WFFuture<WFHttpResult> async_request(const std::string& method,
 										 const std::string& url,
 										 const std::map<std::string, std::string>& headers,
-										 const std::string& body);
+										 WFHttpBody body);
 
 	//async
 	void request(const std::string& method,
 				 const std::string& url,
 				 const std::map<std::string, std::string>& headers,
-				 const std::string& body,
+				 WFHttpBody body,
 				 WFHttpClient::ON_COMPLETE on_complete);
 
 	void request(const std::string& method,
 				 const std::string& url,
 				 const std::map<std::string, std::string>& headers,
-				 const std::string& body,
+				 WFHttpBody body,
 				 WFHttpClient::ON_SUCCESS on_success,
 				 WFHttpClient::ON_ERROR on_error,
 				 WFHttpClient::ON_COMPLETE on_complete);
@@ -92,15 +285,108 @@ public:
 	//async, method chaining style
 	WFHttpChain request(const std::string& method, const std::string& url);
 
+	// batch, results are in the order of requests, see WFClientBatch.h
+	using ON_BATCH = std::function<void (std::vector<WFHttpResult>&)>;
+
+	std::vector<WFHttpResult> sync_parallel_request(std::vector<WFHttpRequest> requests,
+													const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	WFFuture<std::vector<WFHttpResult>> async_parallel_request(std::vector<WFHttpRequest> requests,
+															   const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	void parallel_request(std::vector<WFHttpRequest> requests,
+						  WFHttpClient::ON_BATCH on_complete,
+						  const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	// download to the file of path by Range requests, see WFHttpDownload.h.
+	// Responses are never cached, shared or decoded
+	using ON_DOWNLOAD = std::function<void (WFHttpDownloadResult&)>;
+
+	WFHttpDownloadResult sync_download(const std::string& url,
+									   const std::map<std::string, std::string>& headers,
+									   const std::string& path,
+									   const struct WFHttpDownloadParams *params = &HTTP_DOWNLOAD_PARAMS_DEFAULT);
+
+	WFFuture<WFHttpDownloadResult> async_download(const std::string& url,
+												  const std::map<std::string, std::string>& headers,
+												  const std::string& path,
+												  const struct WFHttpDownloadParams *params = &HTTP_DOWNLOAD_PARAMS_DEFAULT);
+
+	// on_progress gets the bytes in the file after every chunk, may be NULL
+	void download(const std::string& url,
+				  const std::map<std::string, std::string>& headers,
+				  const std::string& path,
+				  WFHttpDownload::progress_t on_progress,
+				  WFHttpClient::ON_DOWNLOAD on_complete,
+				  const struct WFHttpDownloadParams *params = &HTTP_DOWNLOAD_PARAMS_DEFAULT);
+
 private:
-	int retry_max_;
-	int redirect_max_;
-	int send_timeout_;
-	int recv_timeout_;
+	// every request reads the options once, requests in flight keep theirs
+	std::shared_ptr<const WFHttpClientOptions> options() const
+	{
+		return std::atomic_load(&opts_);
+	}
+
+	// fn changes a new copy, run again if another setter wins the race
+	void update(const std::function<void (WFHttpClientOptions *)>& fn)
+	{
+		std::shared_ptr<const WFHttpClientOptions> old = options();
+		std::shared_ptr<const WFHttpClientOptions> opts;
+
+		do
+		{
+			auto copy = std::make_shared<WFHttpClientOptions>(*old);
+
+			fn(copy.get());
+			opts = std::move(copy);
+		} while (!std::atomic_compare_exchange_weak(&opts_, &old, opts));
+	}
+
+	std::shared_ptr<const WFHttpClientOptions> opts_;
 };
 
 //client.request("GET", "https://www.sogou.com").set_header("Connection", "Keep-Alive").send();
 //client.request(method, url).set_header(key, value).append_body(body).retry_max(n).success(cb1).error(cb2).send()
+// auto tpl = client.request("POST", "http://10.0.0.1:8080/api/")
+//                   .set_header("Content-Type", "application/json")
+//                   .success(on_success).prepare();
+// tpl.send("users/1412", std::move(json));
+// tpl.create_task("users/1412?fields=name", "", {{"X-Trace-Id", id}})->start();
+//
+// The url is parsed, the headers are serialized and callbacks are shared
+// once. An instance only copies the parsed url and adds the headers.
+// Templates are immutable, copies share the same data and may be used by
+// many threads at the same time.
+class WFHttpTemplate
+{
+public:
+	using HeaderPairs = std::initializer_list<std::pair<const char *, const char *>>;
+
+	// the prepared body is used
+	WFHttpTask *create_task() const;
+	// path_suffix is appended to the path of url,
+	// a '?' in path_suffix starts a query that replaces the one of url
+	WFHttpTask *create_task(const std::string& path_suffix, WFHttpBody body) const;
+	// headers are added after the prepared ones
+	WFHttpTask *create_task(const std::string& path_suffix, WFHttpBody body,
+							HeaderPairs headers) const;
+
+	void send() const { create_task()->start(); }
+	void send(const std::string& path_suffix, WFHttpBody body) const
+	{
+		create_task(path_suffix, std::move(body))->start();
+	}
+
+private:
+	WFHttpTemplate(std::shared_ptr<const WFHttpTemplateData> data):
+		data_(std::move(data))
+	{}
+
+	std::shared_ptr<const WFHttpTemplateData> data_;
+
+	friend class WFHttpChain;
+};
+
 class WFHttpChain
 {
 public:
@@ -109,7 +395,13 @@ public:
 	WFHttpChain& set_header(const std::string& key, const std::string& value);
 	WFHttpChain& set_header(const std::map<std::string, std::string>& headers);
 	WFHttpChain& append_body(const std::string& str);
+	WFHttpChain& append_body(std::string&& str);
+	WFHttpChain& append_body(const char *str);
+	WFHttpChain& append_body(std::shared_ptr<const std::string> buf);
+	WFHttpChain& append_body(const void *buf, size_t size, std::function<void ()> deleter);
+	WFHttpChain& append_body(const WFHttpBody& body);
 	WFHttpChain& operator() (const std::string& str);
+	WFHttpChain& operator() (std::string&& str);
 	WFHttpChain& complete(WFHttpClient::ON_COMPLETE on_complete);
 	WFHttpChain& success(WFHttpClient::ON_SUCCESS on_success);
 	WFHttpChain& error(WFHttpClient::ON_ERROR on_error);
@@ -118,25 +410,24 @@ public:
 	WFHttpChain& send_timeout(int timeout);
 	WFHttpChain& recv_timeout(int timeout);
 
+	// freeze url, headers, body and callbacks into a reusable template
+	WFHttpTemplate prepare() const;
+
 private:
-	WFHttpChain(const std::string& method,
-				const std::string& url,
-				int retry_max,
-				int redirect_max,
-				int send_timeout,
-				int recv_timeout);
+	WFHttpChain(const std::string& method, const std::string& url,
+				std::shared_ptr<const WFHttpClientOptions> opts);
+
+	// a new copy to change, a chain is used by one thread
+	WFHttpClientOptions *options();
 
 	std::string method_;
 	std::string url_;
 	std::map<std::string, std::string> headers_;
-	std::string body_;
+	WFHttpBody body_;
 	WFHttpClient::ON_COMPLETE on_complete_;
 	WFHttpClient::ON_SUCCESS on_success_;
 	WFHttpClient::ON_ERROR on_error_;
-	int retry_max_;
-	int redirect_max_;
-	int send_timeout_;
-	int recv_timeout_;
+	std::shared_ptr<const WFHttpClientOptions> opts_;
 
 	friend class WFHttpClient;
 };
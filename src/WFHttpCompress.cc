@@ -0,0 +1,407 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <vector>
+#include <functional>
+#include <zlib.h>
+#ifdef ANYCLIENT_ZSTD
+# include <zstd.h>
+#endif
+#include <workflow/HttpUtil.h>
+#include <workflow/StringUtil.h>
+#include "WFHttpClient.h"
+#include "WFHttpCompress.h"
+
+using namespace protocol;
+
+// decoded bytes are handed out in pieces of this size
+#define HTTP_DECODE_WINDOW		(16 * 1024)
+
+// return false to stop
+using __output_t = std::function<bool (const void *buf, size_t size)>;
+
+static int __zlib_compress(int encoding, int level,
+						   const struct iovec *in, int n, std::string& out)
+{
+	int bits = encoding == HTTP_ENCODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+	size_t total = 0;
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof zs);
+	if (level < 0)
+		level = Z_DEFAULT_COMPRESSION;
+
+	if (deflateInit2(&zs, level, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	for (int i = 0; i < n; i++)
+		total += in[i].iov_len;
+
+	// the bound always fits, so output is written once
+	out.resize(deflateBound(&zs, total));
+	zs.next_out = (Bytef *)&out[0];
+	zs.avail_out = out.size();
+	for (int i = 0; i < n; i++)
+	{
+		zs.next_in = (Bytef *)in[i].iov_base;
+		zs.avail_in = in[i].iov_len;
+		if (deflate(&zs, Z_NO_FLUSH) == Z_STREAM_ERROR)
+			break;
+	}
+
+	ret = deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return ret == Z_STREAM_END ? 0 : -1;
+}
+
+static int __zlib_decompress(int encoding, const void *buf, size_t size,
+							 size_t size_limit, const __output_t& output)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	unsigned char window[HTTP_DECODE_WINDOW];
+	int bits = MAX_WBITS + 16;
+	size_t total = 0;
+	z_stream zs;
+	int ret;
+
+	// "deflate" is meant to be zlib, some servers send raw deflate
+	if (encoding == HTTP_ENCODING_DEFLATE)
+	{
+		if (size >= 2 && (p[0] & 0x0f) == Z_DEFLATED && (p[0] * 256 + p[1]) % 31 == 0)
+			bits = MAX_WBITS;
+		else
+			bits = -MAX_WBITS;
+	}
+
+	memset(&zs, 0, sizeof zs);
+	if (inflateInit2(&zs, bits) != Z_OK)
+		return -1;
+
+	zs.next_in = (Bytef *)buf;
+	zs.avail_in = size;
+	do
+	{
+		zs.next_out = window;
+		zs.avail_out = sizeof window;
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+
+		size_t n = sizeof window - zs.avail_out;
+
+		total += n;
+		if (total > size_limit || (n > 0 && !output(window, n)))
+		{
+			ret = Z_BUF_ERROR;
+			break;
+		}
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&zs);
+	return ret == Z_STREAM_END ? 0 : -1;
+}
+
+#ifdef ANYCLIENT_ZSTD
+
+static int __zstd_compress(int level, const struct iovec *in, int n,
+						   std::string& out)
+{
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	size_t total = 0;
+	size_t ret = 0;
+
+	if (!cctx)
+		return -1;
+
+	if (level < 0)
+		level = ZSTD_CLEVEL_DEFAULT;
+
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+	for (int i = 0; i < n; i++)
+		total += in[i].iov_len;
+
+	out.resize(ZSTD_compressBound(total));
+
+	ZSTD_outBuffer ob = { &out[0], out.size(), 0 };
+
+	// the last round has no input and ends the frame
+	for (int i = 0; i <= n; i++)
+	{
+		ZSTD_EndDirective mode = i < n ? ZSTD_e_continue : ZSTD_e_end;
+		ZSTD_inBuffer ib = { NULL, 0, 0 };
+
+		if (i < n)
+		{
+			ib.src = in[i].iov_base;
+			ib.size = in[i].iov_len;
+		}
+
+		do
+		{
+			ret = ZSTD_compressStream2(cctx, &ob, &ib, mode);
+			if (ZSTD_isError(ret))
+				break;
+		} while (mode == ZSTD_e_end ? ret != 0 : ib.pos < ib.size);
+
+		if (ZSTD_isError(ret))
+			break;
+	}
+
+	out.resize(ob.pos);
+	ZSTD_freeCCtx(cctx);
+	return ret == 0 ? 0 : -1;
+}
+
+static int __zstd_decompress(const void *buf, size_t size,
+							 size_t size_limit, const __output_t& output)
+{
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	char window[HTTP_DECODE_WINDOW];
+	ZSTD_inBuffer ib = { buf, size, 0 };
+	ZSTD_outBuffer ob;
+	size_t total = 0;
+	size_t ret = 1;
+
+	if (!dctx)
+		return -1;
+
+	do
+	{
+		ob = { window, sizeof window, 0 };
+		ret = ZSTD_decompressStream(dctx, &ob, &ib);
+		if (ZSTD_isError(ret))
+			break;
+
+		total += ob.pos;
+		if (total > size_limit || (ob.pos > 0 && !output(window, ob.pos)))
+		{
+			ret = 1;
+			break;
+		}
+	} while (ib.pos < ib.size || ob.pos == ob.size);
+
+	ZSTD_freeDCtx(dctx);
+	return ret == 0 ? 0 : -1;
+}
+
+#endif
+
+static int __compress(int encoding, int level,
+					  const struct iovec *in, int n, std::string& out)
+{
+	switch (encoding)
+	{
+	case HTTP_ENCODING_GZIP:
+	case HTTP_ENCODING_DEFLATE:
+		return __zlib_compress(encoding, level, in, n, out);
+#ifdef ANYCLIENT_ZSTD
+	case HTTP_ENCODING_ZSTD:
+		return __zstd_compress(level, in, n, out);
+#endif
+	default:
+		return -1;
+	}
+}
+
+static int __decompress(int encoding, const void *buf, size_t size,
+						size_t size_limit, const __output_t& output)
+{
+	switch (encoding)
+	{
+	case HTTP_ENCODING_GZIP:
+	case HTTP_ENCODING_DEFLATE:
+		return __zlib_decompress(encoding, buf, size, size_limit, output);
+#ifdef ANYCLIENT_ZSTD
+	case HTTP_ENCODING_ZSTD:
+		return __zstd_decompress(buf, size, size_limit, output);
+#endif
+	default:
+		return -1;
+	}
+}
+
+// append() is protected, borrow it to feed a decoded response
+class __HttpResponseFeeder : public HttpResponse
+{
+public:
+	static int feed(HttpResponse *resp, const void *buf, size_t size)
+	{
+		int (HttpMessage::*fn)(const void *, size_t *) = &__HttpResponseFeeder::append;
+
+		return (resp->*fn)(buf, &size);
+	}
+};
+
+const char *WFHttpCompress::accept_encoding()
+{
+#ifdef ANYCLIENT_ZSTD
+	return "gzip, deflate, zstd";
+#else
+	return "gzip, deflate";
+#endif
+}
+
+int WFHttpCompress::encoding_of(const std::string& name)
+{
+	const char *p = name.c_str();
+
+	if (strcasecmp(p, "gzip") == 0 || strcasecmp(p, "x-gzip") == 0)
+		return HTTP_ENCODING_GZIP;
+	else if (strcasecmp(p, "deflate") == 0)
+		return HTTP_ENCODING_DEFLATE;
+	else if (strcasecmp(p, "identity") == 0 || *p == '\0')
+		return HTTP_ENCODING_IDENTITY;
+#ifdef ANYCLIENT_ZSTD
+	else if (strcasecmp(p, "zstd") == 0)
+		return HTTP_ENCODING_ZSTD;
+#endif
+
+	return -1;
+}
+
+const char *WFHttpCompress::name_of(int encoding)
+{
+	switch (encoding)
+	{
+	case HTTP_ENCODING_IDENTITY:
+		return "identity";
+	case HTTP_ENCODING_GZIP:
+		return "gzip";
+	case HTTP_ENCODING_DEFLATE:
+		return "deflate";
+	case HTTP_ENCODING_ZSTD:
+		return "zstd";
+	default:
+		return NULL;
+	}
+}
+
+int WFHttpCompress::compress(int encoding, int level, const void *buf, size_t size,
+							 std::string& out)
+{
+	struct iovec in = { (void *)buf, size };
+
+	return __compress(encoding, level, &in, 1, out);
+}
+
+int WFHttpCompress::decompress(int encoding, const void *buf, size_t size,
+							   size_t size_limit, std::string& out)
+{
+	auto output = [&out](const void *buf, size_t size) {
+		out.append((const char *)buf, size);
+		return true;
+	};
+
+	return __decompress(encoding, buf, size, size_limit, output);
+}
+
+const char *WFHttpCompress::encode_body(WFHttpBody& body) const
+{
+	std::vector<struct iovec> in;
+	std::string out;
+
+	if (params_.min_size == 0 || body.size() < params_.min_size)
+		return NULL;
+
+	for (const auto& piece : body.pieces_)
+		in.push_back({ (void *)piece.buf, piece.size });
+
+	if (__compress(params_.encoding, params_.level, in.data(), (int)in.size(), out) < 0)
+		return NULL;
+
+	// not worth it
+	if (out.size() >= body.size())
+		return NULL;
+
+	body = WFHttpBody(std::move(out));
+	return name_of(params_.encoding);
+}
+
+int WFHttpCompress::decode(HttpResponse *resp) const
+{
+	HttpHeaderCursor cursor(resp);
+	const char *reason = resp->get_reason_phrase();
+	int encoding = HTTP_ENCODING_IDENTITY;
+	std::string name;
+	std::string value;
+	std::string head;
+	const void *body;
+	size_t size;
+
+	head = std::string(resp->get_http_version()) + " " + resp->get_status_code() +
+		   " " + (reason ? reason : "") + "\r\n";
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "Content-Encoding") == 0)
+		{
+			encoding = encoding_of(StringUtil::strip(value));
+			continue;
+		}
+
+		if (strcasecmp(name.c_str(), "Content-Length") == 0 ||
+			strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+		{
+			continue;
+		}
+
+		head += name + ": " + value + "\r\n";
+	}
+
+	if (encoding == HTTP_ENCODING_IDENTITY)
+		return 0;
+
+	if (encoding < 0)
+		return -1;
+
+	// HEAD or 304
+	if (!resp->get_parsed_body(&body, &size) || size == 0)
+		return 0;
+
+	// the decoded body goes to the parser window by window as chunks,
+	// its size is not known before
+	HttpResponse decoded;
+
+	head += "Transfer-Encoding: chunked\r\n\r\n";
+	if (__HttpResponseFeeder::feed(&decoded, head.c_str(), head.size()) != 0)
+		return -1;
+
+	auto output = [&decoded](const void *buf, size_t size) {
+		char line[32];
+		int len = snprintf(line, sizeof line, "%zx\r\n", size);
+
+		return __HttpResponseFeeder::feed(&decoded, line, len) == 0 &&
+			   __HttpResponseFeeder::feed(&decoded, buf, size) == 0 &&
+			   __HttpResponseFeeder::feed(&decoded, "\r\n", 2) == 0;
+	};
+
+	if (__decompress(encoding, body, size, params_.max_decoded, output) < 0 ||
+		__HttpResponseFeeder::feed(&decoded, "0\r\n\r\n", 5) != 1)
+	{
+		return -1;
+	}
+
+	*resp = std::move(decoded);
+	return 0;
+}
+
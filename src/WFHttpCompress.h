@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFHTTPCOMPRESS_H_
+#define _WFHTTPCOMPRESS_H_
+
+#include <stddef.h>
+#include <string>
+#include <workflow/HttpMessage.h>
+
+/**
+ * @file   WFHttpCompress.h
+ * @brief  Content-Encoding of WFHttpClient requests and responses
+ */
+
+enum
+{
+	HTTP_ENCODING_IDENTITY	=	0,
+	HTTP_ENCODING_GZIP		=	1,
+	HTTP_ENCODING_DEFLATE	=	2,
+	HTTP_ENCODING_ZSTD		=	3,	// only if built with libzstd
+};
+
+struct WFHttpCompressParams
+{
+	int encoding;			// of request bodies
+	int level;				// -1 for the default of encoding
+	size_t min_size;		// compress request bodies from this size, 0 never
+	size_t max_decoded;		// larger decoded bodies are left encoded
+};
+
+static constexpr struct WFHttpCompressParams HTTP_COMPRESS_PARAMS_DEFAULT =
+{
+	.encoding		=	HTTP_ENCODING_GZIP,
+	.level			=	-1,
+	.min_size		=	0,
+	.max_decoded	=	64 * 1024 * 1024,
+};
+
+class WFHttpBody;
+
+// Requests send Accept-Encoding unless they have one. A response body
+// is decoded by its Content-Encoding before any callback sees it, the
+// decoded body is framed as chunked and Content-Encoding is removed. A
+// body that fails to decode is left as it is.
+//
+// Request bodies of min_size or more are compressed once into a new
+// body, unless the request has its own Content-Encoding.
+class WFHttpCompress
+{
+public:
+	// "gzip, deflate", and "zstd" if supported
+	static const char *accept_encoding();
+	// HTTP_ENCODING_*, or -1 if not supported
+	static int encoding_of(const std::string& name);
+	static const char *name_of(int encoding);
+
+	// return -1 if encoding is not supported
+	static int compress(int encoding, int level, const void *buf, size_t size,
+						std::string& out);
+	// return -1 on corrupt data or if out would pass size_limit
+	static int decompress(int encoding, const void *buf, size_t size,
+						  size_t size_limit, std::string& out);
+
+	// compress body in place,
+	// return its Content-Encoding, or NULL if it is not compressed
+	const char *encode_body(WFHttpBody& body) const;
+	// return -1 if resp is left as it is for an error
+	int decode(protocol::HttpResponse *resp) const;
+
+public:
+	WFHttpCompress(const struct WFHttpCompressParams *params):
+		params_(*params)
+	{}
+
+private:
+	struct WFHttpCompressParams params_;
+};
+
+#endif
+
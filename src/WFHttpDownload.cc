@@ -0,0 +1,500 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <openssl/evp.h>
+#include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include "WFHttpDownload.h"
+
+// buffer of reading the resumed part for its digest
+#define DOWNLOAD_READ_SIZE		(64 * 1024)
+// allowance for the header of a response over its body
+#define DOWNLOAD_HEADER_SIZE	(64 * 1024)
+
+class WFHttpDownloadContext
+{
+public:
+	void start(const std::string& path);
+
+private:
+	WFHttpTask *chunk_task();
+	void hash_file();
+	void http_done(WFHttpTask *task);
+	void write_done(WFFileIOTask *task);
+	int restart();
+	void finish(int state, int error);
+
+public:
+	WFHttpDownload::create_t create;
+	WFHttpDownload::progress_t progress;
+	WFHttpDownload::callback_t callback;
+	size_t chunk_size;
+	size_t max_full_size;
+	bool resume;
+	std::string digest;
+	std::string expected;
+
+private:
+	int fd;
+	const EVP_MD *md_type;
+	EVP_MD_CTX *md;
+	int read_error;
+	bool last;
+	bool restarted;
+	// If-Range of the bytes in the file, kept in validator_path
+	std::string validator;
+	std::string validator_path;
+	// the chunk being written
+	protocol::HttpResponse resp;
+	struct WFHttpDownloadResult result;
+
+public:
+	WFHttpDownloadContext():
+		fd(-1),
+		md_type(NULL),
+		md(NULL),
+		read_error(0),
+		last(false),
+		restarted(false)
+	{
+		result.size = 0;
+		result.total = -1;
+		result.task_state = WFT_STATE_UNDEFINED;
+		result.task_error = 0;
+		result.status_code = -1;
+		result.success = false;
+	}
+
+	~WFHttpDownloadContext()
+	{
+		if (md)
+			EVP_MD_CTX_destroy(md);
+
+		if (fd >= 0)
+			close(fd);
+	}
+};
+
+// "bytes 0-1023/4096", total is -1 for "*".
+// first is -1 for "bytes */4096" of a 416
+static bool __parse_content_range(const std::string& value,
+								  long long *first, long long *total)
+{
+	const char *p = value.c_str();
+	const char *slash;
+	char *end;
+
+	if (strncasecmp(p, "bytes ", 6) != 0)
+		return false;
+
+	if (p[6] == '*')
+	{
+		*first = -1;
+		end = (char *)p + 7;
+	}
+	else
+	{
+		*first = strtoll(p + 6, &end, 10);
+		if (end == p + 6 || *end != '-')
+			return false;
+	}
+
+	slash = strchr(end, '/');
+	if (!slash)
+		return false;
+
+	*total = slash[1] == '*' ? -1 : atoll(slash + 1);
+	return true;
+}
+
+// strong ETag, or Last-Modified, empty if neither
+static std::string __validator_of(protocol::HttpResponse *resp)
+{
+	protocol::HttpHeaderCursor cursor(resp);
+	std::string etag;
+	std::string last_modified;
+	std::string name;
+	std::string value;
+
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "ETag") == 0)
+			etag = std::move(value);
+		else if (strcasecmp(name.c_str(), "Last-Modified") == 0)
+			last_modified = std::move(value);
+	}
+
+	if (!etag.empty() && strncmp(etag.c_str(), "W/", 2) != 0)
+		return etag;
+
+	return last_modified;
+}
+
+static std::string __load_validator(const std::string& path)
+{
+	std::string validator;
+	char buf[1024];
+	FILE *f;
+	size_t n;
+
+	f = fopen(path.c_str(), "r");
+	if (f)
+	{
+		n = fread(buf, 1, sizeof buf, f);
+		validator.assign(buf, n);
+		fclose(f);
+	}
+
+	return validator;
+}
+
+// an empty validator removes the file
+static int __save_validator(const std::string& path, const std::string& validator)
+{
+	FILE *f;
+	size_t n;
+
+	if (validator.empty())
+		return unlink(path.c_str()) < 0 && errno != ENOENT ? -1 : 0;
+
+	f = fopen(path.c_str(), "w");
+	if (!f)
+		return -1;
+
+	n = fwrite(validator.c_str(), 1, validator.size(), f);
+	if (fclose(f) != 0 || n != validator.size())
+		return -1;
+
+	return 0;
+}
+
+void WFHttpDownloadContext::start(const std::string& path)
+{
+	int flags = O_WRONLY | O_CREAT;
+	SubTask *first;
+	struct stat st;
+
+	if (!resume)
+		flags |= O_TRUNC;
+
+	fd = open(path.c_str(), flags, 0644);
+	if (fd < 0)
+		return finish(WFT_STATE_SYS_ERROR, errno);
+
+	if (resume)
+	{
+		if (fstat(fd, &st) < 0)
+			return finish(WFT_STATE_SYS_ERROR, errno);
+
+		result.size = st.st_size;
+	}
+
+	validator_path = path + ".validator";
+	if (result.size > 0)
+	{
+		// nothing tells if the bytes are of the current resource
+		validator = __load_validator(validator_path);
+		if (validator.empty())
+		{
+			if (ftruncate(fd, 0) < 0)
+				return finish(WFT_STATE_SYS_ERROR, errno);
+
+			result.size = 0;
+		}
+	}
+
+	if (!digest.empty())
+	{
+		md_type = EVP_get_digestbyname(digest.c_str());
+		if (!md_type)
+			return finish(WFT_STATE_SYS_ERROR, EINVAL);
+
+		md = EVP_MD_CTX_create();
+		EVP_DigestInit_ex(md, md_type, NULL);
+	}
+
+	if (md && result.size > 0)
+	{
+		auto *task = WFTaskFactory::create_go_task("WFHttpDownload",
+												   &WFHttpDownloadContext::hash_file,
+												   this);
+
+		task->set_callback([this](WFGoTask *task) {
+			if (read_error)
+				return finish(WFT_STATE_SYS_ERROR, read_error);
+
+			series_of(task)->push_back(chunk_task());
+		});
+		first = task;
+	}
+	else
+		first = chunk_task();
+
+	Workflow::start_series_work(first, nullptr);
+}
+
+// blocking reads in a go task, only for the part already downloaded
+void WFHttpDownloadContext::hash_file()
+{
+	char buf[DOWNLOAD_READ_SIZE];
+	long long off = 0;
+	ssize_t n;
+
+	while (off < result.size)
+	{
+		n = pread(fd, buf, sizeof buf, off);
+		if (n <= 0)
+		{
+			read_error = n < 0 ? errno : EIO;
+			return;
+		}
+
+		EVP_DigestUpdate(md, buf, n);
+		off += n;
+	}
+}
+
+WFHttpTask *WFHttpDownloadContext::chunk_task()
+{
+	std::string range = "bytes=" + std::to_string(result.size) + "-" +
+						std::to_string(result.size + chunk_size - 1);
+
+	WFHttpTask *task = create(range, [this](WFHttpTask *task) { http_done(task); });
+
+	// a changed resource is answered 200 with the whole body
+	if (result.size > 0 && !validator.empty())
+		task->get_req()->add_header_pair("If-Range", validator);
+
+	if (max_full_size > 0)
+	{
+		task->get_resp()->set_size_limit(std::max(chunk_size, max_full_size) +
+										 DOWNLOAD_HEADER_SIZE);
+	}
+
+	return task;
+}
+
+// the bytes in the file are of another version of the resource
+int WFHttpDownloadContext::restart()
+{
+	if (ftruncate(fd, 0) < 0)
+		return -1;
+
+	result.size = 0;
+	result.total = -1;
+	if (md)
+		EVP_DigestInit_ex(md, md_type, NULL);
+
+	validator.clear();
+	return 0;
+}
+
+void WFHttpDownloadContext::http_done(WFHttpTask *task)
+{
+	protocol::HttpResponse *r = task->get_resp();
+	std::string value;
+	long long first;
+	long long total;
+	const void *body;
+	size_t size;
+
+	if (task->get_state() != WFT_STATE_SUCCESS)
+	{
+		// the 200 of a changed resource is too large, ask it by ranges
+		if (task->get_state() == WFT_STATE_SYS_ERROR &&
+			task->get_error() == EMSGSIZE && result.size > 0 &&
+			!validator.empty() && !restarted)
+		{
+			restarted = true;
+			if (restart() < 0 || __save_validator(validator_path, validator) < 0)
+				return finish(WFT_STATE_SYS_ERROR, errno);
+
+			return series_of(task)->push_back(chunk_task());
+		}
+
+		return finish(task->get_state(), task->get_error());
+	}
+
+	protocol::HttpHeaderCursor cursor(r);
+	std::string current = __validator_of(r);
+
+	result.status_code = atoi(r->get_status_code());
+	if (result.status_code == 416)
+	{
+		// resumed after the last byte
+		if (cursor.find("Content-Range", value) &&
+			__parse_content_range(value, &first, &total) &&
+			total == result.size)
+		{
+			result.total = total;
+			last = true;
+		}
+
+		return finish(WFT_STATE_SUCCESS, 0);
+	}
+	else if (result.status_code == 200)
+	{
+		// changed, or no Range support, the body is the whole resource
+		if (result.size > 0 && restart() < 0)
+			return finish(WFT_STATE_SYS_ERROR, errno);
+
+		validator = std::move(current);
+		if (__save_validator(validator_path, validator) < 0)
+			return finish(WFT_STATE_SYS_ERROR, errno);
+
+		last = true;
+	}
+	else if (result.status_code == 206)
+	{
+		if (!cursor.find("Content-Range", value) ||
+			!__parse_content_range(value, &first, &total) ||
+			first != result.size)
+		{
+			return finish(WFT_STATE_SYS_ERROR, EBADMSG);
+		}
+
+		// changed while downloading, If-Range is not supported
+		if ((result.total >= 0 && total != result.total) ||
+			(!validator.empty() && !current.empty() && current != validator))
+		{
+			return finish(WFT_STATE_SYS_ERROR, ESTALE);
+		}
+
+		if (validator.empty() && !current.empty())
+		{
+			validator = std::move(current);
+			if (__save_validator(validator_path, validator) < 0)
+				return finish(WFT_STATE_SYS_ERROR, errno);
+		}
+
+		result.total = total;
+	}
+	else
+		return finish(WFT_STATE_SUCCESS, 0);
+
+	resp = std::move(*r);
+	if (!resp.get_parsed_body(&body, &size) || size == 0)
+	{
+		last = true;
+		return finish(WFT_STATE_SUCCESS, 0);
+	}
+
+	if (result.status_code == 200)
+		result.total = size;
+
+	auto *pwrite_task = WFTaskFactory::create_pwrite_task(fd, body, size, result.size,
+		[this](WFFileIOTask *task) { write_done(task); });
+
+	series_of(task)->push_back(pwrite_task);
+}
+
+void WFHttpDownloadContext::write_done(WFFileIOTask *task)
+{
+	const auto *args = task->get_args();
+
+	if (task->get_state() != WFT_STATE_SUCCESS)
+		return finish(task->get_state(), task->get_error());
+
+	if (task->get_retval() != (long)args->count)
+		return finish(WFT_STATE_SYS_ERROR, EIO);
+
+	if (md)
+		EVP_DigestUpdate(md, args->buf, args->count);
+
+	result.size += args->count;
+	// the chunk is on the disk, free it
+	resp = protocol::HttpResponse();
+	if (progress)
+		progress(result.size, result.total);
+
+	// a short chunk is the end when the total is not known
+	if (result.total >= 0 ? result.size >= result.total : args->count < chunk_size)
+		last = true;
+
+	if (last)
+		return finish(WFT_STATE_SUCCESS, 0);
+
+	series_of(task)->push_back(chunk_task());
+}
+
+void WFHttpDownloadContext::finish(int state, int error)
+{
+	result.task_state = state;
+	result.task_error = error;
+	result.success = state == WFT_STATE_SUCCESS && last;
+	if (result.success && md)
+	{
+		unsigned char buf[EVP_MAX_MD_SIZE];
+		unsigned int len = 0;
+		char hex[3];
+
+		EVP_DigestFinal_ex(md, buf, &len);
+		for (unsigned int i = 0; i < len; i++)
+		{
+			snprintf(hex, sizeof hex, "%02x", buf[i]);
+			result.checksum += hex;
+		}
+
+		if (!expected.empty() && strcasecmp(expected.c_str(), result.checksum.c_str()) != 0)
+		{
+			result.task_state = WFT_STATE_SYS_ERROR;
+			result.task_error = EBADMSG;
+			result.success = false;
+		}
+	}
+
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+
+	callback(result);
+	delete this;
+}
+
+void WFHttpDownload::start(const std::string& path, create_t create,
+						   const struct WFHttpDownloadParams *params,
+						   progress_t progress, callback_t callback)
+{
+	auto *ctx = new WFHttpDownloadContext;
+
+	ctx->create = std::move(create);
+	ctx->progress = std::move(progress);
+	ctx->callback = std::move(callback);
+	ctx->chunk_size = params->chunk_size > 0 ? params->chunk_size : 1;
+	ctx->max_full_size = params->max_full_size;
+	ctx->resume = params->resume;
+	if (params->digest)
+		ctx->digest = params->digest;
+
+	if (params->expected)
+		ctx->expected = params->expected;
+
+	ctx->start(path);
+}
+
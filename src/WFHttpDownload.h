@@ -0,0 +1,90 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFHTTPDOWNLOAD_H_
+#define _WFHTTPDOWNLOAD_H_
+
+#include <stddef.h>
+#include <string>
+#include <functional>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFHttpDownload.h
+ * @brief  Download to a file by WFHttpClient with bounded memory
+ */
+
+struct WFHttpDownloadParams
+{
+	size_t chunk_size;		// bytes of one Range request
+	bool resume;			// continue after the bytes already in the file
+	const char *digest;		// "md5", "sha256" ..., NULL for no checksum
+	const char *expected;	// hex digest to verify, NULL to only compute
+	size_t max_full_size;	// body of a 200, larger fails, 0 for no limit
+};
+
+static constexpr struct WFHttpDownloadParams HTTP_DOWNLOAD_PARAMS_DEFAULT =
+{
+	.chunk_size		=	4 * 1024 * 1024,
+	.resume			=	true,
+	.digest			=	NULL,
+	.expected		=	NULL,
+	.max_full_size	=	64 * 1024 * 1024,
+};
+
+struct WFHttpDownloadResult
+{
+	long long size;			// bytes in the file
+	long long total;		// of the resource, -1 if not known
+	std::string checksum;	// hex digest of the file, if asked
+	int task_state;
+	int task_error;			// EBADMSG if checksum is not the expected one,
+							// EMSGSIZE if a 200 is over max_full_size
+	int status_code;		// of the last response, -1 if none
+	bool success;			// the whole resource is in the file
+};
+
+// The resource is fetched by Range requests of chunk_size, one at a time,
+// and each chunk is written by a pwrite task before the next is asked, so
+// no more than one chunk is in memory. A resumed download starts at the
+// size of the file, and the digest of that part is computed first.
+//
+// The strong ETag, or else the Last-Modified, of the resource is kept in
+// path + ".validator" and sent as If-Range, so a resource changed since
+// the bytes in the file were written is answered 200 with the whole body,
+// which is then written from the start of the file. So is the answer of
+// a server without Range support. A file without a stored validator is
+// never resumed. A 200 body is in memory at once, so it is bounded by
+// max_full_size. When a resumed request exceeds it, the download starts
+// over by ranges without If-Range, otherwise it fails with EMSGSIZE.
+class WFHttpDownload
+{
+public:
+	using progress_t = std::function<void (long long size, long long total)>;
+	using callback_t = std::function<void (WFHttpDownloadResult&)>;
+	// a GET of the resource with this Range header
+	using create_t = std::function<WFHttpTask *(const std::string& range,
+												http_callback_t&& callback)>;
+
+	static void start(const std::string& path, create_t create,
+					  const struct WFHttpDownloadParams *params,
+					  progress_t progress, callback_t callback);
+};
+
+#endif
+
@@ -0,0 +1,289 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <workflow/Workflow.h>
+#include "WFLatencyBuckets.h"
+#include "WFClientLimiter.h"
+#include "WFHttpHedge.h"
+
+// samples are halved at this count, old latency fades out
+#define HEDGE_WINDOW		2048
+// a hedge costs 100 tokens, a request earns budget tokens
+#define HEDGE_TOKENS_MAX	1000
+
+static long long __monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+class WFHttpHedgeHost
+{
+public:
+	WFHttpHedgeHost()
+	{
+		memset(buckets, 0, sizeof buckets);
+		samples = 0;
+		tokens = 0;
+		requests = 0;
+		hedged = 0;
+		hedge_wins = 0;
+		denied = 0;
+	}
+
+	// us, or -1 before min_samples
+	long long delay(const struct WFHttpHedgeParams *params);
+	void record(long long latency);
+
+public:
+	std::mutex mutex;
+	unsigned int buckets[LATENCY_BUCKETS];
+	unsigned int samples;
+	int tokens;
+	unsigned long long requests;
+	unsigned long long hedged;
+	unsigned long long hedge_wins;
+	unsigned long long denied;
+};
+
+long long WFHttpHedgeHost::delay(const struct WFHttpHedgeParams *params)
+{
+	unsigned long long rank;
+	unsigned long long n = 0;
+	long long us = params->max_delay * 1000LL;
+
+	if (samples < (unsigned int)params->min_samples || samples == 0)
+		return -1;
+
+	rank = (samples * (unsigned long long)params->percentile + 99) / 100;
+	for (int i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		n += buckets[i];
+		if (n >= rank)
+		{
+			us = WFLatencyBuckets::bucket_bound(i);
+			break;
+		}
+	}
+
+	if (us < params->min_delay * 1000LL)
+		us = params->min_delay * 1000LL;
+	else if (us > params->max_delay * 1000LL)
+		us = params->max_delay * 1000LL;
+
+	return us;
+}
+
+void WFHttpHedgeHost::record(long long latency)
+{
+	if (latency < 0)
+		latency = 0;
+
+	buckets[WFLatencyBuckets::bucket_of(latency)]++;
+	if (++samples < HEDGE_WINDOW)
+		return;
+
+	samples = 0;
+	for (unsigned int& count : buckets)
+	{
+		count /= 2;
+		samples += count;
+	}
+}
+
+class __WFHedgeContext
+{
+public:
+	std::shared_ptr<WFHttpHedge> hedge;
+	WFHttpHedgeHost *host;
+	WFHttpHedge::create_t create;
+	http_callback_t callback;
+	long long start;
+	long long hedge_start;
+	int outstanding;
+	bool done;
+};
+
+static void __hedge_callback(__WFHedgeContext *ctx, bool hedge, WFHttpTask *task)
+{
+	WFHttpHedgeHost *host = ctx->host;
+	long long now = __monotonic_us();
+	bool deliver = false;
+
+	host->mutex.lock();
+	ctx->outstanding--;
+	if (!ctx->done)
+	{
+		if (task->get_state() == WFT_STATE_SUCCESS)
+		{
+			host->record(now - (hedge ? ctx->hedge_start : ctx->start));
+			if (hedge)
+				host->hedge_wins++;
+
+			deliver = true;
+		}
+		else if (ctx->outstanding == 0)
+			deliver = true;	// the other one may still win
+
+		ctx->done = deliver;
+	}
+
+	host->mutex.unlock();
+	if (deliver)
+		ctx->callback(task);
+}
+
+static void __timer_callback(__WFHedgeContext *ctx, WFTimerTask *timer)
+{
+	WFHttpHedgeHost *host = ctx->host;
+	bool hedge = false;
+
+	host->mutex.lock();
+	if (!ctx->done)
+	{
+		if (host->tokens >= 100)
+		{
+			host->tokens -= 100;
+			host->hedged++;
+			ctx->outstanding++;
+			ctx->hedge_start = __monotonic_us();
+			hedge = true;
+		}
+		else
+			host->denied++;
+	}
+
+	host->mutex.unlock();
+	if (hedge)
+	{
+		series_of(timer)->push_back(ctx->create([ctx](WFHttpTask *task) {
+			__hedge_callback(ctx, true, task);
+		}));
+	}
+}
+
+void WFHttpHedge::request(const std::string& url, create_t create,
+						  http_callback_t callback)
+{
+	auto *ctx = new __WFHedgeContext;
+	WFHttpHedgeHost *host = host_of(url);
+	WFHttpTask *task;
+	long long delay;
+
+	ctx->hedge = shared_from_this();
+	ctx->host = host;
+	ctx->create = std::move(create);
+	ctx->callback = std::move(callback);
+	ctx->outstanding = 1;
+	ctx->done = false;
+
+	host->mutex.lock();
+	host->requests++;
+	host->tokens += params_.budget;
+	if (host->tokens > HEDGE_TOKENS_MAX)
+		host->tokens = HEDGE_TOKENS_MAX;
+
+	delay = host->delay(&params_);
+	host->mutex.unlock();
+
+	task = ctx->create([ctx](WFHttpTask *task) {
+		__hedge_callback(ctx, false, task);
+	});
+
+	ctx->start = __monotonic_us();
+	if (delay < 0)
+	{
+		Workflow::start_series_work(task, [ctx](const SeriesWork *) {
+			delete ctx;
+		});
+		return;
+	}
+
+	auto *timer = WFTaskFactory::create_timer_task((unsigned int)delay,
+		[ctx](WFTimerTask *timer) {
+			__timer_callback(ctx, timer);
+		});
+
+	SeriesWork *series[2] = {
+		Workflow::create_series_work(task, nullptr),
+		Workflow::create_series_work(timer, nullptr),
+	};
+
+	Workflow::start_parallel_work(series, 2, [ctx](const ParallelWork *) {
+		delete ctx;
+	});
+}
+
+WFHttpHedgeHost *WFHttpHedge::host_of(const std::string& url)
+{
+	std::string key = WFClientLimiter::upstream_of(url);
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFHttpHedgeHost *& host = hosts_[key];
+
+	if (!host)
+		host = new WFHttpHedgeHost;
+
+	return host;
+}
+
+bool WFHttpHedge::idempotent(const std::string& method)
+{
+	static const char *methods[] = { "GET", "HEAD", "OPTIONS", "PUT", "DELETE" };
+
+	for (const char *m : methods)
+	{
+		if (strcasecmp(method.c_str(), m) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+void WFHttpHedge::get_stats(struct WFHttpHedgeStats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	memset(stats, 0, sizeof (struct WFHttpHedgeStats));
+	for (const auto& kv : hosts_)
+	{
+		WFHttpHedgeHost *host = kv.second;
+
+		host->mutex.lock();
+		stats->requests += host->requests;
+		stats->hedged += host->hedged;
+		stats->hedge_wins += host->hedge_wins;
+		stats->denied += host->denied;
+		host->mutex.unlock();
+	}
+}
+
+WFHttpHedge::WFHttpHedge(const struct WFHttpHedgeParams *params):
+	params_(*params)
+{}
+
+WFHttpHedge::~WFHttpHedge()
+{
+	for (const auto& kv : hosts_)
+		delete kv.second;
+}
+
@@ -0,0 +1,103 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFHTTPHEDGE_H_
+#define _WFHTTPHEDGE_H_
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFHttpHedge.h
+ * @brief  Hedged requests of WFHttpClient for tail latency
+ */
+
+struct WFHttpHedgeParams
+{
+	int percentile;		// hedge after this latency percentile of the host
+	int min_delay;		// ms
+	int max_delay;		// ms
+	int budget;			// hedges per 100 requests at most
+	int min_samples;	// no hedge before this many responses of the host
+};
+
+static constexpr struct WFHttpHedgeParams HTTP_HEDGE_PARAMS_DEFAULT =
+{
+	.percentile		=	95,
+	.min_delay		=	1,
+	.max_delay		=	1000,
+	.budget			=	5,
+	.min_samples	=	20,
+};
+
+struct WFHttpHedgeStats
+{
+	unsigned long long requests;
+	unsigned long long hedged;		// second requests sent
+	unsigned long long hedge_wins;	// second requests answered first
+	unsigned long long denied;		// not hedged for the budget
+};
+
+class WFHttpHedgeHost;
+
+// A request of an idempotent method starts a timer next to it. If no
+// response comes before the timer, an identical request is sent, and the
+// first response wins. Workflow can not abort a task on the wire, so the
+// loser runs to its end and its response is dropped, a timer left after
+// the winner only holds memory.
+//
+// The delay is the percentile of recent response time of the host. Every
+// request earns budget/100 of a hedge, a hedge spends one.
+// Always owned by a shared_ptr, running requests keep it alive.
+class WFHttpHedge : public std::enable_shared_from_this<WFHttpHedge>
+{
+public:
+	// create() is called once for the request and once for the hedge,
+	// callback gets the winner, or the last failure.
+	using create_t = std::function<WFHttpTask *(http_callback_t&& callback)>;
+
+	void request(const std::string& url, create_t create, http_callback_t callback);
+
+	void get_stats(struct WFHttpHedgeStats *stats);
+
+	static bool idempotent(const std::string& method);
+
+public:
+	WFHttpHedge(const struct WFHttpHedgeParams *params);
+	~WFHttpHedge();
+
+	WFHttpHedge(const WFHttpHedge&) = delete;
+	WFHttpHedge& operator= (const WFHttpHedge&) = delete;
+
+private:
+	WFHttpHedgeHost *host_of(const std::string& url);
+
+private:
+	struct WFHttpHedgeParams params_;
+	std::unordered_map<std::string, WFHttpHedgeHost *> hosts_;
+	std::mutex mutex_;
+
+	friend class WFHttpHedgeHost;
+};
+
+#endif
+
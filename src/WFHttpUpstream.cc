@@ -0,0 +1,290 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdint.h>
+#include <time.h>
+#include <random>
+#include "WFHttpUpstream.h"
+
+// weight of a new sample in the latency
+#define UPSTREAM_LATENCY_ALPHA	0.2
+// weight of an endpoint just back from ejection
+#define UPSTREAM_START_WEIGHT	0.1
+
+class WFHttpUpstreamEndpoint
+{
+public:
+	std::string url;
+	int weight;
+	int outstanding;
+	double latency;
+	int fails;				// in a row
+	int streak;				// ejections without a success between
+	long long eject_until;	// us
+	long long returned_at;	// us, end of the last ejection
+	unsigned long long requests;
+	unsigned long long failures;
+	unsigned long long ejections;
+};
+
+static double __random()
+{
+	static thread_local std::minstd_rand gen(
+		(unsigned int)(WFHttpUpstream::now_us() ^ (uintptr_t)&gen));
+
+	return std::uniform_real_distribution<double>(0, 1)(gen);
+}
+
+long long WFHttpUpstream::now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// with mutex_ locked, 0 if ejected
+double WFHttpUpstream::weight_of(WFHttpUpstreamEndpoint *ep, long long now) const
+{
+	long long ramp = params_.slow_start * 1000LL;
+	double factor = 1;
+
+	if (now < ep->eject_until)
+		return 0;
+
+	if (ep->returned_at > 0 && now - ep->returned_at < ramp)
+	{
+		factor = UPSTREAM_START_WEIGHT +
+				 (1 - UPSTREAM_START_WEIGHT) * (now - ep->returned_at) / ramp;
+	}
+
+	return ep->weight * factor;
+}
+
+WFHttpUpstreamEndpoint *WFHttpUpstream::select_p2c(const std::vector<double>& weights)
+{
+	size_t n = weights.size();
+	size_t pick[2] = { n, n };
+	double total = 0;
+	int usable = 0;
+
+	for (double w : weights)
+	{
+		total += w;
+		if (w > 0)
+			usable++;
+	}
+
+	// the second draw skips the first pick
+	for (int k = 0; k < 2 && k < usable; k++)
+	{
+		double r = __random() * total;
+		size_t last = n;
+		size_t i;
+
+		for (i = 0; i < n; i++)
+		{
+			if (weights[i] == 0 || i == pick[0])
+				continue;
+
+			last = i;
+			r -= weights[i];
+			if (r < 0)
+				break;
+		}
+
+		// rounding
+		if (i == n)
+			i = last;
+
+		pick[k] = i;
+		total -= weights[i];
+	}
+
+	if (usable == 1)
+		return endpoints_[pick[0]];
+
+	auto cost = [&](size_t i) {
+		const WFHttpUpstreamEndpoint *ep = endpoints_[i];
+
+		return (ep->outstanding + 1) * (ep->latency + 1) / weights[i];
+	};
+
+	return endpoints_[cost(pick[0]) <= cost(pick[1]) ? pick[0] : pick[1]];
+}
+
+WFHttpUpstreamEndpoint *WFHttpUpstream::select_least(const std::vector<double>& weights)
+{
+	size_t n = endpoints_.size();
+	// ties go to a random one
+	size_t start = (size_t)(__random() * n) % n;
+	WFHttpUpstreamEndpoint *best = NULL;
+	double best_load = 0;
+
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = (start + k) % n;
+		double load;
+
+		if (weights[i] == 0)
+			continue;
+
+		load = endpoints_[i]->outstanding / weights[i];
+		if (!best || load < best_load)
+		{
+			best = endpoints_[i];
+			best_load = load;
+		}
+	}
+
+	return best;
+}
+
+WFHttpUpstreamEndpoint *WFHttpUpstream::select()
+{
+	long long now = now_us();
+	std::vector<double> weights;
+	WFHttpUpstreamEndpoint *ep;
+	bool usable = false;
+
+	if (endpoints_.empty())
+		return NULL;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	weights.reserve(endpoints_.size());
+	for (WFHttpUpstreamEndpoint *ep : endpoints_)
+	{
+		weights.push_back(weight_of(ep, now));
+		if (weights.back() > 0)
+			usable = true;
+	}
+
+	// all ejected, better try them than fail
+	if (!usable)
+	{
+		for (size_t i = 0; i < endpoints_.size(); i++)
+			weights[i] = endpoints_[i]->weight;
+	}
+
+	if (params_.select == UPSTREAM_SELECT_LEAST_OUTSTANDING)
+		ep = select_least(weights);
+	else
+		ep = select_p2c(weights);
+
+	ep->outstanding++;
+	ep->requests++;
+	return ep;
+}
+
+void WFHttpUpstream::release(WFHttpUpstreamEndpoint *ep, long long start_us,
+							 bool success)
+{
+	long long now = now_us();
+	long long eject_time;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	ep->outstanding--;
+	if (success)
+	{
+		if (ep->latency == 0)
+			ep->latency = now - start_us;
+		else
+			ep->latency += (now - start_us - ep->latency) * UPSTREAM_LATENCY_ALPHA;
+
+		ep->fails = 0;
+		ep->streak = 0;
+		return;
+	}
+
+	ep->failures++;
+	// failures of tasks sent before the ejection do not count
+	if (++ep->fails < params_.max_fails || now < ep->eject_until)
+		return;
+
+	eject_time = params_.eject_time * 1000LL << (ep->streak < 16 ? ep->streak : 16);
+	if (eject_time > params_.max_eject_time * 1000LL)
+		eject_time = params_.max_eject_time * 1000LL;
+
+	ep->eject_until = now + eject_time;
+	ep->returned_at = ep->eject_until;
+	ep->fails = 0;
+	ep->streak++;
+	ep->ejections++;
+}
+
+const std::string& WFHttpUpstream::url_of(WFHttpUpstreamEndpoint *ep) const
+{
+	return ep->url;
+}
+
+void WFHttpUpstream::get_stats(std::vector<struct WFHttpEndpointStats>& stats)
+{
+	long long now = now_us();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	stats.clear();
+	for (WFHttpUpstreamEndpoint *ep : endpoints_)
+	{
+		stats.push_back({ep->url, ep->weight, ep->outstanding,
+						 (long long)ep->latency, ep->requests, ep->failures,
+						 ep->ejections, now < ep->eject_until});
+	}
+}
+
+WFHttpUpstream::WFHttpUpstream(const std::string& name,
+							   std::vector<struct WFHttpEndpoint> endpoints,
+							   const struct WFHttpUpstreamParams *params):
+	params_(*params),
+	name_(name),
+	base_("upstream://" + name)
+{
+	for (auto& endpoint : endpoints)
+	{
+		if (endpoint.weight <= 0)
+			continue;
+
+		auto *ep = new WFHttpUpstreamEndpoint;
+
+		ep->url = std::move(endpoint.url);
+		// the path of a request starts with '/'
+		while (!ep->url.empty() && ep->url.back() == '/')
+			ep->url.pop_back();
+
+		ep->weight = endpoint.weight;
+		ep->outstanding = 0;
+		ep->latency = 0;
+		ep->fails = 0;
+		ep->streak = 0;
+		ep->eject_until = 0;
+		ep->returned_at = 0;
+		ep->requests = 0;
+		ep->failures = 0;
+		ep->ejections = 0;
+		endpoints_.push_back(ep);
+	}
+}
+
+WFHttpUpstream::~WFHttpUpstream()
+{
+	for (WFHttpUpstreamEndpoint *ep : endpoints_)
+		delete ep;
+}
+
@@ -0,0 +1,133 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFHTTPUPSTREAM_H_
+#define _WFHTTPUPSTREAM_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+/**
+ * @file   WFHttpUpstream.h
+ * @brief  Weighted endpoints of a named service for WFHttpClient
+ */
+
+enum
+{
+	UPSTREAM_SELECT_P2C					=	0,	// power of two choices by latency
+	UPSTREAM_SELECT_LEAST_OUTSTANDING	=	1,
+};
+
+struct WFHttpUpstreamParams
+{
+	int select;				// UPSTREAM_SELECT_*
+	int max_fails;			// consecutive failures to eject an endpoint
+	int eject_time;			// ms, doubled for every ejection without a success
+	int max_eject_time;		// ms
+	int slow_start;			// ms for a returned endpoint to get its full weight
+};
+
+static constexpr struct WFHttpUpstreamParams HTTP_UPSTREAM_PARAMS_DEFAULT =
+{
+	.select			=	UPSTREAM_SELECT_P2C,
+	.max_fails		=	5,
+	.eject_time		=	1000,
+	.max_eject_time	=	30000,
+	.slow_start		=	10000,
+};
+
+struct WFHttpEndpoint
+{
+	std::string url;		// "http://10.0.0.1:8080", a path is kept as a prefix
+	int weight;
+};
+
+struct WFHttpEndpointStats
+{
+	std::string url;
+	int weight;
+	int outstanding;
+	long long latency;		// us, moving average
+	unsigned long long requests;
+	unsigned long long failures;
+	unsigned long long ejections;
+	bool ejected;
+};
+
+class WFHttpUpstreamEndpoint;
+
+// An endpoint is chosen for every task, so a hedge may go to another
+// endpoint than its request. Retries of a task stay on its endpoint.
+// A failure is a failed task or a 5xx response.
+//
+// P2C draws two endpoints by weight and takes the one with less
+// (outstanding + 1) * latency / weight. Least outstanding takes the
+// endpoint with the least outstanding / weight. An endpoint failing
+// max_fails times in a row is skipped for the eject time, then its weight
+// grows back from 1/10 during slow_start. If every endpoint is ejected,
+// all are used.
+//
+// auto upstream = std::make_shared<WFHttpUpstream>("user_service",
+//     std::vector<WFHttpEndpoint>{{"http://10.0.0.1:8080", 10},
+//                                 {"http://10.0.0.2:8080", 5}},
+//     &HTTP_UPSTREAM_PARAMS_DEFAULT);
+// http_client.set_upstream(upstream);
+// http_client.request("GET", "/users/1412", {}, "", on_complete);
+class WFHttpUpstream
+{
+public:
+	// call release() once with the result of every selected endpoint
+	WFHttpUpstreamEndpoint *select();
+	void release(WFHttpUpstreamEndpoint *ep, long long start_us, bool success);
+
+	const std::string& url_of(WFHttpUpstreamEndpoint *ep) const;
+	// "upstream://name", stands for the endpoints in urls of cache,
+	// single-flight, limiter and hedge
+	const std::string& base() const { return base_; }
+	const std::string& name() const { return name_; }
+
+	// in the order of the endpoints
+	void get_stats(std::vector<struct WFHttpEndpointStats>& stats);
+
+	static long long now_us();
+
+public:
+	// endpoints with no positive weight are dropped
+	WFHttpUpstream(const std::string& name, std::vector<struct WFHttpEndpoint> endpoints,
+				   const struct WFHttpUpstreamParams *params);
+	~WFHttpUpstream();
+
+	WFHttpUpstream(const WFHttpUpstream&) = delete;
+	WFHttpUpstream& operator= (const WFHttpUpstream&) = delete;
+
+private:
+	double weight_of(WFHttpUpstreamEndpoint *ep, long long now) const;
+	WFHttpUpstreamEndpoint *select_p2c(const std::vector<double>& weights);
+	WFHttpUpstreamEndpoint *select_least(const std::vector<double>& weights);
+
+private:
+	struct WFHttpUpstreamParams params_;
+	std::string name_;
+	std::string base_;
+	std::vector<WFHttpUpstreamEndpoint *> endpoints_;
+	std::mutex mutex_;
+};
+
+#endif
+
@@ -0,0 +1,59 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFLATENCYBUCKETS_H_
+#define _WFLATENCYBUCKETS_H_
+
+/**
+ * @file   WFLatencyBuckets.h
+ * @brief  Log-linear latency buckets shared by server metrics and clients
+ */
+
+// 4 buckets per power of 2 of us, up to 2^27 us
+#define LATENCY_BUCKETS			104
+
+class WFLatencyBuckets
+{
+public:
+	static int bucket_of(unsigned long long us)
+	{
+		if (us < 4)
+			return (int)us;
+
+		int p = 63 - __builtin_clzll(us);
+
+		if (p > 26)
+			return LATENCY_BUCKETS - 1;
+
+		return (p - 1) * 4 + (int)((us >> (p - 2)) & 3);
+	}
+
+	// upper bound of a bucket in us
+	static unsigned long long bucket_bound(int bucket)
+	{
+		if (bucket < 4)
+			return bucket + 1;
+
+		int p = bucket / 4 + 1;
+
+		return (5ULL + bucket % 4) << (p - 2);
+	}
+};
+
+#endif
+
@@ -16,6 +16,8 @@
   Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
+#include <errno.h>
+#include <memory>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFGlobal.h>
 #include "WFMySQLClient.h"
@@ -42,14 +44,12 @@ static inline bool __set_result(WFMySQLTask *task, WFMySQLResult& res)
 	return res.success;
 }
 
-static void __async_callback(WFMySQLClient::ON_SUCCESS on_success,
-							 WFMySQLClient::ON_ERROR on_error,
-							 WFMySQLClient::ON_COMPLETE on_complete,
-							 WFMySQLTask *task)
+static void __async_result(const WFMySQLClient::ON_SUCCESS& on_success,
+						   const WFMySQLClient::ON_ERROR& on_error,
+						   const WFMySQLClient::ON_COMPLETE& on_complete,
+						   WFMySQLResult& res)
 {
-	WFMySQLResult res;
-
-	if (__set_result(task, res))
+	if (res.success)
 	{
 		if (on_success)
 			on_success(res.resp, res.result_cursor);
@@ -73,6 +73,68 @@ static void __async_callback(WFMySQLClient::ON_SUCCESS on_success,
 		on_complete(res);
 }
 
+static void __async_callback(const WFMySQLClient::ON_SUCCESS& on_success,
+							 const WFMySQLClient::ON_ERROR& on_error,
+							 const WFMySQLClient::ON_COMPLETE& on_complete,
+							 WFMySQLTask *task)
+{
+	WFMySQLResult res;
+
+	__set_result(task, res);
+	__async_result(on_success, on_error, on_complete, res);
+}
+
+static void __limiter_callback(const std::shared_ptr<WFClientLimiter>& limiter,
+							   WFClientLimiterUpstream *up,
+							   long long admitted_at,
+							   const mysql_callback_t& callback,
+							   WFMySQLTask *task)
+{
+	limiter->release(up, admitted_at, task->get_state() == WFT_STATE_SUCCESS);
+	callback(task);
+}
+
+// the task may be created later from another thread, everything is copied.
+// reject() is called if the queue is full
+static void __start_task(const std::shared_ptr<WFClientLimiter>& limiter,
+						 WFClientLimiterUpstream *up,
+						 const ParsedURI& uri,
+						 const std::string& sql,
+						 int retry_max,
+						 int send_timeout,
+						 int recv_timeout,
+						 void *user_data,
+						 mysql_callback_t&& callback,
+						 std::function<void (WFMySQLResult&)>&& reject)
+{
+	auto u = std::make_shared<const ParsedURI>(uri);
+
+	limiter->acquire(up, [limiter, up, u, sql, retry_max, send_timeout,
+						  recv_timeout, user_data, callback, reject]
+						 (long long admitted_at) {
+		if (admitted_at < 0)
+		{
+			WFMySQLResult res;
+
+			res.seqid = -1;
+			res.task_state = WFT_STATE_SYS_ERROR;
+			res.task_error = EAGAIN;
+			res.success = false;
+			return reject(res);
+		}
+
+		auto *task = WFTaskFactory::create_mysql_task(*u, retry_max,
+			std::bind(__limiter_callback, limiter, up, admitted_at,
+					  callback, std::placeholders::_1));
+
+		task->get_req()->set_query(sql);
+		task->set_send_timeout(send_timeout);
+		task->set_receive_timeout(recv_timeout);
+		task->user_data = user_data;
+		task->start();
+	});
+}
+
 /*
 static void __await_callback(WFMySQLTask *task)
 {
@@ -98,11 +160,29 @@ static void __future_callback(WFMySQLTask *task)
 WFMySQLClient::WFMySQLClient(const std::string& url):
 	retry_max_(0),
 	send_timeout_(-1),
-	recv_timeout_(-1)
+	recv_timeout_(-1),
+	upstream_(NULL)
 {
 	parse_error_ = URIParser::parse(url, uri_);
 }
 
+void WFMySQLClient::set_limiter(std::shared_ptr<WFClientLimiter> limiter)
+{
+	limiter_ = std::move(limiter);
+	upstream_ = NULL;
+	if (limiter_ && uri_.state == URI_STATE_SUCCESS)
+	{
+		std::string name = std::string(uri_.scheme) + "://" + uri_.host;
+
+		if (uri_.port)
+			name = name + ":" + uri_.port;
+
+		upstream_ = limiter_->upstream(name);
+	}
+	else
+		limiter_.reset();
+}
+
 /*
 WFAsyncCtrl<WFMySQLResult> WFMySQLClient::async_request(const std::string& command,
 														const std::vector<std::string>& params)
@@ -125,6 +205,18 @@ WFFuture<WFMySQLResult> WFMySQLClient::async_request(const std::string& sql)
 {
 	auto *pr = new WFPromise<WFMySQLResult>();
 	auto fr = pr->get_future();
+
+	if (limiter_)
+	{
+		__start_task(limiter_, upstream_, uri_, sql, retry_max_,
+					 send_timeout_, recv_timeout_, pr, __future_callback,
+					 [pr](WFMySQLResult& res) {
+						 pr->set_value(std::move(res));
+						 delete pr;
+					 });
+		return fr;
+	}
+
 	auto *task = WFTaskFactory::create_mysql_task(uri_, retry_max_, __future_callback);
 
 	task->get_req()->set_query(sql);
@@ -152,12 +244,27 @@ void WFMySQLClient::request(const std::string& sql,
 							WFMySQLClient::ON_ERROR on_error,
 							WFMySQLClient::ON_COMPLETE on_complete)
 {
+	std::function<void (WFMySQLResult&)> reject;
+
+	if (limiter_)
+	{
+		reject = std::bind(__async_result, on_success, on_error, on_complete,
+						   std::placeholders::_1);
+	}
+
 	auto&& cb = std::bind(__async_callback,
 						  std::move(on_success),
 						  std::move(on_error),
 						  std::move(on_complete),
 						  std::placeholders::_1);
 
+	if (limiter_)
+	{
+		return __start_task(limiter_, upstream_, uri_, sql, retry_max_,
+							send_timeout_, recv_timeout_, NULL,
+							std::move(cb), std::move(reject));
+	}
+
 	auto *redis_task = WFTaskFactory::create_mysql_task(uri_,
 														retry_max_,
 														std::move(cb));
@@ -168,3 +275,66 @@ void WFMySQLClient::request(const std::string& sql,
 	redis_task->start();
 }
 
+static bool __batch_result(WFMySQLTask *task, WFMySQLResult& res)
+{
+	if (task)
+		return __set_result(task, res);
+
+	res.seqid = -1;
+	res.task_state = WFT_STATE_UNDEFINED;
+	res.task_error = 0;
+	res.success = false;
+	return false;
+}
+
+std::vector<WFMySQLResult> WFMySQLClient::sync_parallel_request(std::vector<std::string> sqls,
+																const struct WFBatchParams *params)
+{
+	return this->async_parallel_request(std::move(sqls), params).get();
+}
+
+WFFuture<std::vector<WFMySQLResult>>
+WFMySQLClient::async_parallel_request(std::vector<std::string> sqls,
+									  const struct WFBatchParams *params)
+{
+	auto pr = std::make_shared<WFPromise<std::vector<WFMySQLResult>>>();
+	auto fr = pr->get_future();
+
+	// result_cursor points into resp, the vector is moved but not its elements
+	parallel_request(std::move(sqls), [pr](std::vector<WFMySQLResult>& results) {
+		pr->set_value(std::move(results));
+	}, params);
+
+	return fr;
+}
+
+void WFMySQLClient::parallel_request(std::vector<std::string> sqls,
+									 WFMySQLClient::ON_BATCH on_complete,
+									 const struct WFBatchParams *params)
+{
+	auto reqs = std::make_shared<const std::vector<std::string>>(std::move(sqls));
+	size_t n = reqs->size();
+	auto uri = std::make_shared<const ParsedURI>(uri_);
+	int retry_max = retry_max_;
+	int send_timeout = send_timeout_;
+	int recv_timeout = recv_timeout_;
+	WFClientLimiterUpstream *up = upstream_;
+
+	// tasks are created later, the client may be gone by then
+	auto create = [reqs, uri, retry_max, send_timeout, recv_timeout]
+				  (size_t i, mysql_callback_t&& callback) {
+		auto *mysql_task = WFTaskFactory::create_mysql_task(*uri, retry_max,
+															std::move(callback));
+
+		mysql_task->get_req()->set_query((*reqs)[i]);
+		mysql_task->set_send_timeout(send_timeout);
+		mysql_task->set_receive_timeout(recv_timeout);
+		return mysql_task;
+	};
+
+	WFClientBatch<WFMySQLTask, WFMySQLResult>::start(n, std::move(create),
+													 __batch_result, params,
+													 std::move(on_complete), limiter_,
+													 [up](size_t) { return up; });
+}
+
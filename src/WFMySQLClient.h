@@ -21,12 +21,15 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 #include <workflow/MySQLMessage.h>
 #include <workflow/MySQLResult.h>
 #include <workflow/URIParser.h>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFFuture.h>
+#include "WFClientBatch.h"
+#include "WFClientLimiter.h"
 
 /**
  * @file   WFMySQLClient.h
@@ -60,6 +63,11 @@ public:
 	// return REG_ERR
 	int parse_error() const { return parse_error_; }
 
+	// limit concurrency to this server, see WFClientLimiter.h. A rejected
+	// request fails with WFT_STATE_SYS_ERROR and EAGAIN. Every request of
+	// a batch is admitted on its own.
+	void set_limiter(std::shared_ptr<WFClientLimiter> limiter);
+
 	//sync
 	WFMySQLResult sync_request(const std::string& sql);
 
@@ -75,6 +83,19 @@ public:
 				 WFMySQLClient::ON_ERROR on_error,
 				 WFMySQLClient::ON_COMPLETE on_complete);
 
+	// batch, results are in the order of sqls, see WFClientBatch.h
+	using ON_BATCH = std::function<void (std::vector<WFMySQLResult>&)>;
+
+	std::vector<WFMySQLResult> sync_parallel_request(std::vector<std::string> sqls,
+													 const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	WFFuture<std::vector<WFMySQLResult>> async_parallel_request(std::vector<std::string> sqls,
+																const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	void parallel_request(std::vector<std::string> sqls,
+						  WFMySQLClient::ON_BATCH on_complete,
+						  const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
 	void set_send_timeout(int send_timeout) { send_timeout_ = send_timeout; }
 	void set_recv_timeout(int recv_timeout) { recv_timeout_ = recv_timeout; }
 
@@ -84,6 +105,8 @@ private:
 	int retry_max_;
 	int send_timeout_;
 	int recv_timeout_;
+	std::shared_ptr<WFClientLimiter> limiter_;
+	WFClientLimiterUpstream *upstream_;
 };
 
 #endif
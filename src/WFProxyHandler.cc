@@ -0,0 +1,384 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <atomic>
+#include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include "WFRequestTarget.h"
+#include "WFSeriesUtil.h"
+#include "WFProxyHandler.h"
+
+using namespace protocol;
+
+static long long __monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int __gcd(int a, int b)
+{
+	while (b != 0)
+	{
+		int t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+class WFProxyUpstream
+{
+public:
+	WFProxyUpstream(const std::string& url, int weight):
+		url(url),
+		weight(weight),
+		requests(0),
+		errors(0),
+		latency(0),
+		max_latency(0)
+	{}
+
+	void update(long long cost, bool error)
+	{
+		unsigned long long max = max_latency;
+
+		requests++;
+		if (error)
+			errors++;
+
+		latency += cost;
+		while (max < (unsigned long long)cost &&
+			   !max_latency.compare_exchange_weak(max, cost))
+		{
+		}
+	}
+
+public:
+	std::string url;//always ends with '/'
+	int weight;
+	std::atomic<unsigned long long> requests;
+	std::atomic<unsigned long long> errors;
+	std::atomic<unsigned long long> latency;
+	std::atomic<unsigned long long> max_latency;
+};
+
+class WFProxyContext
+{
+public:
+	WFProxyUpstream *select()
+	{
+		if (schedule.empty())
+			return NULL;
+
+		return upstreams[schedule[next++ % schedule.size()]];
+	}
+
+	void build_schedule();
+
+	WFProxyContext(): next(0) { }
+
+	~WFProxyContext()
+	{
+		for (WFProxyUpstream *upstream : upstreams)
+			delete upstream;
+	}
+
+public:
+	std::vector<WFProxyUpstream *> upstreams;
+	std::vector<size_t> schedule;
+	std::atomic<size_t> next;
+};
+
+// unroll smooth weighted round robin into one cycle, so select() is lock free
+void WFProxyContext::build_schedule()
+{
+	std::vector<int> current(upstreams.size(), 0);
+	int gcd = 0;
+	int total = 0;
+
+	for (WFProxyUpstream *upstream : upstreams)
+		gcd = __gcd(upstream->weight, gcd);
+
+	for (WFProxyUpstream *upstream : upstreams)
+		total += upstream->weight / gcd;
+
+	schedule.clear();
+	for (int n = 0; n < total; n++)
+	{
+		size_t best = 0;
+
+		for (size_t i = 0; i < upstreams.size(); i++)
+		{
+			current[i] += upstreams[i]->weight / gcd;
+			if (current[i] > current[best])
+				best = i;
+		}
+
+		current[best] -= total;
+		schedule.push_back(best);
+	}
+}
+
+static inline bool __header_is(const struct HttpMessageHeader *header,
+								const char *name, size_t len)
+{
+	return header->name_len == len &&
+		   strncasecmp((const char *)header->name, name, len) == 0;
+}
+
+// headers named by Connection are hop-by-hop too
+static void __connection_options(const HttpMessage *msg,
+								 std::vector<std::string>& options)
+{
+	struct HttpMessageHeader header;
+	HttpHeaderCursor cursor(msg);
+
+	while (cursor.next(&header))
+	{
+		if (!__header_is(&header, "Connection", 10))
+			continue;
+
+		const char *p = (const char *)header.value;
+		const char *end = p + header.value_len;
+
+		while (p < end)
+		{
+			const char *comma = (const char *)memchr(p, ',', end - p);
+			const char *q = comma ? comma : end;
+			const char *r = q;
+
+			while (p < r && (*p == ' ' || *p == '\t'))
+				p++;
+
+			while (r > p && (r[-1] == ' ' || r[-1] == '\t'))
+				r--;
+
+			if (r > p)
+				options.emplace_back(p, r - p);
+
+			p = q + 1;
+		}
+	}
+}
+
+static bool __is_hop_by_hop(const struct HttpMessageHeader *header,
+							const std::vector<std::string>& options)
+{
+	static const char *names[] = {
+		"Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+		"Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade"
+	};
+
+	for (const char *name : names)
+	{
+		if (__header_is(header, name, strlen(name)))
+			return true;
+	}
+
+	for (const std::string& option : options)
+	{
+		if (__header_is(header, option.c_str(), option.size()))
+			return true;
+	}
+
+	return false;
+}
+
+// the body stays in from, which must live until the reply is sent
+static void __forward_response(const HttpResponse *from, HttpResponse *to)
+{
+	std::vector<std::string> options;
+	struct HttpMessageHeader header;
+	HttpHeaderCursor cursor(from);
+	const void *body;
+	size_t size;
+
+	if (!from->get_parsed_body(&body, &size))
+		size = 0;
+
+	to->set_http_version(from->get_http_version());
+	to->set_status_code(from->get_status_code());
+	to->set_reason_phrase(from->get_reason_phrase());
+	__connection_options(from, options);
+	while (cursor.next(&header))
+	{
+		if (__is_hop_by_hop(&header, options))
+			continue;
+
+		// the server adds the length of body, but HEAD and 304 have none
+		if (size > 0 && __header_is(&header, "Content-Length", 14))
+			continue;
+
+		to->add_header(&header);
+	}
+
+	if (size > 0)
+		to->append_output_body_nocopy(body, size);
+}
+
+static void __proxy_callback(WFHttpTask *task, WFProxyUpstream *upstream,
+							 long long start, WFHttpTask *upstream_task)
+{
+	auto *resp = task->get_resp();
+	int state = upstream_task->get_state();
+
+	upstream->update(__monotonic_us() - start, state != WFT_STATE_SUCCESS);
+	if (state == WFT_STATE_SUCCESS)
+	{
+		auto *upstream_resp = new HttpResponse(std::move(*upstream_task->get_resp()));
+
+		WFSeriesUtil::defer(series_of(task), [upstream_resp]() {
+			delete upstream_resp;
+		});
+		__forward_response(upstream_resp, resp);
+	}
+	else if (state == WFT_STATE_SYS_ERROR && upstream_task->get_error() == ETIMEDOUT)
+		HttpUtil::set_response_status(resp, HttpStatusGatewayTimeout);
+	else
+		HttpUtil::set_response_status(resp, HttpStatusBadGateway);
+}
+
+void WFProxyHandler::operator() (WFHttpTask *task) const
+{
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	WFProxyUpstream *upstream = ctx_->select();
+	WFRequestTarget target;
+
+	if (!upstream)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusServiceUnavailable);
+		return;
+	}
+
+	if (WFRequestTargetParser::parse(req->get_request_uri(), target) < 0)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusBadRequest);
+		return;
+	}
+
+	std::string url = upstream->url;
+	const char *path = target.path;
+	size_t len = target.path_len;
+
+	if (len >= prefix_.size() && memcmp(path, prefix_.c_str(), prefix_.size()) == 0)
+	{
+		path += prefix_.size();
+		len -= prefix_.size();
+	}
+
+	while (len > 0 && *path == '/')
+	{
+		path++;
+		len--;
+	}
+
+	url.append(path, len);
+	if (target.query_len > 0)
+	{
+		url.push_back('?');
+		url.append(target.query, target.query_len);
+	}
+
+	auto *upstream_task = WFTaskFactory::create_http_task(url, 0,
+		params_.retry_max,
+		std::bind(__proxy_callback, task, upstream, __monotonic_us(),
+				  std::placeholders::_1));
+	auto *upstream_req = upstream_task->get_req();
+	std::vector<std::string> options;
+	struct HttpMessageHeader header;
+	HttpHeaderCursor cursor(req);
+	const void *body;
+	size_t size;
+
+	upstream_req->set_method(req->get_method());
+	__connection_options(req, options);
+	while (cursor.next(&header))
+	{
+		// Host and Content-Length are set for the upstream
+		if (!__is_hop_by_hop(&header, options) &&
+			!__header_is(&header, "Host", 4) &&
+			!__header_is(&header, "Content-Length", 14))
+		{
+			upstream_req->add_header(&header);
+		}
+	}
+
+	// server task outlives upstream task in the same series
+	if (req->get_parsed_body(&body, &size) && size > 0)
+	{
+		upstream_req->add_header_pair("Content-Length", std::to_string(size));
+		upstream_req->append_output_body_nocopy(body, size);
+	}
+
+	upstream_req->add_header_pair("Connection", "Keep-Alive");
+	upstream_task->set_send_timeout(params_.send_timeout);
+	upstream_task->set_receive_timeout(params_.recv_timeout);
+	series_of(task)->push_back(upstream_task);
+}
+
+int WFProxyHandler::add_upstream(const std::string& url, int weight)
+{
+	if (weight <= 0 || url.empty())
+		return -1;
+
+	auto *upstream = new WFProxyUpstream(url, weight);
+
+	if (url.back() != '/')
+		upstream->url.push_back('/');
+
+	ctx_->upstreams.push_back(upstream);
+	ctx_->build_schedule();
+	return 0;
+}
+
+void WFProxyHandler::get_stats(std::vector<struct WFUpstreamStats>& stats) const
+{
+	stats.clear();
+	for (const WFProxyUpstream *upstream : ctx_->upstreams)
+	{
+		stats.emplace_back();
+		stats.back().url = upstream->url;
+		stats.back().weight = upstream->weight;
+		stats.back().requests = upstream->requests;
+		stats.back().errors = upstream->errors;
+		stats.back().latency = upstream->latency;
+		stats.back().max_latency = upstream->max_latency;
+	}
+}
+
+WFProxyHandler::WFProxyHandler(const std::string& prefix):
+	WFProxyHandler(prefix, &PROXY_PARAMS_DEFAULT)
+{}
+
+WFProxyHandler::WFProxyHandler(const std::string& prefix,
+							   const struct WFProxyParams *params):
+	prefix_(prefix),
+	params_(*params),
+	ctx_(new WFProxyContext)
+{}
+
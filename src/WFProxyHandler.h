@@ -0,0 +1,91 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFPROXYHANDLER_H_
+#define _WFPROXYHANDLER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFProxyHandler.h
+ * @brief  Reverse proxy handler for WFWebServer
+ */
+
+struct WFProxyParams
+{
+	int retry_max;
+	int send_timeout;		// ms, -1 for no timeout
+	int recv_timeout;		// ms, -1 for no timeout
+};
+
+static constexpr struct WFProxyParams PROXY_PARAMS_DEFAULT =
+{
+	.retry_max		=	0,
+	.send_timeout	=	-1,
+	.recv_timeout	=	-1,
+};
+
+struct WFUpstreamStats
+{
+	std::string url;
+	int weight;
+	unsigned long long requests;
+	unsigned long long errors;		// upstream unreachable or timed out
+	unsigned long long latency;		// us, sum of all requests
+	unsigned long long max_latency;	// us
+};
+
+class WFProxyContext;
+
+// WFProxyHandler proxy("/api/");
+// proxy.add_upstream("http://10.0.0.1:8080/v1/", 3);
+// proxy.add_upstream("http://10.0.0.2:8080/v1/", 1);
+// server.set_handler("/api/", proxy);
+// "/api/users?id=1" is forwarded to "http://10.0.0.x:8080/v1/users?id=1"
+//
+// The upstream task runs in the series of server task, nothing is blocked.
+// Request body is sent from the buffer of server task and the upstream
+// response body is kept until the reply is sent, nothing is copied.
+// Hop-by-hop headers, and headers named by Connection, are dropped both
+// ways.
+// Add all upstreams before serving. Copies of handler share upstreams.
+class WFProxyHandler
+{
+public:
+	void operator() (WFHttpTask *task) const;
+
+	// weight > 0, upstreams are chosen by smooth weighted round robin
+	int add_upstream(const std::string& url, int weight);
+
+	void get_stats(std::vector<struct WFUpstreamStats>& stats) const;
+
+public:
+	WFProxyHandler(const std::string& prefix);
+	WFProxyHandler(const std::string& prefix, const struct WFProxyParams *params);
+
+private:
+	std::string prefix_;
+	struct WFProxyParams params_;
+	std::shared_ptr<WFProxyContext> ctx_;
+};
+
+#endif
+
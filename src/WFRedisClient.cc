@@ -17,6 +17,10 @@
            Li Yingxin (liyingxin@sogou-inc.com)
 */
 
+#include <errno.h>
+#include <ctype.h>
+#include <strings.h>
+#include <memory>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFGlobal.h>
 #include "WFRedisClient.h"
@@ -43,14 +47,12 @@ static inline bool __set_result(WFRedisTask *task, WFRedisResult& res)
 	return res.success;
 }
 
-static void __async_callback(WFRedisClient::ON_SUCCESS on_success,
-							 WFRedisClient::ON_ERROR on_error,
-							 WFRedisClient::ON_COMPLETE on_complete,
-							 WFRedisTask *task)
+static void __async_result(const WFRedisClient::ON_SUCCESS& on_success,
+						   const WFRedisClient::ON_ERROR& on_error,
+						   const WFRedisClient::ON_COMPLETE& on_complete,
+						   WFRedisResult& res)
 {
-	WFRedisResult res;
-
-	if (__set_result(task, res))
+	if (res.success)
 	{
 		if (on_success)
 			on_success(res.value);
@@ -74,6 +76,342 @@ static void __async_callback(WFRedisClient::ON_SUCCESS on_success,
 		on_complete(res);
 }
 
+static void __async_callback(const WFRedisClient::ON_SUCCESS& on_success,
+							 const WFRedisClient::ON_ERROR& on_error,
+							 const WFRedisClient::ON_COMPLETE& on_complete,
+							 WFRedisTask *task)
+{
+	WFRedisResult res;
+
+	__set_result(task, res);
+	__async_result(on_success, on_error, on_complete, res);
+}
+
+using redis_create_t = std::function<WFRedisTask *(redis_callback_t&& callback)>;
+using redis_options_t = std::shared_ptr<const WFRedisClientOptions>;
+
+// TASK is WFRedisTask, or WFRedisPipelineTask of a batch
+template<class TASK>
+static void __limiter_callback(const std::shared_ptr<WFClientLimiter>& limiter,
+							   WFClientLimiterUpstream *up,
+							   long long admitted_at,
+							   const std::function<void (TASK *)>& callback,
+							   TASK *task)
+{
+	limiter->release(up, admitted_at, task->get_state() == WFT_STATE_SUCCESS);
+	callback(task);
+}
+
+// the task may be created later from another thread, everything is copied
+static redis_create_t __creator(const ParsedURI& uri,
+								const std::string& command,
+								const std::vector<std::string>& params,
+								const WFRedisClientOptions *opts,
+								void *user_data)
+{
+	auto u = std::make_shared<const ParsedURI>(uri);
+	int retry_max = opts->retry_max;
+	int send_timeout = opts->send_timeout;
+	int recv_timeout = opts->recv_timeout;
+
+	return [u, command, params, retry_max, send_timeout, recv_timeout, user_data]
+		   (redis_callback_t&& callback) {
+		auto *redis_task = WFTaskFactory::create_redis_task(*u, retry_max,
+															std::move(callback));
+
+		redis_task->get_req()->set_request(command, params);
+		redis_task->set_send_timeout(send_timeout);
+		redis_task->set_receive_timeout(recv_timeout);
+		redis_task->user_data = user_data;
+		return redis_task;
+	};
+}
+
+// create() is called once admitted, reject() if the queue is full
+template<class TASK>
+static void __start_task(const std::shared_ptr<WFClientLimiter>& limiter,
+						 WFClientLimiterUpstream *up,
+						 std::function<TASK *(std::function<void (TASK *)>&&)>&& create,
+						 std::function<void (TASK *)>&& callback,
+						 std::function<void (WFRedisResult&)>&& reject)
+{
+	if (!limiter)
+		return create(std::move(callback))->start();
+
+	limiter->acquire(up, [limiter, up, create, callback, reject](long long admitted_at) {
+		if (admitted_at < 0)
+		{
+			WFRedisResult res;
+
+			res.seqid = -1;
+			res.task_state = WFT_STATE_SYS_ERROR;
+			res.task_error = EAGAIN;
+			res.success = false;
+			return reject(res);
+		}
+
+		create(std::bind(__limiter_callback<TASK>, limiter, up, admitted_at,
+						 callback, std::placeholders::_1))->start();
+	});
+}
+
+using WFRedisFlight = WFSingleFlight<WFRedisResult>;
+
+static void __copy_result(const WFRedisResult& from, WFRedisResult& to)
+{
+	to = from;
+}
+
+// sharing the result of these is the same as running them again
+static bool __read_only(const std::string& command)
+{
+	static const char *commands[] = {
+		"GET", "MGET", "STRLEN", "GETRANGE", "EXISTS", "TYPE", "TTL", "PTTL",
+		"HGET", "HMGET", "HGETALL", "HEXISTS", "HLEN", "HKEYS", "HVALS",
+		"LRANGE", "LINDEX", "LLEN", "SMEMBERS", "SISMEMBER", "SCARD",
+		"ZRANGE", "ZRANGEBYSCORE", "ZREVRANGE", "ZSCORE", "ZRANK", "ZCARD"
+	};
+
+	for (const char *cmd : commands)
+	{
+		if (strcasecmp(command.c_str(), cmd) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static std::string __flight_key(const std::string& command,
+								const std::vector<std::string>& params)
+{
+	std::string key;
+
+	for (char c : command)
+		key += toupper(c);
+
+	// length prefixed, params may have any bytes
+	for (const std::string& param : params)
+		key += " " + std::to_string(param.size()) + ":" + param;
+
+	return key;
+}
+
+static void __flight_task(const WFRedisClientOptions *opts,
+						  const std::string& command,
+						  const std::vector<std::string>& params,
+						  redis_create_t&& create,
+						  redis_callback_t&& callback,
+						  std::function<void (WFRedisResult&)>&& on_result)
+{
+	const auto& limiter = opts->limiter;
+	WFClientLimiterUpstream *up = opts->upstream;
+
+	if (!opts->flight || !__read_only(command))
+	{
+		return __start_task<WFRedisTask>(limiter, up, std::move(create),
+										 std::move(callback), std::move(on_result));
+	}
+
+	// start is called at once, before request() returns
+	auto start = [&](WFRedisFlight::callback_t done) {
+		auto&& cb = [done](WFRedisTask *task) {
+			WFRedisResult res;
+
+			__set_result(task, res);
+			done(res);
+		};
+
+		__start_task<WFRedisTask>(limiter, up, std::move(create), std::move(cb),
+								  std::move(done));
+	};
+
+	opts->flight->request(__flight_key(command, params), start, std::move(on_result));
+}
+
+// REQ is WFRedisRequest, or WFRedisAutoPipeline::Command
+template<class REQ>
+static WFRedisPipelineTask *__create_pipeline_task(const ParsedURI& uri, int retry_max,
+												   const std::vector<REQ>& requests,
+												   redis_pipeline_callback_t&& callback)
+{
+	auto *task = WFRedisPipelineTaskFactory::create_task(uri, retry_max,
+														 std::move(callback));
+
+	for (const REQ& req : requests)
+		task->get_req()->add_request(req.command, req.params);
+
+	WFRedisPipelineTaskFactory::seal(task);
+	return task;
+}
+
+static void __pipeline_results(WFRedisPipelineTask *task,
+							   std::vector<WFRedisResult>& results)
+{
+	const auto *resp = task->get_resp();
+	protocol::RedisValue setup_error;
+	bool setup_failed = false;
+
+	if (task->get_state() == WFT_STATE_SUCCESS)
+		setup_failed = resp->get_setup_error(setup_error);
+
+	results.resize(resp->size());
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		WFRedisResult& res = results[i];
+
+		res.seqid = task->get_task_seq();
+		res.task_state = task->get_state();
+		res.task_error = task->get_error();
+		res.success = false;
+		if (res.task_state != WFT_STATE_SUCCESS)
+			continue;
+
+		if (setup_failed)
+			res.value = setup_error;
+		else if (resp->get_result(i, res.value) && res.value.is_ok())
+			res.success = true;
+	}
+}
+
+using WFRedisCommand = WFRedisAutoPipeline::Command;
+
+// field of the cache is "GET" or "HGET <field>"
+static bool __near_field(const std::string& command,
+						 const std::vector<std::string>& params,
+						 std::string& field)
+{
+	if (strcasecmp(command.c_str(), "GET") == 0 && params.size() == 1)
+		field = "GET";
+	else if (strcasecmp(command.c_str(), "HGET") == 0 && params.size() == 2)
+		field = "HGET " + params[1];
+	else
+		return false;
+
+	return true;
+}
+
+static void __near_callback(const std::shared_ptr<WFRedisNearCache>& near,
+							const std::string& key, const std::string& field,
+							const std::function<void (WFRedisResult&)>& on_result,
+							WFRedisPipelineTask *task)
+{
+	std::vector<WFRedisResult> results;
+	const protocol::RedisValue *value = NULL;
+
+	__pipeline_results(task, results);
+	// not tracked, not stored
+	if (results[0].success && results[1].task_state == WFT_STATE_SUCCESS &&
+		!results[1].value.is_error())
+	{
+		value = &results[1].value;
+	}
+
+	near->fill_end(key, field, value);
+	on_result(results[1]);
+}
+
+// false if the command goes the usual way, it is not cached, or it is
+// a miss before the invalidation connection is subscribed.
+// A hit is answered in a go task if go is true, or at once.
+static bool __near_request(const ParsedURI& uri, const WFRedisClientOptions *opts,
+						   const std::string& command,
+						   const std::vector<std::string>& params, bool go,
+						   const std::function<void (WFRedisResult&)>& on_result)
+{
+	const auto& near = opts->near;
+	std::string field;
+	WFRedisResult res;
+	long long id;
+
+	if (!__near_field(command, params, field))
+		return false;
+
+	if (near->get(params[0], field, res.value))
+	{
+		res.seqid = -1;
+		res.task_state = WFT_STATE_SUCCESS;
+		res.task_error = 0;
+		res.success = res.value.is_ok();
+		if (!go)
+			on_result(res);
+		else
+		{
+			WFTaskFactory::create_go_task("WFRedisClient", [res, on_result]() {
+				WFRedisResult r = res;
+
+				on_result(r);
+			})->start();
+		}
+
+		return true;
+	}
+
+	id = near->tracking_id();
+	if (id < 0)
+		return false;
+
+	auto u = std::make_shared<const ParsedURI>(uri);
+	int retry_max = opts->retry_max;
+	int send_timeout = opts->send_timeout;
+	int recv_timeout = opts->recv_timeout;
+	std::vector<WFRedisRequest> requests = {
+		{"CLIENT", {"TRACKING", "on", "REDIRECT", std::to_string(id)}},
+		{command, params}
+	};
+
+	// a miss is limited and shared as the same command without the cache
+	auto create = [u, retry_max, send_timeout, recv_timeout, requests]
+				  (redis_pipeline_callback_t&& callback) {
+		auto *task = __create_pipeline_task(*u, retry_max, requests,
+											std::move(callback));
+
+		task->set_send_timeout(send_timeout);
+		task->set_receive_timeout(recv_timeout);
+		return task;
+	};
+
+	// start is called at once, only the one that reads fills the cache
+	auto start = [&](std::function<void (WFRedisResult&)> done) {
+		const std::string& key = params[0];
+
+		near->fill_begin(key);
+		__start_task<WFRedisPipelineTask>(opts->limiter, opts->upstream,
+			std::move(create),
+			std::bind(__near_callback, near, key, field, done,
+					  std::placeholders::_1),
+			[near, key, field, done](WFRedisResult& res) {
+				near->fill_end(key, field, NULL);
+				done(res);
+			});
+	};
+
+	if (opts->flight)
+		opts->flight->request(__flight_key(command, params), start, on_result);
+	else
+		start(on_result);
+
+	return true;
+}
+
+static void __auto_request(const redis_options_t& opts,
+						   const std::string& command,
+						   const std::vector<std::string>& params,
+						   std::function<void (WFRedisResult&)>&& on_result)
+{
+	const auto& autop = opts->autop;
+
+	if (!opts->flight || !__read_only(command))
+		return autop->request({command, params, std::move(on_result), opts});
+
+	// start is called at once, before request() returns
+	auto start = [&](WFRedisFlight::callback_t done) {
+		autop->request({command, params, std::move(done), opts});
+	};
+
+	opts->flight->request(__flight_key(command, params), start,
+						  std::move(on_result));
+}
+
 /*
 static void __await_callback(WFRedisTask *task)
 {
@@ -97,9 +435,7 @@ static void __future_callback(WFRedisTask *task)
 }
 
 WFRedisClient::WFRedisClient(const std::string& url):
-	retry_max_(0),
-	send_timeout_(-1),
-	recv_timeout_(-1)
+	opts_(std::make_shared<WFRedisClientOptions>())
 {
 	parse_error_ = URIParser::parse(url, uri_);
 }
@@ -127,14 +463,47 @@ WFFuture<WFRedisResult> WFRedisClient::async_request(const std::string& command,
 {
 	auto *pr = new WFPromise<WFRedisResult>();
 	auto fr = pr->get_future();
-	auto *task = WFTaskFactory::create_redis_task(uri_, retry_max_, __future_callback);
+	redis_options_t opts = options();
 
-	task->get_req()->set_request(command, params);
-	task->set_send_timeout(send_timeout_);
-	task->set_receive_timeout(recv_timeout_);
-	task->user_data = pr;
+	if (opts->near && __near_request(uri_, opts.get(), command, params, false,
+									 [pr](WFRedisResult& res) {
+										 pr->set_value(std::move(res));
+										 delete pr;
+									 }))
+	{
+		return fr;
+	}
 
-	task->start();
+	if (opts->autop)
+	{
+		__auto_request(opts, command, params, [pr](WFRedisResult& res) {
+			pr->set_value(std::move(res));
+			delete pr;
+		});
+		return fr;
+	}
+
+	if (!opts->limiter && !opts->flight)
+	{
+		auto *task = WFTaskFactory::create_redis_task(uri_, opts->retry_max,
+													  __future_callback);
+
+		task->get_req()->set_request(command, params);
+		task->set_send_timeout(opts->send_timeout);
+		task->set_receive_timeout(opts->recv_timeout);
+		task->user_data = pr;
+
+		task->start();
+		return fr;
+	}
+
+	__flight_task(opts.get(), command, params,
+				  __creator(uri_, command, params, opts.get(), pr),
+				  __future_callback,
+				  [pr](WFRedisResult& res) {
+					  pr->set_value(std::move(res));
+					  delete pr;
+				  });
 	return fr;
 }
 
@@ -157,25 +526,215 @@ void WFRedisClient::request(const std::string& command,
 							WFRedisClient::ON_ERROR on_error,
 							WFRedisClient::ON_COMPLETE on_complete)
 {
+	std::function<void (WFRedisResult&)> on_result;
+	redis_options_t opts = options();
+
+	if (opts->limiter || opts->flight || opts->autop || opts->near)
+	{
+		on_result = std::bind(__async_result, on_success, on_error, on_complete,
+							  std::placeholders::_1);
+	}
+
+	if (opts->near && __near_request(uri_, opts.get(), command, params, true,
+									 on_result))
+	{
+		return;
+	}
+
+	if (opts->autop)
+		return __auto_request(opts, command, params, std::move(on_result));
+
 	auto&& cb = std::bind(__async_callback,
 						  std::move(on_success),
 						  std::move(on_error),
 						  std::move(on_complete),
 						  std::placeholders::_1);
 
+	if (opts->limiter || opts->flight)
+	{
+		return __flight_task(opts.get(), command, params,
+							 __creator(uri_, command, params, opts.get(), NULL),
+							 std::move(cb), std::move(on_result));
+	}
+
 	auto *redis_task = WFTaskFactory::create_redis_task(uri_,
-														retry_max_,
+														opts->retry_max,
 														std::move(cb));
 
 	redis_task->get_req()->set_request(command, params);
-	redis_task->set_send_timeout(send_timeout_);
-	redis_task->set_receive_timeout(recv_timeout_);
+	redis_task->set_send_timeout(opts->send_timeout);
+	redis_task->set_receive_timeout(opts->recv_timeout);
 	redis_task->start();
 }
 
+static bool __batch_result(WFRedisTask *task, WFRedisResult& res)
+{
+	if (task)
+		return __set_result(task, res);
+
+	res.seqid = -1;
+	res.task_state = WFT_STATE_UNDEFINED;
+	res.task_error = 0;
+	res.success = false;
+	return false;
+}
+
+std::vector<WFRedisResult> WFRedisClient::sync_parallel_request(std::vector<WFRedisRequest> requests,
+																const struct WFBatchParams *params)
+{
+	return this->async_parallel_request(std::move(requests), params).get();
+}
+
+WFFuture<std::vector<WFRedisResult>>
+WFRedisClient::async_parallel_request(std::vector<WFRedisRequest> requests,
+									  const struct WFBatchParams *params)
+{
+	auto pr = std::make_shared<WFPromise<std::vector<WFRedisResult>>>();
+	auto fr = pr->get_future();
+
+	parallel_request(std::move(requests), [pr](std::vector<WFRedisResult>& results) {
+		pr->set_value(std::move(results));
+	}, params);
+
+	return fr;
+}
+
+void WFRedisClient::parallel_request(std::vector<WFRedisRequest> requests,
+									 WFRedisClient::ON_BATCH on_complete,
+									 const struct WFBatchParams *params)
+{
+	auto reqs = std::make_shared<const std::vector<WFRedisRequest>>(std::move(requests));
+	size_t n = reqs->size();
+	auto uri = std::make_shared<const ParsedURI>(uri_);
+	redis_options_t opts = options();
+	int retry_max = opts->retry_max;
+	int send_timeout = opts->send_timeout;
+	int recv_timeout = opts->recv_timeout;
+	WFClientLimiterUpstream *up = opts->upstream;
+
+	// tasks are created later, the client may be gone by then
+	auto create = [reqs, uri, retry_max, send_timeout, recv_timeout]
+				  (size_t i, redis_callback_t&& callback) {
+		const WFRedisRequest& req = (*reqs)[i];
+		auto *redis_task = WFTaskFactory::create_redis_task(*uri, retry_max,
+															std::move(callback));
+
+		redis_task->get_req()->set_request(req.command, req.params);
+		redis_task->set_send_timeout(send_timeout);
+		redis_task->set_receive_timeout(recv_timeout);
+		return redis_task;
+	};
+
+	WFClientBatch<WFRedisTask, WFRedisResult>::start(n, std::move(create),
+													 __batch_result, params,
+													 std::move(on_complete), opts->limiter,
+													 [up](size_t) { return up; });
+}
+
 WFRedisChain WFRedisClient::request(const std::string& command)
 {
-	return WFRedisChain(uri_, command, retry_max_, send_timeout_, recv_timeout_);
+	return WFRedisChain(uri_, command, options());
+}
+
+void WFRedisClient::set_single_flight()
+{
+	auto flight = std::make_shared<WFRedisFlight>(__copy_result);
+
+	update([&flight](WFRedisClientOptions *opts) { opts->flight = flight; });
+}
+
+static void __auto_callback(const std::shared_ptr<std::vector<WFRedisCommand>>& batch,
+							WFRedisPipelineTask *task)
+{
+	std::vector<WFRedisResult> results;
+
+	__pipeline_results(task, results);
+	for (size_t i = 0; i < results.size(); i++)
+		(*batch)[i].callback(results[i]);
+}
+
+void WFRedisClient::set_auto_pipeline(const struct WFRedisAutoPipelineParams *params)
+{
+	auto uri = std::make_shared<const ParsedURI>(uri_);
+
+	// A batch is one request to the limiter. Settings are read when it is
+	// flushed, from its newest command, never kept here: the options own
+	// this pipeline.
+	auto flush = [uri](std::vector<WFRedisCommand>& commands) {
+		auto batch = std::make_shared<std::vector<WFRedisCommand>>(std::move(commands));
+		redis_options_t opts = batch->back().opts;
+
+		auto create = [uri, opts, batch](redis_pipeline_callback_t&& callback) {
+			auto *task = __create_pipeline_task(*uri, opts->retry_max, *batch,
+												std::move(callback));
+
+			task->set_send_timeout(opts->send_timeout);
+			task->set_receive_timeout(opts->recv_timeout);
+			return task;
+		};
+
+		auto reject = [batch](WFRedisResult& res) {
+			for (WFRedisCommand& cmd : *batch)
+			{
+				WFRedisResult r = res;
+
+				cmd.callback(r);
+			}
+		};
+
+		__start_task<WFRedisPipelineTask>(opts->limiter, opts->upstream,
+										  std::move(create),
+										  std::bind(__auto_callback, batch,
+													std::placeholders::_1),
+										  std::move(reject));
+	};
+
+	auto autop = std::make_shared<WFRedisAutoPipeline>(params, std::move(flush));
+
+	update([&autop](WFRedisClientOptions *opts) { opts->autop = autop; });
+}
+
+void WFRedisClient::set_near_cache(const struct WFRedisNearCacheParams *params)
+{
+	std::shared_ptr<WFRedisNearCache> near;
+
+	if (uri_.state == URI_STATE_SUCCESS)
+	{
+		near = std::make_shared<WFRedisNearCache>(uri_, params);
+		near->start();
+	}
+
+	update([&near](WFRedisClientOptions *opts) { opts->near = near; });
+}
+
+void WFRedisClient::set_limiter(std::shared_ptr<WFClientLimiter> limiter)
+{
+	WFClientLimiterUpstream *up = NULL;
+
+	if (limiter && uri_.state == URI_STATE_SUCCESS)
+	{
+		std::string name = std::string(uri_.scheme) + "://" + uri_.host;
+
+		if (uri_.port)
+			name = name + ":" + uri_.port;
+
+		up = limiter->upstream(name);
+	}
+	else
+		limiter.reset();
+
+	update([&limiter, up](WFRedisClientOptions *opts) {
+		opts->limiter = limiter;
+		opts->upstream = up;
+	});
+}
+
+WFRedisClientOptions *WFRedisChain::options()
+{
+	auto opts = std::make_shared<WFRedisClientOptions>(*opts_);
+
+	opts_ = opts;
+	return opts.get();
 }
 
 WFRedisTask *WFRedisChain::create_task()
@@ -187,18 +746,46 @@ WFRedisTask *WFRedisChain::create_task()
 						  std::placeholders::_1);
 
 	auto *redis_task = WFTaskFactory::create_redis_task(uri_,
-														retry_max_,
+														opts_->retry_max,
 														std::move(cb));
 
 	redis_task->get_req()->set_request(command_, params_);
-	redis_task->set_send_timeout(send_timeout_);
-	redis_task->set_receive_timeout(recv_timeout_);
+	redis_task->set_send_timeout(opts_->send_timeout);
+	redis_task->set_receive_timeout(opts_->recv_timeout);
 	return redis_task;
 }
 
 void WFRedisChain::send()
 {
-	create_task()->start();
+	if (opts_->near && __near_request(uri_, opts_.get(), command_, params_, true,
+									  std::bind(__async_result, on_success_,
+												on_error_, on_complete_,
+												std::placeholders::_1)))
+	{
+		return;
+	}
+
+	if (opts_->autop)
+	{
+		return __auto_request(opts_, command_, params_,
+							  std::bind(__async_result, on_success_, on_error_,
+										on_complete_, std::placeholders::_1));
+	}
+
+	if (!opts_->limiter && !opts_->flight)
+		return create_task()->start();
+
+	auto&& cb = std::bind(__async_callback,
+						  on_success_,
+						  on_error_,
+						  on_complete_,
+						  std::placeholders::_1);
+
+	__flight_task(opts_.get(), command_, params_,
+				  __creator(uri_, command_, params_, opts_.get(), NULL),
+				  std::move(cb),
+				  std::bind(__async_result, on_success_, on_error_, on_complete_,
+							std::placeholders::_1));
 }
 
 WFRedisChain& WFRedisChain::append(const std::string& param)
@@ -242,8 +829,134 @@ WFRedisChain& WFRedisChain::error(WFRedisClient::ON_ERROR on_error)
 }
 
 WFRedisChain& WFRedisChain::retry_max(int n)
+{
+	options()->retry_max = n;
+	return *this;
+}
+
+WFRedisChain& WFRedisChain::send_timeout(int timeout)
+{
+	options()->send_timeout = timeout;
+	return *this;
+}
+
+WFRedisChain& WFRedisChain::recv_timeout(int timeout)
+{
+	options()->recv_timeout = timeout;
+	return *this;
+}
+
+WFRedisPipeline WFRedisClient::pipeline()
+{
+	redis_options_t opts = options();
+
+	return WFRedisPipeline(uri_, opts->retry_max, opts->send_timeout,
+						   opts->recv_timeout);
+}
+
+void WFRedisPipeline::send(WFRedisPipeline::ON_COMPLETE on_complete)
+{
+	if (requests_.empty())
+	{
+		std::vector<WFRedisResult> results;
+
+		if (on_complete)
+			on_complete(results);
+
+		return;
+	}
+
+	auto&& cb = [on_complete](WFRedisPipelineTask *task) {
+		std::vector<WFRedisResult> results;
+
+		__pipeline_results(task, results);
+		if (on_complete)
+			on_complete(results);
+	};
+
+	auto *task = __create_pipeline_task(uri_, retry_max_, requests_, std::move(cb));
+
+	task->set_send_timeout(send_timeout_);
+	task->set_receive_timeout(recv_timeout_);
+	task->start();
+}
+
+WFFuture<std::vector<WFRedisResult>> WFRedisPipeline::async_send()
+{
+	auto pr = std::make_shared<WFPromise<std::vector<WFRedisResult>>>();
+	auto fr = pr->get_future();
+
+	send([pr](std::vector<WFRedisResult>& results) {
+		pr->set_value(std::move(results));
+	});
+
+	return fr;
+}
+
+std::vector<WFRedisResult> WFRedisPipeline::sync_send()
+{
+	return this->async_send().get();
+}
+
+WFRedisPipeline& WFRedisPipeline::add(const std::string& command)
+{
+	requests_.push_back({command, {}});
+	return *this;
+}
+
+WFRedisPipeline& WFRedisPipeline::add(const std::string& command,
+									  const std::vector<std::string>& params)
+{
+	requests_.push_back({command, params});
+	return *this;
+}
+
+// nothing to append to before add()
+WFRedisPipeline& WFRedisPipeline::append(const std::string& param)
+{
+	if (!requests_.empty())
+		requests_.back().params.push_back(param);
+
+	return *this;
+}
+
+WFRedisPipeline& WFRedisPipeline::append(const std::vector<std::string>& params)
+{
+	if (!requests_.empty())
+	{
+		auto& last = requests_.back().params;
+
+		last.insert(last.end(), params.begin(), params.end());
+	}
+
+	return *this;
+}
+
+WFRedisPipeline& WFRedisPipeline::operator() (const std::string& param)
+{
+	return append(param);
+}
+
+WFRedisPipeline& WFRedisPipeline::operator() (const std::vector<std::string>& params)
+{
+	return append(params);
+}
+
+WFRedisPipeline& WFRedisPipeline::retry_max(int n)
 {
 	retry_max_ = n;
 	return *this;
 }
 
+WFRedisPipeline& WFRedisPipeline::send_timeout(int timeout)
+{
+	send_timeout_ = timeout;
+	return *this;
+}
+
+WFRedisPipeline& WFRedisPipeline::recv_timeout(int timeout)
+{
+	recv_timeout_ = timeout;
+	return *this;
+}
+
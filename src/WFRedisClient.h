@@ -22,11 +22,18 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <functional>
 #include <workflow/RedisMessage.h>
 #include <workflow/URIParser.h>
 #include <workflow/WFTaskFactory.h>
 #include <workflow/WFFuture.h>
+#include "WFClientBatch.h"
+#include "WFClientLimiter.h"
+#include "WFSingleFlight.h"
+#include "WFRedisPipeline.h"
+#include "WFRedisNearCache.h"
 
 /**
  * @file   WFRedisClient.h
@@ -42,7 +49,37 @@ struct WFRedisResult
 	bool success;//task_state == WFT_STATE_SUCCESS && value.is_ok()
 };
 
+// one request of a batch
+struct WFRedisRequest
+{
+	std::string command;
+	std::vector<std::string> params;
+};
+
+// Everything a command is sent with besides itself. A client shares one
+// copy with its chains and commands in flight, setters publish a new copy
+// atomically, so they may run while commands are sent.
+struct WFRedisClientOptions
+{
+	int retry_max;
+	int send_timeout;
+	int recv_timeout;
+	std::shared_ptr<WFClientLimiter> limiter;
+	WFClientLimiterUpstream *upstream;//the server in limiter
+	std::shared_ptr<WFSingleFlight<WFRedisResult>> flight;
+	std::shared_ptr<WFRedisAutoPipeline> autop;
+	std::shared_ptr<WFRedisNearCache> near;
+
+	WFRedisClientOptions():
+		retry_max(0),
+		send_timeout(-1),
+		recv_timeout(-1),
+		upstream(NULL)
+	{}
+};
+
 class WFRedisChain;//for method chaining
+class WFRedisPipeline;
 
 class WFRedisClient
 {
@@ -54,13 +91,87 @@ public:
 public:
 	WFRedisClient(const std::string& url);
 
-	void default_retry_max(int n) { retry_max_ = n; }
-	void default_send_timeout(int timeout) { send_timeout_ = timeout; }
-	void default_recv_timeout(int timeout) { recv_timeout_ = timeout; }
+	void default_retry_max(int n)
+	{
+		update([n](WFRedisClientOptions *opts) { opts->retry_max = n; });
+	}
+
+	void default_send_timeout(int timeout)
+	{
+		update([timeout](WFRedisClientOptions *opts) { opts->send_timeout = timeout; });
+	}
+
+	void default_recv_timeout(int timeout)
+	{
+		update([timeout](WFRedisClientOptions *opts) { opts->recv_timeout = timeout; });
+	}
 
 	// return REG_ERR
 	int parse_error() const { return parse_error_; }
 
+	// limit concurrency to this server, see WFClientLimiter.h. A rejected
+	// request fails with WFT_STATE_SYS_ERROR and EAGAIN. Every request of
+	// a batch is admitted on its own.
+	// Tasks from create_task() are never limited.
+	void set_limiter(std::shared_ptr<WFClientLimiter> limiter);
+
+	// identical read-only commands in flight, such as GET, HGET or MGET
+	// with the same params, share one task and its result,
+	// see WFSingleFlight.h. Tasks from create_task() never share.
+	void set_single_flight();
+
+	// return -1 if set_single_flight() is not called
+	int get_single_flight_stats(struct WFSingleFlightStats *stats) const
+	{
+		auto opts = options();
+
+		if (!opts->flight)
+			return -1;
+
+		opts->flight->get_stats(stats);
+		return 0;
+	}
+
+	// gather commands of request(), async_request(), sync_request() and
+	// chains into pipelines, see WFRedisAutoPipeline. A pipeline is sent
+	// with the limiter and timeouts of the client when its newest command
+	// was, so settings may change later.
+	void set_auto_pipeline(const struct WFRedisAutoPipelineParams *params =
+								&REDIS_AUTO_PIPELINE_PARAMS_DEFAULT);
+
+	// return -1 if set_auto_pipeline() is not called
+	int get_auto_pipeline_stats(struct WFRedisAutoPipelineStats *stats) const
+	{
+		auto opts = options();
+
+		if (!opts->autop)
+			return -1;
+
+		opts->autop->get_stats(stats);
+		return 0;
+	}
+
+	// answer GET and HGET of request(), async_request(), sync_request()
+	// and chains from a cache in this process, kept up to date by CLIENT
+	// TRACKING of redis 6, see WFRedisNearCache.h. Answers from the cache
+	// have seqid -1, and request() calls back in a go task. A miss is a
+	// pipeline of its own, never auto pipelined, but limited and shared
+	// as the same command without the cache.
+	void set_near_cache(const struct WFRedisNearCacheParams *params =
+							&REDIS_NEAR_CACHE_PARAMS_DEFAULT);
+
+	// return -1 if set_near_cache() is not called
+	int get_near_cache_stats(struct WFRedisNearCacheStats *stats) const
+	{
+		auto opts = options();
+
+		if (!opts->near)
+			return -1;
+
+		opts->near->get_stats(stats);
+		return 0;
+	}
+
 	//sync
 	WFRedisResult sync_request(const std::string& command,
 							   const std::vector<std::string>& params);
@@ -83,15 +194,50 @@ public:
 	//async, method chaining style
 	WFRedisChain request(const std::string& command);
 
-	void set_send_timeout(int send_timeout) { send_timeout_ = send_timeout; }
-	void set_recv_timeout(int recv_timeout) { recv_timeout_ = recv_timeout; }
+	// batch, results are in the order of requests, see WFClientBatch.h
+	using ON_BATCH = std::function<void (std::vector<WFRedisResult>&)>;
+
+	std::vector<WFRedisResult> sync_parallel_request(std::vector<WFRedisRequest> requests,
+													 const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	WFFuture<std::vector<WFRedisResult>> async_parallel_request(std::vector<WFRedisRequest> requests,
+																const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	void parallel_request(std::vector<WFRedisRequest> requests,
+						  WFRedisClient::ON_BATCH on_complete,
+						  const struct WFBatchParams *params = &BATCH_PARAMS_DEFAULT);
+
+	// many commands written at once on one connection, see WFRedisPipeline
+	WFRedisPipeline pipeline();
+
+	void set_send_timeout(int send_timeout) { default_send_timeout(send_timeout); }
+	void set_recv_timeout(int recv_timeout) { default_recv_timeout(recv_timeout); }
 
 private:
+	// every command reads the options once, commands in flight keep theirs
+	std::shared_ptr<const WFRedisClientOptions> options() const
+	{
+		return std::atomic_load(&opts_);
+	}
+
+	// fn changes a new copy, run again if another setter wins the race
+	void update(const std::function<void (WFRedisClientOptions *)>& fn)
+	{
+		std::shared_ptr<const WFRedisClientOptions> old = options();
+		std::shared_ptr<const WFRedisClientOptions> opts;
+
+		do
+		{
+			auto copy = std::make_shared<WFRedisClientOptions>(*old);
+
+			fn(copy.get());
+			opts = std::move(copy);
+		} while (!std::atomic_compare_exchange_weak(&opts_, &old, opts));
+	}
+
 	ParsedURI uri_;
 	int parse_error_;//REG_ERR
-	int retry_max_;
-	int send_timeout_;
-	int recv_timeout_;
+	std::shared_ptr<const WFRedisClientOptions> opts_;
 };
 
 //client.request("HSET")("Key")({"Hashkey","Value"}).send();
@@ -113,27 +259,72 @@ public:
 	WFRedisChain& recv_timeout(int timeout);
 
 private:
-	WFRedisChain(const ParsedURI &uri,
-				 const std::string& command,
-				 int retry_max,
-				 int send_timeout,
-				 int recv_timeout):
+	WFRedisChain(const ParsedURI& uri, const std::string& command,
+				 std::shared_ptr<const WFRedisClientOptions> opts):
 		uri_(uri),
 		command_(command),
 		on_complete_(NULL),
 		on_success_(NULL),
 		on_error_(NULL),
-		retry_max_(retry_max),
-		send_timeout_(send_timeout),
-		recv_timeout_(recv_timeout)
+		opts_(std::move(opts))
 	{}
 
+	// a new copy to change, a chain is used by one thread
+	WFRedisClientOptions *options();
+
 	ParsedURI uri_;
 	std::string command_;
 	std::vector<std::string> params_;
 	WFRedisClient::ON_COMPLETE on_complete_;
 	WFRedisClient::ON_SUCCESS on_success_;
 	WFRedisClient::ON_ERROR on_error_;
+	std::shared_ptr<const WFRedisClientOptions> opts_;
+
+	friend class WFRedisClient;
+};
+
+//client.pipeline().add("SET")("k1")("v1").add("INCR")("n").add("GET", {"k1"}).send(cb);
+// The commands go in one write and their replies are read in order from
+// the same connection, one round trip for all. A pipeline is not a
+// transaction, other clients may run commands in between. Pipelines are
+// never limited or shared, and retries send all the commands again.
+class WFRedisPipeline
+{
+public:
+	using ON_COMPLETE = std::function<void (std::vector<WFRedisResult>&)>;
+
+	// results are in the order of the commands
+	void send(WFRedisPipeline::ON_COMPLETE on_complete);
+	WFFuture<std::vector<WFRedisResult>> async_send();
+	std::vector<WFRedisResult> sync_send();
+
+	// start a command, params are appended to the last one
+	WFRedisPipeline& add(const std::string& command);
+	WFRedisPipeline& add(const std::string& command,
+						 const std::vector<std::string>& params);
+	WFRedisPipeline& append(const std::string& param);
+	WFRedisPipeline& append(const std::vector<std::string>& params);
+	WFRedisPipeline& operator() (const std::string& param);
+	WFRedisPipeline& operator() (const std::vector<std::string>& params);
+	WFRedisPipeline& retry_max(int n);
+	WFRedisPipeline& send_timeout(int timeout);
+	WFRedisPipeline& recv_timeout(int timeout);
+
+	size_t size() const { return requests_.size(); }
+
+private:
+	WFRedisPipeline(const ParsedURI& uri,
+					int retry_max,
+					int send_timeout,
+					int recv_timeout):
+		uri_(uri),
+		retry_max_(retry_max),
+		send_timeout_(send_timeout),
+		recv_timeout_(recv_timeout)
+	{}
+
+	ParsedURI uri_;
+	std::vector<WFRedisRequest> requests_;
 	int retry_max_;
 	int send_timeout_;
 	int recv_timeout_;
@@ -0,0 +1,565 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include <mutex>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/URIParser.h>
+#include "WFRedisCluster.h"
+#include "WFRedisSplit.h"
+
+using namespace protocol;
+
+using redis_result_t = std::function<void (WFRedisResult&)>;
+
+// one command on its way through redirects
+struct WFRedisClusterCommand
+{
+	std::string command;
+	std::vector<std::string> params;
+	int slot;				// -1 if no key
+	int redirects;
+	std::string asking;		// node of an ASK, empty if none
+	redis_result_t on_result;
+};
+
+class WFRedisClusterState : public std::enable_shared_from_this<WFRedisClusterState>
+{
+public:
+	void execute(std::shared_ptr<WFRedisClusterCommand> cmd);
+	void refresh();
+	std::string node_of(int slot) const;
+
+private:
+	std::string route(int slot);
+	std::string url_of(const std::string& node) const;
+	void set_slot(int slot, const std::string& node);
+	int node_index(const std::string& node);
+	void done(std::shared_ptr<WFRedisClusterCommand> cmd,
+			  const std::string& node, WFRedisResult& res);
+	void refresh_done(WFRedisTask *task, const std::string& node);
+
+public:
+	WFRedisClusterState(const std::vector<std::string>& seeds,
+						const struct WFRedisClusterParams *params);
+
+public:
+	int retry_max;
+	int send_timeout;
+	int recv_timeout;
+
+private:
+	struct WFRedisClusterParams params_;
+	std::string prefix_;				// "redis://user:pass@"
+	std::vector<std::string> seeds_;	// "host:port"
+	std::vector<std::string> nodes_;	// masters
+	std::vector<int> slots_;			// index in nodes_, -1 if not known
+	size_t next_;						// round robin of nodes without a slot
+	bool refreshing_;
+	long long last_refresh_;			// ms
+	mutable std::mutex mutex_;
+};
+
+static long long __now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// CRC16-CCITT (XMODEM), the hash of Redis Cluster
+static uint16_t __crc16(const char *buf, size_t len)
+{
+	uint16_t crc = 0;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint16_t)((unsigned char)buf[i] << 8);
+		for (int k = 0; k < 8; k++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+unsigned int WFRedisClusterClient::slot_of(const std::string& key)
+{
+	size_t start = key.find('{');
+	size_t end;
+
+	// only a non-empty tag counts
+	if (start != std::string::npos)
+	{
+		end = key.find('}', start + 1);
+		if (end != std::string::npos && end > start + 1)
+			return __crc16(key.c_str() + start + 1, end - start - 1) % REDIS_CLUSTER_SLOTS;
+	}
+
+	return __crc16(key.c_str(), key.size()) % REDIS_CLUSTER_SLOTS;
+}
+
+static std::string __node_name(const std::string& host, const std::string& port)
+{
+	if (host.find(':') != std::string::npos)
+		return "[" + host + "]:" + port;
+
+	return host + ":" + port;
+}
+
+static std::string __node_host(const std::string& node)
+{
+	size_t pos = node.rfind(':');
+	std::string host = node.substr(0, pos == std::string::npos ? 0 : pos);
+
+	if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+		host = host.substr(1, host.size() - 2);
+
+	return host;
+}
+
+// "MOVED 3999 10.0.0.1:6381", an empty host is the host asked
+static bool __parse_redirect(const std::string& error, const std::string& from,
+							 bool& moved, int& slot, std::string& node)
+{
+	size_t pos;
+	size_t colon;
+	std::string target;
+
+	if (strncasecmp(error.c_str(), "MOVED ", 6) == 0)
+		moved = true;
+	else if (strncasecmp(error.c_str(), "ASK ", 4) == 0)
+		moved = false;
+	else
+		return false;
+
+	pos = error.find(' ');
+	slot = atoi(error.c_str() + pos + 1);
+	pos = error.find(' ', pos + 1);
+	if (pos == std::string::npos || slot < 0 || slot >= REDIS_CLUSTER_SLOTS)
+		return false;
+
+	target = error.substr(pos + 1);
+	colon = target.rfind(':');
+	if (colon == std::string::npos || colon + 1 == target.size())
+		return false;
+
+	if (colon == 0)
+		node = __node_name(__node_host(from), target.substr(1));
+	else
+		node = __node_name(target.substr(0, colon), target.substr(colon + 1));
+
+	return true;
+}
+
+static int __command_slot(const std::string& command,
+						  const std::vector<std::string>& params)
+{
+	const std::string *key = WFRedisSplit::first_key(command, params);
+
+	return key ? WFRedisClusterClient::slot_of(*key) : -1;
+}
+
+static void __task_result(WFRedisTask *task, WFRedisResult& res)
+{
+	res.seqid = task->get_task_seq();
+	res.task_state = task->get_state();
+	res.task_error = task->get_error();
+	res.success = false;
+
+	if (res.task_state == WFT_STATE_SUCCESS)
+	{
+		const auto *resp = task->get_resp();
+
+		if (resp->parse_success())
+		{
+			resp->get_result(res.value);
+			if (res.value.is_ok())
+				res.success = true;
+		}
+	}
+}
+
+// the reply of the command after ASKING
+static void __asking_result(WFRedisPipelineTask *task, WFRedisResult& res)
+{
+	const auto *resp = task->get_resp();
+
+	res.seqid = task->get_task_seq();
+	res.task_state = task->get_state();
+	res.task_error = task->get_error();
+	res.success = false;
+
+	if (res.task_state != WFT_STATE_SUCCESS)
+		return;
+
+	if (resp->get_setup_error(res.value))
+		return;
+
+	if (resp->get_result(1, res.value) && res.value.is_ok())
+		res.success = true;
+}
+
+WFRedisClusterState::WFRedisClusterState(const std::vector<std::string>& seeds,
+										 const struct WFRedisClusterParams *params):
+	retry_max(0),
+	send_timeout(-1),
+	recv_timeout(-1),
+	params_(*params),
+	prefix_("redis://"),
+	slots_(REDIS_CLUSTER_SLOTS, -1),
+	next_(0),
+	refreshing_(false),
+	last_refresh_(0)
+{
+	for (const std::string& seed : seeds)
+	{
+		ParsedURI uri;
+
+		if (URIParser::parse(seed, uri) < 0 || !uri.host || !*uri.host)
+			continue;
+
+		if (seeds_.empty())
+		{
+			prefix_ = uri.scheme ? std::string(uri.scheme) + "://" : "redis://";
+			if (uri.userinfo && *uri.userinfo)
+				prefix_ += std::string(uri.userinfo) + "@";
+		}
+
+		seeds_.push_back(__node_name(uri.host,
+									 uri.port && *uri.port ? uri.port : "6379"));
+	}
+
+	nodes_ = seeds_;
+}
+
+std::string WFRedisClusterState::url_of(const std::string& node) const
+{
+	return prefix_ + node;
+}
+
+// with mutex_ locked
+int WFRedisClusterState::node_index(const std::string& node)
+{
+	for (size_t i = 0; i < nodes_.size(); i++)
+	{
+		if (nodes_[i] == node)
+			return (int)i;
+	}
+
+	nodes_.push_back(node);
+	return (int)nodes_.size() - 1;
+}
+
+void WFRedisClusterState::set_slot(int slot, const std::string& node)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	slots_[slot] = node_index(node);
+}
+
+std::string WFRedisClusterState::node_of(int slot) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (slot < 0 || slot >= REDIS_CLUSTER_SLOTS || slots_[slot] < 0)
+		return "";
+
+	return nodes_[slots_[slot]];
+}
+
+// any node for a slot not known, it answers MOVED
+std::string WFRedisClusterState::route(int slot)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (slot >= 0 && slots_[slot] >= 0)
+		return nodes_[slots_[slot]];
+
+	if (nodes_.empty())
+		return "";
+
+	return nodes_[next_++ % nodes_.size()];
+}
+
+void WFRedisClusterState::execute(std::shared_ptr<WFRedisClusterCommand> cmd)
+{
+	std::string node = cmd->asking.empty() ? route(cmd->slot) : cmd->asking;
+	auto self = shared_from_this();
+
+	if (node.empty())
+	{
+		WFRedisResult res;
+
+		res.seqid = -1;
+		res.task_state = WFT_STATE_SYS_ERROR;
+		res.task_error = EINVAL;
+		res.success = false;
+		return cmd->on_result(res);
+	}
+
+	if (!cmd->asking.empty())
+	{
+		ParsedURI uri;
+
+		URIParser::parse(url_of(node), uri);
+		auto *task = WFRedisPipelineTaskFactory::create_task(uri, retry_max,
+			[self, cmd, node](WFRedisPipelineTask *task) {
+				WFRedisResult res;
+
+				__asking_result(task, res);
+				self->done(cmd, node, res);
+			});
+
+		task->get_req()->add_request("ASKING", {});
+		task->get_req()->add_request(cmd->command, cmd->params);
+		WFRedisPipelineTaskFactory::seal(task);
+		task->set_send_timeout(send_timeout);
+		task->set_receive_timeout(recv_timeout);
+		return task->start();
+	}
+
+	auto *task = WFTaskFactory::create_redis_task(url_of(node), retry_max,
+		[self, cmd, node](WFRedisTask *task) {
+			WFRedisResult res;
+
+			__task_result(task, res);
+			self->done(cmd, node, res);
+		});
+
+	task->get_req()->set_request(cmd->command, cmd->params);
+	task->set_send_timeout(send_timeout);
+	task->set_receive_timeout(recv_timeout);
+	task->start();
+}
+
+void WFRedisClusterState::done(std::shared_ptr<WFRedisClusterCommand> cmd,
+							   const std::string& node, WFRedisResult& res)
+{
+	std::string target;
+	bool moved;
+	int slot;
+
+	// the node may be gone, a replica may take over
+	if (res.task_state != WFT_STATE_SUCCESS)
+	{
+		refresh();
+		return cmd->on_result(res);
+	}
+
+	if (!res.value.is_error() || cmd->redirects >= params_.max_redirects ||
+		!__parse_redirect(res.value.string_value(), node, moved, slot, target))
+	{
+		return cmd->on_result(res);
+	}
+
+	cmd->redirects++;
+	if (moved)
+	{
+		set_slot(slot, target);
+		cmd->asking.clear();
+		refresh();
+	}
+	else
+		cmd->asking = target;
+
+	execute(std::move(cmd));
+}
+
+void WFRedisClusterState::refresh()
+{
+	long long now = __now_ms();
+	std::string node;
+
+	mutex_.lock();
+	if (refreshing_ || nodes_.empty() ||
+		(last_refresh_ > 0 && now - last_refresh_ < params_.refresh_interval))
+	{
+		mutex_.unlock();
+		return;
+	}
+
+	refreshing_ = true;
+	last_refresh_ = now;
+	node = nodes_[next_++ % nodes_.size()];
+	mutex_.unlock();
+
+	auto self = shared_from_this();
+	auto *task = WFTaskFactory::create_redis_task(url_of(node), retry_max,
+		[self, node](WFRedisTask *task) { self->refresh_done(task, node); });
+
+	task->get_req()->set_request("CLUSTER", {"SLOTS"});
+	task->set_send_timeout(send_timeout);
+	task->set_receive_timeout(recv_timeout);
+	task->start();
+}
+
+// [[start, end, [host, port, id], replicas...], ...]
+void WFRedisClusterState::refresh_done(WFRedisTask *task, const std::string& node)
+{
+	std::vector<std::string> nodes;
+	std::vector<int> slots(REDIS_CLUSTER_SLOTS, -1);
+	RedisValue value;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	refreshing_ = false;
+	if (task->get_state() != WFT_STATE_SUCCESS ||
+		!task->get_resp()->parse_success() ||
+		!task->get_resp()->get_result(value) || !value.is_array())
+	{
+		// another node next time
+		last_refresh_ = 0;
+		return;
+	}
+
+	for (size_t i = 0; i < value.arr_size(); i++)
+	{
+		const RedisValue& range = value[i];
+		std::string host;
+		std::string name;
+		int64_t start;
+		int64_t end;
+		size_t k;
+
+		if (!range.is_array() || range.arr_size() < 3 || !range[2].is_array() ||
+			range[2].arr_size() < 2)
+		{
+			continue;
+		}
+
+		start = range[0].int_value();
+		end = range[1].int_value();
+		host = range[2][0].string_value();
+		if (host.empty() || host == "?")
+			host = __node_host(node);
+
+		name = __node_name(host, std::to_string(range[2][1].int_value()));
+		for (k = 0; k < nodes.size(); k++)
+		{
+			if (nodes[k] == name)
+				break;
+		}
+
+		if (k == nodes.size())
+			nodes.push_back(name);
+
+		for (int64_t s = start; s <= end && s < REDIS_CLUSTER_SLOTS; s++)
+		{
+			if (s >= 0)
+				slots[s] = (int)k;
+		}
+	}
+
+	// not a cluster yet, keep what is known
+	if (nodes.empty())
+		return;
+
+	nodes_.swap(nodes);
+	slots_.swap(slots);
+}
+
+static void __cluster_request(const std::shared_ptr<WFRedisClusterState>& state,
+							  const std::string& command,
+							  const std::vector<std::string>& params,
+							  redis_result_t&& on_result)
+{
+	auto run = [&state, &command](int slot, std::vector<std::string>& params,
+								  redis_result_t&& on_result) {
+		auto cmd = std::make_shared<WFRedisClusterCommand>();
+
+		cmd->command = command;
+		cmd->params = std::move(params);
+		cmd->slot = slot;
+		cmd->redirects = 0;
+		cmd->on_result = std::move(on_result);
+		state->execute(std::move(cmd));
+	};
+
+	if (WFRedisSplit::start(command, params, WFRedisClusterClient::slot_of,
+							run, std::move(on_result)))
+	{
+		return;
+	}
+
+	std::vector<std::string> all(params);
+
+	run(__command_slot(command, params), all, std::move(on_result));
+}
+
+WFRedisClusterClient::WFRedisClusterClient(const std::vector<std::string>& seeds,
+										   const struct WFRedisClusterParams *params):
+	state_(std::make_shared<WFRedisClusterState>(seeds, params))
+{
+	state_->refresh();
+}
+
+void WFRedisClusterClient::default_retry_max(int n)
+{
+	state_->retry_max = n;
+}
+
+void WFRedisClusterClient::default_send_timeout(int timeout)
+{
+	state_->send_timeout = timeout;
+}
+
+void WFRedisClusterClient::default_recv_timeout(int timeout)
+{
+	state_->recv_timeout = timeout;
+}
+
+WFFuture<WFRedisResult> WFRedisClusterClient::async_request(const std::string& command,
+															const std::vector<std::string>& params)
+{
+	auto *pr = new WFPromise<WFRedisResult>();
+	auto fr = pr->get_future();
+
+	__cluster_request(state_, command, params, [pr](WFRedisResult& res) {
+		pr->set_value(std::move(res));
+		delete pr;
+	});
+
+	return fr;
+}
+
+WFRedisResult WFRedisClusterClient::sync_request(const std::string& command,
+												 const std::vector<std::string>& params)
+{
+	return this->async_request(command, params).get();
+}
+
+void WFRedisClusterClient::request(const std::string& command,
+								   const std::vector<std::string>& params,
+								   WFRedisClient::ON_COMPLETE on_complete)
+{
+	__cluster_request(state_, command, params, [on_complete](WFRedisResult& res) {
+		if (on_complete)
+			on_complete(res);
+	});
+}
+
+std::string WFRedisClusterClient::node_of(unsigned int slot) const
+{
+	return state_->node_of((int)slot);
+}
+
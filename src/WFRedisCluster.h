@@ -0,0 +1,98 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREDISCLUSTER_H_
+#define _WFREDISCLUSTER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <workflow/WFFuture.h>
+#include "WFRedisClient.h"
+
+/**
+ * @file   WFRedisCluster.h
+ * @brief  Redis Cluster client with slot routing
+ */
+
+#define REDIS_CLUSTER_SLOTS		16384
+
+struct WFRedisClusterParams
+{
+	int max_redirects;		// MOVED and ASK followed by one command
+	int refresh_interval;	// ms between two topology refreshes at least
+};
+
+static constexpr struct WFRedisClusterParams REDIS_CLUSTER_PARAMS_DEFAULT =
+{
+	.max_redirects		=	5,
+	.refresh_interval	=	1000,
+};
+
+class WFRedisClusterState;
+
+// The slot map comes from CLUSTER SLOTS of a seed or a known node, asked
+// at start, after every MOVED and after failed tasks, at most once a
+// refresh_interval. A command goes to the master of the slot of its key,
+// or to any node if its slot is not known yet, a MOVED then updates the
+// slot and the command follows it. An ASK is followed once by ASKING and
+// the command in one pipeline, the slot map is kept.
+//
+// MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys of many slots are
+// split by slot into parallel commands, and the results are merged in
+// the order of the keys. The first failure of them is the result.
+//
+// The userinfo of the first seed is used for every node, such as
+// "redis://:password@10.0.0.1:6379". Thread safe.
+class WFRedisClusterClient
+{
+public:
+	WFRedisClusterClient(const std::vector<std::string>& seeds,
+						 const struct WFRedisClusterParams *params =
+							&REDIS_CLUSTER_PARAMS_DEFAULT);
+
+	void default_retry_max(int n);
+	void default_send_timeout(int timeout);
+	void default_recv_timeout(int timeout);
+
+	//sync
+	WFRedisResult sync_request(const std::string& command,
+							   const std::vector<std::string>& params);
+
+	//async future
+	WFFuture<WFRedisResult> async_request(const std::string& command,
+										  const std::vector<std::string>& params);
+
+	//async
+	void request(const std::string& command,
+				 const std::vector<std::string>& params,
+				 WFRedisClient::ON_COMPLETE on_complete);
+
+	// "host:port" of the master of slot, empty if not known
+	std::string node_of(unsigned int slot) const;
+
+	// CRC16 of the key, or of its {hash tag}, mod REDIS_CLUSTER_SLOTS
+	static unsigned int slot_of(const std::string& key);
+
+private:
+	std::shared_ptr<WFRedisClusterState> state_;
+};
+
+#endif
+
@@ -0,0 +1,297 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFRedisPipeline.h"
+#include "WFRedisNearCache.h"
+
+using namespace protocol;
+
+#define NEAR_CACHE_INVALIDATE_CHANNEL	"__redis__:invalidate"
+
+static long long __monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+WFRedisNearCache::WFRedisNearCache(const ParsedURI& uri,
+								   const struct WFRedisNearCacheParams *params):
+	params_(*params),
+	uri_(uri),
+	id_(-1),
+	next_id_(-1)
+{
+	char buf[100];
+
+	snprintf(buf, sizeof buf, "__near_cache__:%d:%p:%lld",
+			 (int)getpid(), (void *)this, __monotonic_ms());
+	channel_ = buf;
+	memset(&stats_, 0, sizeof stats_);
+}
+
+// the subscriber gets this message, finds the cache gone and closes
+WFRedisNearCache::~WFRedisNearCache()
+{
+	auto *task = WFTaskFactory::create_redis_task(uri_, 0, nullptr);
+
+	task->get_req()->set_request("PUBLISH", {channel_, "closed"});
+	task->start();
+}
+
+// with mutex_ locked
+void WFRedisNearCache::erase(std::list<Entry>::iterator it)
+{
+	auto key = keys_.find(it->key);
+
+	key->second.erase(it->field);
+	if (key->second.empty())
+		keys_.erase(key);
+
+	lru_.erase(it);
+}
+
+bool WFRedisNearCache::get(const std::string& key, const std::string& field,
+						   RedisValue& value)
+{
+	long long now = __monotonic_ms();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto it = keys_.find(key);
+
+	if (it != keys_.end())
+	{
+		auto f = it->second.find(field);
+
+		if (f != it->second.end())
+		{
+			auto entry = f->second;
+
+			if (now < entry->expire_at)
+			{
+				lru_.splice(lru_.begin(), lru_, entry);
+				value = entry->value;
+				stats_.hits++;
+				return true;
+			}
+
+			erase(entry);
+			stats_.evictions++;
+		}
+	}
+
+	stats_.misses++;
+	return false;
+}
+
+long long WFRedisNearCache::tracking_id() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	return id_;
+}
+
+void WFRedisNearCache::fill_begin(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	fills_[key].count++;
+}
+
+void WFRedisNearCache::fill_end(const std::string& key, const std::string& field,
+								const RedisValue *value)
+{
+	long long expire_at = __monotonic_ms() + params_.ttl;
+	bool invalidated;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto fill = fills_.find(key);
+
+	invalidated = fill->second.invalidated;
+	if (--fill->second.count == 0)
+		fills_.erase(fill);
+
+	if (!value || invalidated || id_ < 0)
+		return;
+
+	Fields& fields = keys_[key];
+	auto f = fields.find(field);
+
+	if (f != fields.end())
+	{
+		f->second->value = *value;
+		f->second->expire_at = expire_at;
+		lru_.splice(lru_.begin(), lru_, f->second);
+		return;
+	}
+
+	lru_.push_front({key, field, *value, expire_at});
+	fields[field] = lru_.begin();
+	while (lru_.size() > params_.max_entries)
+	{
+		erase(std::prev(lru_.end()));
+		stats_.evictions++;
+	}
+}
+
+// with mutex_ locked
+void WFRedisNearCache::invalidate(const std::string& key)
+{
+	auto fill = fills_.find(key);
+	auto it = keys_.find(key);
+
+	stats_.invalidations++;
+	if (fill != fills_.end())
+		fill->second.invalidated = true;
+
+	if (it == keys_.end())
+		return;
+
+	for (auto& f : it->second)
+		lru_.erase(f.second);
+
+	keys_.erase(it);
+}
+
+// with mutex_ locked
+void WFRedisNearCache::flush()
+{
+	for (auto& fill : fills_)
+		fill.second.invalidated = true;
+
+	lru_.clear();
+	keys_.clear();
+	stats_.flushes++;
+}
+
+// the reply of CLIENT ID, then ["subscribe", channel, n] of both
+// channels, then ["message", channel, keys] of every invalidation
+bool WFRedisNearCache::on_push(const RedisValue& value)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (value.is_int())
+	{
+		next_id_ = value.int_value();
+		return true;
+	}
+
+	if (!value.is_array() || value.arr_size() < 3 ||
+		value[1].string_value() != NEAR_CACHE_INVALIDATE_CHANNEL)
+	{
+		return !value.is_error();
+	}
+
+	// invalidations come from now on
+	if (value[0].string_value() == "subscribe")
+	{
+		id_ = next_id_;
+		return true;
+	}
+
+	if (value[0].string_value() != "message")
+		return true;
+
+	const RedisValue& keys = value[2];
+
+	// FLUSHALL and FLUSHDB
+	if (keys.is_nil())
+		flush();
+	else if (keys.is_array())
+	{
+		for (size_t i = 0; i < keys.arr_size(); i++)
+			invalidate(keys[i].string_value());
+	}
+	else
+		invalidate(keys.string_value());
+
+	return true;
+}
+
+void WFRedisNearCache::subscribe(const std::weak_ptr<WFRedisNearCache>& weak)
+{
+	auto cache = weak.lock();
+
+	if (!cache)
+		return;
+
+	auto *task = WFRedisPipelineTaskFactory::create_task(cache->uri_, 0,
+		[weak](WFRedisPipelineTask *) { subscriber_done(weak); });
+	auto *req = task->get_req();
+
+	req->add_request("CLIENT", {"ID"});
+	req->add_request("SUBSCRIBE", {NEAR_CACHE_INVALIDATE_CHANNEL, cache->channel_});
+	// only the replies of AUTH and SELECT are expected, the rest are pushed
+	task->get_resp()->expect(req->setup_size(), req->setup_size());
+	task->get_resp()->set_push_handler([weak](const RedisValue& value) {
+		auto cache = weak.lock();
+
+		return cache && cache->on_push(value);
+	});
+
+	// a subscribed connection is never used again
+	task->set_receive_timeout(-1);
+	task->set_keep_alive(0);
+	task->start();
+}
+
+// what was tracked by the lost connection may be stale
+void WFRedisNearCache::subscriber_done(const std::weak_ptr<WFRedisNearCache>& weak)
+{
+	auto cache = weak.lock();
+
+	if (!cache)
+		return;
+
+	cache->mutex_.lock();
+	cache->id_ = -1;
+	cache->next_id_ = -1;
+	cache->flush();
+	cache->mutex_.unlock();
+
+	auto *timer = WFTaskFactory::create_timer_task(
+		(unsigned int)cache->params_.retry_interval * 1000,
+		[weak](WFTimerTask *) { subscribe(weak); });
+
+	timer->start();
+}
+
+void WFRedisNearCache::start()
+{
+	subscribe(shared_from_this());
+}
+
+void WFRedisNearCache::get_stats(struct WFRedisNearCacheStats *stats) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	unsigned long long reads;
+
+	*stats = stats_;
+	stats->entries = lru_.size();
+	reads = stats_.hits + stats_.misses;
+	stats->hit_ratio = reads ? (double)stats_.hits / reads : 0;
+}
+
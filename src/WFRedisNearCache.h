@@ -0,0 +1,136 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREDISNEARCACHE_H_
+#define _WFREDISNEARCACHE_H_
+
+#include <stddef.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <workflow/RedisMessage.h>
+#include <workflow/URIParser.h>
+
+/**
+ * @file   WFRedisNearCache.h
+ * @brief  Client side cache of redis reads, invalidated by the server
+ */
+
+struct WFRedisNearCacheParams
+{
+	size_t max_entries;		// least recently used are evicted
+	int ttl;				// ms, bounds an entry whose invalidation is lost
+	int retry_interval;		// ms to subscribe again after a lost connection
+};
+
+static constexpr struct WFRedisNearCacheParams REDIS_NEAR_CACHE_PARAMS_DEFAULT =
+{
+	.max_entries		=	100000,
+	.ttl				=	60 * 1000,
+	.retry_interval		=	1000,
+};
+
+struct WFRedisNearCacheStats
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long invalidations;	// keys invalidated by the server
+	unsigned long long evictions;		// by max_entries or ttl
+	unsigned long long flushes;			// lost connection or FLUSHALL
+	size_t entries;
+	double hit_ratio;					// hits / (hits + misses)
+};
+
+// CLIENT TRACKING in the RESP2 redirect mode, RESP3 is not parsed by
+// workflow. One connection of its own subscribes __redis__:invalidate,
+// and a miss is read in a pipeline after CLIENT TRACKING ON REDIRECT to
+// that connection, so the server tells when the key changes.
+//
+// Nothing is cached before the subscription is made, and all is flushed
+// when its connection is lost. A read that meets an invalidation of its
+// key on the way is not stored.
+// Always owned by a shared_ptr, see WFRedisClient::set_near_cache().
+class WFRedisNearCache : public std::enable_shared_from_this<WFRedisNearCache>
+{
+public:
+	// field is the command and its params after the key, "GET" or "HGET f"
+	bool get(const std::string& key, const std::string& field,
+			 protocol::RedisValue& value);
+
+	// CLIENT ID of the invalidation connection, -1 before subscribed
+	long long tracking_id() const;
+
+	// around a read of a miss, value is NULL if the read failed
+	void fill_begin(const std::string& key);
+	void fill_end(const std::string& key, const std::string& field,
+				  const protocol::RedisValue *value);
+
+	void get_stats(struct WFRedisNearCacheStats *stats) const;
+
+	// subscribe, again after every lost connection
+	void start();
+
+public:
+	WFRedisNearCache(const ParsedURI& uri, const struct WFRedisNearCacheParams *params);
+	~WFRedisNearCache();
+
+	WFRedisNearCache(const WFRedisNearCache&) = delete;
+	WFRedisNearCache& operator= (const WFRedisNearCache&) = delete;
+
+private:
+	struct Entry
+	{
+		std::string key;
+		std::string field;
+		protocol::RedisValue value;
+		long long expire_at;	// ms
+	};
+
+	using Fields = std::unordered_map<std::string, std::list<Entry>::iterator>;
+
+	struct Fill
+	{
+		int count;				// reads in flight
+		bool invalidated;
+	};
+
+private:
+	bool on_push(const protocol::RedisValue& value);
+	void invalidate(const std::string& key);
+	void flush();
+	void erase(std::list<Entry>::iterator it);
+	static void subscribe(const std::weak_ptr<WFRedisNearCache>& weak);
+	static void subscriber_done(const std::weak_ptr<WFRedisNearCache>& weak);
+
+private:
+	struct WFRedisNearCacheParams params_;
+	ParsedURI uri_;
+	std::string channel_;		// wakes the subscriber up when the cache is gone
+	long long id_;
+	long long next_id_;			// CLIENT ID, in use once subscribed
+	std::list<Entry> lru_;		// most recent first
+	std::unordered_map<std::string, Fields> keys_;
+	std::unordered_map<std::string, Fill> fills_;
+	struct WFRedisNearCacheStats stats_;
+	mutable std::mutex mutex_;
+};
+
+#endif
+
@@ -0,0 +1,327 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <workflow/StringUtil.h>
+#include "WFRedisPipeline.h"
+
+using namespace protocol;
+
+// iovecs of one encoded command
+#define PIPELINE_COMMAND_IOV	8
+
+// encode() and append() are protected, borrow them
+class __RedisMessageAccess : public RedisMessage
+{
+public:
+	static int encode_to(RedisMessage *msg, struct iovec vectors[], int max)
+	{
+		int (RedisMessage::*fn)(struct iovec *, int) = &__RedisMessageAccess::encode;
+
+		return (msg->*fn)(vectors, max);
+	}
+
+	static int feed(RedisMessage *msg, const void *buf, size_t *size)
+	{
+		int (RedisMessage::*fn)(const void *, size_t *) = &__RedisMessageAccess::append;
+
+		return (msg->*fn)(buf, size);
+	}
+};
+
+void WFRedisPipelineRequest::add_request(const std::string& command,
+										 const std::vector<std::string>& params)
+{
+	requests_.emplace_back();
+	requests_.back().set_request(command, params);
+}
+
+size_t WFRedisPipelineRequest::add_setup(const ParsedURI& uri)
+{
+	size_t n = 0;
+
+	if (uri.userinfo && *uri.userinfo)
+	{
+		std::string user = uri.userinfo;
+		size_t pos = user.find(':');
+		std::string pass;
+
+		if (pos != std::string::npos)
+		{
+			pass = user.substr(pos + 1);
+			user.resize(pos);
+		}
+
+		StringUtil::url_decode(user);
+		StringUtil::url_decode(pass);
+		if (!pass.empty())
+		{
+			if (user.empty())
+				add_request("AUTH", {pass});
+			else
+				add_request("AUTH", {user, pass});
+
+			n++;
+		}
+	}
+
+	if (uri.path && uri.path[0] == '/' && atoi(uri.path + 1) > 0)
+	{
+		add_request("SELECT", {std::to_string(atoi(uri.path + 1))});
+		n++;
+	}
+
+	setup_size_ += n;
+	return n;
+}
+
+int WFRedisPipelineRequest::encode(struct iovec vectors[], int max)
+{
+	struct iovec iov[PIPELINE_COMMAND_IOV];
+	int n;
+
+	if (max < 1)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	// one buffer, so the number of commands is not bound by max
+	buf_.clear();
+	for (RedisRequest& req : requests_)
+	{
+		n = __RedisMessageAccess::encode_to(&req, iov, PIPELINE_COMMAND_IOV);
+		if (n < 0)
+			return -1;
+
+		for (int i = 0; i < n; i++)
+			buf_.append((const char *)iov[i].iov_base, iov[i].iov_len);
+	}
+
+	vectors[0].iov_base = (void *)buf_.c_str();
+	vectors[0].iov_len = buf_.size();
+	return 1;
+}
+
+void WFRedisPipelineResponse::expect(size_t n, size_t skip)
+{
+	responses_.clear();
+	responses_.resize(n);
+	skip_ = skip;
+	done_ = 0;
+}
+
+// a reply ends inside buf, the rest goes to the next one
+int WFRedisPipelineResponse::append(const void *buf, size_t *size)
+{
+	const char *p = (const char *)buf;
+	size_t left = *size;
+	size_t n;
+	int ret;
+
+	while (done_ < responses_.size())
+	{
+		n = left;
+		ret = __RedisMessageAccess::feed(&responses_[done_], p, &n);
+		if (ret <= 0)
+			return ret;
+
+		// n is what the reply took
+		done_++;
+		p += n;
+		left -= n;
+		if (left == 0 && done_ < responses_.size())
+			return 0;
+	}
+
+	if (push_handler_)
+	{
+		n = left;
+		ret = append_push(p, &n);
+		if (ret <= 0)
+			return ret;
+
+		left -= n;
+	}
+
+	*size -= left;
+	return 1;
+}
+
+// 1 once the handler is done, n is then what its replies took
+int WFRedisPipelineResponse::append_push(const char *buf, size_t *size)
+{
+	protocol::RedisValue value;
+	size_t left = *size;
+	size_t n;
+	int ret;
+	bool more;
+
+	while (left > 0)
+	{
+		n = left;
+		ret = __RedisMessageAccess::feed(&push_, buf, &n);
+		if (ret <= 0)
+			return ret;
+
+		buf += n;
+		left -= n;
+		push_.get_result(value);
+		more = push_handler_(value);
+		push_ = RedisResponse();
+		if (!more)
+		{
+			*size -= left;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+bool WFRedisPipelineResponse::get_result(size_t i, RedisValue& value) const
+{
+	const RedisResponse& resp = responses_[skip_ + i];
+
+	return resp.parse_success() && resp.get_result(value);
+}
+
+bool WFRedisPipelineResponse::get_setup_error(RedisValue& value) const
+{
+	for (size_t i = 0; i < skip_; i++)
+	{
+		if (responses_[i].get_result(value) && value.is_error())
+			return true;
+	}
+
+	return false;
+}
+
+WFRedisPipelineTask *WFRedisPipelineTaskFactory::create_task(const ParsedURI& uri,
+															  int retry_max,
+															  redis_pipeline_callback_t callback)
+{
+	using factory = WFNetworkTaskFactory<WFRedisPipelineRequest, WFRedisPipelineResponse>;
+	TransportType type = TT_TCP;
+	ParsedURI u(uri);
+	WFRedisPipelineTask *task;
+
+	if (u.state == URI_STATE_SUCCESS)
+	{
+		if (strcasecmp(u.scheme, "rediss") == 0)
+			type = TT_TCP_SSL;
+
+		if (!u.port || !*u.port)
+		{
+			free(u.port);
+			u.port = strdup("6379");
+		}
+	}
+
+	task = factory::create_client_task(type, u, retry_max, std::move(callback));
+	task->get_req()->add_setup(u);
+	return task;
+}
+
+void WFRedisPipelineTaskFactory::seal(WFRedisPipelineTask *task)
+{
+	const auto *req = task->get_req();
+
+	task->get_resp()->expect(req->size(), req->setup_size());
+}
+
+WFRedisAutoPipeline::WFRedisAutoPipeline(const struct WFRedisAutoPipelineParams *params,
+										 flush_t flush):
+	params_(*params),
+	flush_(std::move(flush)),
+	timer_running_(false)
+{
+	memset(&stats_, 0, sizeof stats_);
+}
+
+void WFRedisAutoPipeline::request(Command&& cmd)
+{
+	std::vector<Command> batch;
+
+	mutex_.lock();
+	pending_.push_back(std::move(cmd));
+	if ((int)pending_.size() >= params_.max_batch)
+	{
+		// the timer running finds what comes after
+		batch.swap(pending_);
+		mutex_.unlock();
+		return flush(batch);
+	}
+
+	if (timer_running_)
+	{
+		mutex_.unlock();
+		return;
+	}
+
+	timer_running_ = true;
+	mutex_.unlock();
+
+	auto self = shared_from_this();
+	auto *timer = WFTaskFactory::create_timer_task((unsigned int)params_.window,
+		[self](WFTimerTask *) { self->timer_done(); });
+
+	timer->start();
+}
+
+void WFRedisAutoPipeline::timer_done()
+{
+	std::vector<Command> batch;
+
+	mutex_.lock();
+	batch.swap(pending_);
+	timer_running_ = false;
+	mutex_.unlock();
+
+	if (!batch.empty())
+		flush(batch);
+}
+
+void WFRedisAutoPipeline::flush(std::vector<Command>& batch)
+{
+	size_t n = batch.size();
+	int i = 0;
+
+	while (i < AUTO_PIPELINE_BUCKETS - 1 && n >= (2UL << i))
+		i++;
+
+	mutex_.lock();
+	stats_.commands += n;
+	stats_.batches++;
+	stats_.batch_sizes[i]++;
+	mutex_.unlock();
+
+	flush_(batch);
+}
+
+void WFRedisAutoPipeline::get_stats(struct WFRedisAutoPipelineStats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	*stats = stats_;
+}
+
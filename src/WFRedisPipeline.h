@@ -0,0 +1,188 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREDISPIPELINE_H_
+#define _WFREDISPIPELINE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <workflow/RedisMessage.h>
+#include <workflow/URIParser.h>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFRedisPipeline.h
+ * @brief  Many redis commands in one write, replies read in order
+ */
+
+// The commands are encoded into one buffer and written at once.
+class WFRedisPipelineRequest : public protocol::ProtocolMessage
+{
+public:
+	void add_request(const std::string& command,
+					 const std::vector<std::string>& params);
+	// add AUTH and SELECT of uri, return how many
+	size_t add_setup(const ParsedURI& uri);
+	size_t size() const { return requests_.size(); }
+	size_t setup_size() const { return setup_size_; }
+
+protected:
+	virtual int encode(struct iovec vectors[], int max);
+
+private:
+	std::vector<protocol::RedisRequest> requests_;
+	std::string buf_;
+	size_t setup_size_;
+
+public:
+	WFRedisPipelineRequest():
+		setup_size_(0)
+	{}
+};
+
+// Each reply is parsed by its own RedisResponse from the bytes it spans,
+// nothing is copied before get_result().
+class WFRedisPipelineResponse : public protocol::ProtocolMessage
+{
+public:
+	// n replies to read, the first skip are of the connection setup
+	void expect(size_t n, size_t skip);
+	// replies of the commands
+	size_t size() const { return responses_.size() - skip_; }
+	bool get_result(size_t i, protocol::RedisValue& value) const;
+	// the error reply of a setup command, such as a failed AUTH
+	bool get_setup_error(protocol::RedisValue& value) const;
+
+	using push_handler_t = std::function<bool (const protocol::RedisValue& value)>;
+
+	// every reply after those expected, such as the messages of SUBSCRIBE,
+	// goes to handler in the network thread. The response is complete when
+	// the handler returns false, so set a receive timeout of -1.
+	void set_push_handler(push_handler_t handler)
+	{
+		push_handler_ = std::move(handler);
+	}
+
+protected:
+	virtual int append(const void *buf, size_t *size);
+
+public:
+	WFRedisPipelineResponse():
+		skip_(0),
+		done_(0)
+	{}
+
+private:
+	int append_push(const char *buf, size_t *size);
+
+private:
+	std::vector<protocol::RedisResponse> responses_;
+	size_t skip_;
+	size_t done_;
+	push_handler_t push_handler_;
+	protocol::RedisResponse push_;
+};
+
+using WFRedisPipelineTask = WFNetworkTask<WFRedisPipelineRequest,
+										  WFRedisPipelineResponse>;
+using redis_pipeline_callback_t = std::function<void (WFRedisPipelineTask *)>;
+
+class WFRedisPipelineTaskFactory
+{
+public:
+	// A pipeline is not a redis task, so its connection is not set up by
+	// workflow. The AUTH and SELECT of uri go first in every pipeline.
+	// Add the commands to the request, then seal() the task before start.
+	static WFRedisPipelineTask *create_task(const ParsedURI& uri, int retry_max,
+											redis_pipeline_callback_t callback);
+	// the response expects the replies of every command added
+	static void seal(WFRedisPipelineTask *task);
+};
+
+// batch i of the histogram has [2^i, 2^(i+1)) commands, the last has more
+#define AUTO_PIPELINE_BUCKETS	16
+
+struct WFRedisAutoPipelineParams
+{
+	int window;			// us to wait for more commands after the first
+	int max_batch;		// a batch of this many is sent at once
+};
+
+static constexpr struct WFRedisAutoPipelineParams REDIS_AUTO_PIPELINE_PARAMS_DEFAULT =
+{
+	.window			=	200,
+	.max_batch		=	128,
+};
+
+struct WFRedisAutoPipelineStats
+{
+	unsigned long long commands;
+	unsigned long long batches;
+	unsigned long long batch_sizes[AUTO_PIPELINE_BUCKETS];
+};
+
+struct WFRedisResult;
+struct WFRedisClientOptions;
+
+// Commands of many threads to one server are gathered for a window, or
+// until max_batch of them, and flushed as one pipeline. flush() gives
+// every command its own result.
+// Always owned by a shared_ptr, a pending window keeps it alive.
+class WFRedisAutoPipeline : public std::enable_shared_from_this<WFRedisAutoPipeline>
+{
+public:
+	struct Command
+	{
+		std::string command;
+		std::vector<std::string> params;
+		std::function<void (WFRedisResult&)> callback;
+		// of the client when sent, a batch is flushed with its newest
+		std::shared_ptr<const WFRedisClientOptions> opts;
+	};
+
+	using flush_t = std::function<void (std::vector<Command>& batch)>;
+
+	void request(Command&& cmd);
+	void get_stats(struct WFRedisAutoPipelineStats *stats);
+
+public:
+	WFRedisAutoPipeline(const struct WFRedisAutoPipelineParams *params,
+						flush_t flush);
+
+	WFRedisAutoPipeline(const WFRedisAutoPipeline&) = delete;
+	WFRedisAutoPipeline& operator= (const WFRedisAutoPipeline&) = delete;
+
+private:
+	void flush(std::vector<Command>& batch);
+	void timer_done();
+
+private:
+	struct WFRedisAutoPipelineParams params_;
+	flush_t flush_;
+	std::vector<Command> pending_;
+	bool timer_running_;
+	std::mutex mutex_;
+	struct WFRedisAutoPipelineStats stats_;
+};
+
+#endif
+
@@ -0,0 +1,384 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <openssl/evp.h>
+#include <workflow/URIParser.h>
+#include "WFRedisShard.h"
+#include "WFRedisSplit.h"
+
+using redis_result_t = std::function<void (WFRedisResult&)>;
+
+struct WFRedisShardServer
+{
+	std::string url;
+	WFRedisClient client;
+	std::atomic<int> fails;						// in a row
+	std::atomic<long long> eject_until;			// ms
+	std::atomic<unsigned long long> requests;
+	std::atomic<unsigned long long> failures;
+	std::atomic<unsigned long long> ejections;
+
+	WFRedisShardServer(const std::string& url):
+		url(url),
+		client(url),
+		fails(0),
+		eject_until(0),
+		requests(0),
+		failures(0),
+		ejections(0)
+	{}
+};
+
+// replaced as a whole, requests keep the one they started with
+struct WFRedisShardRing
+{
+	std::vector<std::shared_ptr<WFRedisShardServer>> servers;
+	std::vector<std::pair<uint32_t, size_t>> points;	// sorted, index of server
+};
+
+class WFRedisShardState
+{
+public:
+	void set_servers(const std::vector<std::string>& urls);
+	void set_defaults(int retry_max, int send_timeout, int recv_timeout);
+	void release(WFRedisShardServer *server, bool success);
+
+	std::shared_ptr<const WFRedisShardRing> get_ring() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		return ring_;
+	}
+
+public:
+	WFRedisShardState(const struct WFRedisShardParams *params):
+		params_(*params),
+		ring_(std::make_shared<WFRedisShardRing>()),
+		retry_max_(0),
+		send_timeout_(-1),
+		recv_timeout_(-1)
+	{}
+
+private:
+	struct WFRedisShardParams params_;
+	std::shared_ptr<const WFRedisShardRing> ring_;
+	int retry_max_;
+	int send_timeout_;
+	int recv_timeout_;
+	mutable std::mutex mutex_;
+};
+
+static long long __now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void __md5(const char *buf, size_t len, unsigned char digest[16])
+{
+	EVP_Digest(buf, len, digest, NULL, EVP_md5(), NULL);
+}
+
+// the h-th of the four points of a digest, as ketama
+static inline uint32_t __point(const unsigned char digest[16], int h)
+{
+	return ((uint32_t)digest[3 + h * 4] << 24) |
+		   ((uint32_t)digest[2 + h * 4] << 16) |
+		   ((uint32_t)digest[1 + h * 4] << 8) |
+		   digest[h * 4];
+}
+
+// only a non-empty {hash tag} counts, as Redis Cluster
+static uint32_t __key_hash(const std::string& key)
+{
+	unsigned char digest[16];
+	size_t start = key.find('{');
+	size_t end;
+
+	if (start != std::string::npos)
+	{
+		end = key.find('}', start + 1);
+		if (end != std::string::npos && end > start + 1)
+		{
+			__md5(key.c_str() + start + 1, end - start - 1, digest);
+			return __point(digest, 0);
+		}
+	}
+
+	__md5(key.c_str(), key.size(), digest);
+	return __point(digest, 0);
+}
+
+// "host:port/db", the password does not move keys
+static std::string __server_name(const std::string& url)
+{
+	std::string name;
+	ParsedURI uri;
+
+	if (URIParser::parse(url, uri) < 0 || !uri.host)
+		return url;
+
+	name = std::string(uri.host) + ":" + (uri.port && *uri.port ? uri.port : "6379");
+	if (uri.path && uri.path[0] == '/' && atoi(uri.path + 1) > 0)
+		name += "/" + std::to_string(atoi(uri.path + 1));
+
+	return name;
+}
+
+// the first server after hash not ejected, or the first of all if none
+static size_t __locate(const WFRedisShardRing& ring, uint32_t hash, long long now)
+{
+	const auto& points = ring.points;
+	size_t n = points.size();
+	size_t start;
+
+	start = std::lower_bound(points.begin(), points.end(),
+							 std::make_pair(hash, (size_t)0)) - points.begin();
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = points[(start + k) % n].second;
+
+		if (ring.servers[i]->eject_until <= now)
+			return i;
+	}
+
+	return points[start % n].second;
+}
+
+void WFRedisShardState::set_servers(const std::vector<std::string>& urls)
+{
+	auto ring = std::make_shared<WFRedisShardRing>();
+	int digests = params_.vnodes / 4 > 0 ? params_.vnodes / 4 : 1;
+	unsigned char digest[16];
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	for (const std::string& url : urls)
+	{
+		std::shared_ptr<WFRedisShardServer> server;
+		std::string name = __server_name(url);
+
+		for (const auto& old : ring_->servers)
+		{
+			if (old->url == url)
+			{
+				server = old;
+				break;
+			}
+		}
+
+		if (!server)
+		{
+			server = std::make_shared<WFRedisShardServer>(url);
+			server->client.default_retry_max(retry_max_);
+			server->client.default_send_timeout(send_timeout_);
+			server->client.default_recv_timeout(recv_timeout_);
+		}
+
+		for (int i = 0; i < digests; i++)
+		{
+			std::string point = name + "-" + std::to_string(i);
+
+			__md5(point.c_str(), point.size(), digest);
+			for (int h = 0; h < 4; h++)
+				ring->points.emplace_back(__point(digest, h), ring->servers.size());
+		}
+
+		ring->servers.push_back(std::move(server));
+	}
+
+	std::sort(ring->points.begin(), ring->points.end());
+	ring_ = std::move(ring);
+}
+
+void WFRedisShardState::set_defaults(int retry_max, int send_timeout, int recv_timeout)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	retry_max_ = retry_max;
+	send_timeout_ = send_timeout;
+	recv_timeout_ = recv_timeout;
+	for (const auto& server : ring_->servers)
+	{
+		server->client.default_retry_max(retry_max);
+		server->client.default_send_timeout(send_timeout);
+		server->client.default_recv_timeout(recv_timeout);
+	}
+}
+
+void WFRedisShardState::release(WFRedisShardServer *server, bool success)
+{
+	long long now = __now_ms();
+
+	if (success)
+	{
+		server->fails = 0;
+		return;
+	}
+
+	server->failures++;
+	// failures of tasks sent before the ejection do not count
+	if (++server->fails < params_.max_fails || now < server->eject_until)
+		return;
+
+	server->eject_until = now + params_.eject_time;
+	server->fails = 0;
+	server->ejections++;
+}
+
+static void __shard_request(const std::shared_ptr<WFRedisShardState>& state,
+							const std::string& command,
+							const std::vector<std::string>& params,
+							redis_result_t&& on_result)
+{
+	std::shared_ptr<const WFRedisShardRing> ring = state->get_ring();
+	long long now = __now_ms();
+	const std::string *key;
+
+	if (ring->points.empty())
+	{
+		WFRedisResult res;
+
+		res.seqid = -1;
+		res.task_state = WFT_STATE_SYS_ERROR;
+		res.task_error = EINVAL;
+		res.success = false;
+		return on_result(res);
+	}
+
+	auto run = [&state, &ring, &command](int i, std::vector<std::string>& params,
+										 redis_result_t&& on_result) {
+		std::shared_ptr<WFRedisShardServer> server = ring->servers[i];
+		redis_result_t cb = std::move(on_result);
+
+		server->requests++;
+		server->client.request(command, params, [state, server, cb](WFRedisResult& res) {
+			state->release(server.get(), res.task_state == WFT_STATE_SUCCESS);
+			cb(res);
+		});
+	};
+
+	auto group_of = [&ring, now](const std::string& key) {
+		return (int)__locate(*ring, __key_hash(key), now);
+	};
+
+	if (WFRedisSplit::start(command, params, group_of, run, std::move(on_result)))
+		return;
+
+	key = WFRedisSplit::first_key(command, params);
+	std::vector<std::string> all(params);
+
+	run((int)__locate(*ring, key ? __key_hash(*key) : 0, now), all,
+		std::move(on_result));
+}
+
+WFRedisShardClient::WFRedisShardClient(const std::vector<std::string>& urls,
+									   const struct WFRedisShardParams *params):
+	state_(std::make_shared<WFRedisShardState>(params)),
+	retry_max_(0),
+	send_timeout_(-1),
+	recv_timeout_(-1)
+{
+	state_->set_servers(urls);
+}
+
+void WFRedisShardClient::set_servers(const std::vector<std::string>& urls)
+{
+	state_->set_servers(urls);
+}
+
+void WFRedisShardClient::default_retry_max(int n)
+{
+	retry_max_ = n;
+	state_->set_defaults(retry_max_, send_timeout_, recv_timeout_);
+}
+
+void WFRedisShardClient::default_send_timeout(int timeout)
+{
+	send_timeout_ = timeout;
+	state_->set_defaults(retry_max_, send_timeout_, recv_timeout_);
+}
+
+void WFRedisShardClient::default_recv_timeout(int timeout)
+{
+	recv_timeout_ = timeout;
+	state_->set_defaults(retry_max_, send_timeout_, recv_timeout_);
+}
+
+WFFuture<WFRedisResult> WFRedisShardClient::async_request(const std::string& command,
+														  const std::vector<std::string>& params)
+{
+	auto *pr = new WFPromise<WFRedisResult>();
+	auto fr = pr->get_future();
+
+	__shard_request(state_, command, params, [pr](WFRedisResult& res) {
+		pr->set_value(std::move(res));
+		delete pr;
+	});
+
+	return fr;
+}
+
+WFRedisResult WFRedisShardClient::sync_request(const std::string& command,
+											   const std::vector<std::string>& params)
+{
+	return this->async_request(command, params).get();
+}
+
+void WFRedisShardClient::request(const std::string& command,
+								 const std::vector<std::string>& params,
+								 WFRedisClient::ON_COMPLETE on_complete)
+{
+	__shard_request(state_, command, params, [on_complete](WFRedisResult& res) {
+		if (on_complete)
+			on_complete(res);
+	});
+}
+
+std::string WFRedisShardClient::server_of(const std::string& key) const
+{
+	std::shared_ptr<const WFRedisShardRing> ring = state_->get_ring();
+
+	if (ring->points.empty())
+		return "";
+
+	return ring->servers[__locate(*ring, __key_hash(key), __now_ms())]->url;
+}
+
+void WFRedisShardClient::get_stats(std::vector<struct WFRedisShardStats>& stats) const
+{
+	std::shared_ptr<const WFRedisShardRing> ring = state_->get_ring();
+	long long now = __now_ms();
+
+	stats.clear();
+	for (const auto& server : ring->servers)
+	{
+		stats.push_back({server->url, server->requests, server->failures,
+						 server->ejections, now < server->eject_until});
+	}
+}
+
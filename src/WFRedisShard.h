@@ -0,0 +1,113 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREDISSHARD_H_
+#define _WFREDISSHARD_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <workflow/WFFuture.h>
+#include "WFRedisClient.h"
+
+/**
+ * @file   WFRedisShard.h
+ * @brief  Redis servers sharded by a consistent hash ring of keys
+ */
+
+struct WFRedisShardParams
+{
+	int vnodes;			// points of a server on the ring
+	int max_fails;		// failed tasks in a row to eject a server
+	int eject_time;		// ms
+};
+
+static constexpr struct WFRedisShardParams REDIS_SHARD_PARAMS_DEFAULT =
+{
+	.vnodes			=	160,
+	.max_fails		=	3,
+	.eject_time		=	10000,
+};
+
+struct WFRedisShardStats
+{
+	std::string url;
+	unsigned long long requests;
+	unsigned long long failures;
+	unsigned long long ejections;
+	bool ejected;
+};
+
+class WFRedisShardState;
+
+// Ketama: every server has vnodes points on a ring of 32 bits, from the
+// MD5 of its "host:port/db", and a key belongs to the first point after
+// the MD5 of the key, or of its {hash tag}. Adding or removing a server
+// only moves the keys of its points.
+//
+// A server failing max_fails tasks in a row is skipped for eject_time,
+// its keys go to the next points of the ring meanwhile, so this is meant
+// for caches. If every server is ejected, the ring is used as it is.
+// Commands without a key go to the server of the start of the ring.
+//
+// MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys of many servers are
+// split into parallel commands, see WFRedisSplit.h. Each server is a
+// WFRedisClient of its url, with its AUTH and SELECT. Thread safe.
+class WFRedisShardClient
+{
+public:
+	WFRedisShardClient(const std::vector<std::string>& urls,
+					   const struct WFRedisShardParams *params =
+							&REDIS_SHARD_PARAMS_DEFAULT);
+
+	// servers staying keep their connections and stats
+	void set_servers(const std::vector<std::string>& urls);
+
+	void default_retry_max(int n);
+	void default_send_timeout(int timeout);
+	void default_recv_timeout(int timeout);
+
+	//sync
+	WFRedisResult sync_request(const std::string& command,
+							   const std::vector<std::string>& params);
+
+	//async future
+	WFFuture<WFRedisResult> async_request(const std::string& command,
+										  const std::vector<std::string>& params);
+
+	//async
+	void request(const std::string& command,
+				 const std::vector<std::string>& params,
+				 WFRedisClient::ON_COMPLETE on_complete);
+
+	// url of the server of key now, empty if there is none
+	std::string server_of(const std::string& key) const;
+
+	// in the order of the urls
+	void get_stats(std::vector<struct WFRedisShardStats>& stats) const;
+
+private:
+	std::shared_ptr<WFRedisShardState> state_;
+	int retry_max_;
+	int send_timeout_;
+	int recv_timeout_;
+};
+
+#endif
+
@@ -0,0 +1,280 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <map>
+#include <mutex>
+#include <memory>
+#include "WFRedisSplit.h"
+
+using namespace protocol;
+
+using redis_result_t = std::function<void (WFRedisResult&)>;
+
+enum
+{
+	SPLIT_MERGE_ARRAY,		// values in the order of the keys
+	SPLIT_MERGE_SUM,		// integers added up
+	SPLIT_MERGE_OK,
+};
+
+struct __split_command
+{
+	const char *command;
+	size_t step;				// params of one key
+	int merge;
+};
+
+static const struct __split_command *__find_split(const std::string& command)
+{
+	static const struct __split_command commands[] = {
+		{ "MGET",	1,	SPLIT_MERGE_ARRAY	},
+		{ "MSET",	2,	SPLIT_MERGE_OK	},
+		{ "DEL",	1,	SPLIT_MERGE_SUM	},
+		{ "UNLINK",	1,	SPLIT_MERGE_SUM	},
+		{ "EXISTS",	1,	SPLIT_MERGE_SUM	},
+		{ "TOUCH",	1,	SPLIT_MERGE_SUM	},
+	};
+
+	for (const auto& split : commands)
+	{
+		if (strcasecmp(command.c_str(), split.command) == 0)
+			return &split;
+	}
+
+	return NULL;
+}
+
+// the parts of a split command
+struct WFRedisSplitParts
+{
+	int merge;
+	size_t keys;
+	std::vector<std::vector<size_t>> positions;	// of the keys of each part
+	std::vector<WFRedisResult> results;
+	size_t left;
+	std::mutex mutex;
+	redis_result_t on_result;
+};
+
+static void __merge_results(WFRedisSplitParts *split, WFRedisResult& res)
+{
+	int64_t sum = 0;
+
+	for (WFRedisResult& part : split->results)
+	{
+		if (!part.success)
+		{
+			res = std::move(part);
+			return;
+		}
+	}
+
+	res.seqid = split->results[0].seqid;
+	res.task_state = WFT_STATE_SUCCESS;
+	res.task_error = 0;
+	res.success = true;
+
+	switch (split->merge)
+	{
+	case SPLIT_MERGE_ARRAY:
+		res.value.set_array(split->keys);
+		for (size_t i = 0; i < split->results.size(); i++)
+		{
+			const RedisValue& value = split->results[i].value;
+			const std::vector<size_t>& positions = split->positions[i];
+
+			if (!value.is_array() || value.arr_size() != positions.size())
+			{
+				res.value.set_error("ERR unexpected reply of a part");
+				res.success = false;
+				return;
+			}
+
+			for (size_t k = 0; k < positions.size(); k++)
+				res.value[positions[k]] = value[k];
+		}
+
+		break;
+
+	case SPLIT_MERGE_SUM:
+		for (const WFRedisResult& part : split->results)
+			sum += part.value.int_value();
+
+		res.value.set_int(sum);
+		break;
+
+	default:
+		res.value.set_status("OK");
+		break;
+	}
+}
+
+bool WFRedisSplit::start(const std::string& command,
+						 const std::vector<std::string>& params,
+						 const group_t& group_of, const run_t& run,
+						 redis_result_t&& on_result)
+{
+	const struct __split_command *split_cmd = __find_split(command);
+	std::map<int, size_t> parts;
+	std::vector<std::vector<std::string>> part_params;
+	std::shared_ptr<WFRedisSplitParts> split;
+
+	if (!split_cmd || params.empty() || params.size() % split_cmd->step != 0)
+		return false;
+
+	split = std::make_shared<WFRedisSplitParts>();
+	split->merge = split_cmd->merge;
+	split->keys = params.size() / split_cmd->step;
+	for (size_t i = 0; i < split->keys; i++)
+	{
+		const std::string *key = &params[i * split_cmd->step];
+		auto ret = parts.emplace(group_of(*key), parts.size());
+
+		if (ret.second)
+		{
+			part_params.emplace_back();
+			split->positions.emplace_back();
+		}
+
+		part_params[ret.first->second].insert(part_params[ret.first->second].end(),
+											  key, key + split_cmd->step);
+		split->positions[ret.first->second].push_back(i);
+	}
+
+	if (parts.size() <= 1)
+		return false;
+
+	split->results.resize(parts.size());
+	split->left = parts.size();
+	split->on_result = std::move(on_result);
+	for (const auto& part : parts)
+	{
+		size_t i = part.second;
+
+		run(part.first, part_params[i], [split, i](WFRedisResult& res) {
+			WFRedisResult merged;
+
+			split->mutex.lock();
+			split->results[i] = std::move(res);
+			if (--split->left > 0)
+			{
+				split->mutex.unlock();
+				return;
+			}
+
+			split->mutex.unlock();
+			__merge_results(split.get(), merged);
+			split->on_result(merged);
+		});
+	}
+
+	return true;
+}
+
+// the key of XREAD and XREADGROUP is the first after STREAMS,
+// GROUP takes 2 args, COUNT and BLOCK take 1
+static const std::string *__stream_key(const std::vector<std::string>& params)
+{
+	for (size_t i = 0; i < params.size(); i++)
+	{
+		const char *arg = params[i].c_str();
+
+		if (strcasecmp(arg, "STREAMS") == 0)
+			return i + 1 < params.size() ? &params[i + 1] : NULL;
+
+		if (strcasecmp(arg, "GROUP") == 0)
+			i += 2;
+		else if (strcasecmp(arg, "COUNT") == 0 || strcasecmp(arg, "BLOCK") == 0)
+			i++;
+	}
+
+	return NULL;
+}
+
+const std::string *WFRedisSplit::first_key(const std::string& command,
+										   const std::vector<std::string>& params)
+{
+	static const char *keyless[] = {
+		"PING", "ECHO", "INFO", "TIME", "DBSIZE", "CLUSTER", "CLIENT",
+		"CONFIG", "COMMAND", "SCRIPT", "FUNCTION", "RANDOMKEY", "KEYS",
+		"SCAN", "PUBLISH", "WAIT", "READONLY", "READWRITE"
+	};
+	// the key is not params[0], such as OBJECT ENCODING key
+	static const struct
+	{
+		const char *command;
+		size_t pos;
+	} positions[] = {
+		{ "OBJECT",		1 },	// OBJECT subcommand key
+		{ "MEMORY",		1 },	// MEMORY USAGE key
+		{ "XINFO",		1 },	// XINFO STREAM key
+		{ "XGROUP",		1 },	// XGROUP CREATE key group id
+		{ "BITOP",		1 },	// BITOP op destkey key...
+		{ "ZUNION",		1 },	// ZUNION numkeys key...
+		{ "ZINTER",		1 },
+		{ "ZDIFF",		1 },
+		{ "ZINTERCARD",	1 },
+		{ "SINTERCARD",	1 },
+		{ "LMPOP",		1 },	// LMPOP numkeys key...
+		{ "ZMPOP",		1 },
+		{ "BLMPOP",		2 },	// BLMPOP timeout numkeys key...
+		{ "BZMPOP",		2 },
+	};
+
+	for (const char *cmd : keyless)
+	{
+		if (strcasecmp(command.c_str(), cmd) == 0)
+			return NULL;
+	}
+
+	for (const auto& entry : positions)
+	{
+		// OBJECT HELP or MEMORY STATS has no key
+		if (strcasecmp(command.c_str(), entry.command) == 0)
+			return entry.pos < params.size() ? &params[entry.pos] : NULL;
+	}
+
+	if (strcasecmp(command.c_str(), "XREAD") == 0 ||
+		strcasecmp(command.c_str(), "XREADGROUP") == 0)
+	{
+		return __stream_key(params);
+	}
+
+	// EVAL script numkeys key...
+	if (strcasecmp(command.c_str(), "EVAL") == 0 ||
+		strcasecmp(command.c_str(), "EVALSHA") == 0 ||
+		strcasecmp(command.c_str(), "EVAL_RO") == 0 ||
+		strcasecmp(command.c_str(), "EVALSHA_RO") == 0 ||
+		strcasecmp(command.c_str(), "FCALL") == 0 ||
+		strcasecmp(command.c_str(), "FCALL_RO") == 0)
+	{
+		if (params.size() > 2 && atoi(params[1].c_str()) > 0)
+			return &params[2];
+
+		return NULL;
+	}
+
+	if (params.empty())
+		return NULL;
+
+	return &params[0];
+}
+
@@ -0,0 +1,60 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREDISSPLIT_H_
+#define _WFREDISSPLIT_H_
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "WFRedisClient.h"
+
+/**
+ * @file   WFRedisSplit.h
+ * @brief  Multi-key redis commands split by where their keys live
+ */
+
+// MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys of many groups,
+// such as cluster slots or shards, run as one command per group in
+// parallel. The results are merged in the order of the keys: an array
+// for MGET, OK for MSET and the sum for the others. The first failure of
+// the parts is the result.
+class WFRedisSplit
+{
+public:
+	using group_t = std::function<int (const std::string& key)>;
+	using run_t = std::function<void (int group, std::vector<std::string>& params,
+									  std::function<void (WFRedisResult&)>&& on_result)>;
+
+	// false and on_result untouched if the command is not split,
+	// run() is called for every group before it returns true
+	static bool start(const std::string& command,
+					  const std::vector<std::string>& params,
+					  const group_t& group_of, const run_t& run,
+					  std::function<void (WFRedisResult&)>&& on_result);
+
+	// the first key of a command, such as the key of GET, the first of
+	// EVAL, the key of OBJECT ENCODING or MEMORY USAGE and the first
+	// stream after STREAMS of XREAD. NULL for commands without a key such
+	// as PING or INFO
+	static const std::string *first_key(const std::string& command,
+										const std::vector<std::string>& params);
+};
+
+#endif
+
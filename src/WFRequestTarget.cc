@@ -0,0 +1,118 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <ctype.h>
+#include "WFRequestTarget.h"
+
+// space and control characters are never valid in request-target
+static inline bool __is_invalid(char c)
+{
+	return (unsigned char)c <= 0x20 || c == 0x7f;
+}
+
+static inline bool __is_scheme_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '+' || c == '-' || c == '.';
+}
+
+int WFRequestTargetParser::parse(const char *str, WFRequestTarget& target)
+{
+	const char *p = str;
+
+	if (!p || !*p)
+		return -1;
+
+	target.authority = "";
+	target.authority_len = 0;
+	if (*p != '/')
+	{
+		if (p[0] == '*' && p[1] == '\0')
+		{
+			target.path = p;
+			target.path_len = 1;
+			target.query = p + 1;
+			target.query_len = 0;
+			return 0;
+		}
+
+		// absolute-form, skip scheme and authority
+		while (__is_scheme_char(*p))
+			p++;
+
+		if (p == str || p[0] != ':' || p[1] != '/' || p[2] != '/')
+			return -1;
+
+		target.authority = p + 3;
+		for (p += 3; *p && *p != '/' && *p != '?' && *p != '#'; p++)
+		{
+			if (__is_invalid(*p))
+				return -1;
+		}
+
+		target.authority_len = p - target.authority;
+	}
+
+	target.path = p;
+	for (; *p && *p != '?' && *p != '#'; p++)
+	{
+		if (__is_invalid(*p))
+			return -1;
+	}
+
+	target.path_len = p - target.path;
+	if (*p == '?')
+		p++;
+
+	target.query = p;
+	for (; *p && *p != '#'; p++)
+	{
+		if (__is_invalid(*p))
+			return -1;
+	}
+
+	target.query_len = p - target.query;
+	if (target.path_len == 0)
+	{
+		target.path = "/";
+		target.path_len = 1;
+	}
+
+	return 0;
+}
+
+std::string WFRequestTargetParser::redirect_location(bool is_ssl,
+													 const char *host,
+													 size_t host_len,
+													 const WFRequestTarget& target)
+{
+	std::string location;
+
+	location.reserve(8 + host_len + target.path_len + 2 + target.query_len);
+	location.append(is_ssl ? "https://" : "http://");
+	location.append(host, host_len);
+	location.append(target.path, target.path_len);
+	location.push_back('/');
+	if (target.query_len > 0)
+	{
+		location.push_back('?');
+		location.append(target.query, target.query_len);
+	}
+
+	return location;
+}
+
@@ -0,0 +1,56 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFREQUESTTARGET_H_
+#define _WFREQUESTTARGET_H_
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * @file   WFRequestTarget.h
+ * @brief  Allocation-free parser for the request-target of a http request line
+ */
+
+// path and query point into the parsed string, nothing is copied or decoded
+struct WFRequestTarget
+{
+	const char *authority;//host[:port] of absolute-form, empty otherwise
+	size_t authority_len;
+	const char *path;//never empty, "/" if request-target has no path
+	size_t path_len;
+	const char *query;//without '?', empty if no query
+	size_t query_len;
+};
+
+class WFRequestTargetParser
+{
+public:
+	// accept origin-form "/path?query", absolute-form "http://host/path?query"
+	// and asterisk-form "*". fragment is dropped
+	// return 0 on success, -1 if str is not a valid request-target
+	static int parse(const char *str, WFRequestTarget& target);
+
+	// build "scheme://host/path/?query", used when answering 302
+	static std::string redirect_location(bool is_ssl,
+										 const char *host, size_t host_len,
+										 const WFRequestTarget& target);
+};
+
+#endif
+
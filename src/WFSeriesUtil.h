@@ -0,0 +1,68 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFSERIESUTIL_H_
+#define _WFSERIESUTIL_H_
+
+#include <utility>
+#include <functional>
+#include <workflow/Workflow.h>
+
+/**
+ * @file   WFSeriesUtil.h
+ * @brief  Run cleanups at the end of a series without taking its callback
+ */
+
+class WFSeriesUtil
+{
+public:
+	// fn runs when series ends, after the callback already set, so the
+	// wrapper who defers first sees the reply before the handler it wraps
+	// frees anything. The series of a server task ends after the reply is
+	// sent, handlers keep reply memory here and leave the callback of the
+	// server task to others.
+	static void defer(SeriesWork *series, std::function<void ()> fn);
+
+private:
+	class Access : public SeriesWork
+	{
+	public:
+		static series_callback_t& callback_of(SeriesWork *series)
+		{
+			series_callback_t SeriesWork::*member = &Access::callback;
+
+			return series->*member;
+		}
+	};
+};
+
+inline void WFSeriesUtil::defer(SeriesWork *series, std::function<void ()> fn)
+{
+	series_callback_t& callback = Access::callback_of(series);
+	series_callback_t prev = std::move(callback);
+
+	callback = [prev, fn](const SeriesWork *series) {
+		if (prev)
+			prev(series);
+
+		fn();
+	};
+}
+
+#endif
+
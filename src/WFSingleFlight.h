@@ -0,0 +1,128 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFSINGLEFLIGHT_H_
+#define _WFSINGLEFLIGHT_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+
+/**
+ * @file   WFSingleFlight.h
+ * @brief  Share one request among identical requests in flight
+ */
+
+struct WFSingleFlightStats
+{
+	unsigned long long requests;
+	unsigned long long shared;	// requests that joined one in flight
+	size_t in_flight;			// keys
+};
+
+// The first request of a key is sent, identical requests coming before
+// its result wait for it, and every one gets a copy of the same result.
+// A key is free again as soon as the result comes, so nothing is cached.
+// Always owned by a shared_ptr, running requests keep it alive.
+template<class RESULT>
+class WFSingleFlight : public std::enable_shared_from_this<WFSingleFlight<RESULT>>
+{
+public:
+	using callback_t = std::function<void (RESULT&)>;
+	// send the only request of a key, call done() once with its result
+	using start_t = std::function<void (callback_t done)>;
+	// fill the result of a waiter from the one of the request
+	using copy_t = void (*)(const RESULT& from, RESULT& to);
+
+	void request(const std::string& key, const start_t& start, callback_t callback)
+	{
+		auto self = this->shared_from_this();
+
+		mutex_.lock();
+		requests_++;
+		auto ret = flights_.emplace(key, std::vector<callback_t>());
+
+		ret.first->second.push_back(std::move(callback));
+		if (!ret.second)
+		{
+			shared_++;
+			mutex_.unlock();
+			return;
+		}
+
+		mutex_.unlock();
+		start([self, key](RESULT& res) { self->finish(key, res); });
+	}
+
+	void get_stats(struct WFSingleFlightStats *stats)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		stats->requests = requests_;
+		stats->shared = shared_;
+		stats->in_flight = flights_.size();
+	}
+
+public:
+	WFSingleFlight(copy_t copy):
+		copy_(copy),
+		requests_(0),
+		shared_(0)
+	{}
+
+	WFSingleFlight(const WFSingleFlight&) = delete;
+	WFSingleFlight& operator= (const WFSingleFlight&) = delete;
+
+private:
+	void finish(const std::string& key, RESULT& res)
+	{
+		std::vector<callback_t> waiters;
+
+		mutex_.lock();
+		auto it = flights_.find(key);
+
+		waiters = std::move(it->second);
+		flights_.erase(it);
+		mutex_.unlock();
+
+		// copy before the first waiter takes res
+		for (size_t i = 1; i < waiters.size(); i++)
+		{
+			RESULT r;
+
+			copy_(res, r);
+			waiters[i](r);
+		}
+
+		waiters[0](res);
+	}
+
+private:
+	std::unordered_map<std::string, std::vector<callback_t>> flights_;
+	std::mutex mutex_;
+	copy_t copy_;
+	unsigned long long requests_;
+	unsigned long long shared_;
+};
+
+#endif
+
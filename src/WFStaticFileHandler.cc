@@ -0,0 +1,590 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <workflow/HttpUtil.h>
+#include <workflow/StringUtil.h>
+#include <workflow/WFTaskFactory.h>
+#include <workflow/Workflow.h>
+#include "WFRequestTarget.h"
+#include "WFSeriesUtil.h"
+#include "WFWebStream.h"
+#include "WFStaticFileHandler.h"
+
+using namespace protocol;
+
+#define OPEN_FILE_CACHE_SHARDS		16
+
+static long long __monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void __http_date(time_t t, std::string& date)
+{
+	char buf[64];
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	date = buf;
+}
+
+static time_t __parse_http_date(const std::string& date)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof tm);
+	if (!strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+		return -1;
+
+	return timegm(&tm);
+}
+
+static const char *__content_type(const std::string& path)
+{
+	static const struct
+	{
+		const char *ext;
+		const char *type;
+	} types[] = {
+		{ "html",	"text/html; charset=utf-8"			},
+		{ "htm",	"text/html; charset=utf-8"			},
+		{ "css",	"text/css; charset=utf-8"			},
+		{ "js",		"application/javascript"			},
+		{ "json",	"application/json"					},
+		{ "txt",	"text/plain; charset=utf-8"			},
+		{ "xml",	"application/xml"					},
+		{ "svg",	"image/svg+xml"						},
+		{ "png",	"image/png"							},
+		{ "jpg",	"image/jpeg"						},
+		{ "jpeg",	"image/jpeg"						},
+		{ "gif",	"image/gif"							},
+		{ "ico",	"image/x-icon"						},
+		{ "webp",	"image/webp"						},
+		{ "woff",	"font/woff"							},
+		{ "woff2",	"font/woff2"						},
+		{ "wasm",	"application/wasm"					},
+		{ "pdf",	"application/pdf"					},
+		{ "zip",	"application/zip"					},
+		{ "gz",		"application/gzip"					},
+		{ "mp4",	"video/mp4"							},
+	};
+
+	size_t pos = path.rfind('.');
+
+	if (pos != std::string::npos && path.find('/', pos) == std::string::npos)
+	{
+		const char *ext = path.c_str() + pos + 1;
+
+		for (const auto& t : types)
+		{
+			if (strcasecmp(ext, t.ext) == 0)
+				return t.type;
+		}
+	}
+
+	return "application/octet-stream";
+}
+
+// one open file, shared by the cache and every response still reading it.
+// A file replaced by rename keeps its old content until the next stat(),
+// a file truncated in place makes pread() short
+class WFOpenFile
+{
+public:
+	static std::shared_ptr<WFOpenFile> open(const std::string& path);
+
+	bool same_file(const struct stat *st) const
+	{
+		return st->st_ino == ino && st->st_dev == dev &&
+			   st->st_mtime == mtime && (size_t)st->st_size == size;
+	}
+
+	~WFOpenFile()
+	{
+		if (fd >= 0)
+			close(fd);
+	}
+
+public:
+	int fd;
+	size_t size;
+	time_t mtime;
+	ino_t ino;
+	dev_t dev;
+	const char *content_type;
+	std::string last_modified;
+	std::string etag;
+	long long checked_at;//guarded by the shard lock
+
+private:
+	WFOpenFile():
+		fd(-1),
+		size(0)
+	{}
+};
+
+std::shared_ptr<WFOpenFile> WFOpenFile::open(const std::string& path)
+{
+	std::shared_ptr<WFOpenFile> file;
+	struct stat st;
+	char buf[64];
+	int fd;
+
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return file;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return file;
+	}
+
+	file.reset(new WFOpenFile);
+	file->fd = fd;
+	file->size = st.st_size;
+	file->mtime = st.st_mtime;
+	file->ino = st.st_ino;
+	file->dev = st.st_dev;
+	file->content_type = __content_type(path);
+	__http_date(st.st_mtime, file->last_modified);
+	snprintf(buf, sizeof buf, "\"%llx-%llx\"",
+			 (unsigned long long)st.st_mtime, (unsigned long long)st.st_size);
+	file->etag = buf;
+	file->checked_at = __monotonic_ms();
+	return file;
+}
+
+class WFOpenFileCache
+{
+public:
+	std::shared_ptr<WFOpenFile> get(const std::string& path);
+
+public:
+	WFOpenFileCache(size_t max_files, int valid_time):
+		valid_time_(valid_time)
+	{
+		max_files_ = max_files / OPEN_FILE_CACHE_SHARDS;
+		if (max_files_ == 0)
+			max_files_ = 1;
+	}
+
+private:
+	using LRUList = std::list<std::pair<std::string, std::shared_ptr<WFOpenFile>>>;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		LRUList lru;//front is the most recently used
+		std::unordered_map<std::string, LRUList::iterator> map;
+	};
+
+	Shard shards_[OPEN_FILE_CACHE_SHARDS];
+	size_t max_files_;//per shard
+	int valid_time_;
+};
+
+std::shared_ptr<WFOpenFile> WFOpenFileCache::get(const std::string& path)
+{
+	Shard& shard = shards_[std::hash<std::string>()(path) % OPEN_FILE_CACHE_SHARDS];
+	long long now = __monotonic_ms();
+	std::shared_ptr<WFOpenFile> file;
+	struct stat st;
+
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.map.find(path);
+
+		if (it != shard.map.end())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			file = it->second->second;
+			if (now - file->checked_at < valid_time_)
+				return file;
+		}
+	}
+
+	// miss or expired, only this path touches the disk
+	if (file)
+	{
+		if (stat(path.c_str(), &st) == 0 && file->same_file(&st))
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			file->checked_at = now;
+			return file;
+		}
+	}
+
+	file = WFOpenFile::open(path);
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto it = shard.map.find(path);
+
+	if (it != shard.map.end())
+	{
+		shard.lru.erase(it->second);
+		shard.map.erase(it);
+	}
+
+	if (!file)
+		return file;
+
+	shard.lru.emplace_front(path, file);
+	shard.map[path] = shard.lru.begin();
+	if (shard.lru.size() > max_files_)
+	{
+		shard.map.erase(shard.lru.back().first);
+		shard.lru.pop_back();
+	}
+
+	return file;
+}
+
+// parse single range "bytes=a-b", "bytes=a-" or "bytes=-n"
+// return 0 on success, -1 if unsatisfiable, 1 if ignored
+static int __parse_range(const std::string& range, size_t size,
+						 size_t *start, size_t *end)
+{
+	unsigned long long a, b;
+	const char *p;
+	char *q;
+
+	if (range.compare(0, 6, "bytes=") != 0 ||
+		range.find(',') != std::string::npos)
+	{
+		return 1;
+	}
+
+	p = range.c_str() + 6;
+	if (*p == '-')
+	{
+		b = strtoull(p + 1, &q, 10);
+		if (q == p + 1 || *q)
+			return 1;
+
+		if (b == 0 || size == 0)
+			return -1;
+
+		*start = b >= size ? 0 : size - b;
+		*end = size - 1;
+		return 0;
+	}
+
+	a = strtoull(p, &q, 10);
+	if (q == p || *q != '-')
+		return 1;
+
+	p = q + 1;
+	if (*p)
+	{
+		b = strtoull(p, &q, 10);
+		if (*q || b < a)
+			return 1;
+	}
+	else
+		b = size - 1;
+
+	if (a >= size)
+		return -1;
+
+	*start = a;
+	*end = b >= size ? size - 1 : b;
+	return 0;
+}
+
+static void __set_file_headers(HttpResponse *resp, const WFOpenFile *file)
+{
+	resp->add_header_pair("Last-Modified", file->last_modified);
+	resp->add_header_pair("ETag", file->etag);
+	resp->add_header_pair("Content-Type", file->content_type);
+	resp->add_header_pair("Accept-Ranges", "bytes");
+}
+
+static void __set_file_reply(HttpResponse *resp, const WFOpenFile *file,
+							 bool partial, size_t start, size_t end)
+{
+	__set_file_headers(resp, file);
+	if (partial)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusPartialContent);
+		resp->add_header_pair("Content-Range",
+							  "bytes " + std::to_string(start) + "-" +
+							  std::to_string(end) + "/" +
+							  std::to_string(file->size));
+	}
+	else
+		HttpUtil::set_response_status(resp, HttpStatusOK);
+}
+
+// buf is read from offset to end again and again, the next pread starts
+// once the socket takes the last chunk
+static void __stream_file(WFWebStream *stream, std::shared_ptr<WFOpenFile> file,
+						  bool partial, void *buf, size_t chunk_size,
+						  size_t start, size_t offset, size_t end)
+{
+	size_t len = end - offset + 1;
+
+	if (len > chunk_size)
+		len = chunk_size;
+
+	auto *pread = WFTaskFactory::create_pread_task(file->fd, buf, len, offset,
+		[=](WFFileIOTask *pread) {
+			auto *args = pread->get_args();
+			auto *resp = stream->get_task()->get_resp();
+
+			// short if the file is truncated after stat(). 500 before the
+			// first chunk, otherwise the connection is closed short
+			if (pread->get_state() != WFT_STATE_SUCCESS ||
+				pread->get_retval() != (long)args->count)
+			{
+				if (offset == start)
+					HttpUtil::set_response_status(resp, HttpStatusInternalServerError);
+
+				return;
+			}
+
+			if (offset == start)
+			{
+				__set_file_reply(resp, file.get(), partial, start, end);
+				resp->add_header_pair("Content-Length",
+									  std::to_string(end - start + 1));
+			}
+
+			size_t next = offset + args->count;
+
+			if (stream->write(args->buf, args->count) < 0)
+				return;
+
+			if (next > end)
+				return stream->finish();
+
+			stream->wait_sent([=]() {
+				if (!stream->failed())
+				{
+					__stream_file(stream, file, partial, buf, chunk_size,
+								  start, next, end);
+				}
+			});
+		});
+
+	series_of(stream->get_task())->push_back(pread);
+}
+
+WFStaticFileHandler::WFStaticFileHandler(const std::string& prefix,
+										 const std::string& root):
+	WFStaticFileHandler(prefix, root, &STATIC_FILE_PARAMS_DEFAULT)
+{}
+
+WFStaticFileHandler::WFStaticFileHandler(const std::string& prefix,
+										 const std::string& root,
+										 const struct WFStaticFileParams *params):
+	prefix_(prefix),
+	root_(root),
+	chunk_size_(params->chunk_size),
+	cache_(new WFOpenFileCache(params->max_files, params->valid_time))
+{
+	if (params->index)
+		index_ = params->index;
+
+	if (chunk_size_ == 0)
+		chunk_size_ = STATIC_FILE_PARAMS_DEFAULT.chunk_size;
+
+	while (!root_.empty() && root_.back() == '/')
+		root_.pop_back();
+}
+
+void WFStaticFileHandler::operator() (WFHttpTask *task) const
+{
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	const char *method = req->get_method();
+	bool is_head = (strcmp(method, "HEAD") == 0);
+	WFRequestTarget target;
+
+	if (!is_head && strcmp(method, "GET") != 0)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusMethodNotAllowed);
+		return;
+	}
+
+	if (WFRequestTargetParser::parse(req->get_request_uri(), target) < 0 ||
+		target.path_len < prefix_.size() ||
+		memcmp(target.path, prefix_.c_str(), prefix_.size()) != 0)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusNotFound);
+		return;
+	}
+
+	std::string rel(target.path + prefix_.size(),
+					target.path_len - prefix_.size());
+
+	StringUtil::url_decode(rel);
+	if (rel.empty() || rel.back() == '/')
+	{
+		if (index_.empty())
+		{
+			HttpUtil::set_response_status(resp, HttpStatusNotFound);
+			return;
+		}
+
+		rel += index_;
+	}
+
+	// never leave root
+	if (rel.find('\0') != std::string::npos ||
+		("/" + rel + "/").find("/../") != std::string::npos)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusForbidden);
+		return;
+	}
+
+	std::string path = root_;
+
+	if (rel[0] != '/')
+		path += '/';
+
+	path += rel;
+
+	std::shared_ptr<WFOpenFile> file = cache_->get(path);
+
+	if (!file)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusNotFound);
+		return;
+	}
+
+	std::string name;
+	std::string value;
+	std::string range;
+	std::string if_range;
+	std::string if_none_match;
+	std::string if_modified_since;
+	HttpHeaderCursor cursor(req);
+
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "Range") == 0)
+			range = std::move(value);
+		else if (strcasecmp(name.c_str(), "If-Range") == 0)
+			if_range = std::move(value);
+		else if (strcasecmp(name.c_str(), "If-None-Match") == 0)
+			if_none_match = std::move(value);
+		else if (strcasecmp(name.c_str(), "If-Modified-Since") == 0)
+			if_modified_since = std::move(value);
+	}
+
+	if (!if_none_match.empty()
+		? (if_none_match == file->etag || if_none_match == "*")
+		: (!if_modified_since.empty() &&
+		   __parse_http_date(if_modified_since) >= file->mtime))
+	{
+		resp->add_header_pair("Last-Modified", file->last_modified);
+		resp->add_header_pair("ETag", file->etag);
+		HttpUtil::set_response_status(resp, HttpStatusNotModified);
+		return;
+	}
+
+	size_t start = 0;
+	size_t end = file->size - 1;
+	int ret = 1;
+
+	if (!range.empty() &&
+		(if_range.empty() || if_range == file->etag ||
+		 if_range == file->last_modified))
+	{
+		ret = __parse_range(range, file->size, &start, &end);
+	}
+
+	if (ret < 0)
+	{
+		__set_file_headers(resp, file.get());
+		resp->add_header_pair("Content-Range",
+							  "bytes */" + std::to_string(file->size));
+		HttpUtil::set_response_status(resp, HttpStatusRequestedRangeNotSatisfiable);
+		return;
+	}
+
+	if (file->size == 0 || is_head)
+	{
+		__set_file_reply(resp, file.get(), ret == 0, start, end);
+		if (file->size > 0)
+			resp->add_header_pair("Content-Length", std::to_string(end - start + 1));
+
+		return;
+	}
+
+	size_t len = end - start + 1;
+	bool partial = (ret == 0);
+	void *buf = malloc(len > chunk_size_ ? chunk_size_ : len);
+
+	if (!buf)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusInternalServerError);
+		return;
+	}
+
+	// the reply is sent before the series ends
+	WFSeriesUtil::defer(series_of(task), [buf]() { free(buf); });
+	if (len > chunk_size_)
+	{
+		struct WFWebStreamParams params = WEB_STREAM_PARAMS_DEFAULT;
+
+		params.mode = WEB_STREAM_IDENTITY;
+		params.max_pending = chunk_size_;
+		__stream_file(WFWebStream::create(task, &params), std::move(file),
+					  partial, buf, chunk_size_, start, start, end);
+		return;
+	}
+
+	auto *pread = WFTaskFactory::create_pread_task(file->fd, buf, len, start,
+		[resp, file, partial, start, end](WFFileIOTask *pread) {
+			auto *args = pread->get_args();
+
+			// short if the file is truncated after stat()
+			if (pread->get_state() != WFT_STATE_SUCCESS ||
+				pread->get_retval() != (long)args->count)
+			{
+				HttpUtil::set_response_status(resp, HttpStatusInternalServerError);
+				return;
+			}
+
+			__set_file_reply(resp, file.get(), partial, start, end);
+			resp->append_output_body_nocopy(args->buf, args->count);
+		});
+
+	series_of(task)->push_back(pread);
+}
+
@@ -0,0 +1,76 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFSTATICFILEHANDLER_H_
+#define _WFSTATICFILEHANDLER_H_
+
+#include <stddef.h>
+#include <string>
+#include <memory>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFStaticFileHandler.h
+ * @brief  Static file handler for WFWebServer, files are read with async pread
+ */
+
+struct WFStaticFileParams
+{
+	size_t max_files;		// open file cache size, each holds a fd
+	int valid_time;			// ms, cached metadata is trusted without stat()
+	const char *index;		// served for path ends with '/', NULL to disable
+	size_t chunk_size;		// bytes read at once, a longer body is streamed
+};
+
+static constexpr struct WFStaticFileParams STATIC_FILE_PARAMS_DEFAULT =
+{
+	.max_files		=	1024,
+	.valid_time		=	1000,
+	.index			=	"index.html",
+	.chunk_size		=	256 * 1024,
+};
+
+class WFOpenFileCache;
+
+// server.set_handler("/static/", WFStaticFileHandler("/static/", "/var/www"));
+// "/static/js/a.js" is served from "/var/www/js/a.js"
+// support GET/HEAD, Range(single range), If-Modified-Since and If-None-Match
+// A body longer than chunk_size is sent by WFWebStream, one chunk_size
+// buffer is read again and again, each time after the socket takes the
+// last chunk, and the connection is closed after it. A file truncated
+// while being read is answered 500, or cut short if it is streaming.
+class WFStaticFileHandler
+{
+public:
+	void operator() (WFHttpTask *task) const;
+
+public:
+	WFStaticFileHandler(const std::string& prefix, const std::string& root);
+	WFStaticFileHandler(const std::string& prefix, const std::string& root,
+						const struct WFStaticFileParams *params);
+
+private:
+	std::string prefix_;
+	std::string root_;
+	std::string index_;
+	size_t chunk_size_;
+	std::shared_ptr<WFOpenFileCache> cache_;//shared by copies of handler
+};
+
+#endif
+
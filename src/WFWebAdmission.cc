@@ -0,0 +1,231 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include "WFWebAdmission.h"
+
+using namespace protocol;
+
+static long long __monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+class WFWebAdmissionWaiter
+{
+public:
+	WFCounterTask *counter;
+	long long enqueued_at;//us
+	bool admitted;
+};
+
+void WFWebAdmission::run(WFHttpTask *task, const route_handler_t *handler,
+						 const WFWebParams& params, bool *admitted)
+{
+	*admitted = true;
+	if (*handler)
+		(*handler)(task, params);
+}
+
+void WFWebAdmission::shed(WFHttpTask *task)
+{
+	auto *resp = task->get_resp();
+
+	HttpUtil::set_response_status(resp, HttpStatusServiceUnavailable);
+	resp->add_header_pair("Retry-After", "1");
+}
+
+bool WFWebAdmission::delay_drop(long long delay, long long now)
+{
+	if (delay < params_.target * 1000LL)
+	{
+		first_above_ = 0;
+		dropping_ = false;
+		return false;
+	}
+
+	if (first_above_ == 0)
+	{
+		first_above_ = now + params_.interval * 1000LL;
+		return false;
+	}
+
+	if (now >= first_above_)
+		dropping_ = true;
+
+	return dropping_;
+}
+
+void WFWebAdmission::process(WFHttpTask *task, int priority,
+							 const route_handler_t *handler,
+							 const WFWebParams& params, bool *admitted)
+{
+	int limit = priority == WEB_PRIORITY_BULK ? bulk_limit_ : params_.max_in_flight;
+	WFWebAdmissionWaiter *evicted = NULL;
+	WFWebAdmissionWaiter *waiter;
+	bool empty;
+
+	mutex_.lock();
+	empty = queue_[WEB_PRIORITY_NORMAL].empty() &&
+			(priority != WEB_PRIORITY_BULK || queue_[WEB_PRIORITY_BULK].empty());
+
+	if (priority == WEB_PRIORITY_CRITICAL || (in_flight_ < limit && empty))
+	{
+		in_flight_++;
+		admitted_++;
+		mutex_.unlock();
+		return run(task, handler, params, admitted);
+	}
+
+	size_t size = queue_[WEB_PRIORITY_NORMAL].size() +
+				  queue_[WEB_PRIORITY_BULK].size();
+
+	if ((dropping_ || size >= (size_t)params_.max_queue) &&
+		priority == WEB_PRIORITY_NORMAL && !queue_[WEB_PRIORITY_BULK].empty())
+	{
+		// lower priority is shed first, the newest bulk waiter makes room
+		evicted = queue_[WEB_PRIORITY_BULK].back();
+		queue_[WEB_PRIORITY_BULK].pop_back();
+		shed_[WEB_PRIORITY_BULK]++;
+		size--;
+	}
+
+	if ((dropping_ && !evicted) || size >= (size_t)params_.max_queue)
+	{
+		shed_[priority]++;
+		mutex_.unlock();
+		if (evicted)
+			evicted->counter->count();
+
+		return shed(task);
+	}
+
+	waiter = new WFWebAdmissionWaiter;
+	waiter->enqueued_at = __monotonic_us();
+	waiter->admitted = false;
+	waiter->counter = WFTaskFactory::create_counter_task(1,
+		[this, task, handler, params, admitted, waiter](WFCounterTask *) {
+			if (waiter->admitted)
+				this->run(task, handler, params, admitted);
+			else
+				this->shed(task);
+
+			delete waiter;
+		});
+
+	queue_[priority].push_back(waiter);
+	queued_++;
+	mutex_.unlock();
+
+	if (evicted)
+		evicted->counter->count();
+
+	series_of(task)->push_back(waiter->counter);
+}
+
+void WFWebAdmission::release()
+{
+	std::vector<WFWebAdmissionWaiter *> done;
+	long long now = __monotonic_us();
+	WFWebAdmissionWaiter *waiter;
+	int priority;
+
+	mutex_.lock();
+	in_flight_--;
+	while (1)
+	{
+		if (!queue_[WEB_PRIORITY_NORMAL].empty() && in_flight_ < params_.max_in_flight)
+			priority = WEB_PRIORITY_NORMAL;
+		else if (!queue_[WEB_PRIORITY_BULK].empty() && in_flight_ < bulk_limit_)
+			priority = WEB_PRIORITY_BULK;
+		else
+			break;
+
+		waiter = queue_[priority].front();
+		queue_[priority].pop_front();
+		done.push_back(waiter);
+		if (delay_drop(now - waiter->enqueued_at, now))
+		{
+			shed_[priority]++;
+			delay_shed_++;
+			continue;
+		}
+
+		waiter->admitted = true;
+		in_flight_++;
+		admitted_++;
+		break;
+	}
+
+	// an empty queue has no delay
+	if (queue_[WEB_PRIORITY_NORMAL].empty() && queue_[WEB_PRIORITY_BULK].empty())
+	{
+		first_above_ = 0;
+		dropping_ = false;
+	}
+
+	mutex_.unlock();
+	for (WFWebAdmissionWaiter *waiter : done)
+		waiter->counter->count();
+}
+
+void WFWebAdmission::get_stats(struct WFWebAdmissionStats *stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	stats->admitted = admitted_;
+	stats->queued = queued_;
+	for (int i = 0; i < WEB_PRIORITY_MAX; i++)
+		stats->shed[i] = shed_[i];
+
+	stats->delay_shed = delay_shed_;
+	stats->in_flight = in_flight_;
+	stats->queue_size = queue_[WEB_PRIORITY_NORMAL].size() +
+						queue_[WEB_PRIORITY_BULK].size();
+	stats->dropping = dropping_;
+}
+
+WFWebAdmission::WFWebAdmission(const struct WFWebAdmissionParams *params):
+	params_(*params),
+	in_flight_(0),
+	first_above_(0),
+	dropping_(false),
+	admitted_(0),
+	queued_(0),
+	delay_shed_(0)
+{
+	bulk_limit_ = params_.max_in_flight - params_.max_in_flight / 4;
+	memset(shed_, 0, sizeof shed_);
+}
+
+WFWebAdmission::~WFWebAdmission()
+{
+	for (auto& queue : queue_)
+	{
+		for (WFWebAdmissionWaiter *waiter : queue)
+			delete waiter;
+	}
+}
+
@@ -0,0 +1,109 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBADMISSION_H_
+#define _WFWEBADMISSION_H_
+
+#include <deque>
+#include <mutex>
+#include "WFWebRouter.h"
+
+/**
+ * @file   WFWebAdmission.h
+ * @brief  Admission control and load shedding for WFWebServer
+ */
+
+struct WFWebAdmissionParams
+{
+	int max_in_flight;		// requests in handlers at the same time
+	int max_queue;			// requests waiting for a slot
+	int target;				// ms, acceptable queueing delay
+	int interval;			// ms, delay above target this long starts shedding
+};
+
+static constexpr struct WFWebAdmissionParams WEB_ADMISSION_PARAMS_DEFAULT =
+{
+	.max_in_flight	=	1000,
+	.max_queue		=	1000,
+	.target			=	5,
+	.interval		=	100,
+};
+
+struct WFWebAdmissionStats
+{
+	unsigned long long admitted;
+	unsigned long long queued;
+	unsigned long long shed[WEB_PRIORITY_MAX];	// answered 503, by priority
+	unsigned long long delay_shed;	// part of shed, by queueing delay
+	int in_flight;
+	int queue_size;
+	bool dropping;	// queueing delay stays above target
+};
+
+class WFWebAdmissionWaiter;
+
+// A request of a found route is admitted while in_flight < max_in_flight,
+// otherwise it waits in a queue without blocking any thread. Queueing delay
+// is controlled like CoDel: once the delay of dequeued requests stays above
+// target for an interval, waiters and new arrivals are answered 503 at once
+// until the delay drops below target.
+//
+// WEB_PRIORITY_CRITICAL is always admitted. WEB_PRIORITY_BULK may only use
+// 3/4 of the slots, is served after normal waiters and gives its place to
+// a normal request when the queue is full or shedding, so a normal arrival
+// is only shed once no bulk waiter is left.
+//
+// *admitted is set once handler is called, the caller must release()
+// after the series of server task ends if so.
+class WFWebAdmission
+{
+public:
+	void process(WFHttpTask *task, int priority,
+				 const route_handler_t *handler, const WFWebParams& params,
+				 bool *admitted);
+
+	void release();
+
+	void get_stats(struct WFWebAdmissionStats *stats);
+
+public:
+	WFWebAdmission(const struct WFWebAdmissionParams *params);
+	~WFWebAdmission();
+
+private:
+	bool delay_drop(long long delay, long long now);
+	void run(WFHttpTask *task, const route_handler_t *handler,
+			 const WFWebParams& params, bool *admitted);
+	void shed(WFHttpTask *task);
+
+private:
+	struct WFWebAdmissionParams params_;
+	std::deque<WFWebAdmissionWaiter *> queue_[WEB_PRIORITY_MAX];
+	std::mutex mutex_;
+	int in_flight_;
+	int bulk_limit_;
+	long long first_above_;//0 if delay is below target
+	bool dropping_;
+	unsigned long long admitted_;
+	unsigned long long queued_;
+	unsigned long long shed_[WEB_PRIORITY_MAX];
+	unsigned long long delay_shed_;
+};
+
+#endif
+
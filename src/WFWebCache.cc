@@ -0,0 +1,476 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <workflow/HttpUtil.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFRequestTarget.h"
+#include "WFSeriesUtil.h"
+#include "WFWebCache.h"
+
+using namespace protocol;
+
+#define WEB_CACHE_SHARDS		16
+#define WEB_CACHE_IOV_MAX		4096
+
+static long long __monotonic_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// encode() is protected, borrow it to read back the output of a response
+class __HttpResponseEncoder : public HttpResponse
+{
+public:
+	static int encode_response(HttpResponse *resp, struct iovec vectors[], int max)
+	{
+		int (HttpMessage::*fn)(struct iovec [], int) = &__HttpResponseEncoder::encode;
+
+		return (resp->*fn)(vectors, max);
+	}
+};
+
+class WFWebCacheEntry
+{
+public:
+	std::string key;
+	std::string status_code;
+	std::string reason_phrase;
+	std::vector<std::pair<std::string, std::string>> headers;
+	std::string body;
+	long long expire_at;
+	size_t bytes;
+};
+
+using WFWebCacheEntryPtr = std::shared_ptr<const WFWebCacheEntry>;
+
+class WFWebCacheFlight
+{
+public:
+	std::vector<WFCounterTask *> waiters;
+	WFWebCacheEntryPtr entry;//NULL if leader got nothing to cache
+};
+
+class WFWebCacheImpl : public std::enable_shared_from_this<WFWebCacheImpl>
+{
+public:
+	void process(const route_handler_t& handler,
+				 WFHttpTask *task, const WFWebParams& params);
+
+	WFWebCacheImpl(const struct WFWebCacheParams *params):
+		hits(0),
+		misses(0),
+		collapsed(0),
+		evictions(0)
+	{
+		ttl_ = params->ttl;
+		max_bytes_ = params->max_bytes / WEB_CACHE_SHARDS;
+	}
+
+private:
+	using LRUList = std::list<WFWebCacheEntryPtr>;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		LRUList lru;//front is the most recently used
+		std::unordered_map<std::string, LRUList::iterator> map;
+		std::unordered_map<std::string, std::shared_ptr<WFWebCacheFlight>> flights;
+		size_t bytes;
+
+		Shard(): bytes(0) { }
+	};
+
+	Shard& shard_of(const std::string& key)
+	{
+		return shards_[std::hash<std::string>()(key) % WEB_CACHE_SHARDS];
+	}
+
+	std::string make_key(const HttpRequest *req) const;
+	WFWebCacheEntryPtr capture(WFHttpTask *task) const;
+	void store(const std::string& key,
+			   const std::shared_ptr<WFWebCacheFlight>& flight,
+			   WFHttpTask *task);
+	void erase(Shard& shard, std::unordered_map<std::string, LRUList::iterator>::iterator it);
+
+	static void fill(WFHttpTask *task, const WFWebCacheEntryPtr& entry);
+
+public:
+	std::vector<std::string> vary;
+	std::atomic<unsigned long long> hits;
+	std::atomic<unsigned long long> misses;
+	std::atomic<unsigned long long> collapsed;
+	std::atomic<unsigned long long> evictions;
+
+private:
+	Shard shards_[WEB_CACHE_SHARDS];
+	int ttl_;
+	size_t max_bytes_;//per shard
+
+	friend class WFWebCache;
+};
+
+std::string WFWebCacheImpl::make_key(const HttpRequest *req) const
+{
+	WFRequestTarget target;
+	std::string key;
+
+	if (WFRequestTargetParser::parse(req->get_request_uri(), target) < 0)
+		return key;
+
+	// absolute-form wins over the Host header, names are case insensitive
+	if (target.authority_len > 0)
+		key.assign(target.authority, target.authority_len);
+	else
+	{
+		HttpHeaderCursor cursor(req);
+
+		cursor.find("Host", key);
+	}
+
+	std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+	key.append(target.path, target.path_len);
+	if (target.query_len > 0)
+	{
+		std::vector<std::pair<const char *, size_t>> args;
+		const char *p = target.query;
+		const char *end = target.query + target.query_len;
+		const char *amp;
+
+		while (p < end)
+		{
+			amp = (const char *)memchr(p, '&', end - p);
+			if (!amp)
+				amp = end;
+
+			if (amp > p)
+				args.emplace_back(p, amp - p);
+
+			p = amp + 1;
+		}
+
+		// "b=1&a=2" and "a=2&b=1" share one entry
+		std::sort(args.begin(), args.end(),
+			[](const std::pair<const char *, size_t>& x,
+			   const std::pair<const char *, size_t>& y) {
+				int ret = memcmp(x.first, y.first, std::min(x.second, y.second));
+
+				return ret < 0 || (ret == 0 && x.second < y.second);
+			});
+
+		for (size_t i = 0; i < args.size(); i++)
+		{
+			key.push_back(i == 0 ? '?' : '&');
+			key.append(args[i].first, args[i].second);
+		}
+	}
+
+	for (const std::string& name : vary)
+	{
+		HttpHeaderCursor cursor(req);
+		std::string value;
+
+		cursor.find(name, value);
+		key.push_back('\n');
+		key.append(value);
+	}
+
+	return key;
+}
+
+WFWebCacheEntryPtr WFWebCacheImpl::capture(WFHttpTask *task) const
+{
+	auto *resp = task->get_resp();
+	WFWebCacheEntryPtr ret;
+
+	if (task->get_state() != WFT_STATE_SUCCESS ||
+		strcmp(resp->get_status_code(), "200") != 0)
+	{
+		return ret;
+	}
+
+	auto *entry = new WFWebCacheEntry;
+	HttpHeaderCursor cursor(resp);
+	std::string name;
+	std::string value;
+
+	ret.reset(entry);
+	while (cursor.next(name, value))
+	{
+		if (strcasecmp(name.c_str(), "Set-Cookie") == 0)
+			return WFWebCacheEntryPtr();
+
+		if (strcasecmp(name.c_str(), "Cache-Control") == 0 &&
+			(strcasestr(value.c_str(), "no-store") ||
+			 strcasestr(value.c_str(), "private")))
+		{
+			return WFWebCacheEntryPtr();
+		}
+
+		// the output body still has the chunk framing
+		if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0)
+			return WFWebCacheEntryPtr();
+
+		// hop-by-hop and length are added again by the server
+		if (strcasecmp(name.c_str(), "Content-Length") == 0 ||
+			strcasecmp(name.c_str(), "Connection") == 0 ||
+			strcasecmp(name.c_str(), "Keep-Alive") == 0)
+		{
+			continue;
+		}
+
+		entry->headers.emplace_back(std::move(name), std::move(value));
+	}
+
+	std::vector<struct iovec> vectors(WEB_CACHE_IOV_MAX);
+	std::string raw;
+	int cnt = __HttpResponseEncoder::encode_response(resp, vectors.data(), WEB_CACHE_IOV_MAX);
+
+	if (cnt < 0 || cnt == WEB_CACHE_IOV_MAX)
+		return WFWebCacheEntryPtr();
+
+	for (int i = 0; i < cnt; i++)
+		raw.append((const char *)vectors[i].iov_base, vectors[i].iov_len);
+
+	size_t pos = raw.find("\r\n\r\n");
+
+	if (pos == std::string::npos)
+		return WFWebCacheEntryPtr();
+
+	entry->body = raw.substr(pos + 4);
+	entry->status_code = resp->get_status_code();
+	entry->reason_phrase = resp->get_reason_phrase();
+	entry->bytes = entry->body.size() + sizeof (WFWebCacheEntry);
+	for (const auto& kv : entry->headers)
+		entry->bytes += kv.first.size() + kv.second.size();
+
+	return ret;
+}
+
+void WFWebCacheImpl::erase(Shard& shard,
+						   std::unordered_map<std::string, LRUList::iterator>::iterator it)
+{
+	shard.bytes -= (*it->second)->bytes;
+	shard.lru.erase(it->second);
+	shard.map.erase(it);
+}
+
+void WFWebCacheImpl::store(const std::string& key,
+						   const std::shared_ptr<WFWebCacheFlight>& flight,
+						   WFHttpTask *task)
+{
+	WFWebCacheEntryPtr entry = capture(task);
+	Shard& shard = shard_of(key);
+	std::vector<WFCounterTask *> waiters;
+
+	if (entry)
+	{
+		auto *e = const_cast<WFWebCacheEntry *>(entry.get());
+
+		e->key = key;
+		e->bytes += key.size();
+		e->expire_at = __monotonic_ms() + ttl_;
+	}
+
+	shard.mutex.lock();
+	auto fit = shard.flights.find(key);
+
+	if (fit != shard.flights.end() && fit->second == flight)
+		shard.flights.erase(fit);
+
+	if (entry && entry->bytes <= max_bytes_)
+	{
+		auto it = shard.map.find(key);
+
+		if (it != shard.map.end())
+			erase(shard, it);
+
+		shard.lru.push_front(entry);
+		shard.map[key] = shard.lru.begin();
+		shard.bytes += entry->bytes;
+		while (shard.bytes > max_bytes_)
+		{
+			erase(shard, shard.map.find(shard.lru.back()->key));
+			evictions++;
+		}
+	}
+
+	flight->entry = entry;
+	waiters.swap(flight->waiters);
+	shard.mutex.unlock();
+
+	for (WFCounterTask *counter : waiters)
+		counter->count();
+}
+
+void WFWebCacheImpl::fill(WFHttpTask *task, const WFWebCacheEntryPtr& entry)
+{
+	auto *resp = task->get_resp();
+
+	resp->set_status_code(entry->status_code);
+	resp->set_reason_phrase(entry->reason_phrase);
+	for (const auto& kv : entry->headers)
+		resp->add_header_pair(kv.first, kv.second);
+
+	resp->append_output_body_nocopy(entry->body.c_str(), entry->body.size());
+	// the body belongs to entry, hold it until the reply is sent
+	WFSeriesUtil::defer(series_of(task), [entry]() { });
+}
+
+void WFWebCacheImpl::process(const route_handler_t& handler,
+							 WFHttpTask *task, const WFWebParams& params)
+{
+	auto *req = task->get_req();
+
+	if (strcmp(req->get_method(), "GET") != 0)
+		return handler(task, params);
+
+	std::string key = make_key(req);
+
+	if (key.empty())
+		return handler(task, params);
+
+	Shard& shard = shard_of(key);
+	std::shared_ptr<WFWebCacheFlight> flight;
+	WFWebCacheEntryPtr entry;
+
+	shard.mutex.lock();
+	auto it = shard.map.find(key);
+
+	if (it != shard.map.end())
+	{
+		if ((*it->second)->expire_at > __monotonic_ms())
+		{
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			entry = *it->second;
+		}
+		else
+			erase(shard, it);
+	}
+
+	if (entry)
+	{
+		shard.mutex.unlock();
+		hits++;
+		return fill(task, entry);
+	}
+
+	auto fit = shard.flights.find(key);
+
+	if (fit != shard.flights.end())
+	{
+		flight = fit->second;
+
+		// wait in our own series, no thread is blocked
+		auto *counter = WFTaskFactory::create_counter_task(1,
+			[handler, task, params, flight](WFCounterTask *) {
+				if (flight->entry)
+					WFWebCacheImpl::fill(task, flight->entry);
+				else
+					handler(task, params);
+			});
+
+		flight->waiters.push_back(counter);
+		shard.mutex.unlock();
+		collapsed++;
+		series_of(task)->push_back(counter);
+		return;
+	}
+
+	flight = std::make_shared<WFWebCacheFlight>();
+	shard.flights.emplace(key, flight);
+	shard.mutex.unlock();
+	misses++;
+
+	// the handler may take the callback of task, the series is ours.
+	// Deferred before the handler, so the reply is seen before the
+	// handler frees anything, the flight is released in every case
+	std::shared_ptr<WFWebCacheImpl> impl = shared_from_this();
+
+	WFSeriesUtil::defer(series_of(task), [impl, key, flight, task]() {
+		impl->store(key, flight, task);
+	});
+	handler(task, params);
+}
+
+WFWebCache::WFWebCache():
+	WFWebCache(&WEB_CACHE_PARAMS_DEFAULT)
+{}
+
+WFWebCache::WFWebCache(const struct WFWebCacheParams *params):
+	impl_(new WFWebCacheImpl(params))
+{}
+
+void WFWebCache::vary(const std::string& header)
+{
+	impl_->vary.push_back(header);
+}
+
+route_handler_t WFWebCache::wrap(route_handler_t handler)
+{
+	std::shared_ptr<WFWebCacheImpl> impl = impl_;
+
+	return [impl, handler](WFHttpTask *task, const WFWebParams& params) {
+		impl->process(handler, task, params);
+	};
+}
+
+route_handler_t WFWebCache::wrap(web_handler_t handler)
+{
+	return wrap([handler](WFHttpTask *task, const WFWebParams& params) {
+		handler(*task->get_req(), *task->get_resp());
+	});
+}
+
+route_handler_t WFWebCache::wrap(web_params_handler_t handler)
+{
+	return wrap([handler](WFHttpTask *task, const WFWebParams& params) {
+		handler(*task->get_req(), *task->get_resp(), params);
+	});
+}
+
+void WFWebCache::get_stats(struct WFWebCacheStats *stats) const
+{
+	stats->hits = impl_->hits;
+	stats->misses = impl_->misses;
+	stats->collapsed = impl_->collapsed;
+	stats->evictions = impl_->evictions;
+	stats->entries = 0;
+	stats->bytes = 0;
+
+	for (auto& shard : impl_->shards_)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		stats->entries += shard.lru.size();
+		stats->bytes += shard.bytes;
+	}
+}
+
@@ -0,0 +1,90 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBCACHE_H_
+#define _WFWEBCACHE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "WFWebServer.h"
+
+/**
+ * @file   WFWebCache.h
+ * @brief  Server side response micro-cache for idempotent WFWebServer routes
+ */
+
+struct WFWebCacheParams
+{
+	int ttl;				// ms
+	size_t max_bytes;		// memory cap of all cached responses
+};
+
+static constexpr struct WFWebCacheParams WEB_CACHE_PARAMS_DEFAULT =
+{
+	.ttl			=	1000,
+	.max_bytes		=	64 * 1024 * 1024,
+};
+
+struct WFWebCacheStats
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long collapsed;	// misses waited for another request
+	unsigned long long evictions;
+	size_t entries;
+	size_t bytes;
+};
+
+class WFWebCacheImpl;
+
+// WFWebCache cache(&params);
+// cache.vary("Accept-Encoding");
+// server.set_handler("GET", "/item/:id", cache.wrap(handler));
+//
+// Only GET requests answered 200 are cached, keyed by host, path,
+// query(sorted) and the vary headers. Responses with Set-Cookie, Transfer-Encoding or
+// "Cache-Control: no-store/private" are never stored.
+// Concurrent misses on the same key run handler once, the others wait
+// in their series and get the same response.
+// The handler may set the callback of server task, but must not replace
+// the callback of its series, see WFSeriesUtil::defer().
+// Copies of WFWebCache share the same cache.
+class WFWebCache
+{
+public:
+	route_handler_t wrap(route_handler_t handler);
+	route_handler_t wrap(web_handler_t handler);
+	route_handler_t wrap(web_params_handler_t handler);
+
+	// add a request header to the cache key, call before wrap()
+	void vary(const std::string& header);
+
+	void get_stats(struct WFWebCacheStats *stats) const;
+
+public:
+	WFWebCache();
+	WFWebCache(const struct WFWebCacheParams *params);
+
+private:
+	std::shared_ptr<WFWebCacheImpl> impl_;
+};
+
+#endif
+
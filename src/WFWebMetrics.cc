@@ -0,0 +1,347 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "WFWebMetrics.h"
+
+class WFWebRouteCounters
+{
+public:
+	std::atomic<unsigned long long> requests[WEB_METRICS_CLASSES];
+	std::atomic<unsigned long long> bytes_in;
+	std::atomic<unsigned long long> bytes_out;
+	std::atomic<unsigned long long> latency;
+	std::atomic<unsigned long long> buckets[WEB_METRICS_BUCKETS];
+};
+
+#define WEB_METRICS_PAGE_SIZE		256
+#define WEB_METRICS_PAGES			(WEB_METRICS_ROUTES_MAX / WEB_METRICS_PAGE_SIZE)
+
+class WFWebMetricsPage
+{
+public:
+	WFWebMetricsPage()
+	{
+		for (auto& route : routes)
+			route.store(NULL, std::memory_order_relaxed);
+	}
+
+	~WFWebMetricsPage()
+	{
+		for (auto& route : routes)
+			delete route.load(std::memory_order_relaxed);
+	}
+
+public:
+	std::atomic<WFWebRouteCounters *> routes[WEB_METRICS_PAGE_SIZE];
+};
+
+// only the owner thread writes, pages and counters are created on first
+// use, so a shard is as large as the routes its thread served
+class WFWebMetricsShard
+{
+public:
+	WFWebRouteCounters *counters(int route);
+	WFWebRouteCounters *find(int route) const;
+
+public:
+	WFWebMetricsShard():
+		thread(std::this_thread::get_id())
+	{
+		for (auto& page : pages)
+			page.store(NULL, std::memory_order_relaxed);
+	}
+
+	~WFWebMetricsShard()
+	{
+		for (auto& page : pages)
+			delete page.load(std::memory_order_relaxed);
+	}
+
+public:
+	std::thread::id thread;
+
+private:
+	std::atomic<WFWebMetricsPage *> pages[WEB_METRICS_PAGES];
+};
+
+WFWebRouteCounters *WFWebMetricsShard::counters(int route)
+{
+	auto& page = pages[route / WEB_METRICS_PAGE_SIZE];
+	WFWebMetricsPage *p = page.load(std::memory_order_relaxed);
+
+	if (!p)
+	{
+		p = new WFWebMetricsPage;
+		page.store(p, std::memory_order_release);
+	}
+
+	auto& counters = p->routes[route % WEB_METRICS_PAGE_SIZE];
+	WFWebRouteCounters *c = counters.load(std::memory_order_relaxed);
+
+	if (!c)
+	{
+		c = new WFWebRouteCounters();
+		counters.store(c, std::memory_order_release);
+	}
+
+	return c;
+}
+
+WFWebRouteCounters *WFWebMetricsShard::find(int route) const
+{
+	const auto& page = pages[route / WEB_METRICS_PAGE_SIZE];
+	WFWebMetricsPage *p = page.load(std::memory_order_acquire);
+
+	if (!p)
+		return NULL;
+
+	return p->routes[route % WEB_METRICS_PAGE_SIZE].load(std::memory_order_acquire);
+}
+
+static std::atomic<unsigned long long> __metrics_id(1);
+
+static thread_local struct
+{
+	unsigned long long id;
+	WFWebMetricsShard *shard;
+} __shard_cache;
+
+// single writer, a plain load and store is enough
+static inline void __add(std::atomic<unsigned long long>& counter,
+						 unsigned long long n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n,
+				  std::memory_order_relaxed);
+}
+
+WFWebMetricsShard *WFWebMetrics::shard()
+{
+	if (__shard_cache.id == id_)
+		return __shard_cache.shard;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::thread::id self = std::this_thread::get_id();
+	WFWebMetricsShard *shard = NULL;
+
+	for (WFWebMetricsShard *s : shards_)
+	{
+		if (s->thread == self)
+		{
+			shard = s;
+			break;
+		}
+	}
+
+	if (!shard)
+	{
+		shard = new WFWebMetricsShard;
+		shards_.push_back(shard);
+	}
+
+	__shard_cache.id = id_;
+	__shard_cache.shard = shard;
+	return shard;
+}
+
+void WFWebMetrics::record(int route, WFHttpTask *task, long long latency)
+{
+	if (route < 0 || route >= WEB_METRICS_ROUTES_MAX)
+		return;
+
+	WFWebRouteCounters *c = shard()->counters(route);
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	const char *code = resp->get_status_code();
+	int cls = WEB_METRICS_FAILED;
+	const void *body;
+	size_t size;
+
+	if (task->get_state() == WFT_STATE_SUCCESS && code && code[0] >= '1' && code[0] <= '5')
+		cls = code[0] - '1';
+
+	__add(c->requests[cls], 1);
+	if (req->get_parsed_body(&body, &size))
+		__add(c->bytes_in, size);
+
+	size = resp->get_output_body_size();
+	if (size == 0 && resp->get_parsed_body(&body, &size) == false)
+		size = 0;
+
+	__add(c->bytes_out, size);
+	if (latency < 0)
+		latency = 0;
+
+	__add(c->latency, latency);
+	__add(c->buckets[bucket_of(latency)], 1);
+}
+
+int WFWebMetrics::add_route(int route, const std::string& method,
+							const std::string& path)
+{
+	if (route < 0 || route >= WEB_METRICS_ROUTES_MAX)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if ((size_t)route >= routes_.size())
+		routes_.resize(route + 1);
+
+	routes_[route].method = method;
+	routes_[route].path = path;
+	return 0;
+}
+
+// with mutex_ locked
+void WFWebMetrics::merge(int route, struct WFWebRouteMetrics *metrics)
+{
+	memset(metrics, 0, sizeof (struct WFWebRouteMetrics));
+	for (WFWebMetricsShard *s : shards_)
+	{
+		WFWebRouteCounters *c = s->find(route);
+
+		if (!c)
+			continue;
+
+		for (int i = 0; i < WEB_METRICS_CLASSES; i++)
+			metrics->requests[i] += c->requests[i].load(std::memory_order_relaxed);
+
+		metrics->bytes_in += c->bytes_in.load(std::memory_order_relaxed);
+		metrics->bytes_out += c->bytes_out.load(std::memory_order_relaxed);
+		metrics->latency += c->latency.load(std::memory_order_relaxed);
+		for (int i = 0; i < WEB_METRICS_BUCKETS; i++)
+			metrics->buckets[i] += c->buckets[i].load(std::memory_order_relaxed);
+	}
+}
+
+int WFWebMetrics::get_route_metrics(int route, struct WFWebRouteMetrics *metrics)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (route < 0 || (size_t)route >= routes_.size() || routes_[route].path.empty())
+		return -1;
+
+	merge(route, metrics);
+	return 0;
+}
+
+static std::string __label(const std::string& str)
+{
+	std::string ret;
+
+	for (char c : str)
+	{
+		if (c == '\\' || c == '"')
+			ret.push_back('\\');
+		else if (c == '\n')
+		{
+			ret.append("\\n");
+			continue;
+		}
+
+		ret.push_back(c);
+	}
+
+	return ret;
+}
+
+void WFWebMetrics::dump(std::string& out)
+{
+	static const char *classes[WEB_METRICS_CLASSES] = {
+		"1xx", "2xx", "3xx", "4xx", "5xx", "failed"
+	};
+	static const unsigned long long bounds[] = {
+		100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+		100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+	};
+	std::lock_guard<std::mutex> lock(mutex_);
+	struct WFWebRouteMetrics m;
+	std::string requests;
+	std::string bytes;
+	std::string duration;
+	char buf[256];
+
+	requests = "# HELP web_requests_total Requests by route and status class.\n"
+			   "# TYPE web_requests_total counter\n";
+	bytes = "# HELP web_body_bytes_total Body bytes by route and direction.\n"
+			"# TYPE web_body_bytes_total counter\n";
+	duration = "# HELP web_request_duration_seconds Request latency by route.\n"
+			   "# TYPE web_request_duration_seconds histogram\n";
+
+	for (size_t route = 0; route < routes_.size(); route++)
+	{
+		if (routes_[route].path.empty())
+			continue;
+
+		std::string label = "method=\"" + __label(routes_[route].method) +
+							"\",route=\"" + __label(routes_[route].path) + "\"";
+		unsigned long long count = 0;
+
+		merge(route, &m);
+		for (int i = 0; i < WEB_METRICS_CLASSES; i++)
+		{
+			count += m.requests[i];
+			if (m.requests[i] == 0)
+				continue;
+
+			snprintf(buf, sizeof buf, ",code=\"%s\"} %llu\n", classes[i], m.requests[i]);
+			requests += "web_requests_total{" + label + buf;
+		}
+
+		snprintf(buf, sizeof buf, ",direction=\"in\"} %llu\n", m.bytes_in);
+		bytes += "web_body_bytes_total{" + label + buf;
+		snprintf(buf, sizeof buf, ",direction=\"out\"} %llu\n", m.bytes_out);
+		bytes += "web_body_bytes_total{" + label + buf;
+
+		// a bucket is counted under le once its upper bound fits
+		unsigned long long cumulative = 0;
+		int bucket = 0;
+
+		for (unsigned long long bound : bounds)
+		{
+			while (bucket < WEB_METRICS_BUCKETS && bucket_bound(bucket) <= bound)
+				cumulative += m.buckets[bucket++];
+
+			snprintf(buf, sizeof buf, ",le=\"%g\"} %llu\n", bound / 1e6, cumulative);
+			duration += "web_request_duration_seconds_bucket{" + label + buf;
+		}
+
+		snprintf(buf, sizeof buf, ",le=\"+Inf\"} %llu\n", count);
+		duration += "web_request_duration_seconds_bucket{" + label + buf;
+		snprintf(buf, sizeof buf, "} %g\n", m.latency / 1e6);
+		duration += "web_request_duration_seconds_sum{" + label + buf;
+		snprintf(buf, sizeof buf, "} %llu\n", count);
+		duration += "web_request_duration_seconds_count{" + label + buf;
+	}
+
+	out = requests + bytes + duration;
+}
+
+WFWebMetrics::WFWebMetrics():
+	id_(__metrics_id++)
+{}
+
+WFWebMetrics::~WFWebMetrics()
+{
+	for (WFWebMetricsShard *s : shards_)
+		delete s;
+}
+
@@ -0,0 +1,112 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBMETRICS_H_
+#define _WFWEBMETRICS_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <workflow/WFTaskFactory.h>
+#include "WFLatencyBuckets.h"
+
+/**
+ * @file   WFWebMetrics.h
+ * @brief  Per-route request metrics of WFWebServer in Prometheus text format
+ */
+
+#define WEB_METRICS_ROUTES_MAX		65536
+#define WEB_METRICS_BUCKETS			LATENCY_BUCKETS
+
+enum
+{
+	WEB_METRICS_1XX		=	0,
+	WEB_METRICS_2XX		=	1,
+	WEB_METRICS_3XX		=	2,
+	WEB_METRICS_4XX		=	3,
+	WEB_METRICS_5XX		=	4,
+	WEB_METRICS_FAILED	=	5,	// reply not sent
+	WEB_METRICS_CLASSES	=	6,
+};
+
+struct WFWebRouteMetrics
+{
+	unsigned long long requests[WEB_METRICS_CLASSES];
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+	unsigned long long latency;		// us, sum
+	unsigned long long buckets[WEB_METRICS_BUCKETS];
+};
+
+class WFWebMetricsShard;
+
+// Every thread records into its own shard with plain stores, so record()
+// takes no lock and no atomic read-modify-write. Readers merge shards.
+class WFWebMetrics
+{
+public:
+	void record(int route, WFHttpTask *task, long long latency);
+
+	// labels may be reset, return -1 if route >= WEB_METRICS_ROUTES_MAX.
+	// record() of a route not added is ignored
+	int add_route(int route, const std::string& method, const std::string& path);
+
+	// return -1 if route is unknown
+	int get_route_metrics(int route, struct WFWebRouteMetrics *metrics);
+
+	// Prometheus text exposition format 0.0.4
+	void dump(std::string& out);
+
+	// see WFLatencyBuckets.h
+	static unsigned long long bucket_bound(int bucket)
+	{
+		return WFLatencyBuckets::bucket_bound(bucket);
+	}
+
+	static int bucket_of(unsigned long long us)
+	{
+		return WFLatencyBuckets::bucket_of(us);
+	}
+
+public:
+	WFWebMetrics();
+	~WFWebMetrics();
+
+	WFWebMetrics(const WFWebMetrics&) = delete;
+	WFWebMetrics& operator= (const WFWebMetrics&) = delete;
+
+private:
+	WFWebMetricsShard *shard();
+	void merge(int route, struct WFWebRouteMetrics *metrics);
+
+private:
+	struct Route
+	{
+		std::string method;
+		std::string path;
+	};
+
+	std::vector<Route> routes_;
+	std::vector<WFWebMetricsShard *> shards_;
+	std::mutex mutex_;
+	unsigned long long id_;
+};
+
+#endif
+
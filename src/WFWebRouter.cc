@@ -0,0 +1,436 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <string.h>
+#include <vector>
+#include "WFWebRouter.h"
+
+class WFWebRouteEntry
+{
+public:
+	std::string method;//empty for any method
+	std::vector<std::string> keys;
+	std::shared_ptr<route_handler_t> handler;
+	struct WFWebRouteAttr attr;
+};
+
+class WFWebRouteNode
+{
+public:
+	WFWebRouteNode *child_of(char c) const
+	{
+		size_t pos = indices.find(c);
+
+		return pos == std::string::npos ? NULL : children[pos];
+	}
+
+	const WFWebRouteEntry *entry_of(const char *method) const
+	{
+		const WFWebRouteEntry *any = NULL;
+
+		for (const WFWebRouteEntry& entry : entries)
+		{
+			if (entry.method.empty())
+				any = &entry;
+			else if (strcmp(entry.method.c_str(), method) == 0)
+				return &entry;
+		}
+
+		return any;
+	}
+
+	WFWebRouteNode():
+		param(NULL),
+		wildcard(NULL),
+		is_prefix(false)
+	{}
+
+	~WFWebRouteNode()
+	{
+		for (WFWebRouteNode *child : children)
+			delete child;
+
+		delete param;
+		delete wildcard;
+	}
+
+public:
+	std::string label;
+	std::string indices;//first char of each child's label
+	std::vector<WFWebRouteNode *> children;
+	WFWebRouteNode *param;
+	WFWebRouteNode *wildcard;
+	std::vector<WFWebRouteEntry> entries;
+	bool is_prefix;
+};
+
+struct __WFWebCapture
+{
+	const char *value;
+	size_t len;
+};
+
+class __WFWebRouteSearch
+{
+public:
+	__WFWebRouteSearch(const char *method, const char *path, size_t len):
+		method_(method),
+		path_(path),
+		len_(len),
+		slash_end_(len > 0 && path[len - 1] == '/'),
+		n_(0),
+		found(NULL),
+		prefix(NULL),
+		prefix_pos(0),
+		redirect(false),
+		not_allowed(false)
+	{}
+
+	// return true if an exact route for method is found
+	bool search(const WFWebRouteNode *node, size_t pos);
+
+private:
+	void push(const char *value, size_t len)
+	{
+		captures[n_].value = value;
+		captures[n_].len = len;
+		n_++;
+	}
+
+	const char *method_;
+	const char *path_;
+	size_t len_;
+	bool slash_end_;
+	size_t n_;
+
+public:
+	__WFWebCapture captures[WEB_PARAMS_MAX];
+	__WFWebCapture prefix_captures[WEB_PARAMS_MAX];
+	const WFWebRouteEntry *found;
+	const WFWebRouteEntry *prefix;
+	size_t prefix_pos;
+	bool redirect;
+	bool not_allowed;
+};
+
+bool __WFWebRouteSearch::search(const WFWebRouteNode *node, size_t pos)
+{
+	const WFWebRouteNode *child;
+	const WFWebRouteEntry *entry;
+
+	if (node->is_prefix && (!prefix || pos > prefix_pos))
+	{
+		entry = node->entry_of(method_);
+		if (entry)
+		{
+			prefix = entry;
+			prefix_pos = pos;
+			memcpy(prefix_captures, captures, n_ * sizeof (__WFWebCapture));
+		}
+	}
+
+	if (pos == len_)
+	{
+		if (!node->entries.empty())
+		{
+			entry = node->entry_of(method_);
+			if (entry)
+			{
+				found = entry;
+				return true;
+			}
+
+			not_allowed = true;
+		}
+
+		child = node->child_of('/');
+		if (!slash_end_ && child && child->label.size() == 1 &&
+			!child->entries.empty())
+		{
+			redirect = true;
+		}
+	}
+	else
+	{
+		child = node->child_of(path_[pos]);
+		if (child)
+		{
+			const std::string& label = child->label;
+			size_t n = len_ - pos;
+
+			if (n > label.size())
+				n = label.size();
+
+			if (memcmp(label.c_str(), path_ + pos, n) == 0)
+			{
+				if (n == label.size())
+				{
+					if (search(child, pos + n))
+						return true;
+				}
+				else if (!slash_end_ && n + 1 == label.size() &&
+						 label[n] == '/' && !child->entries.empty())
+				{
+					// path ends inside this edge
+					redirect = true;
+				}
+			}
+		}
+
+		if (node->param && n_ < WEB_PARAMS_MAX)
+		{
+			size_t end = pos;
+
+			while (end < len_ && path_[end] != '/')
+				end++;
+
+			if (end > pos)
+			{
+				push(path_ + pos, end - pos);
+				if (search(node->param, end))
+					return true;
+
+				n_--;
+			}
+		}
+	}
+
+	if (node->wildcard && n_ < WEB_PARAMS_MAX)
+	{
+		entry = node->wildcard->entry_of(method_);
+		if (entry)
+		{
+			push(path_ + pos, len_ - pos);
+			found = entry;
+			return true;
+		}
+
+		if (!node->wildcard->entries.empty())
+			not_allowed = true;
+	}
+
+	return false;
+}
+
+static WFWebRouteNode *__insert_static(WFWebRouteNode *node,
+									   const char *str, size_t len)
+{
+	size_t pos = 0;
+
+	while (pos < len)
+	{
+		WFWebRouteNode *child = node->child_of(str[pos]);
+
+		if (!child)
+		{
+			child = new WFWebRouteNode;
+			child->label.assign(str + pos, len - pos);
+			node->indices.push_back(str[pos]);
+			node->children.push_back(child);
+			return child;
+		}
+
+		const std::string& label = child->label;
+		size_t i = 1;
+
+		while (i < label.size() && pos + i < len && label[i] == str[pos + i])
+			i++;
+
+		if (i < label.size())
+		{
+			// split the edge, the common part becomes a new inner node
+			auto *inner = new WFWebRouteNode;
+
+			inner->label = label.substr(0, i);
+			inner->indices.push_back(label[i]);
+			inner->children.push_back(child);
+			child->label.erase(0, i);
+			node->children[node->indices.find(str[pos])] = inner;
+			child = inner;
+		}
+
+		pos += i;
+		node = child;
+	}
+
+	return node;
+}
+
+static inline bool __is_capture(const std::string& path, size_t pos)
+{
+	return (path[pos] == ':' || path[pos] == '*') &&
+		   pos > 0 && path[pos - 1] == '/';
+}
+
+const WFWebParam *WFWebParams::find(const char *key) const
+{
+	size_t len = strlen(key);
+
+	for (size_t i = 0; i < size_; i++)
+	{
+		if (params_[i].key_len == len && memcmp(params_[i].key, key, len) == 0)
+			return &params_[i];
+	}
+
+	return NULL;
+}
+
+std::string WFWebParams::get(const std::string& key) const
+{
+	const WFWebParam *param = find(key.c_str());
+
+	if (!param)
+		return "";
+
+	return std::string(param->value, param->value_len);
+}
+
+WFWebRouter::WFWebRouter():
+	root_(new WFWebRouteNode)
+{}
+
+WFWebRouter::~WFWebRouter()
+{
+	delete root_;
+}
+
+int WFWebRouter::add(const std::string& method, const std::string& path,
+					 const std::shared_ptr<route_handler_t>& handler,
+					 const struct WFWebRouteAttr *attr)
+{
+	std::vector<std::string> keys;
+	WFWebRouteNode *node = root_;
+	size_t pos = 0;
+	size_t end;
+
+	if (path.empty() || attr->priority < 0 || attr->priority >= WEB_PRIORITY_MAX)
+		return -1;
+
+	// check before touching the tree
+	for (end = 0; end < path.size(); end++)
+	{
+		if (!__is_capture(path, end))
+			continue;
+
+		pos = path.find('/', end);
+		if (path[end] == '*' && pos != std::string::npos)
+			return -1;
+
+		if (pos == std::string::npos)
+			pos = path.size();
+
+		if (pos == end + 1 || keys.size() == WEB_PARAMS_MAX)
+			return -1;
+
+		keys.emplace_back(path, end + 1, pos - end - 1);
+	}
+
+	pos = 0;
+	while (pos < path.size())
+	{
+		end = pos;
+		while (end < path.size() && !__is_capture(path, end))
+			end++;
+
+		node = __insert_static(node, path.c_str() + pos, end - pos);
+		if (end == path.size())
+			break;
+
+		if (path[end] == ':')
+		{
+			if (!node->param)
+				node->param = new WFWebRouteNode;
+
+			node = node->param;
+			pos = path.find('/', end);
+			if (pos == std::string::npos)
+				pos = path.size();
+		}
+		else
+		{
+			if (!node->wildcard)
+				node->wildcard = new WFWebRouteNode;
+
+			node = node->wildcard;
+			pos = path.size();
+		}
+	}
+
+	node->is_prefix = (path.back() == '/');
+	for (WFWebRouteEntry& entry : node->entries)
+	{
+		if (entry.method == method)
+		{
+			entry.keys = std::move(keys);
+			entry.handler = handler;
+			entry.attr = *attr;
+			return 0;
+		}
+	}
+
+	node->entries.emplace_back();
+	node->entries.back().method = method;
+	node->entries.back().keys = std::move(keys);
+	node->entries.back().handler = handler;
+	node->entries.back().attr = *attr;
+	return 0;
+}
+
+int WFWebRouter::find(const char *method, const char *path, size_t len,
+					  const route_handler_t **handler, WFWebParams *params,
+					  const struct WFWebRouteAttr **attr) const
+{
+	__WFWebRouteSearch s(method, path, len);
+	const WFWebRouteEntry *entry;
+	const __WFWebCapture *captures;
+
+	if (s.search(root_, 0))
+	{
+		entry = s.found;
+		captures = s.captures;
+	}
+	else if (s.redirect)
+		return WEB_ROUTE_REDIRECT;
+	else if (s.prefix)
+	{
+		entry = s.prefix;
+		captures = s.prefix_captures;
+	}
+	else if (s.not_allowed)
+		return WEB_ROUTE_METHOD_NOT_ALLOWED;
+	else
+		return WEB_ROUTE_NOT_FOUND;
+
+	*handler = entry->handler.get();
+	if (attr)
+		*attr = &entry->attr;
+
+	params->size_ = entry->keys.size();
+	for (size_t i = 0; i < params->size_; i++)
+	{
+		WFWebParam& param = params->params_[i];
+
+		param.key = entry->keys[i].c_str();
+		param.key_len = entry->keys[i].size();
+		param.value = captures[i].value;
+		param.value_len = captures[i].len;
+	}
+
+	return WEB_ROUTE_FOUND;
+}
+
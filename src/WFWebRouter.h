@@ -0,0 +1,156 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBROUTER_H_
+#define _WFWEBROUTER_H_
+
+#include <stddef.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include <workflow/WFTaskFactory.h>
+
+/**
+ * @file   WFWebRouter.h
+ * @brief  Compressed radix tree for WFWebServer path routing
+ */
+
+#define WEB_PARAMS_MAX		16
+
+enum
+{
+	WEB_ROUTE_NOT_FOUND				=	0,
+	WEB_ROUTE_FOUND					=	1,
+	WEB_ROUTE_REDIRECT				=	2,	// path + '/' is a route, answer 302
+	WEB_ROUTE_METHOD_NOT_ALLOWED	=	3,
+};
+
+// admission priority of a route, see WFWebAdmission.h
+enum
+{
+	WEB_PRIORITY_CRITICAL			=	0,	// never shed, such as health checks
+	WEB_PRIORITY_NORMAL				=	1,
+	WEB_PRIORITY_BULK				=	2,	// shed first
+	WEB_PRIORITY_MAX				=	3,
+};
+
+struct WFWebRouteAttr
+{
+	int priority;
+	size_t body_limit;		// 413 if request body is larger, 0 for no limit
+	const char *spill_dir;	// write request body to a file here, NULL for memory
+	int id;					// set by WFWebProcessor, for metrics
+};
+
+static constexpr struct WFWebRouteAttr WEB_ROUTE_ATTR_DEFAULT =
+{
+	.priority		=	WEB_PRIORITY_NORMAL,
+	.body_limit		=	0,
+	.spill_dir		=	NULL,
+	.id				=	-1,
+};
+
+// key points into the router, value points into the request-target,
+// only valid during the handler call
+struct WFWebParam
+{
+	const char *key;
+	size_t key_len;
+	const char *value;
+	size_t value_len;
+};
+
+class WFWebParams
+{
+public:
+	size_t size() const { return size_; }
+	const WFWebParam& operator[] (size_t i) const { return params_[i]; }
+
+	// return NULL if key not found
+	const WFWebParam *find(const char *key) const;
+
+	// copy the value out, "" if key not found
+	std::string get(const std::string& key) const;
+
+public:
+	WFWebParams():
+		size_(0)
+	{}
+
+private:
+	WFWebParam params_[WEB_PARAMS_MAX];
+	size_t size_;
+
+	friend class WFWebRouter;
+};
+
+using processor_handler_t = std::function<void (WFHttpTask *)>;
+using route_handler_t = std::function<void (WFHttpTask *, const WFWebParams&)>;
+
+class WFWebRouteNode;
+
+// A router is never modified after it has been handed to readers.
+// Writers build a new one and publish it, so find() takes no lock.
+//
+// path pattern:
+//   /user/list    static, exact match
+//   /static/      ends with '/', also match any path starts with it
+//   /user/:id     ':' at the start of a segment, capture one segment
+//   /files/*path  '*' at the start of the last segment, capture the rest
+// static beats ':' beats '*' on the same position.
+class WFWebRouter
+{
+public:
+	// method empty for any method
+	// return -1 if pattern is invalid or has more than WEB_PARAMS_MAX captures
+	int add(const std::string& method, const std::string& path,
+			const std::shared_ptr<route_handler_t>& handler)
+	{
+		return add(method, path, handler, &WEB_ROUTE_ATTR_DEFAULT);
+	}
+
+	int add(const std::string& method, const std::string& path,
+			const std::shared_ptr<route_handler_t>& handler,
+			const struct WFWebRouteAttr *attr);
+
+	// exact match first, then 302 to path + '/', then longest prefix.
+	// method and captures are resolved in the same traversal
+	int find(const char *method, const char *path, size_t len,
+			 const route_handler_t **handler, WFWebParams *params) const
+	{
+		return find(method, path, len, handler, params, NULL);
+	}
+
+	// attr may be NULL
+	int find(const char *method, const char *path, size_t len,
+			 const route_handler_t **handler, WFWebParams *params,
+			 const struct WFWebRouteAttr **attr) const;
+
+public:
+	WFWebRouter();
+	~WFWebRouter();
+
+	WFWebRouter(const WFWebRouter&) = delete;
+	WFWebRouter& operator= (const WFWebRouter&) = delete;
+
+private:
+	WFWebRouteNode *root_;
+};
+
+#endif
+
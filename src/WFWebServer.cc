@@ -16,12 +16,53 @@
   Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
-#include <workflow/StringUtil.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 #include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include "WFRequestTarget.h"
+#include "WFSeriesUtil.h"
 #include "WFWebServer.h"
 
 using namespace protocol;
 
+#define WEB_KEEPALIVE_MAX		(300 * 1000)
+// processors a thread keeps a router of, two servers are common
+#define WEB_ROUTER_CACHE_SIZE	4
+
+static long long __monotonic_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static std::atomic<unsigned long long> __processor_id(1);
+
+static thread_local struct __WFRouterCache
+{
+	unsigned long long id;
+	unsigned long long version;
+	std::shared_ptr<const WFWebRouter> router;
+} __router_cache[WEB_ROUTER_CACHE_SIZE];
+
+static thread_local unsigned int __router_cache_next;
+
+class __WFWebRequestContext
+{
+public:
+	std::shared_ptr<const WFWebRouter> router;
+	long long start;
+	int route;
+	bool admitted;
+};
+
 class __WFHttpTask : public WFServerTask<HttpRequest, HttpResponse>
 {
 public:
@@ -56,113 +97,807 @@ private:
 
 };
 
-void WFWebProcessor::process(WFHttpTask *task)
+enum
 {
-	auto *req = task->get_req();
-	auto *resp = task->get_resp();
-	std::string host;
+	WEB_BODY_PARSE		=	0,	// into the message as usual
+	WEB_BODY_SPILL		=	1,	// into a temporary file
+};
 
-	resp->set_http_version("HTTP/1.1");
+// The file a body is spilled to. Writes are pwrite tasks of the io service
+// and hold a reference, the last one closes and removes the file.
+class __WFWebSpill
+{
+public:
+	__WFWebSpill():
+		fd(-1),
+		pending(0),
+		error(false),
+		waiter(NULL)
+	{}
 
-	HttpHeaderCursor cursor(req);
-	cursor.find("Host", host);
+	~__WFWebSpill()
+	{
+		if (fd >= 0)
+			close(fd);
+
+		if (!file.empty())
+			unlink(file.c_str());
+	}
+
+public:
+	std::string file;
+	int fd;
+	int pending;
+	bool error;
+	WFCounterTask *waiter;//of process(), counted by the last write
+	std::mutex mutex;
+};
+
+static void __spill_done(__WFWebSpill *spill, WFFileIOTask *task)
+{
+	WFCounterTask *waiter = NULL;
 
-	if (host.empty())
+	spill->mutex.lock();
+	if (task->get_state() != WFT_STATE_SUCCESS ||
+		task->get_retval() != (ssize_t)task->get_args()->count)
 	{
-		//header Host not found
-		HttpUtil::set_response_status(resp, HttpStatusBadRequest);
+		spill->error = true;
+	}
+
+	if (--spill->pending == 0)
+	{
+		waiter = spill->waiter;
+		spill->waiter = NULL;
+	}
+
+	spill->mutex.unlock();
+	if (waiter)
+		waiter->count();
+}
+
+// The header goes to the parser as usual, then the route of the request
+// decides where its body goes, before any byte of the body is kept.
+class __WFWebRequest : public HttpRequest
+{
+public:
+	__WFWebRequest(const WFWebProcessor *processor):
+		file_size(0),
+		too_large(false),
+		body_lost(false),
+		processor_(processor),
+		mode_(WEB_BODY_PARSE),
+		limit_(0),
+		remaining_(0),
+		body_bytes_(0),
+		line_empty_(false),
+		header_read_(false)
+	{
+		match_.version = 0;
+	}
+
+	// after wait_spill()
+	bool body_in_file() const { return spill_ && !spill_->error; }
+	bool spill_failed() const { return spill_ && spill_->error; }
+	const std::string& body_file() const { return spill_->file; }
+	const struct WFWebRouteMatch *get_match() const { return &match_; }
+
+	// NULL if no write of the body is on the way, or a counter to push
+	// into the series, its callback runs once the last one is done
+	WFCounterTask *wait_spill(counter_callback_t callback);
+
+protected:
+	virtual int append(const void *buf, size_t *size);
+
+private:
+	void route();
+	int append_body(const void *buf, size_t *size);
+	void spill(const void *buf, size_t size);
+
+public:
+	size_t file_size;
+	bool too_large;
+	bool body_lost;
+
+private:
+	const WFWebProcessor *processor_;
+	std::shared_ptr<__WFWebSpill> spill_;
+	struct WFWebRouteMatch match_;
+	int mode_;
+	size_t limit_;
+	size_t remaining_;//of Content-Length, when the body is spilled
+	size_t body_bytes_;
+	bool line_empty_;
+	bool header_read_;
+};
+
+int __WFWebRequest::append(const void *buf, size_t *size)
+{
+	if (header_read_)
+		return append_body(buf, size);
+
+	const char *p = (const char *)buf;
+	size_t n = *size;
+	size_t len = 0;
+
+	// the header ends with an empty line, bare LF is accepted as the parser
+	while (len < n && !header_read_)
+	{
+		if (p[len] == '\n')
+		{
+			header_read_ = line_empty_;
+			line_empty_ = true;
+		}
+		else if (p[len] != '\r')
+			line_empty_ = false;
+
+		len++;
+	}
+
+	int ret = this->HttpRequest::append(buf, &len);
+
+	if (ret != 0 || !header_read_)
+	{
+		*size = len;
+		return ret;
+	}
+
+	route();
+
+	// answered at once, the connection is closed after the reply and the
+	// rest of the body is never read
+	if (too_large || body_lost)
+		return 1;
+
+	size_t rest = n - len;
+
+	if (rest > 0)
+		ret = append_body(p + len, &rest);
+
+	*size = len + rest;
+	return ret;
+}
+
+void __WFWebRequest::route()
+{
+	std::string value;
+
+	// most servers set neither, nothing to look up for them
+	if (!processor_->has_body_attr())
+		return;
+
+	processor_->match(this, &match_);
+	if (match_.result != WEB_ROUTE_FOUND)
+		return;
+
+	HttpHeaderCursor cursor(this);
+	const char *dir = match_.attr->spill_dir;
+
+	limit_ = match_.attr->body_limit;
+	if (this->is_chunked() || !cursor.find("Content-Length", value))
+		return;
+
+	remaining_ = strtoull(value.c_str(), NULL, 10);
+	if (limit_ > 0 && remaining_ > limit_)
+	{
+		too_large = true;
 		return;
 	}
 
-	std::string request_uri;
+	if (!dir || remaining_ == 0)
+		return;
 
-	if (is_ssl_)
-		request_uri = "https://";
-	else
-		request_uri = "http://";
+	auto spill = std::make_shared<__WFWebSpill>();
 
-	request_uri += host;
-	request_uri += req->get_request_uri();
+	spill->file = dir;
+	spill->file += "/body.XXXXXX";
+	spill->fd = mkstemp(&spill->file[0]);
+	if (spill->fd < 0)
+	{
+		spill->file.clear();
+		body_lost = true;
+		return;
+	}
 
-	ParsedURI uri;
+	spill_ = std::move(spill);
+	mode_ = WEB_BODY_SPILL;
+}
 
-	if (URIParser::parse(request_uri, uri) < 0)
+// a copy of buf is written by a pwrite task, the network thread never
+// waits for the disk. A failed write is seen by process()
+void __WFWebRequest::spill(const void *buf, size_t size)
+{
+	std::shared_ptr<__WFWebSpill> spill = spill_;
+	void *copy = malloc(size);
+	WFFileIOTask *task;
+
+	spill->mutex.lock();
+	if (!copy || spill->error)
 	{
-		//parse error
-		//todo 500 status code when uri sys error
-		HttpUtil::set_response_status(resp, HttpStatusBadRequest);
+		spill->error = true;
+		spill->mutex.unlock();
+		free(copy);
 		return;
 	}
 
-	std::string path;
+	spill->pending++;
+	spill->mutex.unlock();
 
-	if (uri.path && uri.path[0])
-		path = uri.path;
-	else
-		path = "/";
+	memcpy(copy, buf, size);
+	task = WFTaskFactory::create_pwrite_task(spill->fd, copy, size, file_size,
+		[spill, copy](WFFileIOTask *task) {
+			free(copy);
+			__spill_done(spill.get(), task);
+		});
+
+	task->start();
+}
 
-	const processor_handler_t *p = NULL;
+WFCounterTask *__WFWebRequest::wait_spill(counter_callback_t callback)
+{
+	if (!spill_)
+		return NULL;
 
-	pthread_rwlock_rdlock(&rwlock_);
-	const auto it = handler_map_.find(path);
+	std::lock_guard<std::mutex> lock(spill_->mutex);
 
-	if (it != handler_map_.cend())
-		p = &it->second;
-	else
+	if (spill_->pending == 0)
+		return NULL;
+
+	// may be counted before the series starts it, a counter waits for that
+	spill_->waiter = WFTaskFactory::create_counter_task(1, std::move(callback));
+	return spill_->waiter;
+}
+
+int __WFWebRequest::append_body(const void *buf, size_t *size)
+{
+	if (mode_ == WEB_BODY_PARSE)
 	{
-		if (path.back() != '/' &&
-			handler_map_.find(path + '/') != handler_map_.end())
+		int ret = this->HttpRequest::append(buf, size);
+
+		// Content-Length is within the limit, a chunked body is counted
+		// with its framing and answered at once when it passes
+		body_bytes_ += *size;
+		if (ret >= 0 && limit_ > 0 && body_bytes_ > limit_)
+		{
+			too_large = true;
+			return 1;
+		}
+
+		return ret;
+	}
+
+	size_t n = *size < remaining_ ? *size : remaining_;
+
+	spill(buf, n);
+	file_size += n;
+	remaining_ -= n;
+	*size = n;
+	return remaining_ > 0 ? 0 : 1;
+}
+
+// the same as the http server task of workflow, but the request is read
+// into __WFWebRequest and moved into req once complete
+class __WFWebServerTask : public WFServerTask<HttpRequest, HttpResponse>
+{
+public:
+	__WFWebServerTask(CommService *service, const WFWebProcessor *processor,
+					  std::function<void (WFHttpTask *)>& proc):
+		WFServerTask(service, proc),
+		in_(processor),
+		req_is_alive_(false)
+	{}
+
+	const __WFWebRequest *get_in() const { return &in_; }
+	__WFWebRequest *get_in() { return &in_; }
+
+protected:
+	virtual CommMessageIn *message_in() { return &in_; }
+	virtual CommMessageOut *message_out();
+	virtual void handle(int state, int error);
+
+private:
+	void keep_alive_params();
+
+private:
+	__WFWebRequest in_;
+	bool req_is_alive_;
+	std::string req_keep_alive_;
+};
+
+void __WFWebServerTask::handle(int state, int error)
+{
+	if (state == WFT_STATE_TOREPLY)
+	{
+		this->req = std::move(in_);
+		req_is_alive_ = this->req.is_keep_alive();
+		if (req_is_alive_)
+		{
+			HttpHeaderCursor cursor(&this->req);
+
+			cursor.find("Keep-Alive", req_keep_alive_);
+		}
+	}
+
+	WFServerTask::handle(state, error);
+}
+
+// "Keep-Alive: timeout=5, max=100" of request
+void __WFWebServerTask::keep_alive_params()
+{
+	const char *p = req_keep_alive_.c_str();
+
+	while (*p)
+	{
+		while (*p == ' ' || *p == ',')
+			p++;
+
+		if (strncasecmp(p, "timeout=", 8) == 0)
+			this->keep_alive_timeo = 1000 * atoi(p + 8);
+		else if (strncasecmp(p, "max=", 4) == 0 &&
+				 this->get_task_seq() >= atoll(p + 4))
 		{
-			pthread_rwlock_unlock(&rwlock_);
-			//302
-			HttpUtil::set_response_status(resp, HttpStatusFound);
-			resp->add_header_pair("Location", request_uri + '/');
+			this->keep_alive_timeo = 0;
 			return;
 		}
 
-		// find longest pattern
-		for (const auto& kv : path_map_)
+		p += strcspn(p, ",");
+	}
+}
+
+CommMessageOut *__WFWebServerTask::message_out()
+{
+	auto *resp = this->get_resp();
+	struct HttpMessageHeader header;
+	HttpHeaderCursor cursor(resp);
+	bool has_length = false;
+	bool has_connection = false;
+	bool is_alive;
+
+	if (!resp->get_http_version())
+		resp->set_http_version("HTTP/1.1");
+
+	if (!resp->get_status_code() || !resp->get_reason_phrase())
+	{
+		int status_code = HttpStatusOK;
+
+		if (resp->get_status_code())
+			status_code = atoi(resp->get_status_code());
+
+		HttpUtil::set_response_status(resp, status_code);
+	}
+
+	while (cursor.next(&header))
+	{
+		if (header.name_len == 14 &&
+			strncasecmp((const char *)header.name, "Content-Length", 14) == 0)
 		{
-			if (StringUtil::start_with(path, kv.first))
-			{
-				p = kv.second;
-				break;
-			}
+			has_length = true;
+		}
+		else if (header.name_len == 10 &&
+				 strncasecmp((const char *)header.name, "Connection", 10) == 0)
+		{
+			has_connection = true;
 		}
 	}
 
-	pthread_rwlock_unlock(&rwlock_);
+	if (!resp->is_chunked() && !has_length)
+	{
+		resp->add_header_pair("Content-Length",
+							  std::to_string(resp->get_output_body_size()));
+	}
 
-	if (!p)
+	is_alive = has_connection ? resp->is_keep_alive() : req_is_alive_;
+	if (!is_alive)
+		this->keep_alive_timeo = 0;
+	else
 	{
+		keep_alive_params();
+		if ((unsigned int)this->keep_alive_timeo > WEB_KEEPALIVE_MAX)
+			this->keep_alive_timeo = WEB_KEEPALIVE_MAX;
+	}
+
+	if (!has_connection)
+	{
+		resp->add_header_pair("Connection",
+							  this->keep_alive_timeo == 0 ? "close" : "Keep-Alive");
+	}
+
+	return this->WFServerTask::message_out();
+}
+
+void WFWebProcessor::process(WFHttpTask *task)
+{
+	// every task of WFWebServer is created by new_session()
+	auto *in = static_cast<__WFWebServerTask *>(task)->get_in();
+	WFCounterTask *waiter;
+
+	// the last writes of a spilled body may still be on the way
+	waiter = in->wait_spill([this, task](WFCounterTask *) {
+		this->serve(task);
+	});
+
+	if (waiter)
+		series_of(task)->push_back(waiter);
+	else
+		serve(task);
+}
+
+void WFWebProcessor::serve(WFHttpTask *task)
+{
+	auto *req = task->get_req();
+	auto *resp = task->get_resp();
+	struct HttpMessageHeader host;
+	const __WFWebRequest *in = static_cast<__WFWebServerTask *>(task)->get_in();
+
+	resp->set_http_version("HTTP/1.1");
+	if (in->too_large)
+	{
+		HttpUtil::set_response_status(resp, HttpStatusRequestEntityTooLarge);
+		resp->add_header_pair("Connection", "close");
+		return;
+	}
+
+	if (in->body_lost || in->spill_failed())
+	{
+		// the rest of a body that is not spilled is never read
+		HttpUtil::set_response_status(resp, HttpStatusInternalServerError);
+		if (in->body_lost)
+			resp->add_header_pair("Connection", "close");
+
+		return;
+	}
+
+	host.name = "Host";
+	host.name_len = 4;
+
+	HttpHeaderCursor cursor(req);
+
+	if (!cursor.find(&host) || host.value_len == 0)
+	{
+		//header Host not found
+		HttpUtil::set_response_status(resp, HttpStatusBadRequest);
+		return;
+	}
+
+	WFRequestTarget target;
+
+	if (WFRequestTargetParser::parse(req->get_request_uri(), target) < 0)
+	{
+		//parse error
+		HttpUtil::set_response_status(resp, HttpStatusBadRequest);
+		return;
+	}
+
+	// handler and params point into the router, this thread keeps it
+	unsigned long long version;
+	const std::shared_ptr<const WFWebRouter>& router = this->router(&version);
+	const struct WFWebRouteMatch *match = in->get_match();
+	const route_handler_t *p = NULL;
+	const struct WFWebRouteAttr *attr = NULL;
+	const WFWebParams *params;
+	WFWebParams found;
+	int result;
+
+	// looked up with the same router while the header was read
+	if (match->version == version && match->path == target.path)
+	{
+		result = match->result;
+		p = match->handler;
+		attr = match->attr;
+		params = &match->params;
+	}
+	else
+	{
+		result = router->find(req->get_method(), target.path, target.path_len,
+							  &p, &found, &attr);
+		params = &found;
+	}
+
+	switch (result)
+	{
+	case WEB_ROUTE_FOUND:
+		break;
+
+	case WEB_ROUTE_REDIRECT:
+		//302
+		HttpUtil::set_response_status(resp, HttpStatusFound);
+		resp->add_header_pair("Location",
+			WFRequestTargetParser::redirect_location(is_ssl_,
+													 (const char *)host.value,
+													 host.value_len,
+													 target));
+		return;
+
+	case WEB_ROUTE_METHOD_NOT_ALLOWED:
+		HttpUtil::set_response_status(resp, HttpStatusMethodNotAllowed);
+		return;
+
+	default:
 		HttpUtil::set_response_status(resp, HttpStatusNotFound);
 		return;
 	}
 
+	if (admission_ || metrics_)
+	{
+		auto *ctx = new __WFWebRequestContext;
+
+		// admission may call the handler later, from another thread
+		if (admission_)
+			ctx->router = router;
+
+		ctx->start = __monotonic_us();
+		ctx->route = attr->id;
+		ctx->admitted = false;
+		// the series ends after the reply, tasks of handler included.
+		// Chained, a handler may take the callback of the series too
+		WFSeriesUtil::defer(series_of(task), [this, task, ctx]() {
+			this->finish(task, ctx);
+		});
+
+		if (admission_)
+			return admission_->process(task, attr->priority, p, *params,
+									   &ctx->admitted);
+	}
+
 	const auto& handler = *p;
 
 	if (handler)
-		handler(task);
+		handler(task, *params);
 }
 
-void WFWebProcessor::set_handler(std::string path, processor_handler_t&& handler)
+const std::shared_ptr<const WFWebRouter>&
+WFWebProcessor::router(unsigned long long *version) const
 {
-	if (path.empty())
-		return;
+	struct __WFRouterCache *cache = NULL;
+
+	*version = version_.load(std::memory_order_acquire);
+
+	for (auto& entry : __router_cache)
+	{
+		if (entry.id == id_)
+		{
+			if (entry.version == *version)
+				return entry.router;
+
+			cache = &entry;
+			break;
+		}
+	}
+
+	if (!cache)
+	{
+		cache = &__router_cache[__router_cache_next++ % WEB_ROUTER_CACHE_SIZE];
+		cache->id = id_;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	cache->router = router_;
+	cache->version = version_.load(std::memory_order_relaxed);
+	*version = cache->version;
+	return cache->router;
+}
+
+void WFWebProcessor::finish(WFHttpTask *task, void *context)
+{
+	auto *ctx = static_cast<__WFWebRequestContext *>(context);
 
-	pthread_rwlock_wrlock(&rwlock_);
+	if (ctx->admitted)
+		admission_->release();
 
-	auto it = handler_map_.find(path);
-	if (it != handler_map_.end())
-		it->second = handler;
+	if (metrics_)
+		metrics_->record(ctx->route, task, __monotonic_us() - ctx->start);
+
+	delete ctx;
+}
+
+int WFWebProcessor::set_handler(std::string method, std::string path,
+								route_handler_t&& handler)
+{
+	auto ptr = std::make_shared<route_handler_t>(std::move(handler));
+	WFWebRouter check;
+
+	// an invalid path never reaches routes_
+	if (check.add(method, path, ptr) < 0)
+		return -1;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFWebRoute *route = route_of(method, path);
+
+	if (route)
+		route->handler = std::move(ptr);
+	else if (metrics_ && routes_.size() >= WEB_METRICS_ROUTES_MAX)
+		return -1;//never counted silently
 	else
-		it = handler_map_.emplace(std::move(path), std::move(handler)).first;
+	{
+		routes_.emplace_back();
+		route = &routes_.back();
+		route->method = std::move(method);
+		route->path = std::move(path);
+		route->handler = std::move(ptr);
+		route->attr = WEB_ROUTE_ATTR_DEFAULT;
+		route->attr.id = (int)routes_.size() - 1;
+		if (metrics_)
+			metrics_->add_route(route->attr.id, route->method, route->path);
+	}
+
+	publish();
+	return 0;
+}
+
+int WFWebProcessor::set_priority(const std::string& method,
+								 const std::string& path, int priority)
+{
+	if (priority < 0 || priority >= WEB_PRIORITY_MAX)
+		return -1;
 
-	const std::string& key = it->first;
-	if (key.back() == '/')
-		path_map_[key] = &it->second;
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFWebRoute *route = route_of(method, path);
+
+	if (!route)
+		return -1;
+
+	route->attr.priority = priority;
+	publish();
+	return 0;
+}
+
+int WFWebProcessor::set_body_limit(const std::string& method,
+								   const std::string& path, size_t limit)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFWebRoute *route = route_of(method, path);
+
+	if (!route)
+		return -1;
+
+	route->attr.body_limit = limit;
+	publish();
+	return 0;
+}
+
+int WFWebProcessor::set_body_spill(const std::string& method,
+								   const std::string& path,
+								   const std::string& dir)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	WFWebRoute *route = route_of(method, path);
+
+	if (!route)
+		return -1;
+
+	spill_dirs_.push_back(dir);
+	route->attr.spill_dir = spill_dirs_.back().c_str();
+	publish();
+	return 0;
+}
 
-	pthread_rwlock_unlock(&rwlock_);
+void WFWebProcessor::match(const HttpRequest *req,
+						   struct WFWebRouteMatch *match) const
+{
+	const WFWebRouter *router = this->router(&match->version).get();
+	const char *method = req->get_method();
+	const char *uri = req->get_request_uri();
+	WFRequestTarget target;
+
+	if (!method || !uri || WFRequestTargetParser::parse(uri, target) < 0)
+	{
+		match->version = 0;
+		return;
+	}
+
+	match->path = target.path;
+	match->result = router->find(method, target.path, target.path_len,
+								 &match->handler, &match->params, &match->attr);
+}
+
+// with mutex_ locked
+WFWebRoute *WFWebProcessor::route_of(const std::string& method,
+									 const std::string& path)
+{
+	for (WFWebRoute& route : routes_)
+	{
+		if (route.method == method && route.path == path)
+			return &route;
+	}
+
+	return NULL;
+}
+
+// with mutex_ locked
+void WFWebProcessor::publish()
+{
+	auto router = std::make_shared<WFWebRouter>();
+	bool body_attr = false;
+
+	for (const WFWebRoute& route : routes_)
+	{
+		router->add(route.method, route.path, route.handler, &route.attr);
+		if (route.attr.body_limit > 0 || route.attr.spill_dir)
+			body_attr = true;
+	}
+
+	// threads and requests still walking the old router hold references
+	router_ = std::move(router);
+	body_attr_.store(body_attr, std::memory_order_relaxed);
+	version_.fetch_add(1, std::memory_order_release);
+}
+
+int WFWebProcessor::set_metrics(const std::string& path)
+{
+	mutex_.lock();
+	if (routes_.size() >= WEB_METRICS_ROUTES_MAX)
+	{
+		mutex_.unlock();
+		return -1;
+	}
+
+	if (!metrics_)
+	{
+		metrics_ = new WFWebMetrics;
+		for (const WFWebRoute& route : routes_)
+			metrics_->add_route(route.attr.id, route.method, route.path);
+	}
+
+	mutex_.unlock();
+
+	WFWebMetrics *metrics = metrics_;
+
+	return set_handler("GET", path, [metrics](WFHttpTask *task, const WFWebParams&) {
+		auto *resp = task->get_resp();
+		std::string text;
+
+		metrics->dump(text);
+		resp->add_header_pair("Content-Type", "text/plain; version=0.0.4");
+		resp->append_output_body(text);
+	});
+}
+
+int WFWebProcessor::get_route_metrics(const std::string& method,
+									  const std::string& path,
+									  struct WFWebRouteMetrics *metrics)
+{
+	int id;
+
+	mutex_.lock();
+	WFWebRoute *route = route_of(method, path);
+
+	id = route ? route->attr.id : -1;
+	mutex_.unlock();
+
+	if (!metrics_ || id < 0)
+		return -1;
+
+	return metrics_->get_route_metrics(id, metrics);
+}
+
+void WFWebProcessor::set_admission(const struct WFWebAdmissionParams *params)
+{
+	delete admission_;
+	admission_ = new WFWebAdmission(params);
+}
+
+void WFWebProcessor::ssl_start(bool is_ssl)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	is_ssl_ = is_ssl;
+}
+
+WFWebProcessor::WFWebProcessor():
+	router_(std::make_shared<WFWebRouter>()),
+	version_(1),
+	id_(__processor_id++),
+	body_attr_(false),
+	admission_(NULL),
+	metrics_(NULL),
+	is_ssl_(false)
+{
+}
+
+WFWebProcessor::~WFWebProcessor()
+{
+	delete admission_;
+	delete metrics_;
 }
 
 WFWebServer::WFWebServer():
@@ -180,7 +915,7 @@ WFWebServer::WFWebServer(const WFServerParams *params):
 class __WebFunctor
 {
 public:
-	void operator() (WFHttpTask *task) const
+	void operator() (WFHttpTask *task, const WFWebParams& params) const
 	{
 		if (handler_)
 			handler_(*task->get_req(), *task->get_resp());
@@ -202,46 +937,182 @@ private:
 	web_handler_t handler_;
 };
 
-void WFWebServer::set_handler(const std::string& path, web_handler_t handler)
+class __WebParamsFunctor
 {
-	processor_.set_handler(path, __WebFunctor(std::move(handler)));
+public:
+	void operator() (WFHttpTask *task, const WFWebParams& params) const
+	{
+		if (handler_)
+			handler_(*task->get_req(), *task->get_resp(), params);
+	}
+
+	__WebParamsFunctor(web_params_handler_t&& handler):
+		handler_(std::move(handler))
+	{}
+
+	__WebParamsFunctor(const __WebParamsFunctor& copy):
+		handler_(copy.handler_)
+	{}
+
+	__WebParamsFunctor(__WebParamsFunctor&& move):
+		handler_(std::move(move.handler_))
+	{}
+
+private:
+	web_params_handler_t handler_;
+};
+
+class __ProcessorFunctor
+{
+public:
+	void operator() (WFHttpTask *task, const WFWebParams& params) const
+	{
+		if (handler_)
+			handler_(task);
+	}
+
+	__ProcessorFunctor(processor_handler_t&& handler):
+		handler_(std::move(handler))
+	{}
+
+	__ProcessorFunctor(const __ProcessorFunctor& copy):
+		handler_(copy.handler_)
+	{}
+
+	__ProcessorFunctor(__ProcessorFunctor&& move):
+		handler_(std::move(move.handler_))
+	{}
+
+private:
+	processor_handler_t handler_;
+};
+
+int WFWebServer::set_handler(const std::string& path, web_handler_t handler)
+{
+	return processor_.set_handler("", path, __WebFunctor(std::move(handler)));
 }
 
-void WFWebServer::set_handler(const std::string& path, processor_handler_t handler)
+int WFWebServer::set_handler(const std::string& path, web_params_handler_t handler)
 {
-	processor_.set_handler(path, std::move(handler));
+	return processor_.set_handler("", path, __WebParamsFunctor(std::move(handler)));
 }
 
-int WFWebServer::start(unsigned short port)
+int WFWebServer::set_handler(const std::string& path, processor_handler_t handler)
+{
+	return processor_.set_handler("", path, __ProcessorFunctor(std::move(handler)));
+}
+
+int WFWebServer::set_handler(const std::string& path, route_handler_t handler)
 {
-	int ret = this->WFHttpServer::start(port);
+	return processor_.set_handler("", path, std::move(handler));
+}
 
+int WFWebServer::set_handler(const std::string& method, const std::string& path,
+							 web_handler_t handler)
+{
+	return processor_.set_handler(method, path, __WebFunctor(std::move(handler)));
+}
+
+int WFWebServer::set_handler(const std::string& method, const std::string& path,
+							 web_params_handler_t handler)
+{
+	return processor_.set_handler(method, path, __WebParamsFunctor(std::move(handler)));
+}
+
+int WFWebServer::set_handler(const std::string& method, const std::string& path,
+							 processor_handler_t handler)
+{
+	return processor_.set_handler(method, path, __ProcessorFunctor(std::move(handler)));
+}
+
+int WFWebServer::set_handler(const std::string& method, const std::string& path,
+							 route_handler_t handler)
+{
+	return processor_.set_handler(method, path, std::move(handler));
+}
+
+int WFWebServer::set_priority(const std::string& path, int priority)
+{
+	return processor_.set_priority("", path, priority);
+}
+
+int WFWebServer::set_priority(const std::string& method, const std::string& path,
+							  int priority)
+{
+	return processor_.set_priority(method, path, priority);
+}
+
+int WFWebServer::set_body_limit(const std::string& path, size_t limit)
+{
+	return processor_.set_body_limit("", path, limit);
+}
+
+int WFWebServer::set_body_limit(const std::string& method, const std::string& path,
+								size_t limit)
+{
+	return processor_.set_body_limit(method, path, limit);
+}
+
+int WFWebServer::set_body_spill(const std::string& path, const std::string& dir)
+{
+	return processor_.set_body_spill("", path, dir);
+}
+
+int WFWebServer::set_body_spill(const std::string& method, const std::string& path,
+								const std::string& dir)
+{
+	return processor_.set_body_spill(method, path, dir);
+}
+
+void WFWebServer::set_admission(const struct WFWebAdmissionParams *params)
+{
+	processor_.set_admission(params);
+}
+
+int WFWebServer::set_metrics(const std::string& path)
+{
+	return processor_.set_metrics(path);
+}
+
+int WFWebServer::get_route_metrics(const std::string& method, const std::string& path,
+								   struct WFWebRouteMetrics *metrics)
+{
+	return processor_.get_route_metrics(method, path, metrics);
+}
+
+int WFWebServer::get_admission_stats(struct WFWebAdmissionStats *stats)
+{
+	WFWebAdmission *admission = processor_.get_admission();
+
+	if (!admission)
+		return -1;
+
+	admission->get_stats(stats);
+	return 0;
+}
+
+int WFWebServer::start(unsigned short port)
+{
 	processor_.ssl_start(false);
-	return ret;
+	return this->WFHttpServer::start(port);
 }
 
 int WFWebServer::start(unsigned short port, const char *cert_file, const char *key_file)
 {
-	int ret = this->WFHttpServer::start(port, cert_file, key_file);
-
 	processor_.ssl_start(true);
-	return ret;
+	return this->WFHttpServer::start(port, cert_file, key_file);
 }
 
 int WFWebServer::start(const char *host, unsigned short port)
 {
-	int ret = this->WFHttpServer::start(host, port);
-
 	processor_.ssl_start(false);
-	return ret;
+	return this->WFHttpServer::start(host, port);
 }
 
 int WFWebServer::start(const char *host, unsigned short port, const char *cert_file, const char *key_file)
 {
-	int ret = this->WFHttpServer::start(host, port, cert_file, key_file);
-
 	processor_.ssl_start(true);
-	return ret;
+	return this->WFHttpServer::start(host, port, cert_file, key_file);
 }
 
 int WFWebServer::get_peer_addr(const HttpRequest& req, struct sockaddr *addr, socklen_t *addrlen)
@@ -263,3 +1134,26 @@ WFHttpTask *WFWebServer::task_of(const HttpResponse& resp)
 	return (WFHttpTask *)((char *)(&resp) - http_resp_offset);
 }
 
+int WFWebServer::get_body_file(const WFHttpTask *task, std::string& path,
+							   size_t *size)
+{
+	auto *in = static_cast<const __WFWebServerTask *>(task)->get_in();
+
+	if (!in->body_in_file())
+		return -1;
+
+	path = in->body_file();
+	*size = in->file_size;
+	return 0;
+}
+
+CommSession *WFWebServer::new_session(long long seq, CommConnection *conn)
+{
+	auto *task = new __WFWebServerTask(this, &processor_, this->process);
+
+	task->set_keep_alive(this->params.keep_alive_timeout);
+	task->set_receive_timeout(this->params.receive_timeout);
+	task->get_in()->set_size_limit(this->params.request_size_limit);
+	return task;
+}
+
@@ -33,6 +33,11 @@ using web_handler_t = std::function<void (const protocol::HttpRequest&,
 
 #include "WFWebServer.inl"
 
+// captures of "/user/:id" or "/files/*path", see WFWebRouter.h
+using web_params_handler_t = std::function<void (const protocol::HttpRequest&,
+												 protocol::HttpResponse&,
+												 const WFWebParams&)>;
+
 class WFWebServer : public WFHttpServer
 {
 public:
@@ -41,9 +46,65 @@ public:
 
 	// if multi-path/server use one same functor for handler,
 	// please use std::ref on handler
-	void set_handler(const std::string& path, web_handler_t handler);
-	void set_handler(const std::string& path,
-					 std::function<void (WFHttpTask *)> handler);
+	// the server chains work onto the series callback of a task, handlers
+	// use WFSeriesUtil::defer() rather than set_callback() on that series
+	// return -1 if path is not a valid pattern, or metrics is enabled and
+	// there are WEB_METRICS_ROUTES_MAX routes already
+	int set_handler(const std::string& path, web_handler_t handler);
+	int set_handler(const std::string& path, web_params_handler_t handler);
+	int set_handler(const std::string& path,
+					std::function<void (WFHttpTask *)> handler);
+	int set_handler(const std::string& path,
+					std::function<void (WFHttpTask *, const WFWebParams&)> handler);
+
+	// only for requests with this method, such as "GET" or "POST"
+	int set_handler(const std::string& method, const std::string& path,
+					web_handler_t handler);
+	int set_handler(const std::string& method, const std::string& path,
+					web_params_handler_t handler);
+	int set_handler(const std::string& method, const std::string& path,
+					std::function<void (WFHttpTask *)> handler);
+	int set_handler(const std::string& method, const std::string& path,
+					std::function<void (WFHttpTask *, const WFWebParams&)> handler);
+
+	// admission priority of a route set by set_handler(), WEB_PRIORITY_NORMAL
+	// by default, return -1 if the route is not set
+	int set_priority(const std::string& path, int priority);
+	int set_priority(const std::string& method, const std::string& path,
+					 int priority);
+
+	// answer 413 if request body of a route set by set_handler() is larger
+	// than limit, 0 for no limit. Content-Length is checked once the header
+	// is read, a chunked body while it is read. 413 is answered at once with
+	// Connection: close, the rest of the body is never read.
+	int set_body_limit(const std::string& path, size_t limit);
+	int set_body_limit(const std::string& method, const std::string& path,
+					   size_t limit);
+
+	// write request body of a route set by set_handler() to a temporary
+	// file in dir while it is read, instead of keeping it in memory. Only
+	// for bodies with Content-Length, WFServerParams::request_size_limit
+	// does not count them. See get_body_file() and WFWebUpload.h
+	int set_body_spill(const std::string& path, const std::string& dir);
+	int set_body_spill(const std::string& method, const std::string& path,
+					   const std::string& dir);
+
+	// enable admission control, call before start, see WFWebAdmission.h
+	void set_admission(const struct WFWebAdmissionParams *params);
+
+	// record count, status class, body bytes and latency of every route,
+	// and serve them in Prometheus text format on GET path.
+	// call before start, return -1 if path is invalid or there are
+	// WEB_METRICS_ROUTES_MAX routes already
+	int set_metrics(const std::string& path);
+
+	// method is "" for a route set without method
+	// return -1 if metrics is not enabled or the route is not set
+	int get_route_metrics(const std::string& method, const std::string& path,
+						  struct WFWebRouteMetrics *metrics);
+
+	// return -1 if admission control is not enabled
+	int get_admission_stats(struct WFWebAdmissionStats *stats);
 
 	int start(unsigned short port);
 	int start(unsigned short port, const char *cert_file, const char *key_file);
@@ -57,6 +118,14 @@ public:
 	static WFHttpTask *task_of(const protocol::HttpRequest& req);
 	static WFHttpTask *task_of(const protocol::HttpResponse& resp);
 
+	// only for tasks of WFWebServer, the file is removed after the series,
+	// rename it to keep. return -1 if the body is not in a file
+	static int get_body_file(const WFHttpTask *task, std::string& path,
+							 size_t *size);
+
+protected:
+	virtual CommSession *new_session(long long seq, CommConnection *conn);
+
 private:
 	WFWebProcessor processor_;
 };
@@ -16,45 +16,99 @@
   Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
-#include <pthread.h>
-#include <map>
-#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <list>
+#include <vector>
+#include "WFWebRouter.h"
+#include "WFWebAdmission.h"
+#include "WFWebMetrics.h"
 
-using processor_handler_t = std::function<void (WFHttpTask *)>;
-
-class PathCompare
+class WFWebRoute
 {
 public:
-	bool operator() (const std::string& x, const std::string& y) const
-	{
-		if (x.size() != y.size())
-			return x.size() > y.size();
+	std::string method;
+	std::string path;
+	std::shared_ptr<route_handler_t> handler;
+	struct WFWebRouteAttr attr;
+};
 
-		return x < y;
-	}
+// the route of a request found while its header is read. process() takes
+// it as is if the router has not changed since, the pointers are into it
+struct WFWebRouteMatch
+{
+	unsigned long long version;//0 if not looked up
+	const char *path;
+	int result;
+	const route_handler_t *handler;
+	const struct WFWebRouteAttr *attr;
+	WFWebParams params;
 };
 
 class WFWebProcessor
 {
 public:
-	WFWebProcessor():
-		rwlock_(PTHREAD_RWLOCK_INITIALIZER),
-		is_ssl_(false)
-	{}
+	WFWebProcessor();
+	~WFWebProcessor();
 
 	void process(WFHttpTask *task);
 
-	void set_handler(std::string path, processor_handler_t&& handler);
+	// method empty for any method, return -1 if path is invalid
+	int set_handler(std::string method, std::string path,
+					route_handler_t&& handler);
+
+	// return -1 if the route is not set
+	int set_priority(const std::string& method, const std::string& path,
+					 int priority);
+	int set_body_limit(const std::string& method, const std::string& path,
+					   size_t limit);
+	int set_body_spill(const std::string& method, const std::string& path,
+					   const std::string& dir);
 
-	void ssl_start(bool is_ssl)
+	// the route of a request whose header is just read, only looked up if
+	// some route has body limit or spill, see has_body_attr()
+	void match(const protocol::HttpRequest *req,
+			   struct WFWebRouteMatch *match) const;
+	bool has_body_attr() const
 	{
-		is_ssl_ = is_ssl;
+		return body_attr_.load(std::memory_order_relaxed);
 	}
 
+	// call before server start
+	void set_admission(const struct WFWebAdmissionParams *params);
+	WFWebAdmission *get_admission() const { return admission_; }
+
+	// call before server start
+	int set_metrics(const std::string& path);
+	int get_route_metrics(const std::string& method, const std::string& path,
+						  struct WFWebRouteMetrics *metrics);
+
+	// call before server start
+	void ssl_start(bool is_ssl);
+
+private:
+	const std::shared_ptr<const WFWebRouter>&
+	router(unsigned long long *version) const;
+	void serve(WFHttpTask *task);
+	void finish(WFHttpTask *task, void *context);
+	WFWebRoute *route_of(const std::string& method, const std::string& path);
+	void publish();
+
 private:
-	std::map<std::string, processor_handler_t *, PathCompare> path_map_;
-	std::unordered_map<std::string, processor_handler_t> handler_map_;
-	pthread_rwlock_t rwlock_;
+	// set_handler publishes a new router_ and bumps version_. Every thread
+	// keeps its own reference and only takes mutex_ once version_ moves, so
+	// a request reads the router without a lock or a shared counter. The
+	// old router is freed when no thread or delayed request holds it.
+	std::shared_ptr<const WFWebRouter> router_;
+	std::atomic<unsigned long long> version_;
+	unsigned long long id_;
+	std::atomic<bool> body_attr_;
+	std::vector<WFWebRoute> routes_;//in the order of registration
+	std::list<std::string> spill_dirs_;//never erased, attr points into it
+	mutable std::mutex mutex_;
+	WFWebAdmission *admission_;
+	WFWebMetrics *metrics_;
 	bool is_ssl_;
 };
 
@@ -0,0 +1,298 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFSeriesUtil.h"
+#include "WFWebStream.h"
+
+using namespace protocol;
+
+#define WEB_STREAM_POLL_MIN		1		// ms
+#define WEB_STREAM_POLL_MAX		64		// ms
+#define WEB_STREAM_COMPACT		65536
+
+WFWebStream::WFWebStream(WFHttpTask *task, const struct WFWebStreamParams *params):
+	task_(task),
+	params_(*params),
+	sent_(0),
+	bytes_(0),
+	started_(false),
+	finished_(false),
+	failed_(false)
+{
+	auto *resp = task->get_resp();
+
+	resp->set_status_code("200");
+	resp->set_reason_phrase("OK");
+}
+
+// the response is ours from now on, the server task replies nothing
+void WFWebStream::append_head()
+{
+	auto *resp = task_->get_resp();
+	const char *version = resp->get_http_version();
+	std::string name;
+	std::string value;
+
+	if (params_.mode != WEB_STREAM_IDENTITY)
+		resp->add_header_pair("Transfer-Encoding", "chunked");
+
+	// the connection ends with the series
+	resp->add_header_pair("Connection", "close");
+	if (params_.mode == WEB_STREAM_SSE)
+	{
+		resp->add_header_pair("Content-Type", "text/event-stream");
+		resp->add_header_pair("Cache-Control", "no-cache");
+	}
+
+	HttpHeaderCursor cursor(resp);
+
+	buf_.append(version ? version : "HTTP/1.1");
+	buf_.push_back(' ');
+	buf_.append(resp->get_status_code());
+	buf_.push_back(' ');
+	buf_.append(resp->get_reason_phrase());
+	buf_.append("\r\n", 2);
+	while (cursor.next(name, value))
+	{
+		buf_.append(name);
+		buf_.append(": ", 2);
+		buf_.append(value);
+		buf_.append("\r\n", 2);
+	}
+
+	buf_.append("\r\n", 2);
+	task_->noreply();
+	started_ = true;
+}
+
+// push() never blocks, what the socket does not take waits in buf_
+void WFWebStream::flush()
+{
+	int ret;
+
+	while (sent_ < buf_.size())
+	{
+		ret = task_->push(buf_.c_str() + sent_, buf_.size() - sent_);
+		if (ret > 0)
+			sent_ += ret;
+		else
+		{
+			if (ret < 0 && errno != EAGAIN)
+				failed_ = true;
+
+			break;
+		}
+	}
+
+	if (sent_ == buf_.size() || failed_)
+	{
+		buf_.clear();
+		sent_ = 0;
+	}
+	else if (sent_ >= WEB_STREAM_COMPACT)
+	{
+		buf_.erase(0, sent_);
+		sent_ = 0;
+	}
+}
+
+// workflow has no event for a writable socket, poll it with timers in
+// the series, next() runs when buf_ is sent or the stream failed
+void WFWebStream::drain(std::function<void ()> next, int waited)
+{
+	flush();
+	if (!failed_ && pending() > 0 && params_.send_timeout >= 0 &&
+		waited >= params_.send_timeout)
+	{
+		failed_ = true;
+	}
+
+	if (failed_ || pending() == 0)
+	{
+		if (next)
+			next();
+
+		return;
+	}
+
+	int delay = waited;
+
+	if (delay < WEB_STREAM_POLL_MIN)
+		delay = WEB_STREAM_POLL_MIN;
+	else if (delay > WEB_STREAM_POLL_MAX)
+		delay = WEB_STREAM_POLL_MAX;
+
+	auto *timer = WFTaskFactory::create_timer_task((unsigned int)delay * 1000,
+		[this, next, waited, delay](WFTimerTask *) {
+			this->drain(next, waited + delay);
+		});
+
+	series_of(task_)->push_back(timer);
+}
+
+int WFWebStream::write(const void *buf, size_t size)
+{
+	if (finished_ || failed_)
+		return -1;
+
+	if (size == 0)
+		return 0;
+
+	if (pending() + size > params_.max_pending)
+		return -1;
+
+	if (!started_)
+		append_head();
+
+	if (params_.mode == WEB_STREAM_IDENTITY)
+		buf_.append((const char *)buf, size);
+	else
+	{
+		char head[32];
+		int n = snprintf(head, sizeof head, "%zx\r\n", size);
+
+		buf_.append(head, n);
+		buf_.append((const char *)buf, size);
+		buf_.append("\r\n", 2);
+	}
+
+	bytes_ += size;
+	flush();
+	return failed_ ? -1 : 0;
+}
+
+int WFWebStream::write(const std::string& data)
+{
+	return write(data.c_str(), data.size());
+}
+
+int WFWebStream::write_event(const std::string& event, const std::string& data)
+{
+	std::string msg;
+	size_t pos = 0;
+	size_t end;
+
+	if (!event.empty())
+		msg = "event: " + event + "\n";
+
+	// one "data:" line for each line of data
+	do
+	{
+		end = data.find('\n', pos);
+		if (end == std::string::npos)
+			end = data.size();
+
+		msg.append("data: ");
+		msg.append(data, pos, end - pos);
+		msg.push_back('\n');
+		pos = end + 1;
+	} while (pos <= data.size());
+
+	msg.push_back('\n');
+	return write(msg);
+}
+
+void WFWebStream::finish()
+{
+	if (finished_)
+		return;
+
+	finished_ = true;
+	if (failed_)
+		return;
+
+	if (!started_)
+		append_head();
+
+	if (params_.mode != WEB_STREAM_IDENTITY)
+		buf_.append("0\r\n\r\n", 5);
+
+	drain(nullptr, 0);
+}
+
+void WFWebStream::wait_sent(std::function<void ()> next)
+{
+	drain(std::move(next), 0);
+}
+
+void WFWebStream::produce_next(web_stream_producer_t&& producer)
+{
+	auto *shared = new web_stream_producer_t(std::move(producer));
+	auto *more = new bool(false);
+	auto *go = WFTaskFactory::create_go_task(params_.queue,
+		[this, shared, more] { *more = (*shared)(this); });
+
+	go->set_callback([this, shared, more](WFGoTask *task) {
+		bool next = (*more && task->get_state() == WFT_STATE_SUCCESS);
+
+		delete more;
+		if (!next)
+		{
+			delete shared;
+			return this->finish();
+		}
+
+		// produce again only after the socket takes what is written
+		this->drain([this, shared]() {
+			if (this->failed_)
+				this->finish();
+			else
+				this->produce_next(std::move(*shared));
+
+			delete shared;
+		}, 0);
+	});
+
+	series_of(task_)->push_back(go);
+}
+
+void WFWebStream::produce(web_stream_producer_t producer)
+{
+	produce_next(std::move(producer));
+}
+
+route_handler_t WFWebStream::handler(web_stream_handler_t handler)
+{
+	return WFWebStream::handler(std::move(handler), &WEB_STREAM_PARAMS_DEFAULT);
+}
+
+route_handler_t WFWebStream::handler(web_stream_handler_t handler,
+									 const struct WFWebStreamParams *params)
+{
+	struct WFWebStreamParams p = *params;
+
+	return [handler, p](WFHttpTask *task, const WFWebParams&) {
+		handler(task, WFWebStream::create(task, &p));
+	};
+}
+
+WFWebStream *WFWebStream::create(WFHttpTask *task,
+								 const struct WFWebStreamParams *params)
+{
+	auto *stream = new WFWebStream(task, params);
+
+	WFSeriesUtil::defer(series_of(task), [stream]() { delete stream; });
+	return stream;
+}
+
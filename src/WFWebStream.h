@@ -0,0 +1,133 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBSTREAM_H_
+#define _WFWEBSTREAM_H_
+
+#include <stddef.h>
+#include <string>
+#include <functional>
+#include "WFWebServer.h"
+
+/**
+ * @file   WFWebStream.h
+ * @brief  Chunked and Server-Sent Events responses for WFWebServer
+ */
+
+enum
+{
+	WEB_STREAM_CHUNKED		=	0,	// Transfer-Encoding: chunked
+	WEB_STREAM_SSE			=	1,	// text/event-stream over chunked
+	WEB_STREAM_IDENTITY		=	2,	// as is, set Content-Length before writing
+};
+
+struct WFWebStreamParams
+{
+	int mode;
+	size_t max_pending;		// write() fails while more bytes wait for the socket
+	int send_timeout;		// ms the socket may stay full, -1 for no timeout
+	const char *queue;		// go task queue name of producer
+};
+
+static constexpr struct WFWebStreamParams WEB_STREAM_PARAMS_DEFAULT =
+{
+	.mode			=	WEB_STREAM_CHUNKED,
+	.max_pending	=	1024 * 1024,
+	.send_timeout	=	-1,
+	.queue			=	"web_stream",
+};
+
+class WFWebStream;
+
+using web_stream_handler_t = std::function<void (WFHttpTask *, WFWebStream *)>;
+
+// called again and again on a compute thread until it returns false
+using web_stream_producer_t = std::function<bool (WFWebStream *)>;
+
+// server.set_handler("/export", WFWebStream::handler([](WFHttpTask *task,
+//                                                       WFWebStream *stream) {
+//     stream->produce([](WFWebStream *stream) {
+//         ...
+//         return stream->write(rows) == 0 && !done;
+//     });
+// }));
+//
+// Chunks are pushed to the connection while the series of server task
+// runs, the server task itself sends nothing and the connection is closed
+// after the series. The status and headers of the response are sent with
+// the first chunk, set them before the first write. A handler that never
+// writes nor finishes replies as usual.
+// Bytes the socket does not take at once wait in the stream. The producer
+// runs again only after they are sent, the socket is polled by timer
+// tasks in the series, so a slow client holds at most max_pending bytes.
+// Without produce(), write in handler or in tasks of the series and call
+// finish() after the last write. The stream lives until the series ends.
+class WFWebStream
+{
+public:
+	// return -1 if the stream is finished or failed, or max_pending is exceeded
+	int write(const void *buf, size_t size);
+	int write(const std::string& data);
+
+	// SSE only, event may be empty
+	int write_event(const std::string& event, const std::string& data);
+
+	// producer runs in the series of server task, finish() after it returns false
+	void produce(web_stream_producer_t producer);
+
+	// write the last chunk and send what is left, called after produce()
+	void finish();
+
+	// next runs in the series once what is written is sent or failed
+	void wait_sent(std::function<void ()> next);
+
+	size_t bytes() const { return bytes_; }
+	size_t pending() const { return buf_.size() - sent_; }
+	bool failed() const { return failed_; }
+	WFHttpTask *get_task() const { return task_; }
+
+public:
+	// the stream of a server task, deleted when the series ends
+	static WFWebStream *create(WFHttpTask *task,
+							   const struct WFWebStreamParams *params);
+
+	static route_handler_t handler(web_stream_handler_t handler);
+	static route_handler_t handler(web_stream_handler_t handler,
+								   const struct WFWebStreamParams *params);
+
+private:
+	WFWebStream(WFHttpTask *task, const struct WFWebStreamParams *params);
+
+	void produce_next(web_stream_producer_t&& producer);
+	void append_head();
+	void flush();
+	void drain(std::function<void ()> next, int waited);
+
+private:
+	WFHttpTask *task_;
+	struct WFWebStreamParams params_;
+	std::string buf_;
+	size_t sent_;//bytes of buf_ already pushed
+	size_t bytes_;
+	bool started_;//head is in buf_, the reply is ours
+	bool finished_;
+	bool failed_;
+};
+
+#endif
+
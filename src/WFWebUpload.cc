@@ -0,0 +1,141 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <workflow/HttpUtil.h>
+#include <workflow/Workflow.h>
+#include <workflow/WFTaskFactory.h>
+#include "WFSeriesUtil.h"
+#include "WFWebUpload.h"
+
+using namespace protocol;
+
+class __WFWebUploadContext
+{
+public:
+	WFHttpTask *task;
+	WFWebParams params;
+	web_upload_handler_t handler;
+	size_t chunk_size;
+	std::string path;
+	int fd;
+	const char *body;
+	size_t size;
+	size_t offset;
+};
+
+static void __upload_done(__WFWebUploadContext *ctx, bool success)
+{
+	close(ctx->fd);
+	ctx->fd = -1;
+	if (!success)
+	{
+		unlink(ctx->path.c_str());
+		ctx->path.clear();
+		HttpUtil::set_response_status(ctx->task->get_resp(),
+									  HttpStatusInternalServerError);
+	}
+
+	ctx->handler(ctx->task, ctx->params, ctx->path, ctx->size);
+}
+
+static void __upload_next(__WFWebUploadContext *ctx)
+{
+	size_t n = ctx->size - ctx->offset;
+
+	if (n == 0)
+		return __upload_done(ctx, true);
+
+	if (n > ctx->chunk_size)
+		n = ctx->chunk_size;
+
+	// body stays in the request buffer, nothing is copied
+	auto *pwrite_task = WFTaskFactory::create_pwrite_task(ctx->fd,
+		ctx->body + ctx->offset, n, ctx->offset,
+		[ctx](WFFileIOTask *task) {
+			long ret = task->get_retval();
+
+			if (task->get_state() != WFT_STATE_SUCCESS || ret <= 0)
+				return __upload_done(ctx, false);
+
+			ctx->offset += ret;
+			__upload_next(ctx);
+		});
+
+	series_of(ctx->task)->push_back(pwrite_task);
+}
+
+route_handler_t WFWebUpload::handler(web_upload_handler_t handler)
+{
+	return WFWebUpload::handler(std::move(handler), &WEB_UPLOAD_PARAMS_DEFAULT);
+}
+
+route_handler_t WFWebUpload::handler(web_upload_handler_t handler,
+									 const struct WFWebUploadParams *params)
+{
+	std::string dir = params->dir;
+	size_t chunk_size = params->chunk_size;
+
+	return [handler, dir, chunk_size](WFHttpTask *task, const WFWebParams& params) {
+		std::string path;
+		size_t size;
+
+		// written while read, removed by the server
+		if (WFWebServer::get_body_file(task, path, &size) == 0)
+			return handler(task, params, path, size);
+
+		auto *ctx = new __WFWebUploadContext;
+		const void *body;
+
+		path = dir + "/upload.XXXXXX";
+
+		ctx->task = task;
+		ctx->params = params;
+		ctx->handler = handler;
+		ctx->chunk_size = chunk_size;
+		ctx->body = NULL;
+		ctx->size = 0;
+		ctx->offset = 0;
+		ctx->fd = mkstemp(&path[0]);
+		ctx->path = std::move(path);
+
+		WFSeriesUtil::defer(series_of(task), [ctx]() {
+			if (!ctx->path.empty())
+				unlink(ctx->path.c_str());
+
+			delete ctx;
+		});
+
+		if (ctx->fd < 0)
+		{
+			ctx->path.clear();
+			HttpUtil::set_response_status(task->get_resp(),
+										  HttpStatusInternalServerError);
+			return handler(task, params, ctx->path, 0);
+		}
+
+		if (task->get_req()->get_parsed_body(&body, &ctx->size))
+			ctx->body = (const char *)body;
+		else
+			ctx->size = 0;
+
+		__upload_next(ctx);
+	};
+}
+
@@ -0,0 +1,72 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Authors: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#ifndef _WFWEBUPLOAD_H_
+#define _WFWEBUPLOAD_H_
+
+#include <stddef.h>
+#include <string>
+#include <functional>
+#include "WFWebServer.h"
+
+/**
+ * @file   WFWebUpload.h
+ * @brief  Hand request body of WFWebServer to a handler as a file
+ */
+
+struct WFWebUploadParams
+{
+	const char *dir;		// temporary files are created here, if not spilled
+	size_t chunk_size;		// bytes of one pwrite
+};
+
+static constexpr struct WFWebUploadParams WEB_UPLOAD_PARAMS_DEFAULT =
+{
+	.dir			=	"/tmp",
+	.chunk_size		=	1024 * 1024,
+};
+
+// path is empty if the body could not be saved, answer 500 in that case
+using web_upload_handler_t = std::function<void (WFHttpTask *task,
+												 const WFWebParams& params,
+												 const std::string& path,
+												 size_t size)>;
+
+// server.set_handler("POST", "/upload/:name", WFWebUpload::handler(
+//     [](WFHttpTask *task, const WFWebParams& params,
+//        const std::string& path, size_t size) {
+//         rename(path.c_str(), ("/data/" + params.get("name")).c_str());
+//     }));
+// server.set_body_limit("POST", "/upload/:name", 1024 * 1024 * 1024);
+// server.set_body_spill("POST", "/upload/:name", "/tmp");
+//
+// With set_body_spill(), the server writes the body to a file while it is
+// read and the handler gets that file, the body never stays in memory.
+// Otherwise, such as a chunked body, the body read into memory is written
+// chunk by chunk by pwrite tasks in the series of server task to a file in
+// dir. The file is removed after the reply, rename it in handler to keep it.
+class WFWebUpload
+{
+public:
+	static route_handler_t handler(web_upload_handler_t handler);
+	static route_handler_t handler(web_upload_handler_t handler,
+								   const struct WFWebUploadParams *params);
+};
+
+#endif
+
@@ -16,6 +16,13 @@
   Author: Wu Jiaxu (wujiaxu@sogou-inc.com)
 */
 
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
@@ -24,6 +31,7 @@
 #include <workflow/HttpUtil.h>
 #include <anyclient/WFWebServer.h>
 #include <anyclient/WFHttpClient.h>
+#include <anyclient/WFStaticFileHandler.h>
 
 #define RETRY_MAX  3
 
@@ -176,6 +184,737 @@ KZ1lOvb+vi3TLrQf4tfBekrXXe5tZK40QSJ7UdtY7HHrrbAXU+8=
 	https_server.stop();
 }
 
+TEST(WFHttpBody1, http_unittest)
+{
+	WFWebServer server;
+
+	server.set_handler("/echo", [](const protocol::HttpRequest& req,
+								   protocol::HttpResponse& resp) {
+		const void *body;
+		size_t size;
+
+		if (req.get_parsed_body(&body, &size))
+			resp.append_output_body(body, size);
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8833) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	WFHttpBody body;
+	std::atomic<int> deleted(0);
+	static const char buf[] = "-owned";
+	const void *data;
+	size_t size;
+
+	body.append(std::string("moved"))
+		.append(std::make_shared<const std::string>("-shared"))
+		.append(buf, 6, [&deleted]() { deleted++; });
+	EXPECT_EQ(body.size(), 18);
+
+	auto result = http_client.sync_request("POST", "http://127.0.0.1:8833/echo", {}, body);
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&data, &size));
+	EXPECT_EQ(std::string((const char *)data, size), "moved-shared-owned");
+
+	// still referenced by body
+	EXPECT_EQ(deleted, 0);
+	body = WFHttpBody();
+	for (int i = 0; i < 100 && deleted == 0; i++)
+		usleep(1000);//the task may still be finishing
+
+	EXPECT_EQ(deleted, 1);
+
+	std::string large(1024 * 1024, 'x');
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8833/echo", {},
+									  std::move(large));
+	EXPECT_TRUE(result.resp.get_parsed_body(&data, &size));
+	EXPECT_EQ(size, 1024 * 1024);
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+
+	http_client.request("POST", "http://127.0.0.1:8833/echo")
+		.append_body("a")
+		.append_body(std::string("b"))
+		.append_body(buf, 6, nullptr)
+		.complete([&](WFHttpResult& res) {
+			const void *data;
+			size_t size;
+
+			EXPECT_TRUE(res.resp.get_parsed_body(&data, &size));
+			EXPECT_EQ(std::string((const char *)data, size), "ab-owned");
+			mutex.lock();
+			done = true;
+			mutex.unlock();
+			cond.notify_one();
+		})
+		.send();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done)
+		cond.wait(lock);
+
+	lock.unlock();
+	server.stop();
+}
+
+TEST(WFHttpTemplate1, http_unittest)
+{
+	WFWebServer server;
+
+	server.set_handler("/api/*rest", [](const protocol::HttpRequest& req,
+										protocol::HttpResponse& resp) {
+		protocol::HttpHeaderCursor cursor(&req);
+		std::string token;
+		std::string trace;
+		const void *body;
+		size_t size;
+
+		cursor.find("X-Token", token);
+		cursor.rewind();
+		cursor.find("X-Trace", trace);
+		resp.append_output_body(std::string(req.get_request_uri()) + "|" +
+								token + "|" + trace + "|");
+		if (req.get_parsed_body(&body, &size))
+			resp.append_output_body(body, size);
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8844) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<std::string> bodies;
+
+	http_client.default_retry_max(RETRY_MAX);
+	auto tpl = http_client.request("POST", "http://127.0.0.1:8844/api/?v=1")
+		.set_header("X-Token", "secret")
+		.append_body("default")
+		.complete([&](WFHttpResult& res) {
+			const void *data;
+			size_t size;
+
+			EXPECT_EQ(res.status_code, HttpStatusOK);
+			EXPECT_TRUE(res.resp.get_parsed_body(&data, &size));
+			mutex.lock();
+			bodies.emplace_back((const char *)data, size);
+			mutex.unlock();
+			cond.notify_one();
+		})
+		.prepare();
+
+	tpl.send();
+	tpl.send("users/1", "one");
+	tpl.send("/users/2?v=2", "two");
+	tpl.create_task("users/3", "", {{"X-Trace", "t3"}})->start();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (bodies.size() < 4)
+		cond.wait(lock);
+
+	lock.unlock();
+	std::sort(bodies.begin(), bodies.end());
+	EXPECT_EQ(bodies[0], "/api/?v=1|secret||default");
+	EXPECT_EQ(bodies[1], "/api/users/1?v=1|secret||one");
+	EXPECT_EQ(bodies[2], "/api/users/2?v=2|secret||two");
+	EXPECT_EQ(bodies[3], "/api/users/3?v=1|secret|t3|");
+	server.stop();
+}
+
+TEST(WFHttpBatch1, http_unittest)
+{
+	WFWebServer server;
+
+	server.set_handler("/n/:n", [](const protocol::HttpRequest& req,
+								   protocol::HttpResponse& resp,
+								   const WFWebParams& params) {
+		resp.append_output_body(params.get("n"));
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8855) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	std::vector<WFHttpRequest> requests;
+	struct WFBatchParams params = BATCH_PARAMS_DEFAULT;
+	const void *data;
+	size_t size;
+
+	for (int i = 0; i < 10; i++)
+		requests.push_back({"GET", "http://127.0.0.1:8855/n/" + std::to_string(i), {}, ""});
+
+	params.concurrency = 3;
+	auto results = http_client.sync_parallel_request(requests, &params);
+	EXPECT_EQ(results.size(), 10);
+	for (int i = 0; i < 10; i++)
+	{
+		EXPECT_EQ(results[i].status_code, HttpStatusOK);
+		EXPECT_TRUE(results[i].resp.get_parsed_body(&data, &size));
+		EXPECT_EQ(std::string((const char *)data, size), std::to_string(i));
+	}
+
+	// nothing listens on port 1, later requests are never sent
+	requests.insert(requests.begin() + 1, {"GET", "http://127.0.0.1:1/", {}, ""});
+	params.mode = BATCH_FAIL_FAST;
+	params.concurrency = 1;
+	results = http_client.sync_parallel_request(requests, &params);
+	EXPECT_EQ(results.size(), 11);
+	EXPECT_EQ(results[0].status_code, HttpStatusOK);
+	EXPECT_NE(results[1].task_state, WFT_STATE_SUCCESS);
+	EXPECT_EQ(results[10].task_state, WFT_STATE_UNDEFINED);
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+
+	params.mode = BATCH_FIRST_N;
+	params.concurrency = 0;
+	params.first_n = 5;
+	http_client.parallel_request(requests, [&](std::vector<WFHttpResult>& results) {
+		int n = 0;
+
+		for (const auto& res : results)
+		{
+			if (res.status_code == HttpStatusOK)
+				n++;
+		}
+
+		EXPECT_GE(n, 5);
+		mutex.lock();
+		done = true;
+		mutex.unlock();
+		cond.notify_one();
+	}, &params);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done)
+		cond.wait(lock);
+
+	lock.unlock();
+	EXPECT_TRUE(http_client.sync_parallel_request({}).empty());
+	server.stop();
+}
+
+TEST(WFHttpHedge1, http_unittest)
+{
+	WFWebServer server;
+	std::atomic<int> slow(0);
+
+	server.set_handler("/hedge", [&slow](const protocol::HttpRequest& req,
+										 protocol::HttpResponse& resp) {
+		// only the first copy of a slow request is slow
+		if (strstr(req.get_request_uri(), "slow") && slow++ == 0)
+			usleep(1000 * 1000);
+
+		resp.append_output_body("ok");
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8866) == 0) << "http server start failed";
+
+	struct WFHttpHedgeParams params = HTTP_HEDGE_PARAMS_DEFAULT;
+	struct WFHttpHedgeStats stats;
+	WFHttpClient http_client;
+
+	EXPECT_EQ(http_client.get_hedge_stats(&stats), -1);
+	params.percentile = 50;
+	params.min_delay = 10;
+	params.max_delay = 100;
+	params.budget = 100;
+	params.min_samples = 5;
+	http_client.set_hedge(&params);
+
+	for (int i = 0; i < 10; i++)
+	{
+		auto result = http_client.sync_request("GET", "http://127.0.0.1:8866/hedge", {}, "");
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8866/hedge?slow", {}, "");
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_LT(ms, 900);
+
+	// never hedged
+	result = http_client.sync_request("POST", "http://127.0.0.1:8866/hedge", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+
+	EXPECT_EQ(http_client.get_hedge_stats(&stats), 0);
+	EXPECT_EQ(stats.requests, 11);
+	EXPECT_GE(stats.hedged, 1);
+	EXPECT_GE(stats.hedge_wins, 1);
+	server.stop();
+}
+
+TEST(WFClientLimiter1, http_unittest)
+{
+	WFWebServer server;
+
+	server.set_handler("/slow", [](const protocol::HttpRequest& req,
+								   protocol::HttpResponse& resp) {
+		usleep(200 * 1000);
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8877) == 0) << "http server start failed";
+
+	struct WFClientLimiterParams params = CLIENT_LIMITER_PARAMS_DEFAULT;
+	struct WFClientLimiterStats stats;
+	WFHttpClient http_client;
+
+	params.initial_limit = 1;
+	params.max_limit = 1;
+	params.max_queue = 0;
+	auto limiter = std::make_shared<WFClientLimiter>(&params);
+
+	http_client.set_limiter(limiter);
+	auto slow = http_client.async_request("GET", "http://127.0.0.1:8877/slow", {}, "");
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8877/slow", {}, "");
+
+	EXPECT_EQ(result.task_state, WFT_STATE_SYS_ERROR);
+	EXPECT_EQ(result.task_error, EAGAIN);
+	EXPECT_EQ(slow.get().status_code, HttpStatusOK);
+
+	EXPECT_EQ(limiter->get_stats("http://127.0.0.1:8877", &stats), 0);
+	EXPECT_EQ(stats.limit, 1);
+	EXPECT_EQ(stats.in_flight, 0);
+	EXPECT_EQ(stats.admitted, 1);
+	EXPECT_EQ(stats.rejected, 1);
+
+	params.max_queue = 10;
+	limiter = std::make_shared<WFClientLimiter>(&params);
+	http_client.set_limiter(limiter);
+	slow = http_client.async_request("GET", "http://127.0.0.1:8877/slow", {}, "");
+	result = http_client.sync_request("GET", "http://127.0.0.1:8877/slow", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_EQ(slow.get().status_code, HttpStatusOK);
+
+	std::map<std::string, struct WFClientLimiterStats> all;
+
+	limiter->get_stats(all);
+	EXPECT_EQ(all.size(), 1);
+	EXPECT_EQ(all["http://127.0.0.1:8877"].queued, 1);
+	EXPECT_EQ(all["http://127.0.0.1:8877"].admitted, 2);
+	EXPECT_GT(all["http://127.0.0.1:8877"].rtt, 0);
+
+	// members of a batch wait in the queue, or are rejected beyond it
+	std::vector<WFHttpRequest> requests(3, {"GET", "http://127.0.0.1:8877/slow", {}, ""});
+
+	auto results = http_client.sync_parallel_request(requests);
+	EXPECT_EQ(results.size(), 3);
+	for (const auto& res : results)
+		EXPECT_EQ(res.status_code, HttpStatusOK);
+
+	limiter->get_stats(all);
+	EXPECT_EQ(all["http://127.0.0.1:8877"].queued, 3);
+	EXPECT_EQ(all["http://127.0.0.1:8877"].admitted, 5);
+
+	params.max_queue = 0;
+	limiter = std::make_shared<WFClientLimiter>(&params);
+	http_client.set_limiter(limiter);
+	results = http_client.sync_parallel_request(requests);
+	EXPECT_EQ(results[0].status_code, HttpStatusOK);
+	EXPECT_EQ(results[1].task_state, WFT_STATE_SYS_ERROR);
+	EXPECT_EQ(results[1].task_error, EAGAIN);
+	EXPECT_EQ(results[2].task_error, EAGAIN);
+	server.stop();
+}
+
+TEST(WFHttpCache1, http_unittest)
+{
+	WFWebServer server;
+	std::atomic<int> fresh_count(0);
+	std::atomic<int> etag_count(0);
+
+	server.set_handler("/fresh", [&](const protocol::HttpRequest& req,
+									 protocol::HttpResponse& resp) {
+		fresh_count++;
+		resp.set_header_pair("Cache-Control", "max-age=60");
+		resp.append_output_body("fresh");
+	});
+	server.set_handler("/etag", [&](const protocol::HttpRequest& req,
+									protocol::HttpResponse& resp) {
+		protocol::HttpHeaderCursor cursor(&req);
+		std::string etag;
+
+		etag_count++;
+		resp.set_header_pair("Cache-Control", "no-cache");
+		resp.set_header_pair("ETag", "\"v1\"");
+		if (cursor.find("If-None-Match", etag) && etag == "\"v1\"")
+			resp.set_status_code("304");
+		else
+			resp.append_output_body("etag");
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8888) == 0) << "http server start failed";
+
+	auto cache = std::make_shared<WFHttpCache>(&HTTP_CACHE_PARAMS_DEFAULT);
+	struct WFHttpCacheStats stats;
+	WFHttpClient http_client;
+	WFHttpResult result;
+	const void *body;
+	size_t size;
+
+	http_client.default_retry_max(RETRY_MAX);
+	http_client.set_cache(cache);
+	for (int i = 0; i < 3; i++)
+	{
+		result = http_client.sync_request("GET", "http://127.0.0.1:8888/fresh", {}, "");
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "fresh");
+	}
+
+	EXPECT_EQ(result.seqid, -1);
+	EXPECT_EQ(fresh_count, 1);
+
+	// not cacheable
+	http_client.sync_request("GET", "http://127.0.0.1:8888/fresh",
+							 {{"Authorization", "Basic eDp5"}}, "");
+	http_client.sync_request("POST", "http://127.0.0.1:8888/fresh", {}, "");
+	EXPECT_EQ(fresh_count, 3);
+
+	for (int i = 0; i < 2; i++)
+	{
+		result = http_client.sync_request("GET", "http://127.0.0.1:8888/etag", {}, "");
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "etag");
+	}
+
+	EXPECT_EQ(etag_count, 2);
+
+	cache->get_stats(&stats);
+	EXPECT_EQ(stats.hits, 2);
+	EXPECT_EQ(stats.revalidated, 1);
+	EXPECT_EQ(stats.misses, 3);
+	EXPECT_EQ(stats.entries, 2);
+	EXPECT_GT(stats.bytes, 0);
+	server.stop();
+}
+
+TEST(WFSingleFlight1, http_unittest)
+{
+	WFWebServer server;
+	std::atomic<int> count(0);
+
+	server.set_handler("/slow", [&](const protocol::HttpRequest& req,
+									protocol::HttpResponse& resp) {
+		count++;
+		usleep(200 * 1000);
+		resp.append_output_body("shared");
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8900) == 0) << "http server start failed";
+
+	struct WFSingleFlightStats stats;
+	WFHttpClient http_client;
+	std::vector<WFFuture<WFHttpResult>> futures;
+
+	EXPECT_EQ(http_client.get_single_flight_stats(&stats), -1);
+	http_client.set_single_flight({"X-Tenant"});
+	for (int i = 0; i < 5; i++)
+		futures.push_back(http_client.async_request("GET", "http://127.0.0.1:8900/slow", {}, ""));
+
+	// another key
+	futures.push_back(http_client.async_request("GET", "http://127.0.0.1:8900/slow",
+												{{"X-Tenant", "b"}}, ""));
+	futures.push_back(http_client.async_request("GET", "http://127.0.0.1:8900/slow",
+												{{"Accept-Encoding", "gzip"}}, ""));
+	// never shares
+	futures.push_back(http_client.async_request("GET", "http://127.0.0.1:8900/slow",
+												{{"Range", "bytes=0-"}}, ""));
+	for (auto& fr : futures)
+	{
+		WFHttpResult result = fr.get();
+		const void *body;
+		size_t size;
+
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "shared");
+	}
+
+	EXPECT_EQ(count, 4);
+	EXPECT_EQ(http_client.get_single_flight_stats(&stats), 0);
+	EXPECT_EQ(stats.requests, 7);
+	EXPECT_EQ(stats.shared, 4);
+	EXPECT_EQ(stats.in_flight, 0);
+	server.stop();
+}
+
+TEST(WFHttpCompress1, http_unittest)
+{
+	WFWebServer server;
+	std::string text;
+
+	for (int i = 0; i < 1000; i++)
+		text += "hello world " + std::to_string(i) + "\n";
+
+	server.set_handler("/gzip", [&](const protocol::HttpRequest& req,
+									protocol::HttpResponse& resp) {
+		protocol::HttpHeaderCursor cursor(&req);
+		std::string accept;
+		std::string out;
+
+		EXPECT_TRUE(cursor.find("Accept-Encoding", accept));
+		EXPECT_NE(accept.find("gzip"), std::string::npos);
+		EXPECT_EQ(WFHttpCompress::compress(HTTP_ENCODING_GZIP, -1, text.c_str(),
+										   text.size(), out), 0);
+		resp.set_header_pair("Content-Encoding", "gzip");
+		resp.append_output_body(out);
+	});
+	server.set_handler("/echo", [&](const protocol::HttpRequest& req,
+									protocol::HttpResponse& resp) {
+		protocol::HttpHeaderCursor cursor(&req);
+		std::string encoding;
+		std::string out;
+		const void *body;
+		size_t size;
+
+		req.get_parsed_body(&body, &size);
+		if (cursor.find("Content-Encoding", encoding))
+		{
+			EXPECT_EQ(WFHttpCompress::decompress(WFHttpCompress::encoding_of(encoding),
+												 body, size, (size_t)-1, out), 0);
+		}
+		else
+			out.assign((const char *)body, size);
+
+		resp.set_header_pair("X-Encoding", encoding);
+		resp.append_output_body(std::to_string(out.size()));
+	});
+	EXPECT_TRUE(server.start("127.0.0.1", 8901) == 0) << "http server start failed";
+
+	struct WFHttpCompressParams params = HTTP_COMPRESS_PARAMS_DEFAULT;
+	WFHttpClient http_client;
+	WFHttpResult result;
+	std::string value;
+	const void *body;
+	size_t size;
+
+	params.min_size = 1024;
+	http_client.set_compress(&params);
+	result = http_client.sync_request("GET", "http://127.0.0.1:8901/gzip", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_TRUE(std::string((const char *)body, size) == text);
+
+	protocol::HttpHeaderCursor cursor(&result.resp);
+
+	EXPECT_FALSE(cursor.find("Content-Encoding", value));
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8901/echo", {}, text);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), std::to_string(text.size()));
+
+	protocol::HttpHeaderCursor gzip_cursor(&result.resp);
+
+	EXPECT_TRUE(gzip_cursor.find("X-Encoding", value));
+	EXPECT_EQ(value, "gzip");
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8901/echo", {}, "small");
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "5");
+	server.stop();
+}
+
+TEST(WFHttpDownload1, http_unittest)
+{
+	std::string content;
+
+	for (int i = 0; content.size() < 1024 * 1024 + 123; i++)
+		content += std::to_string(i) + ",";
+
+	mkdir("www_download", 0755);
+	FILE *f = fopen("www_download/data.bin", "w");
+	fwrite(content.c_str(), 1, content.size(), f);
+	fclose(f);
+
+	WFWebServer server;
+	struct WFStaticFileParams static_params = STATIC_FILE_PARAMS_DEFAULT;
+
+	// a changed file is seen at once
+	static_params.valid_time = 0;
+	server.set_handler("/static/", WFStaticFileHandler("/static/", "www_download",
+													   &static_params));
+	EXPECT_TRUE(server.start("127.0.0.1", 8902) == 0) << "http server start failed";
+
+	struct WFHttpDownloadParams params = HTTP_DOWNLOAD_PARAMS_DEFAULT;
+	const char *url = "http://127.0.0.1:8902/static/data.bin";
+	const char *path = "download.bin";
+	WFHttpClient http_client;
+	WFHttpDownloadResult result;
+	int progress = 0;
+	std::string saved;
+	char buf[4096];
+	size_t n;
+
+	auto read_file = [&]() {
+		FILE *f = fopen(path, "r");
+
+		saved.clear();
+		while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+			saved.append(buf, n);
+
+		fclose(f);
+	};
+
+	params.chunk_size = 256 * 1024;
+	params.resume = false;
+	params.digest = "sha256";
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+
+	http_client.download(url, {}, path,
+		[&](long long size, long long total) {
+			EXPECT_EQ(total, (long long)content.size());
+			progress++;
+		},
+		[&](WFHttpDownloadResult& res) {
+			result = std::move(res);
+			mutex.lock();
+			done = true;
+			mutex.unlock();
+			cond.notify_one();
+		}, &params);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done)
+		cond.wait(lock);
+
+	lock.unlock();
+
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.size, (long long)content.size());
+	EXPECT_EQ(result.checksum.size(), 64);
+	EXPECT_EQ(progress, 5);
+	read_file();
+	EXPECT_TRUE(saved == content);
+
+	// cut the file and continue with the checksum of the first
+	std::string checksum = result.checksum;
+
+	EXPECT_EQ(truncate(path, 300000), 0);
+	params.resume = true;
+	params.expected = checksum.c_str();
+	result = http_client.sync_download(url, {}, path, &params);
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.checksum, checksum);
+	read_file();
+	EXPECT_TRUE(saved == content);
+
+	// nothing left
+	result = http_client.sync_download(url, {}, path, &params);
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.status_code, 416);
+	EXPECT_EQ(access("download.bin.validator", F_OK), 0);
+
+	// changed since, If-Range gets the whole resource again
+	content += "changed";
+	f = fopen("www_download/data.bin", "w");
+	fwrite(content.c_str(), 1, content.size(), f);
+	fclose(f);
+	EXPECT_EQ(truncate(path, 300000), 0);
+	params.expected = NULL;
+	result = http_client.sync_download(url, {}, path, &params);
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.status_code, 200);
+	read_file();
+	EXPECT_TRUE(saved == content);
+
+	// too large for a 200, starts over by ranges
+	content += "again";
+	f = fopen("www_download/data.bin", "w");
+	fwrite(content.c_str(), 1, content.size(), f);
+	fclose(f);
+	EXPECT_EQ(truncate(path, 300000), 0);
+	params.max_full_size = 64 * 1024;
+	result = http_client.sync_download(url, {}, path, &params);
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.status_code, 206);
+	read_file();
+	EXPECT_TRUE(saved == content);
+
+	// not resumed without a validator
+	remove("download.bin.validator");
+	EXPECT_EQ(truncate(path, 300000), 0);
+	result = http_client.sync_download(url, {}, path, &params);
+	EXPECT_TRUE(result.success);
+	read_file();
+	EXPECT_TRUE(saved == content);
+
+	server.stop();
+	remove(path);
+	remove("download.bin.validator");
+	remove("www_download/data.bin");
+	rmdir("www_download");
+}
+
+TEST(WFHttpUpstream1, http_unittest)
+{
+	WFWebServer good;
+	WFWebServer bad;
+
+	good.set_handler("/api/", [](const protocol::HttpRequest& req,
+								 protocol::HttpResponse& resp) {
+		resp.append_output_body(req.get_request_uri());
+	});
+	bad.set_handler("/api/", [](const protocol::HttpRequest& req,
+								protocol::HttpResponse& resp) {
+		resp.set_status_code("500");
+	});
+	EXPECT_TRUE(good.start("127.0.0.1", 8903) == 0) << "http server start failed";
+	EXPECT_TRUE(bad.start("127.0.0.1", 8904) == 0) << "http server start failed";
+
+	struct WFHttpUpstreamParams params = HTTP_UPSTREAM_PARAMS_DEFAULT;
+	std::vector<struct WFHttpEndpointStats> stats;
+	WFHttpClient http_client;
+	WFHttpResult result;
+	int failures = 0;
+	const void *body;
+	size_t size;
+
+	params.max_fails = 2;
+	params.eject_time = 60 * 1000;
+	http_client.set_upstream(std::make_shared<WFHttpUpstream>("api",
+		std::vector<struct WFHttpEndpoint>{{"http://127.0.0.1:8903/", 1},
+										   {"http://127.0.0.1:8904", 1}},
+		&params));
+
+	for (int i = 0; i < 20; i++)
+	{
+		result = http_client.sync_request("GET", "/api/users/" + std::to_string(i),
+										  {}, "");
+		if (result.status_code != HttpStatusOK)
+		{
+			failures++;
+			continue;
+		}
+
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "/api/users/" + std::to_string(i));
+	}
+
+	// ejected after two 500s in a row
+	EXPECT_EQ(failures, 2);
+	EXPECT_EQ(http_client.get_upstream_stats(stats), 0);
+	EXPECT_EQ(stats.size(), 2);
+	EXPECT_EQ(stats[0].requests, 18);
+	EXPECT_EQ(stats[0].failures, 0);
+	EXPECT_EQ(stats[0].outstanding, 0);
+	EXPECT_FALSE(stats[0].ejected);
+	EXPECT_EQ(stats[1].failures, 2);
+	EXPECT_EQ(stats[1].ejections, 1);
+	EXPECT_TRUE(stats[1].ejected);
+
+	// a full url is not balanced
+	result = http_client.sync_request("GET", "http://127.0.0.1:8904/api/", {}, "");
+	EXPECT_EQ(result.status_code, 500);
+	http_client.get_upstream_stats(stats);
+	EXPECT_EQ(stats[1].requests, 2);
+
+	good.stop();
+	bad.stop();
+}
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
 
 #include <openssl/ssl.h>
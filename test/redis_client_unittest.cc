@@ -17,14 +17,25 @@
 */
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
 #include <vector>
 #include <string>
+#include <map>
+#include <functional>
+#include <thread>
 #include <gtest/gtest.h>
 #include <workflow/WFRedisServer.h>
 #include <anyclient/WFRedisClient.h>
+#include <anyclient/WFRedisCluster.h>
+#include <anyclient/WFRedisShard.h>
+#include <anyclient/WFRedisSplit.h>
 
 #define RETRY_MAX  3
 
@@ -103,3 +114,900 @@ TEST(WFRedisTask1, redis_unittest)
 	server.stop();
 }
 
+TEST(WFRedisBatch1, redis_unittest)
+{
+	WFRedisServer server(__redis_process);
+	EXPECT_TRUE(server.start("127.0.0.1", 6688) == 0) << "server start failed";
+
+	WFRedisClient redis_client("redis://:testpass@127.0.0.1:6688/6");
+	struct WFBatchParams params = BATCH_PARAMS_DEFAULT;
+
+	params.concurrency = 2;
+	auto results = redis_client.sync_parallel_request({
+		{"SET", {"testkey", "testvalue"}},
+		{"GET", {"testkey"}},
+		{"GET", {"testkey"}},
+		{"DEL", {"testkey"}},
+	}, &params);
+
+	EXPECT_EQ(results.size(), 4);
+	for (const auto& res : results)
+		EXPECT_TRUE(res.success);
+
+	EXPECT_TRUE(results[1].value.is_string());
+	EXPECT_TRUE(results[2].value.string_value() == "testvalue");
+	server.stop();
+}
+
+TEST(WFRedisLimiter1, redis_unittest)
+{
+	WFRedisServer server(__redis_process);
+	EXPECT_TRUE(server.start("127.0.0.1", 6699) == 0) << "server start failed";
+
+	auto limiter = std::make_shared<WFClientLimiter>(&CLIENT_LIMITER_PARAMS_DEFAULT);
+	WFRedisClient redis_client("redis://:testpass@127.0.0.1:6699/6");
+	struct WFClientLimiterStats stats;
+
+	redis_client.set_limiter(limiter);
+	EXPECT_TRUE(redis_client.sync_request("SET", {"testkey", "testvalue"}).success);
+	EXPECT_TRUE(redis_client.async_request("GET", {"testkey"}).get().success);
+	EXPECT_EQ(limiter->get_stats("redis://127.0.0.1:6699", &stats), 0);
+	EXPECT_EQ(stats.admitted, 2);
+	EXPECT_EQ(stats.in_flight, 0);
+	server.stop();
+}
+
+static std::atomic<int> slow_gets(0);
+
+static void __slow_redis_process(WFRedisTask *task)
+{
+	std::string cmd;
+	protocol::RedisValue val;
+
+	task->get_req()->get_command(cmd);
+	if (strcasecmp(cmd.c_str(), "GET") == 0)
+	{
+		slow_gets++;
+		usleep(200 * 1000);
+		val.set_string("testvalue");
+	}
+	else
+		val.set_status("OK");
+
+	task->get_resp()->set_result(val);
+}
+
+TEST(WFRedisSingleFlight1, redis_unittest)
+{
+	WFRedisServer server(__slow_redis_process);
+	EXPECT_TRUE(server.start("127.0.0.1", 6700) == 0) << "server start failed";
+
+	WFRedisClient redis_client("redis://127.0.0.1:6700");
+	std::vector<WFFuture<WFRedisResult>> futures;
+	struct WFSingleFlightStats stats;
+
+	redis_client.set_single_flight();
+	for (int i = 0; i < 5; i++)
+		futures.push_back(redis_client.async_request("get", {"testkey"}));
+
+	// not read-only, never shared
+	futures.push_back(redis_client.async_request("SET", {"testkey", "testvalue"}));
+	for (auto& fr : futures)
+		EXPECT_TRUE(fr.get().success);
+
+	EXPECT_EQ(slow_gets, 1);
+	EXPECT_EQ(redis_client.get_single_flight_stats(&stats), 0);
+	EXPECT_EQ(stats.requests, 5);
+	EXPECT_EQ(stats.shared, 4);
+	EXPECT_EQ(stats.in_flight, 0);
+	server.stop();
+}
+
+TEST(WFRedisPipeline1, redis_unittest)
+{
+	WFRedisServer server(__redis_process);
+	EXPECT_TRUE(server.start("127.0.0.1", 6701) == 0) << "server start failed";
+
+	// AUTH and SELECT go first in the pipeline
+	WFRedisClient redis_client("redis://:testpass@127.0.0.1:6701/6");
+	auto pipeline = redis_client.pipeline();
+
+	pipeline.add("SET")("testkey")("testvalue");
+	for (int i = 0; i < 100; i++)
+		pipeline.add("GET", {"testkey"});
+
+	pipeline.add("DEL")("testkey");
+	EXPECT_EQ(pipeline.size(), 102);
+
+	auto results = pipeline.sync_send();
+
+	EXPECT_EQ(results.size(), 102);
+	for (const auto& res : results)
+		EXPECT_TRUE(res.success);
+
+	EXPECT_TRUE(results[0].value.is_status());
+	EXPECT_TRUE(results[50].value.string_value() == "testvalue");
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+
+	redis_client.pipeline().add("GET", {"testkey"}).add("DEL", {"testkey"})
+		.send([&](std::vector<WFRedisResult>& results) {
+			EXPECT_EQ(results.size(), 2);
+			EXPECT_TRUE(results[0].value.string_value() == "testvalue");
+			EXPECT_TRUE(results[1].success);
+			mutex.lock();
+			done = true;
+			mutex.unlock();
+			cond.notify_one();
+		});
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done)
+		cond.wait(lock);
+
+	lock.unlock();
+	server.stop();
+}
+
+TEST(WFRedisAutoPipeline1, redis_unittest)
+{
+	WFRedisServer server(__redis_process);
+	EXPECT_TRUE(server.start("127.0.0.1", 6702) == 0) << "server start failed";
+
+	WFRedisClient redis_client("redis://:testpass@127.0.0.1:6702/6");
+	struct WFRedisAutoPipelineParams params = REDIS_AUTO_PIPELINE_PARAMS_DEFAULT;
+	std::vector<WFFuture<WFRedisResult>> futures;
+	struct WFRedisAutoPipelineStats stats;
+	unsigned long long batches = 0;
+
+	params.window = 10 * 1000;
+	params.max_batch = 8;
+	redis_client.set_auto_pipeline(&params);
+	for (int i = 0; i < 20; i++)
+		futures.push_back(redis_client.async_request("GET", {"testkey"}));
+
+	for (auto& fr : futures)
+	{
+		WFRedisResult res = fr.get();
+
+		EXPECT_TRUE(res.success);
+		EXPECT_TRUE(res.value.string_value() == "testvalue");
+	}
+
+	EXPECT_TRUE(redis_client.sync_request("SET", {"testkey", "testvalue"}).success);
+	EXPECT_EQ(redis_client.get_auto_pipeline_stats(&stats), 0);
+	EXPECT_EQ(stats.commands, 21);
+	for (int i = 0; i < AUTO_PIPELINE_BUCKETS; i++)
+		batches += stats.batch_sizes[i];
+
+	EXPECT_EQ(batches, stats.batches);
+	EXPECT_GE(stats.batch_sizes[3], 2);
+	EXPECT_LE(stats.batches, 5);
+	server.stop();
+}
+
+// a cluster of 6703 and 6704, slots below cluster_split are on 6703
+static std::atomic<int> cluster_split(REDIS_CLUSTER_SLOTS / 2);
+static std::atomic<int> cluster_ask_slot(-1);
+static std::atomic<int> cluster_moved(0);
+static std::atomic<int> cluster_asking(0);
+static std::mutex cluster_mutex;
+static std::map<std::string, std::string> cluster_data;
+
+static void __cluster_slots(protocol::RedisValue& val)
+{
+	int split = cluster_split;
+	int n = 0;
+
+	val.set_array((split > 0) + (split < REDIS_CLUSTER_SLOTS));
+	if (split > 0)
+	{
+		val[n].set_array(3);
+		val[n][0].set_int(0);
+		val[n][1].set_int(split - 1);
+		val[n][2].set_array(2);
+		val[n][2][0].set_string("127.0.0.1");
+		val[n][2][1].set_int(6703);
+		n++;
+	}
+
+	if (split < REDIS_CLUSTER_SLOTS)
+	{
+		val[n].set_array(3);
+		val[n][0].set_int(split);
+		val[n][1].set_int(REDIS_CLUSTER_SLOTS - 1);
+		val[n][2].set_array(2);
+		val[n][2][0].set_string("127.0.0.1");
+		val[n][2][1].set_int(6704);
+	}
+}
+
+static void __cluster_process(int port, WFRedisTask *task)
+{
+	std::string cmd;
+	std::vector<std::string> params;
+	protocol::RedisValue val;
+	size_t step = 1;
+	int slot = -1;
+	int owner;
+
+	task->get_req()->get_command(cmd);
+	task->get_req()->get_params(params);
+	if (strcasecmp(cmd.c_str(), "CLUSTER") == 0)
+	{
+		__cluster_slots(val);
+		task->get_resp()->set_result(val);
+		return;
+	}
+
+	if (strcasecmp(cmd.c_str(), "ASKING") == 0)
+	{
+		cluster_asking++;
+		val.set_status("OK");
+		task->get_resp()->set_result(val);
+		return;
+	}
+
+	if (strcasecmp(cmd.c_str(), "MSET") == 0 || strcasecmp(cmd.c_str(), "SET") == 0)
+		step = 2;
+
+	for (size_t i = 0; i < params.size(); i += step)
+	{
+		int s = WFRedisClusterClient::slot_of(params[i]);
+
+		if (slot >= 0 && s != slot)
+		{
+			val.set_error("CROSSSLOT Keys in request don't hash to the same slot");
+			task->get_resp()->set_result(val);
+			return;
+		}
+
+		slot = s;
+	}
+
+	// 6703 imports the slot of an ASK
+	owner = slot < cluster_split ? 6703 : 6704;
+	if (slot == cluster_ask_slot)
+		owner = 6703;
+
+	if (owner != port)
+	{
+		std::string target = " " + std::to_string(slot) + " 127.0.0.1:" + std::to_string(owner);
+
+		if (slot == cluster_ask_slot)
+			val.set_error("ASK" + target);
+		else
+		{
+			cluster_moved++;
+			val.set_error("MOVED" + target);
+		}
+
+		task->get_resp()->set_result(val);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(cluster_mutex);
+
+	if (strcasecmp(cmd.c_str(), "GET") == 0)
+	{
+		auto it = cluster_data.find(params[0]);
+
+		if (it == cluster_data.end())
+			val.set_nil();
+		else
+			val.set_string(it->second);
+	}
+	else if (strcasecmp(cmd.c_str(), "MGET") == 0)
+	{
+		val.set_array(params.size());
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			auto it = cluster_data.find(params[i]);
+
+			if (it == cluster_data.end())
+				val[i].set_nil();
+			else
+				val[i].set_string(it->second);
+		}
+	}
+	else if (step == 2)
+	{
+		for (size_t i = 0; i + 1 < params.size(); i += 2)
+			cluster_data[params[i]] = params[i + 1];
+
+		val.set_status("OK");
+	}
+	else if (strcasecmp(cmd.c_str(), "EXISTS") == 0)
+	{
+		int n = 0;
+
+		for (const std::string& key : params)
+			n += cluster_data.count(key);
+
+		val.set_int(n);
+	}
+	else if (strcasecmp(cmd.c_str(), "DEL") == 0)
+	{
+		int n = 0;
+
+		for (const std::string& key : params)
+			n += cluster_data.erase(key);
+
+		val.set_int(n);
+	}
+	else
+		val.set_error("Command Not Support");
+
+	task->get_resp()->set_result(val);
+}
+
+// a key of a slot on 6704
+static std::string __cluster_key(const std::string& prefix)
+{
+	for (int i = 0; ; i++)
+	{
+		std::string key = prefix + std::to_string(i);
+
+		if ((int)WFRedisClusterClient::slot_of(key) >= cluster_split)
+			return key;
+	}
+}
+
+TEST(WFRedisCluster1, redis_unittest)
+{
+	using namespace std::placeholders;
+	WFRedisServer server1(std::bind(__cluster_process, 6703, _1));
+	WFRedisServer server2(std::bind(__cluster_process, 6704, _1));
+	EXPECT_TRUE(server1.start("127.0.0.1", 6703) == 0) << "server start failed";
+	EXPECT_TRUE(server2.start("127.0.0.1", 6704) == 0) << "server start failed";
+
+	// crc16("123456789") is 0x31c3
+	EXPECT_EQ(WFRedisClusterClient::slot_of("123456789"), 0x31c3);
+	EXPECT_EQ(WFRedisClusterClient::slot_of("{user1000}.following"),
+			  WFRedisClusterClient::slot_of("user1000"));
+
+	WFRedisClusterClient cluster({"redis://127.0.0.1:6703"});
+	std::vector<std::string> keys;
+	std::vector<std::string> pairs;
+	WFRedisResult result;
+
+	for (int i = 0; i < 100 && cluster.node_of(0).empty(); i++)
+		usleep(10 * 1000);
+
+	EXPECT_TRUE(cluster.node_of(0) == "127.0.0.1:6703");
+	EXPECT_TRUE(cluster.node_of(REDIS_CLUSTER_SLOTS - 1) == "127.0.0.1:6704");
+
+	// split by slot and merged in the order of the keys
+	for (int i = 0; i < 10; i++)
+	{
+		keys.push_back("key" + std::to_string(i));
+		pairs.push_back(keys.back());
+		pairs.push_back("value" + std::to_string(i));
+	}
+
+	result = cluster.sync_request("MSET", pairs);
+	EXPECT_TRUE(result.success);
+	result = cluster.sync_request("MGET", keys);
+	EXPECT_TRUE(result.success);
+	EXPECT_TRUE(result.value.is_array());
+	EXPECT_EQ(result.value.arr_size(), 10);
+	for (size_t i = 0; i < result.value.arr_size(); i++)
+		EXPECT_TRUE(result.value[i].string_value() == "value" + std::to_string(i));
+
+	result = cluster.sync_request("EXISTS", keys);
+	EXPECT_EQ(result.value.int_value(), 10);
+	result = cluster.sync_request("DEL", keys);
+	EXPECT_EQ(result.value.int_value(), 10);
+	EXPECT_EQ(cluster_moved, 0);
+
+	// ASK is followed once, the slot stays on 6704
+	std::string ask_key = __cluster_key("ask");
+	int ask_slot = WFRedisClusterClient::slot_of(ask_key);
+
+	cluster_ask_slot = ask_slot;
+	result = cluster.sync_request("SET", {ask_key, "asked"});
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(cluster_asking, 1);
+	EXPECT_TRUE(cluster.node_of(ask_slot) == "127.0.0.1:6704");
+	cluster_ask_slot = -1;
+
+	// slots move to 6703, MOVED is followed and remembered
+	std::string key = __cluster_key("user");
+	int slot = WFRedisClusterClient::slot_of(key);
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool done = false;
+
+	EXPECT_TRUE(cluster.sync_request("SET", {key, "moved"}).success);
+	cluster_split = REDIS_CLUSTER_SLOTS;
+	cluster.request("GET", {key}, [&](WFRedisResult& res) {
+		EXPECT_TRUE(res.success);
+		EXPECT_TRUE(res.value.string_value() == "moved");
+		mutex.lock();
+		done = true;
+		cond.notify_one();
+		mutex.unlock();
+	});
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!done)
+		cond.wait(lock);
+
+	lock.unlock();
+	EXPECT_GE(cluster_moved, 1);
+	EXPECT_TRUE(cluster.node_of(slot) == "127.0.0.1:6703");
+	server2.stop();
+	server1.stop();
+}
+
+// every server of the shards has its own data
+static std::mutex shard_mutex;
+static std::map<int, std::map<std::string, std::string>> shard_data;
+
+static void __shard_process(int port, WFRedisTask *task)
+{
+	std::string cmd;
+	std::vector<std::string> params;
+	protocol::RedisValue val;
+
+	task->get_req()->get_command(cmd);
+	task->get_req()->get_params(params);
+
+	std::lock_guard<std::mutex> lock(shard_mutex);
+	auto& data = shard_data[port];
+
+	if (strcasecmp(cmd.c_str(), "GET") == 0)
+	{
+		auto it = data.find(params[0]);
+
+		if (it == data.end())
+			val.set_nil();
+		else
+			val.set_string(it->second);
+	}
+	else if (strcasecmp(cmd.c_str(), "MGET") == 0)
+	{
+		val.set_array(params.size());
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			auto it = data.find(params[i]);
+
+			if (it == data.end())
+				val[i].set_nil();
+			else
+				val[i].set_string(it->second);
+		}
+	}
+	else if (strcasecmp(cmd.c_str(), "MSET") == 0)
+	{
+		for (size_t i = 0; i + 1 < params.size(); i += 2)
+			data[params[i]] = params[i + 1];
+
+		val.set_status("OK");
+	}
+	else
+		val.set_error("Command Not Support");
+
+	task->get_resp()->set_result(val);
+}
+
+TEST(WFRedisSplit1, redis_unittest)
+{
+	auto key_of = [](const std::string& command,
+					 const std::vector<std::string>& params) {
+		const std::string *key = WFRedisSplit::first_key(command, params);
+
+		return key ? *key : std::string("(none)");
+	};
+
+	EXPECT_EQ(key_of("GET", {"a"}), "a");
+	EXPECT_EQ(key_of("PING", {}), "(none)");
+	EXPECT_EQ(key_of("EVAL", {"return 1", "1", "a"}), "a");
+	EXPECT_EQ(key_of("object", {"ENCODING", "a"}), "a");
+	EXPECT_EQ(key_of("OBJECT", {"HELP"}), "(none)");
+	EXPECT_EQ(key_of("MEMORY", {"USAGE", "a", "SAMPLES", "5"}), "a");
+	EXPECT_EQ(key_of("MEMORY", {"STATS"}), "(none)");
+	EXPECT_EQ(key_of("BLMPOP", {"0", "1", "a", "LEFT"}), "a");
+	EXPECT_EQ(key_of("XREAD", {"COUNT", "2", "STREAMS", "a", "b", "0", "0"}), "a");
+	EXPECT_EQ(key_of("XREADGROUP", {"GROUP", "g", "streams", "BLOCK", "10",
+									"STREAMS", "a", ">"}), "a");
+	EXPECT_EQ(key_of("XREAD", {"COUNT", "2"}), "(none)");
+}
+
+TEST(WFRedisShard1, redis_unittest)
+{
+	using namespace std::placeholders;
+	WFRedisServer server1(std::bind(__shard_process, 6705, _1));
+	WFRedisServer server2(std::bind(__shard_process, 6706, _1));
+	WFRedisServer server3(std::bind(__shard_process, 6707, _1));
+	EXPECT_TRUE(server1.start("127.0.0.1", 6705) == 0) << "server start failed";
+	EXPECT_TRUE(server2.start("127.0.0.1", 6706) == 0) << "server start failed";
+	EXPECT_TRUE(server3.start("127.0.0.1", 6707) == 0) << "server start failed";
+
+	std::vector<std::string> urls = {
+		"redis://127.0.0.1:6705", "redis://127.0.0.1:6706", "redis://127.0.0.1:6707"
+	};
+	struct WFRedisShardParams params = REDIS_SHARD_PARAMS_DEFAULT;
+	std::vector<struct WFRedisShardStats> stats;
+	std::vector<std::string> keys;
+	std::vector<std::string> pairs;
+	WFRedisResult result;
+	size_t total = 0;
+
+	params.max_fails = 1;
+	WFRedisShardClient shards(urls, &params);
+
+	// fan out to the servers of the keys, merged in order
+	for (int i = 0; i < 100; i++)
+	{
+		keys.push_back("key" + std::to_string(i));
+		pairs.push_back(keys.back());
+		pairs.push_back("value" + std::to_string(i));
+	}
+
+	EXPECT_TRUE(shards.sync_request("MSET", pairs).success);
+	result = shards.sync_request("MGET", keys);
+	EXPECT_TRUE(result.success);
+	EXPECT_EQ(result.value.arr_size(), 100);
+	for (size_t i = 0; i < result.value.arr_size(); i++)
+		EXPECT_TRUE(result.value[i].string_value() == "value" + std::to_string(i));
+
+	for (int port = 6705; port <= 6707; port++)
+	{
+		EXPECT_GT(shard_data[port].size(), 0);
+		total += shard_data[port].size();
+		for (const auto& kv : shard_data[port])
+			EXPECT_TRUE(shards.server_of(kv.first) == "redis://127.0.0.1:" + std::to_string(port));
+	}
+
+	EXPECT_EQ(total, 100);
+	EXPECT_TRUE(shards.server_of("{user}1") == shards.server_of("{user}2"));
+
+	// without a server, only its keys move
+	WFRedisShardClient two({urls[0], urls[1]}, &params);
+
+	for (const std::string& key : keys)
+	{
+		if (shards.server_of(key) != urls[2])
+		{
+			EXPECT_TRUE(two.server_of(key) == shards.server_of(key));
+		}
+	}
+
+	// a failed server is ejected, its keys go to the others
+	std::string key;
+
+	for (const std::string& k : keys)
+	{
+		if (shards.server_of(k) == urls[2])
+		{
+			key = k;
+			break;
+		}
+	}
+
+	server3.stop();
+	result = shards.sync_request("GET", {key});
+	EXPECT_FALSE(result.success);
+	EXPECT_TRUE(result.task_state != WFT_STATE_SUCCESS);
+	EXPECT_TRUE(shards.server_of(key) != urls[2]);
+	result = shards.sync_request("GET", {key});
+	EXPECT_TRUE(result.task_state == WFT_STATE_SUCCESS);
+	EXPECT_TRUE(result.value.is_nil());
+
+	shards.get_stats(stats);
+	EXPECT_EQ(stats.size(), 3);
+	EXPECT_EQ(stats[2].ejections, 1);
+	EXPECT_TRUE(stats[2].ejected);
+	EXPECT_FALSE(stats[0].ejected);
+	server2.stop();
+	server1.stop();
+}
+
+// WFRedisServer can not push, so a stand-in of redis 6 on raw sockets.
+// A SET pushes the invalidation of its key to the subscriber.
+class __TrackingServer
+{
+public:
+	bool start(int port)
+	{
+		struct sockaddr_in addr;
+		int on = 1;
+
+		listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+		setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		memset(&addr, 0, sizeof addr);
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+		if (bind(listen_fd_, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+			listen(listen_fd_, 16) < 0)
+		{
+			close(listen_fd_);
+			return false;
+		}
+
+		accept_thread_ = std::thread([this]() {
+			int fd;
+
+			while ((fd = accept(listen_fd_, NULL, NULL)) >= 0)
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+
+				fds_.push_back(fd);
+				threads_.emplace_back(&__TrackingServer::serve, this, fd);
+			}
+		});
+
+		return true;
+	}
+
+	void stop()
+	{
+		shutdown(listen_fd_, SHUT_RDWR);
+		close(listen_fd_);
+		accept_thread_.join();
+		for (int fd : fds_)
+			shutdown(fd, SHUT_RDWR);
+
+		for (std::thread& t : threads_)
+			t.join();
+
+		for (int fd : fds_)
+			close(fd);
+	}
+
+	void set(const std::string& key, const std::string& value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		data_[key] = value;
+	}
+
+	std::atomic<int> reads{0};
+
+private:
+	static std::string bulk(const std::string& str)
+	{
+		return "$" + std::to_string(str.size()) + "\r\n" + str + "\r\n";
+	}
+
+	static bool read_line(int fd, std::string& line)
+	{
+		char c;
+
+		line.clear();
+		while (read(fd, &c, 1) == 1)
+		{
+			if (c == '\n')
+			{
+				if (!line.empty())
+					line.pop_back();
+
+				return true;
+			}
+
+			line += c;
+		}
+
+		return false;
+	}
+
+	// *n then n bulk strings
+	static bool read_command(int fd, std::vector<std::string>& args)
+	{
+		std::string line;
+		int n;
+
+		args.clear();
+		if (!read_line(fd, line) || line[0] != '*')
+			return false;
+
+		n = atoi(line.c_str() + 1);
+		for (int i = 0; i < n; i++)
+		{
+			std::string arg;
+			size_t len;
+
+			if (!read_line(fd, line) || line[0] != '$')
+				return false;
+
+			len = atoi(line.c_str() + 1);
+			arg.resize(len + 2);
+			for (size_t got = 0; got < len + 2; )
+			{
+				ssize_t ret = read(fd, &arg[got], len + 2 - got);
+
+				if (ret <= 0)
+					return false;
+
+				got += ret;
+			}
+
+			arg.resize(len);
+			args.push_back(std::move(arg));
+		}
+
+		return true;
+	}
+
+	void push(const std::string& msg)
+	{
+		if (sub_fd_ >= 0 && write(sub_fd_, msg.c_str(), msg.size()) < 0)
+			sub_fd_ = -1;
+	}
+
+	void serve(int fd)
+	{
+		std::vector<std::string> args;
+
+		while (read_command(fd, args))
+		{
+			std::string cmd = args[0];
+			std::string reply;
+
+			for (char& c : cmd)
+				c = toupper(c);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if (cmd == "CLIENT" && strcasecmp(args[1].c_str(), "ID") == 0)
+				reply = ":" + std::to_string(fd) + "\r\n";
+			else if (cmd == "CLIENT")
+				reply = "+OK\r\n";
+			else if (cmd == "SUBSCRIBE")
+			{
+				for (size_t i = 1; i < args.size(); i++)
+				{
+					reply += "*3\r\n" + bulk("subscribe") + bulk(args[i]) +
+							 ":" + std::to_string(i) + "\r\n";
+				}
+
+				sub_fd_ = fd;
+			}
+			else if (cmd == "GET" || cmd == "HGET")
+			{
+				std::string key = cmd == "GET" ? args[1] : args[1] + "/" + args[2];
+				auto it = data_.find(key);
+
+				reads++;
+				reply = it == data_.end() ? "$-1\r\n" : bulk(it->second);
+			}
+			else if (cmd == "SET")
+			{
+				data_[args[1]] = args[2];
+				push("*3\r\n" + bulk("message") + bulk("__redis__:invalidate") +
+					 "*1\r\n" + bulk(args[1]));
+				reply = "+OK\r\n";
+			}
+			else if (cmd == "PUBLISH")
+			{
+				push("*3\r\n" + bulk("message") + bulk(args[1]) + bulk(args[2]));
+				reply = ":1\r\n";
+			}
+			else
+				reply = "-ERR unknown command\r\n";
+
+			if (write(fd, reply.c_str(), reply.size()) < 0)
+				break;
+		}
+	}
+
+private:
+	int listen_fd_;
+	int sub_fd_ = -1;
+	std::thread accept_thread_;
+	std::vector<std::thread> threads_;
+	std::vector<int> fds_;
+	std::map<std::string, std::string> data_;
+	std::mutex mutex_;
+};
+
+TEST(WFRedisNearCache1, redis_unittest)
+{
+	__TrackingServer server;
+	EXPECT_TRUE(server.start(6708)) << "server start failed";
+
+	struct WFRedisNearCacheParams params = REDIS_NEAR_CACHE_PARAMS_DEFAULT;
+	struct WFRedisNearCacheStats stats;
+	WFRedisResult result;
+	int reads;
+
+	server.set("hot", "v1");
+	server.set("user/name", "alice");
+	params.max_entries = 2;
+	params.ttl = 1000;
+	{
+		WFRedisClient redis_client("redis://127.0.0.1:6708");
+
+		redis_client.set_near_cache(&params);
+		// stored once subscribed
+		for (int i = 0; i < 100; i++)
+		{
+			result = redis_client.sync_request("GET", {"hot"});
+			EXPECT_TRUE(result.value.string_value() == "v1");
+			redis_client.get_near_cache_stats(&stats);
+			if (stats.hits > 0)
+				break;
+
+			usleep(10 * 1000);
+		}
+
+		// hits are not read from the server
+		reads = server.reads;
+		for (int i = 0; i < 10; i++)
+		{
+			result = redis_client.sync_request("GET", {"hot"});
+			EXPECT_TRUE(result.success);
+			EXPECT_EQ(result.seqid, -1);
+			EXPECT_TRUE(result.value.string_value() == "v1");
+		}
+
+		EXPECT_EQ(server.reads, reads);
+
+		// a write anywhere is pushed as an invalidation
+		EXPECT_TRUE(redis_client.sync_request("SET", {"hot", "v2"}).success);
+		for (int i = 0; i < 100 && stats.invalidations == 0; i++)
+		{
+			usleep(10 * 1000);
+			redis_client.get_near_cache_stats(&stats);
+		}
+
+		EXPECT_EQ(stats.invalidations, 1);
+		result = redis_client.sync_request("GET", {"hot"});
+		EXPECT_TRUE(result.value.string_value() == "v2");
+		EXPECT_EQ(server.reads, reads + 1);
+		result = redis_client.sync_request("GET", {"hot"});
+		EXPECT_TRUE(result.value.string_value() == "v2");
+		EXPECT_EQ(server.reads, reads + 1);
+
+		std::mutex mutex;
+		std::condition_variable cond;
+		bool done = false;
+
+		redis_client.request("HGET", {"user", "name"}, [&](WFRedisResult& res) {
+			EXPECT_TRUE(res.value.string_value() == "alice");
+			redis_client.request("HGET", {"user", "name"}, [&](WFRedisResult& res) {
+				EXPECT_EQ(res.seqid, -1);
+				EXPECT_TRUE(res.value.string_value() == "alice");
+				mutex.lock();
+				done = true;
+				cond.notify_one();
+				mutex.unlock();
+			});
+		});
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!done)
+			cond.wait(lock);
+
+		lock.unlock();
+		redis_client.get_near_cache_stats(&stats);
+		EXPECT_EQ(stats.entries, 2);
+
+		// max_entries, then the ttl
+		unsigned long long evictions = stats.evictions;
+
+		redis_client.sync_request("GET", {"cold"});
+		redis_client.sync_request("GET", {"cold"});
+		redis_client.get_near_cache_stats(&stats);
+		EXPECT_EQ(stats.entries, 2);
+		EXPECT_EQ(stats.evictions, evictions + 1);
+
+		usleep(1100 * 1000);
+		reads = server.reads;
+		result = redis_client.sync_request("GET", {"cold"});
+		EXPECT_TRUE(result.value.is_nil());
+		EXPECT_EQ(server.reads, reads + 1);
+
+		redis_client.get_near_cache_stats(&stats);
+		EXPECT_EQ(stats.evictions, evictions + 2);
+		EXPECT_GT(stats.hit_ratio, 0);
+		EXPECT_EQ(stats.flushes, 0);
+	}
+
+	server.stop();
+}
+
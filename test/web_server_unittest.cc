@@ -0,0 +1,777 @@
+/*
+  Copyright (c) 2020 Sogou, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Author: Wu Jiaxu (wujiaxu@sogou-inc.com)
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <gtest/gtest.h>
+#include <workflow/HttpUtil.h>
+#include <anyclient/WFRequestTarget.h>
+#include <anyclient/WFProxyHandler.h>
+#include <anyclient/WFStaticFileHandler.h>
+#include <anyclient/WFWebCache.h>
+#include <anyclient/WFWebServer.h>
+#include <anyclient/WFWebStream.h>
+#include <anyclient/WFWebUpload.h>
+#include <anyclient/WFHttpClient.h>
+
+#define RETRY_MAX  3
+
+static std::shared_ptr<route_handler_t> __make_handler()
+{
+	return std::make_shared<route_handler_t>([](WFHttpTask *, const WFWebParams&) {});
+}
+
+static int __route(const WFWebRouter& router, const char *method, const char *path,
+				   const route_handler_t **handler, WFWebParams *params)
+{
+	*handler = NULL;
+	return router.find(method, path, strlen(path), handler, params);
+}
+
+static int __route(const WFWebRouter& router, const char *path,
+				   const route_handler_t **handler)
+{
+	WFWebParams params;
+
+	return __route(router, "GET", path, handler, &params);
+}
+
+TEST(WFWebRouter1, web_server_unittest)
+{
+	WFWebRouter router;
+	auto root = __make_handler();
+	auto api = __make_handler();
+	auto user = __make_handler();
+	auto users = __make_handler();
+	auto static_files = __make_handler();
+	const route_handler_t *h;
+
+	router.add("", "/", root);
+	router.add("", "/api/", api);
+	router.add("", "/api/user", user);
+	router.add("", "/api/users/", users);
+	router.add("", "/static/", static_files);
+
+	EXPECT_EQ(__route(router, "/api/user", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, user.get());
+
+	EXPECT_EQ(__route(router, "/api/users/1", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, users.get());
+
+	EXPECT_EQ(__route(router, "/api/use", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, api.get());
+
+	EXPECT_EQ(__route(router, "/api/users", &h), WEB_ROUTE_REDIRECT);
+	EXPECT_EQ(__route(router, "/static", &h), WEB_ROUTE_REDIRECT);
+
+	EXPECT_EQ(__route(router, "/static/js/a.js", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, static_files.get());
+
+	EXPECT_EQ(__route(router, "/other", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, root.get());
+}
+
+TEST(WFWebRouter2, web_server_unittest)
+{
+	WFWebRouter router;
+	auto a = __make_handler();
+	auto ab = __make_handler();
+	const route_handler_t *h;
+
+	router.add("", "/abc", a);
+	router.add("", "/abd", ab);
+
+	EXPECT_EQ(__route(router, "/abc", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, a.get());
+	EXPECT_EQ(__route(router, "/abd", &h), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, ab.get());
+	EXPECT_EQ(__route(router, "/ab", &h), WEB_ROUTE_NOT_FOUND);
+	EXPECT_EQ(__route(router, "/abcd", &h), WEB_ROUTE_NOT_FOUND);
+	EXPECT_EQ(__route(router, "/", &h), WEB_ROUTE_NOT_FOUND);
+}
+
+TEST(WFWebRouter3, web_server_unittest)
+{
+	WFWebRouter router;
+	auto user = __make_handler();
+	auto user_new = __make_handler();
+	auto orders = __make_handler();
+	auto post_orders = __make_handler();
+	auto files = __make_handler();
+	const route_handler_t *h;
+	WFWebParams params;
+
+	EXPECT_EQ(router.add("", "/user/:id", user), 0);
+	EXPECT_EQ(router.add("", "/user/new", user_new), 0);
+	EXPECT_EQ(router.add("GET", "/user/:uid/orders/:oid", orders), 0);
+	EXPECT_EQ(router.add("POST", "/user/:uid/orders/:oid", post_orders), 0);
+	EXPECT_EQ(router.add("", "/files/*path", files), 0);
+
+	EXPECT_EQ(router.add("", "/bad/:", files), -1);
+	EXPECT_EQ(router.add("", "/bad/*rest/more", files), -1);
+
+	EXPECT_EQ(__route(router, "GET", "/user/new", &h, &params), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, user_new.get());
+	EXPECT_EQ(params.size(), 0);
+
+	EXPECT_EQ(__route(router, "GET", "/user/newer", &h, &params), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, user.get());
+	EXPECT_EQ(params.get("id"), "newer");
+
+	EXPECT_EQ(__route(router, "GET", "/user/12/orders/34", &h, &params), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, orders.get());
+	EXPECT_EQ(params.size(), 2);
+	EXPECT_EQ(params.get("uid"), "12");
+	EXPECT_EQ(params.get("oid"), "34");
+	EXPECT_TRUE(params.find("id") == NULL);
+
+	EXPECT_EQ(__route(router, "POST", "/user/12/orders/34", &h, &params), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, post_orders.get());
+
+	EXPECT_EQ(__route(router, "PUT", "/user/12/orders/34", &h, &params),
+			  WEB_ROUTE_METHOD_NOT_ALLOWED);
+
+	EXPECT_EQ(__route(router, "GET", "/files/css/a.css", &h, &params), WEB_ROUTE_FOUND);
+	EXPECT_EQ(h, files.get());
+	EXPECT_EQ(params.get("path"), "css/a.css");
+
+	EXPECT_EQ(__route(router, "GET", "/user/", &h, &params), WEB_ROUTE_NOT_FOUND);
+}
+
+TEST(WFRequestTarget1, web_server_unittest)
+{
+	WFRequestTarget target;
+
+	EXPECT_EQ(WFRequestTargetParser::parse("/a/b?x=1&y=2#frag", target), 0);
+	EXPECT_EQ(std::string(target.path, target.path_len), "/a/b");
+	EXPECT_EQ(std::string(target.query, target.query_len), "x=1&y=2");
+	EXPECT_EQ(target.authority_len, 0);
+
+	EXPECT_EQ(WFRequestTargetParser::parse("http://host:80?q", target), 0);
+	EXPECT_EQ(std::string(target.path, target.path_len), "/");
+	EXPECT_EQ(std::string(target.query, target.query_len), "q");
+
+	EXPECT_EQ(WFRequestTargetParser::parse("https://host/p", target), 0);
+	EXPECT_EQ(std::string(target.authority, target.authority_len), "host");
+	EXPECT_EQ(std::string(target.path, target.path_len), "/p");
+	EXPECT_EQ(target.query_len, 0);
+
+	EXPECT_EQ(WFRequestTargetParser::parse("*", target), 0);
+	EXPECT_EQ(std::string(target.path, target.path_len), "*");
+
+	EXPECT_EQ(WFRequestTargetParser::parse("", target), -1);
+	EXPECT_EQ(WFRequestTargetParser::parse("/a b", target), -1);
+	EXPECT_EQ(WFRequestTargetParser::parse("host/a", target), -1);
+
+	EXPECT_EQ(WFRequestTargetParser::parse("/dir?k=v", target), 0);
+	EXPECT_EQ(WFRequestTargetParser::redirect_location(false, "h:8", 3, target),
+			  "http://h:8/dir/?k=v");
+}
+
+TEST(WFWebServer1, web_server_unittest)
+{
+	WFWebServer server;
+
+	server.set_handler("/v1/", [](const protocol::HttpRequest& req,
+								  protocol::HttpResponse& resp) {
+		resp.append_output_body("v1");
+	});
+
+	EXPECT_TRUE(server.start("127.0.0.1", 8833) == 0) << "http server start failed";
+
+	// replace and add routes while serving
+	server.set_handler("/v1/", [](const protocol::HttpRequest& req,
+								  protocol::HttpResponse& resp) {
+		resp.append_output_body("v1-new");
+	});
+	server.set_handler("/v2", [](const protocol::HttpRequest& req,
+								 protocol::HttpResponse& resp) {
+		resp.append_output_body("v2");
+	});
+
+	WFHttpClient http_client;
+	const void *body;
+	size_t size;
+
+	http_client.default_redirect_max(0);
+	http_client.default_retry_max(RETRY_MAX);
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8833/v1/x", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "v1-new");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8833/v1", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusFound);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8833/v2", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8833/v3", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusNotFound);
+
+	server.set_handler("GET", "/item/:id", [](const protocol::HttpRequest& req,
+											  protocol::HttpResponse& resp,
+											  const WFWebParams& params) {
+		resp.append_output_body(params.get("id"));
+	});
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8833/item/1412", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "1412");
+
+	result = http_client.sync_request("DELETE", "http://127.0.0.1:8833/item/1412", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusMethodNotAllowed);
+
+	server.stop();
+}
+
+TEST(WFStaticFile1, web_server_unittest)
+{
+	mkdir("www", 0755);
+	FILE *f = fopen("www/hello.txt", "w");
+	fputs("0123456789", f);
+	fclose(f);
+
+	WFWebServer server;
+	struct WFStaticFileParams params = STATIC_FILE_PARAMS_DEFAULT;
+
+	params.chunk_size = 4;
+	server.set_handler("/static/", WFStaticFileHandler("/static/", "www"));
+	server.set_handler("/small/", WFStaticFileHandler("/small/", "www", &params));
+	EXPECT_TRUE(server.start("127.0.0.1", 8844) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	const void *body;
+	size_t size;
+	std::string last_modified;
+	std::string value;
+
+	http_client.default_redirect_max(0);
+	http_client.default_retry_max(RETRY_MAX);
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/hello.txt", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "0123456789");
+
+	protocol::HttpHeaderCursor cursor(&result.resp);
+	EXPECT_TRUE(cursor.find("Last-Modified", last_modified));
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/hello.txt",
+									  {{"Range", "bytes=2-4"}}, "");
+	EXPECT_EQ(result.status_code, HttpStatusPartialContent);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "234");
+
+	protocol::HttpHeaderCursor range_cursor(&result.resp);
+	EXPECT_TRUE(range_cursor.find("Content-Range", value));
+	EXPECT_EQ(value, "bytes 2-4/10");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/hello.txt",
+									  {{"Range", "bytes=-3"}}, "");
+	EXPECT_EQ(result.status_code, HttpStatusPartialContent);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "789");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/hello.txt",
+									  {{"Range", "bytes=20-"}}, "");
+	EXPECT_EQ(result.status_code, HttpStatusRequestedRangeNotSatisfiable);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/hello.txt",
+									  {{"If-Modified-Since", last_modified}}, "");
+	EXPECT_EQ(result.status_code, HttpStatusNotModified);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/none.txt", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusNotFound);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/static/../www/hello.txt", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusForbidden);
+
+	// longer than chunk_size, streamed chunk by chunk
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/small/hello.txt", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "0123456789");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8844/small/hello.txt",
+									  {{"Range", "bytes=2-"}}, "");
+	EXPECT_EQ(result.status_code, HttpStatusPartialContent);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "23456789");
+
+	protocol::HttpHeaderCursor small_cursor(&result.resp);
+	EXPECT_TRUE(small_cursor.find("Content-Range", value));
+	EXPECT_EQ(value, "bytes 2-9/10");
+
+	server.stop();
+	remove("www/hello.txt");
+	rmdir("www");
+}
+
+TEST(WFWebCache1, web_server_unittest)
+{
+	WFWebServer server;
+	WFWebCache cache;
+	std::atomic<int> calls(0);
+
+	server.set_handler("GET", "/item/:id", cache.wrap([&calls](const protocol::HttpRequest& req,
+															   protocol::HttpResponse& resp,
+															   const WFWebParams& params) {
+		calls++;
+		resp.add_header_pair("X-Item", params.get("id"));
+		resp.append_output_body("item" + params.get("id"));
+	}));
+	EXPECT_TRUE(server.start("127.0.0.1", 8855) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	struct WFWebCacheStats stats;
+	const void *body;
+	size_t size;
+	std::string value;
+
+	http_client.default_redirect_max(0);
+	http_client.default_retry_max(RETRY_MAX);
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8855/item/1?b=1&a=2", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8855/item/1?a=2&b=1", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "item1");
+
+	protocol::HttpHeaderCursor cursor(&result.resp);
+	EXPECT_TRUE(cursor.find("X-Item", value));
+	EXPECT_EQ(value, "1");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8855/item/2", {}, "");
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "item2");
+
+	EXPECT_EQ(calls, 2);
+	cache.get_stats(&stats);
+	EXPECT_EQ(stats.hits, 1);
+	EXPECT_EQ(stats.misses, 2);
+	EXPECT_EQ(stats.entries, 2);
+
+	server.stop();
+}
+
+TEST(WFWebCache2, web_server_unittest)
+{
+	mkdir("www_cache", 0755);
+	FILE *f = fopen("www_cache/hello.txt", "w");
+	fputs("0123456789", f);
+	fclose(f);
+
+	WFWebServer server;
+	WFWebCache cache;
+	WFStaticFileHandler files("/static/", "www_cache");
+	std::atomic<int> chunked(0);
+
+	// the file handler reads in the series and keeps its buffer there
+	server.set_handler("GET", "/static/", cache.wrap([files](WFHttpTask *task,
+															 const WFWebParams&) {
+		files(task);
+	}));
+	server.set_handler("GET", "/chunked", cache.wrap([&chunked](WFHttpTask *task,
+																const WFWebParams&) {
+		auto *resp = task->get_resp();
+
+		chunked++;
+		resp->add_header_pair("Transfer-Encoding", "chunked");
+		resp->append_output_body("3\r\nabc\r\n0\r\n\r\n");
+	}));
+	EXPECT_TRUE(server.start("127.0.0.1", 8905) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	struct WFWebCacheStats stats;
+	const void *body;
+	size_t size;
+
+	http_client.default_redirect_max(0);
+	http_client.default_retry_max(RETRY_MAX);
+
+	for (int i = 0; i < 3; i++)
+	{
+		auto result = http_client.sync_request("GET", "http://127.0.0.1:8905/static/hello.txt", {}, "");
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "0123456789");
+	}
+
+	cache.get_stats(&stats);
+	EXPECT_EQ(stats.misses, 1);
+	EXPECT_EQ(stats.hits, 2);
+	EXPECT_EQ(stats.entries, 1);
+
+	for (int i = 0; i < 2; i++)
+	{
+		auto result = http_client.sync_request("GET", "http://127.0.0.1:8905/chunked", {}, "");
+		EXPECT_EQ(result.status_code, HttpStatusOK);
+		EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+		EXPECT_EQ(std::string((const char *)body, size), "abc");
+	}
+
+	// never stored, every request runs the handler
+	EXPECT_EQ(chunked, 2);
+	cache.get_stats(&stats);
+	EXPECT_EQ(stats.entries, 1);
+
+	server.stop();
+	remove("www_cache/hello.txt");
+	rmdir("www_cache");
+}
+
+TEST(WFProxy1, web_server_unittest)
+{
+	WFWebServer backend;
+	WFWebServer server;
+	WFProxyHandler proxy("/api/");
+
+	backend.set_handler("/v1/", [](const protocol::HttpRequest& req,
+								   protocol::HttpResponse& resp) {
+		const void *body;
+		size_t size;
+
+		resp.append_output_body(std::string(req.get_method()) + " " + req.get_request_uri());
+		if (req.get_parsed_body(&body, &size) && size > 0)
+			resp.append_output_body(body, size);
+	});
+	backend.set_handler("/v1/chunked", [](const protocol::HttpRequest& req,
+										  protocol::HttpResponse& resp) {
+		resp.add_header_pair("Connection", "Keep-Alive, X-Hop");
+		resp.add_header_pair("X-Hop", "1");
+		resp.add_header_pair("X-End", "1");
+		resp.add_header_pair("Transfer-Encoding", "chunked");
+		resp.append_output_body("3\r\nabc\r\n0\r\n\r\n");
+	});
+	EXPECT_TRUE(backend.start("127.0.0.1", 8866) == 0) << "http server start failed";
+
+	EXPECT_EQ(proxy.add_upstream("http://127.0.0.1:8866/v1", 0), -1);
+	EXPECT_EQ(proxy.add_upstream("http://127.0.0.1:8866/v1", 2), 0);
+	server.set_handler("/api/", proxy);
+	EXPECT_TRUE(server.start("127.0.0.1", 8877) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	std::vector<struct WFUpstreamStats> stats;
+	const void *body;
+	size_t size;
+
+	http_client.default_redirect_max(0);
+	http_client.default_retry_max(RETRY_MAX);
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8877/api/users?id=1", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "GET /v1/users?id=1");
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8877/api/echo", {}, ":hello");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "POST /v1/echo:hello");
+
+	// hop-by-hop headers of upstream stay on its own connection
+	result = http_client.sync_request("GET", "http://127.0.0.1:8877/api/chunked", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "abc");
+
+	protocol::HttpHeaderCursor cursor(&result.resp);
+	std::string value;
+
+	EXPECT_TRUE(cursor.find("X-End", value));
+	cursor.rewind();
+	EXPECT_FALSE(cursor.find("X-Hop", value));
+	cursor.rewind();
+	EXPECT_FALSE(cursor.find("Transfer-Encoding", value));
+
+	proxy.get_stats(stats);
+	EXPECT_EQ(stats.size(), 1);
+	EXPECT_EQ(stats[0].requests, 3);
+	EXPECT_EQ(stats[0].errors, 0);
+
+	server.stop();
+	backend.stop();
+
+	WFProxyHandler dead("/");
+
+	dead.add_upstream("http://127.0.0.1:8899/", 1);
+	server.set_handler("/", dead);
+	EXPECT_TRUE(server.start("127.0.0.1", 8877) == 0) << "http server start failed";
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8877/x", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusBadGateway);
+
+	dead.get_stats(stats);
+	EXPECT_EQ(stats[0].errors, 1);
+
+	server.stop();
+}
+
+TEST(WFWebAdmission1, web_server_unittest)
+{
+	struct WFWebAdmissionParams params = WEB_ADMISSION_PARAMS_DEFAULT;
+	WFWebServer server;
+
+	params.max_in_flight = 1;
+	params.max_queue = 0;
+	server.set_admission(&params);
+	server.set_handler("/slow", [](WFHttpTask *task) {
+		series_of(task)->push_back(WFTaskFactory::create_timer_task(300 * 1000, nullptr));
+	});
+	server.set_handler("/health", [](const protocol::HttpRequest& req,
+									 protocol::HttpResponse& resp) {
+		resp.append_output_body("ok");
+	});
+	EXPECT_EQ(server.set_priority("/none", WEB_PRIORITY_CRITICAL), -1);
+	EXPECT_EQ(server.set_priority("/health", WEB_PRIORITY_CRITICAL), 0);
+	EXPECT_TRUE(server.start("127.0.0.1", 8888) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	struct WFWebAdmissionStats stats;
+
+	http_client.default_redirect_max(0);
+	auto future = http_client.async_request("GET", "http://127.0.0.1:8888/slow", {}, "");
+	usleep(100 * 1000);
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8888/slow", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusServiceUnavailable);
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8888/health", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+
+	EXPECT_EQ(future.get().status_code, HttpStatusOK);
+
+	EXPECT_EQ(server.get_admission_stats(&stats), 0);
+	EXPECT_EQ(stats.admitted, 2);
+	EXPECT_EQ(stats.shed[WEB_PRIORITY_NORMAL], 1);
+
+	server.stop();
+}
+
+TEST(WFWebStream1, web_server_unittest)
+{
+	struct WFWebStreamParams params = WEB_STREAM_PARAMS_DEFAULT;
+	WFWebServer server;
+
+	server.set_handler("/chunks", WFWebStream::handler([](WFHttpTask *task,
+														  WFWebStream *stream) {
+		auto n = std::make_shared<int>(0);
+
+		stream->produce([n](WFWebStream *stream) {
+			stream->write(std::to_string(*n));
+			return ++*n < 5;
+		});
+	}));
+
+	// much more than the socket takes at once, the producer waits for it
+	server.set_handler("/big", WFWebStream::handler([](WFHttpTask *task,
+													   WFWebStream *stream) {
+		auto n = std::make_shared<int>(0);
+
+		stream->produce([n](WFWebStream *stream) {
+			EXPECT_EQ(stream->pending(), 0);
+			EXPECT_EQ(stream->write(std::string(256 * 1024, 'a' + *n)), 0);
+			return ++*n < 16;
+		});
+	}));
+
+	params.mode = WEB_STREAM_SSE;
+	params.max_pending = 64;
+	server.set_handler("/events", WFWebStream::handler([](WFHttpTask *task,
+														  WFWebStream *stream) {
+		EXPECT_EQ(stream->write_event("tick", "1\n2"), 0);
+		EXPECT_EQ(stream->write(std::string(100, 'x')), -1);
+		stream->finish();
+		EXPECT_EQ(stream->write("late"), -1);
+	}, &params));
+	EXPECT_TRUE(server.start("127.0.0.1", 8811) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	const void *body;
+	size_t size;
+	std::string value;
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8811/chunks", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.is_chunked());
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "01234");
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8811/big", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(size, 16 * 256 * 1024);
+	if (size == 16 * 256 * 1024)
+	{
+		EXPECT_EQ(((const char *)body)[0], 'a');
+		EXPECT_EQ(((const char *)body)[size - 1], 'p');
+	}
+
+	result = http_client.sync_request("GET", "http://127.0.0.1:8811/events", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "event: tick\ndata: 1\ndata: 2\n\n");
+
+	protocol::HttpHeaderCursor cursor(&result.resp);
+	EXPECT_TRUE(cursor.find("Content-Type", value));
+	EXPECT_EQ(value, "text/event-stream");
+
+	server.stop();
+}
+
+TEST(WFWebUpload1, web_server_unittest)
+{
+	struct WFWebUploadParams params = WEB_UPLOAD_PARAMS_DEFAULT;
+	WFWebServer server;
+
+	auto upload = [](WFHttpTask *task, const WFWebParams& params,
+					 const std::string& path, size_t size) {
+		char buf[64];
+		FILE *f = fopen(path.c_str(), "r");
+		size_t n = fread(buf, 1, sizeof buf, f);
+
+		fclose(f);
+		EXPECT_EQ(n, size);
+		task->get_resp()->append_output_body(params.get("name") + ":");
+		task->get_resp()->append_output_body(buf, n);
+	};
+
+	params.dir = ".";
+	params.chunk_size = 4;
+	server.set_handler("POST", "/upload/:name", WFWebUpload::handler(
+		[upload](WFHttpTask *task, const WFWebParams& params,
+				 const std::string& path, size_t size) {
+			const void *body;
+			size_t n;
+
+			// written to the file while read, never in memory
+			EXPECT_FALSE(task->get_req()->get_parsed_body(&body, &n));
+			upload(task, params, path, size);
+		}, &params));
+	server.set_handler("POST", "/buffered/:name", WFWebUpload::handler(upload, &params));
+	EXPECT_EQ(server.set_body_limit("POST", "/upload/:name", 16), 0);
+	EXPECT_EQ(server.set_body_limit("/none", 16), -1);
+	EXPECT_EQ(server.set_body_spill("POST", "/upload/:name", "."), 0);
+	EXPECT_EQ(server.set_body_spill("/none", "."), -1);
+	EXPECT_TRUE(server.start("127.0.0.1", 8822) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	const void *body;
+	size_t size;
+
+	auto result = http_client.sync_request("POST", "http://127.0.0.1:8822/upload/a",
+										   {}, "hello upload");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "a:hello upload");
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8822/upload/b",
+									  {}, std::string(17, 'x'));
+	EXPECT_EQ(result.status_code, HttpStatusRequestEntityTooLarge);
+
+	// answered once the header is read, the body is not
+	protocol::HttpHeaderCursor cursor(&result.resp);
+	std::string connection;
+
+	EXPECT_TRUE(cursor.find("Connection", connection));
+	EXPECT_EQ(connection, "close");
+
+	result = http_client.sync_request("POST", "http://127.0.0.1:8822/buffered/c",
+									  {}, "hello buffer");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+	EXPECT_EQ(std::string((const char *)body, size), "c:hello buffer");
+
+	server.stop();
+}
+
+TEST(WFWebMetrics1, web_server_unittest)
+{
+	EXPECT_EQ(WFWebMetrics::bucket_of(0), 0);
+	EXPECT_EQ(WFWebMetrics::bucket_of(3), 3);
+	for (unsigned long long us = 1; us < (1ULL << 27); us = us * 3 + 1)
+	{
+		int bucket = WFWebMetrics::bucket_of(us);
+
+		EXPECT_LT(us, WFWebMetrics::bucket_bound(bucket));
+		if (bucket > 0)
+		{
+			EXPECT_GE(us, WFWebMetrics::bucket_bound(bucket - 1));
+		}
+	}
+
+	WFWebServer server;
+	struct WFWebRouteMetrics metrics;
+
+	server.set_handler("/item/:id", [](const protocol::HttpRequest& req,
+									   protocol::HttpResponse& resp) {
+		resp.append_output_body("item");
+	});
+	EXPECT_EQ(server.get_route_metrics("", "/item/:id", &metrics), -1);
+	EXPECT_EQ(server.set_metrics("/metrics"), 0);
+	EXPECT_TRUE(server.start("127.0.0.1", 8833) == 0) << "http server start failed";
+
+	WFHttpClient http_client;
+	const void *body;
+	size_t size;
+
+	http_client.sync_request("GET", "http://127.0.0.1:8833/item/1", {}, "");
+	http_client.sync_request("POST", "http://127.0.0.1:8833/item/2", {}, "abc");
+	usleep(10 * 1000);//recorded after the reply
+
+	auto result = http_client.sync_request("GET", "http://127.0.0.1:8833/metrics", {}, "");
+	EXPECT_EQ(result.status_code, HttpStatusOK);
+	EXPECT_TRUE(result.resp.get_parsed_body(&body, &size));
+
+	std::string text((const char *)body, size);
+
+	EXPECT_NE(text.find("web_requests_total{method=\"\",route=\"/item/:id\",code=\"2xx\"} 2"),
+			  std::string::npos);
+	EXPECT_NE(text.find("web_request_duration_seconds_count{method=\"\",route=\"/item/:id\"} 2"),
+			  std::string::npos);
+
+	EXPECT_EQ(server.get_route_metrics("", "/item/:id", &metrics), 0);
+	EXPECT_EQ(metrics.requests[WEB_METRICS_2XX], 2);
+	EXPECT_EQ(metrics.bytes_in, 3);
+	EXPECT_EQ(metrics.bytes_out, 8);
+
+	// more routes than one page of counters
+	for (int i = 0; i < 300; i++)
+	{
+		server.set_handler("/r" + std::to_string(i),
+						   [](const protocol::HttpRequest&, protocol::HttpResponse&) {});
+	}
+
+	http_client.sync_request("GET", "http://127.0.0.1:8833/r299", {}, "");
+	usleep(10 * 1000);
+	EXPECT_EQ(server.get_route_metrics("", "/r299", &metrics), 0);
+	EXPECT_EQ(metrics.requests[WEB_METRICS_2XX], 1);
+
+	server.stop();
+}
+